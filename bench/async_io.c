@@ -0,0 +1,232 @@
+/* Benchmark: blocking I/O vs the asynchronous I/O queue (ioq.h)
+
+   Usage:
+     ./build/bench_async_io <dir> [files] [depth]
+
+   Example:
+     ./build/bench_async_io /data/aio 100000 256
+
+   How it works:
+   1. Create <files> small account files in <dir> (skipped if they exist)
+   2. Read every file: first with open/read/close one after another, then
+      through the I/O queue with <depth> reads in flight, once with
+      io_uring and once with the thread pool
+   3. Rewrite files with an fsync after each one, the same three ways
+      (a tenth of the files, because fsync is slow)
+   4. Print operations per second for every run
+
+   Drop the page cache between runs (echo 3 > /proc/sys/vm/drop_caches)
+   to measure reads from the disk instead of from memory
+ */
+
+#include "ioq.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define FIRST_ACCOUNT 10000000L
+#define FILE_SIZE 160
+
+typedef struct {
+    IoRequest req;
+    char buf[FILE_SIZE];
+} Slot;
+
+static long failures = 0;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void file_path(const char *dir, long i, char *path, size_t size) {
+    snprintf(path, size, "%s/%ld.txt", dir, FIRST_ACCOUNT + i);
+}
+
+// Fill a buffer that looks like an account file
+static void fill_record(long i, char *buf) {
+    memset(buf, ' ', FILE_SIZE);
+    int len = snprintf(buf, FILE_SIZE, "Account Number: %ld\nName: Bench\nBalance: %ld.00\n",
+                       FIRST_ACCOUNT + i, i % 1000);
+    buf[len] = ' ';
+    buf[FILE_SIZE - 1] = '\n';
+}
+
+static int create_files(const char *dir, long files) {
+    char path[300], buf[FILE_SIZE];
+    file_path(dir, files - 1, path, sizeof(path));
+    if (access(path, F_OK) == 0) {
+        return 0;  // Created by an earlier run
+    }
+    for (long i = 0; i < files; i++) {
+        file_path(dir, i, path, sizeof(path));
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return -1;
+        }
+        fill_record(i, buf);
+        if (write(fd, buf, FILE_SIZE) != FILE_SIZE) {
+            close(fd);
+            return -1;
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+/* ---------- Blocking versions ---------- */
+
+static void sync_reads(const char *dir, long files) {
+    char path[300], buf[FILE_SIZE];
+    for (long i = 0; i < files; i++) {
+        file_path(dir, i, path, sizeof(path));
+        int fd = open(path, O_RDONLY);
+        if (fd < 0 || read(fd, buf, sizeof(buf)) != FILE_SIZE) {
+            failures++;
+        }
+        if (fd >= 0) close(fd);
+    }
+}
+
+static void sync_writes(const char *dir, long files) {
+    char path[300], buf[FILE_SIZE];
+    for (long i = 0; i < files; i++) {
+        file_path(dir, i, path, sizeof(path));
+        fill_record(i, buf);
+        int fd = open(path, O_WRONLY);
+        if (fd < 0 || write(fd, buf, FILE_SIZE) != FILE_SIZE || fsync(fd) != 0) {
+            failures++;
+        }
+        if (fd >= 0) close(fd);
+    }
+}
+
+/* ---------- I/O queue versions ---------- */
+
+static void request_done(IoRequest *req) {
+    if (req->result != FILE_SIZE) {
+        failures++;
+    }
+    close(req->fd);
+    req->fd = -1;   // Marks the slot as free again
+}
+
+/* Keep up to "depth" operations in flight: a slot is reused as soon as
+   its callback has run */
+static void queued_run(IoQueue *q, const char *dir, long files, unsigned depth, IoOp op) {
+    Slot *slots = calloc(depth, sizeof(Slot));
+    for (unsigned s = 0; s < depth; s++) {
+        slots[s].req.fd = -1;
+    }
+
+    char path[300];
+    unsigned next_slot = 0;
+    for (long i = 0; i < files; i++) {
+        // Find a free slot, collecting results when all are busy
+        while (slots[next_slot].req.fd >= 0) {
+            next_slot = (next_slot + 1) % depth;
+            if (next_slot == 0) {
+                ioq_poll(q, 1);
+            }
+        }
+        Slot *slot = &slots[next_slot];
+
+        file_path(dir, i, path, sizeof(path));
+        int fd = open(path, op == IOQ_READ ? O_RDONLY : O_WRONLY);
+        if (fd < 0) {
+            failures++;
+            continue;
+        }
+        if (op == IOQ_WRITE) {
+            fill_record(i, slot->buf);
+        }
+        slot->req.op = op;
+        slot->req.fd = fd;
+        slot->req.buf = slot->buf;
+        slot->req.len = FILE_SIZE;
+        slot->req.offset = 0;
+        slot->req.sync = op == IOQ_WRITE;
+        slot->req.done = request_done;
+        ioq_queue(q, &slot->req);
+
+        // Start a batch whenever a good number of requests are waiting
+        if (i % 32 == 31) {
+            ioq_submit(q);
+        }
+    }
+    ioq_drain(q);
+    free(slots);
+}
+
+static void report(const char *name, long ops, double seconds, double baseline) {
+    printf("  %-22s %9.0f ops/s", name, ops / seconds);
+    if (baseline > 0) {
+        printf("   (%.2fx)", baseline / seconds);
+    }
+    printf("\n");
+}
+
+static void run_all(const char *title, const char *dir, long files, unsigned depth, IoOp op) {
+    printf("%s (%ld files, depth %u)\n", title, files, depth);
+
+    double start = now_s();
+    if (op == IOQ_READ) {
+        sync_reads(dir, files);
+    } else {
+        sync_writes(dir, files);
+    }
+    double baseline = now_s() - start;
+    report("blocking", files, baseline, 0);
+
+    IoBackend backends[] = { IOQ_URING, IOQ_THREADS };
+    for (int b = 0; b < 2; b++) {
+        IoQueue *q = ioq_create(depth, 0, backends[b]);
+        if (q == NULL) {
+            printf("  %-22s not available\n", b == 0 ? "io_uring" : "threads");
+            continue;
+        }
+        char name[40];
+        snprintf(name, sizeof(name), "queued (%s)", ioq_backend_name(q));
+        start = now_s();
+        queued_run(q, dir, files, depth, op);
+        report(name, files, now_s() - start, baseline);
+        ioq_destroy(q);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <dir> [files] [depth]\n", argv[0]);
+        return 1;
+    }
+    const char *dir = argv[1];
+    long files = argc > 2 ? atol(argv[2]) : 100000;
+    unsigned depth = argc > 3 ? (unsigned)atoi(argv[3]) : 256;
+    if (files < 10 || depth < 1) {
+        fprintf(stderr, "files must be at least 10, depth at least 1\n");
+        return 1;
+    }
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        perror(dir);
+        return 1;
+    }
+    if (create_files(dir, files) != 0) {
+        perror("create files");
+        return 1;
+    }
+
+    run_all("Account reads", dir, files, depth, IOQ_READ);
+    run_all("Account writes + fsync", dir, files / 10, depth, IOQ_WRITE);
+
+    if (failures > 0) {
+        printf("Failed operations: %ld\n", failures);
+    }
+    return failures > 0 ? 1 : 0;
+}
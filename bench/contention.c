@@ -0,0 +1,235 @@
+/* Benchmark: several programs updating the same few accounts
+
+   Usage:
+     ./build/bench_contention <dir> [processes] [hot accounts] [ops] [optimistic|locked|blind] [reads %]
+
+   Example (8 programs, 4 hot accounts, 2000 operations each, 50% reads):
+     ./build/bench_contention /tmp/contention 8 4 2000 optimistic 50
+     ./build/bench_contention /tmp/contention 8 4 2000 locked 50
+     ./build/bench_contention /tmp/contention 8 4 2000 blind 50
+
+   How it works:
+   1. Create <hot accounts> account files with RM0.00 in <dir>/database
+   2. Start <processes> programs (fork) that each do <ops> operations on a
+      random hot account: <reads %> of them only read it (load_account(),
+      no lock), the others deposit RM1.00 in one of three ways:
+        optimistic  load, add, commit_accounts(); load again on a conflict
+        locked      lock the record, load, add, save, unlock
+        blind       load, add, save (no control at all)
+   3. Report operations per second, retries per deposit, and lost updates:
+      the deposits that were made minus the money found in the accounts
+
+   The transaction log is not written (only the account files and the
+   store), so the numbers show the cost of the update itself
+ */
+
+#include "account.h"
+#include "utils.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define FIRST_ACCOUNT 4000000u
+#define MAX_PROCESSES 64
+
+typedef enum { MODE_OPTIMISTIC, MODE_LOCKED, MODE_BLIND } Mode;
+
+// What one program did (each writes only its own slot of the shared map)
+typedef struct {
+    long deposits;     // Deposits that were saved
+    long retries;      // Conflicts (optimistic) before a deposit was saved
+    long gave_up;      // Deposits still conflicting after COMMIT_ATTEMPTS
+    long reads;
+    long bad_reads;    // Reads that found a missing or half-written file
+} WorkerStats;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void account_name(uint32_t k, char *out, size_t size) {
+    snprintf(out, size, "%u", FIRST_ACCOUNT + k);
+}
+
+static bool create_accounts(uint32_t hot) {
+    mkdir(DATABASE_DIR, 0755);
+    for (uint32_t k = 0; k < hot; k++) {
+        Account acc;
+        memset(&acc, 0, sizeof(acc));
+        account_name(k, acc.account_number, sizeof(acc.account_number));
+        snprintf(acc.name, sizeof(acc.name), "Hot %u", k);
+        snprintf(acc.id_number, sizeof(acc.id_number), "H%u", k);
+        strcpy(acc.pin, "1234");
+        acc.type = SAVINGS;
+        acc.balance = 0.0;
+        if (!save_account(&acc)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void deposit(Mode mode, const char *account_num, WorkerStats *stats) {
+    Account acc;
+    if (mode == MODE_LOCKED) {
+        uint32_t id = account_id_from_string(account_num);
+        if (!lock_account_records(&id, 1)) {
+            stats->gave_up++;
+            return;
+        }
+        if (load_account(account_num, &acc)) {
+            acc.balance += 1.0;
+            stats->deposits += save_account(&acc) ? 1 : 0;
+        }
+        unlock_account_records(&id, 1);
+        return;
+    }
+    if (mode == MODE_BLIND) {
+        if (load_account(account_num, &acc)) {
+            acc.balance += 1.0;
+            stats->deposits += save_account(&acc) ? 1 : 0;
+        }
+        return;
+    }
+
+    Account *changed[1] = { &acc };
+    for (int attempt = 0; attempt < COMMIT_ATTEMPTS; attempt++) {
+        if (!load_account(account_num, &acc)) {
+            break;
+        }
+        acc.balance += 1.0;
+        CommitResult result = commit_accounts(changed, 1);
+        if (result == COMMIT_OK) {
+            stats->deposits++;
+            return;
+        }
+        if (result == COMMIT_FAILED) {
+            break;
+        }
+        stats->retries++;
+    }
+    stats->gave_up++;
+}
+
+static void worker(int number, Mode mode, uint32_t hot, long ops, int reads_percent,
+                   WorkerStats *stats) {
+    unsigned int seed = (unsigned int)number * 2654435761u + 1;
+    char account_num[20];
+    for (long i = 0; i < ops; i++) {
+        account_name((uint32_t)(rand_r(&seed) % hot), account_num, sizeof(account_num));
+        if ((int)(rand_r(&seed) % 100) < reads_percent) {
+            Account acc;
+            stats->reads++;
+            if (!load_account(account_num, &acc)) {
+                stats->bad_reads++;
+            }
+        } else {
+            deposit(mode, account_num, stats);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <dir> [processes] [hot accounts] [ops] "
+                "[optimistic|locked|blind] [reads %%]\n", argv[0]);
+        return 1;
+    }
+    int processes = argc > 2 ? atoi(argv[2]) : 8;
+    uint32_t hot = argc > 3 ? (uint32_t)atol(argv[3]) : 4;
+    long ops = argc > 4 ? atol(argv[4]) : 2000;
+    const char *mode_name = argc > 5 ? argv[5] : "optimistic";
+    int reads_percent = argc > 6 ? atoi(argv[6]) : 0;
+    Mode mode;
+    if (strcmp(mode_name, "optimistic") == 0) {
+        mode = MODE_OPTIMISTIC;
+    } else if (strcmp(mode_name, "locked") == 0) {
+        mode = MODE_LOCKED;
+    } else if (strcmp(mode_name, "blind") == 0) {
+        mode = MODE_BLIND;
+    } else {
+        fprintf(stderr, "Unknown mode %s (optimistic, locked or blind)\n", mode_name);
+        return 1;
+    }
+    if (processes < 1 || processes > MAX_PROCESSES || hot < 1 || ops < 1 ||
+        reads_percent < 0 || reads_percent > 100) {
+        fprintf(stderr, "Bad arguments (1-%d processes, at least 1 account and 1 op)\n",
+                MAX_PROCESSES);
+        return 1;
+    }
+
+    // STEP 1: A fresh set of hot accounts
+    if ((mkdir(argv[1], 0755) != 0 && errno != EEXIST) || chdir(argv[1]) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (!create_accounts(hot)) {
+        fprintf(stderr, "Could not create the accounts\n");
+        return 1;
+    }
+
+    // STEP 2: The programs (their statistics live in a shared anonymous map)
+    WorkerStats *stats = mmap(NULL, MAX_PROCESSES * sizeof(WorkerStats), PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    memset(stats, 0, MAX_PROCESSES * sizeof(WorkerStats));
+
+    double start = now_s();
+    for (int p = 0; p < processes; p++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            worker(p + 1, mode, hot, ops, reads_percent, &stats[p]);
+            _exit(0);
+        }
+    }
+    while (wait(NULL) > 0) {
+    }
+    double seconds = now_s() - start;
+
+    // STEP 3: Add it up and compare with the accounts
+    WorkerStats total;
+    memset(&total, 0, sizeof(total));
+    for (int p = 0; p < processes; p++) {
+        total.deposits += stats[p].deposits;
+        total.retries += stats[p].retries;
+        total.gave_up += stats[p].gave_up;
+        total.reads += stats[p].reads;
+        total.bad_reads += stats[p].bad_reads;
+    }
+    double found = 0.0;
+    for (uint32_t k = 0; k < hot; k++) {
+        char account_num[20];
+        Account acc;
+        account_name(k, account_num, sizeof(account_num));
+        if (load_account(account_num, &acc)) {
+            found += acc.balance;
+        }
+    }
+    long lost = total.deposits - (long)(found + 0.5);
+
+    printf("%s: %d programs, %u hot accounts, %ld ops each, %d%% reads\n",
+           mode_name, processes, hot, ops, reads_percent);
+    printf("  %.0f ops/s (%.3f s)\n", processes * ops / seconds, seconds);
+    printf("  deposits %ld, retries per deposit %.3f, gave up %ld\n", total.deposits,
+           total.deposits > 0 ? (double)total.retries / total.deposits : 0.0, total.gave_up);
+    printf("  reads %ld, failed reads %ld\n", total.reads, total.bad_reads);
+    printf("  lost updates %ld\n", lost);
+    munmap(stats, MAX_PROCESSES * sizeof(WorkerStats));
+    return 0;
+}
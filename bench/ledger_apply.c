@@ -0,0 +1,145 @@
+/* Benchmark: throughput of the single-writer ledger (ledger.h)
+
+   Usage:
+     ./build/bench_ledger_apply <dir> [accounts] [commands] [producers]
+
+   Example:
+     ./build/bench_ledger_apply /tmp/ledger 100000 10000000 4
+
+   How it works:
+   1. Create a fresh account store with <accounts> accounts in <dir>
+   2. Start <producers> threads that submit <commands> random deposits,
+      withdrawals and remittances into the ring without waiting
+   3. Report the rate of the whole run and of the apply step alone
+      (the time the ledger thread spends changing balances)
+   4. Run again with the transaction log switched on
+
+   Account files are not written (the store holds every balance)
+ */
+
+#include "ledger.h"
+#include "store.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define FIRST_ACCOUNT 2000000u
+#define MAX_PRODUCERS 64
+
+static uint32_t accounts = 100000;
+static long commands_per_producer = 0;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *producer(void *arg) {
+    unsigned int seed = (unsigned int)(uintptr_t)arg * 2654435761u + 1;
+    for (long i = 0; i < commands_per_producer; i++) {
+        uint32_t a = FIRST_ACCOUNT + (uint32_t)(rand_r(&seed) % accounts);
+        uint32_t b = FIRST_ACCOUNT + (uint32_t)(rand_r(&seed) % accounts);
+        int64_t cents = 100 + rand_r(&seed) % 10000;
+        switch (i % 4) {
+            case 0:
+            case 1:
+                ledger_submit(LEDGER_DEPOSIT, 0, a, cents, 0, NULL);
+                break;
+            case 2:
+                ledger_submit(LEDGER_WITHDRAW, a, 0, cents, 0, NULL);
+                break;
+            default:
+                ledger_submit(LEDGER_REMIT, a, b, cents, cents / 50, NULL);
+                break;
+        }
+    }
+    // Wait for our last command, so the run ends when everything is applied
+    LedgerTicket ticket;
+    ledger_submit(LEDGER_DEPOSIT, 0, FIRST_ACCOUNT, 1, 0, &ticket);
+    ledger_wait(&ticket);
+    return NULL;
+}
+
+static void run(const char *title, int producers, bool write_log) {
+    LedgerConfig config = { write_log, false, false };
+    if (!ledger_start(&config)) {
+        fprintf(stderr, "Could not start the ledger\n");
+        exit(1);
+    }
+
+    pthread_t tids[MAX_PRODUCERS];
+    double start = now_s();
+    for (int i = 0; i < producers; i++) {
+        pthread_create(&tids[i], NULL, producer, (void *)(uintptr_t)(i + 1));
+    }
+    for (int i = 0; i < producers; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    double seconds = now_s() - start;
+
+    LedgerStats stats;
+    ledger_stop(&stats);
+    uint64_t total = stats.applied + stats.rejected;
+    printf("%s\n", title);
+    printf("  commands %llu (rejected %llu), batches %llu\n", (unsigned long long)total,
+           (unsigned long long)stats.rejected, (unsigned long long)stats.batches);
+    printf("  end to end   %10.0f ops/s  (%.3f s)\n", total / seconds, seconds);
+    printf("  apply step   %10.0f ops/s  (%.3f s)\n",
+           stats.apply_seconds > 0 ? total / stats.apply_seconds : 0.0, stats.apply_seconds);
+    if (write_log) {
+        printf("  log writes   %.3f s\n", stats.log_seconds);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <dir> [accounts] [commands] [producers]\n", argv[0]);
+        return 1;
+    }
+    accounts = argc > 2 ? (uint32_t)atol(argv[2]) : 100000;
+    long commands = argc > 3 ? atol(argv[3]) : 10000000;
+    int producers = argc > 4 ? atoi(argv[4]) : 4;
+    if (accounts < 2 || commands < 1 || producers < 1 || producers > MAX_PRODUCERS) {
+        fprintf(stderr, "Invalid arguments\n");
+        return 1;
+    }
+    commands_per_producer = commands / producers;
+
+    // The store lives in <dir>/database, like in the real program
+    if ((mkdir(argv[1], 0755) != 0 && errno != EEXIST) || chdir(argv[1]) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    mkdir(DATABASE_DIR, 0755);
+    unlink(HOT_STORE_FILE);
+    unlink(COLD_STORE_FILE);
+    unlink(STORE_INDEX_FILE);
+
+    Account acc;
+    memset(&acc, 0, sizeof(acc));
+    strcpy(acc.name, "Bench");
+    strcpy(acc.pin, "1234");
+    acc.balance = 1000.00;
+    for (uint32_t i = 0; i < accounts; i++) {
+        snprintf(acc.account_number, sizeof(acc.account_number), "%u", FIRST_ACCOUNT + i);
+        acc.type = i % 2 ? CURRENT : SAVINGS;
+        if (!store_put(&acc)) {
+            fprintf(stderr, "Could not create the store\n");
+            return 1;
+        }
+    }
+
+    printf("%u accounts, %ld commands, %d producers\n", accounts,
+           commands_per_producer * producers, producers);
+    run("In memory (no log)", producers, false);
+    run("With transaction log", producers, true);
+    store_close();
+    return 0;
+}
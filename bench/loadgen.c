@@ -0,0 +1,566 @@
+/* Load generator: realistic, repeatable traffic for the banking system
+
+   Usage:
+     ./build/loadgen <dir> [options]
+
+   Options:
+     --accounts N      Accounts to create (default 10000)
+     --ops N           Operations to generate (default 1000000)
+     --threads N       Client threads (default 4)
+     --dist D          Which accounts receive the credits:
+                         uniform          every account the same
+                         zipf[:S]         Zipf with exponent S (default 0.99)
+                         hot[:H:P]        P% of credits go to H accounts (default 10:80)
+     --mix D:W:R       Percent of deposits, withdrawals, remittances (default 40:20:40)
+     --rate R          Open loop: R operations per second in total, arriving
+                       at random (Poisson) times. Default 0: closed loop,
+                       every thread sends the next one as soon as it has an answer
+     --seed S          Same seed, same operations (default 1)
+     --engine E        What applies the operations:
+                         ledger           the single-writer ledger (default)
+                         locked           direct posting, one lock per account
+                         sharded          direct posting, busy receivers become
+                                          hot and take credits without the lock
+     --flag-hot N      With sharded: make the N busiest receivers hot from the
+                       start instead of waiting for them to be detected
+     --log             Write the transaction log while running (ledger only)
+     --emit FILE       Do not run anything: write the operations as a
+                       command file for "banking_system --batch FILE"
+
+   Examples:
+     ./build/loadgen /tmp/load --dist hot:10:80 --threads 8
+     ./build/loadgen /tmp/load --dist zipf:1.2 --rate 50000 --log
+     ./build/loadgen /tmp/load --dist hot:1:90 --engine sharded --threads 8
+     ./build/loadgen /tmp/load --accounts 1000 --ops 20000 --emit /tmp/load/cmds.txt
+
+   How it works:
+   1. A fresh database is created in <dir>: the account store, the
+      account files (only with --emit) and an opening deposit for every
+      account in the log (with --log or --emit)
+   2. Operation i is made from a random number generator seeded with
+      (seed, i) only, so the same seed gives the same operations no matter
+      how many threads run them or in which order
+   3. Debits (withdrawals, remittance senders) pick an account uniformly;
+      credits (deposits, remittance receivers) follow --dist, so a few
+      "merchant" accounts can take most of the money coming in
+   4. Every operation goes through the ledger (ledger.h) and waits for its
+      ticket, or is applied by the client thread itself (posting.h).
+      Latency is measured from the time the operation was due (open loop)
+      or sent (closed loop) until its result is known
+   5. With direct posting, the total of all balances is checked against
+      the money that the successful operations moved
+ */
+
+#include "ledger.h"
+#include "posting.h"
+#include "store.h"
+#include "account.h"
+#include "txlog.h"
+#include "fees.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define FIRST_ACCOUNT 3000000u
+#define MAX_THREADS 64
+#define OPENING_CENTS 100000       // Every account starts with RM1000.00
+#define TOP_ACCOUNTS 10            // Credit share reported for the busiest accounts
+
+typedef enum { DIST_UNIFORM, DIST_ZIPF, DIST_HOT } Distribution;
+typedef enum { ENGINE_LEDGER, ENGINE_LOCKED, ENGINE_SHARDED } Engine;
+
+// One generated operation
+typedef struct {
+    LedgerOp op;
+    uint32_t from;       // Account index (0 .. accounts - 1)
+    uint32_t to;
+    int64_t cents;
+} Operation;
+
+static uint32_t accounts = 10000;
+static long total_ops = 1000000;
+static int threads = 4;
+static Distribution dist = DIST_UNIFORM;
+static double zipf_s = 0.99;
+static uint32_t hot_accounts = 10;
+static int hot_percent = 80;
+static int mix[3] = { 40, 20, 40 };
+static double rate = 0;
+static uint64_t seed = 1;
+static Engine engine = ENGINE_LEDGER;
+static uint32_t flag_hot = 0;
+static bool write_log = false;
+static const char *emit_path = NULL;
+
+static double *zipf_cdf;          // zipf_cdf[k]: chance of picking rank <= k
+
+typedef struct {
+    int index;
+    uint64_t *latency_ns;         // One entry per operation of this thread
+    long done;
+    long rejected;
+    int64_t moved_cents;          // Deposits - withdrawals - fees that succeeded
+} Client;
+
+/* ---------- Random numbers ---------- */
+
+static uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// A number in [0, 1) from a 64-bit random value
+static double unit(uint64_t r) {
+    return (r >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Pick the account that receives a credit */
+static uint32_t pick_credit(uint64_t r) {
+    switch (dist) {
+        case DIST_ZIPF: {
+            // Binary search for the first rank whose cumulative chance covers u
+            double u = unit(r);
+            uint32_t lo = 0, hi = accounts - 1;
+            while (lo < hi) {
+                uint32_t mid = lo + (hi - lo) / 2;
+                if (zipf_cdf[mid] < u) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            return lo;
+        }
+        case DIST_HOT: {
+            uint64_t r2 = splitmix64(r);
+            if ((int)(r % 100) < hot_percent || hot_accounts >= accounts) {
+                return (uint32_t)(r2 % hot_accounts);
+            }
+            return hot_accounts + (uint32_t)(r2 % (accounts - hot_accounts));
+        }
+        default:
+            return (uint32_t)(r % accounts);
+    }
+}
+
+/* Build operation number i (depends only on the seed and i) */
+static Operation make_operation(long i) {
+    uint64_t r = splitmix64(seed * 0x100000001B3ull ^ (uint64_t)i);
+    Operation op;
+    int kind = (int)(r % 100);
+    op.op = kind < mix[0] ? LEDGER_DEPOSIT : kind < mix[0] + mix[1] ? LEDGER_WITHDRAW : LEDGER_REMIT;
+    r = splitmix64(r);
+    op.from = (uint32_t)(r % accounts);
+    op.to = pick_credit(splitmix64(r));
+    if (op.op == LEDGER_REMIT && op.to == op.from) {
+        op.to = (op.to + 1) % accounts;
+    }
+    op.cents = 100 + (int64_t)(splitmix64(r ^ 0x5bd1e995) % 9901);   // RM1.00 to RM100.00
+    return op;
+}
+
+static AccountType type_of(uint32_t index) {
+    return index % 2 ? CURRENT : SAVINGS;
+}
+
+/* ---------- Setting up ---------- */
+
+static bool parse_options(int argc, char *argv[]) {
+    for (int i = 2; i < argc; i++) {
+        const char *opt = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(opt, "--log") == 0) {
+            write_log = true;
+            continue;
+        }
+        if (val == NULL) {
+            return false;
+        }
+        i++;
+        if (strcmp(opt, "--accounts") == 0) {
+            accounts = (uint32_t)atol(val);
+        } else if (strcmp(opt, "--ops") == 0) {
+            total_ops = atol(val);
+        } else if (strcmp(opt, "--threads") == 0) {
+            threads = atoi(val);
+        } else if (strcmp(opt, "--rate") == 0) {
+            rate = atof(val);
+        } else if (strcmp(opt, "--seed") == 0) {
+            seed = strtoull(val, NULL, 10);
+        } else if (strcmp(opt, "--engine") == 0) {
+            static const char *names[] = { "ledger", "locked", "sharded" };
+            int e = 0;
+            while (e < 3 && strcmp(val, names[e]) != 0) {
+                e++;
+            }
+            if (e == 3) {
+                return false;
+            }
+            engine = (Engine)e;
+        } else if (strcmp(opt, "--flag-hot") == 0) {
+            flag_hot = (uint32_t)atol(val);
+        } else if (strcmp(opt, "--emit") == 0) {
+            emit_path = val;
+        } else if (strcmp(opt, "--mix") == 0) {
+            if (sscanf(val, "%d:%d:%d", &mix[0], &mix[1], &mix[2]) != 3 ||
+                mix[0] < 0 || mix[1] < 0 || mix[2] < 0 || mix[0] + mix[1] + mix[2] != 100) {
+                fprintf(stderr, "--mix needs three percents that add up to 100\n");
+                return false;
+            }
+        } else if (strcmp(opt, "--dist") == 0) {
+            if (strncmp(val, "uniform", 7) == 0) {
+                dist = DIST_UNIFORM;
+            } else if (strncmp(val, "zipf", 4) == 0) {
+                dist = DIST_ZIPF;
+                sscanf(val, "zipf:%lf", &zipf_s);
+            } else if (strncmp(val, "hot", 3) == 0) {
+                dist = DIST_HOT;
+                sscanf(val, "hot:%u:%d", &hot_accounts, &hot_percent);
+            } else {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return accounts >= 2 && total_ops > 0 && threads >= 1 && threads <= MAX_THREADS &&
+           rate >= 0 && zipf_s > 0 && hot_accounts >= 1 && hot_percent >= 0 && hot_percent <= 100;
+}
+
+static void build_zipf(void) {
+    zipf_cdf = malloc(accounts * sizeof(double));
+    if (zipf_cdf == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    double sum = 0;
+    for (uint32_t k = 0; k < accounts; k++) {
+        sum += 1.0 / pow(k + 1, zipf_s);
+        zipf_cdf[k] = sum;
+    }
+    for (uint32_t k = 0; k < accounts; k++) {
+        zipf_cdf[k] /= sum;
+    }
+}
+
+/* Create a fresh database in the current directory
+   The store always; the account files and the index for --emit (so the
+   real program can run the commands); the opening deposits in the log
+   with --log or --emit (so --replay and the follower agree) */
+static bool create_accounts(void) {
+    mkdir(DATABASE_DIR, 0755);
+    unlink(HOT_STORE_FILE);
+    unlink(COLD_STORE_FILE);
+    unlink(STORE_INDEX_FILE);
+    unlink(INDEX_FILE);
+    unlink(TXLOG_ACTIVE);
+    unlink(TXLOG_CATALOG);
+    unlink(VELOCITY_FILE);
+
+    const uint32_t chunk = 4096;
+    Account *batch = calloc(chunk, sizeof(Account));
+    TxRecord *records = calloc(chunk * 2, sizeof(TxRecord));
+    FILE *index = emit_path != NULL ? fopen(INDEX_FILE, "w") : NULL;
+    if (batch == NULL || records == NULL || (emit_path != NULL && index == NULL)) {
+        return false;
+    }
+
+    bool ok = true;
+    for (uint32_t first = 0; ok && first < accounts; first += chunk) {
+        uint32_t n = accounts - first < chunk ? accounts - first : chunk;
+        for (uint32_t i = 0; i < n; i++) {
+            Account *acc = &batch[i];
+            uint32_t id = FIRST_ACCOUNT + first + i;
+            snprintf(acc->account_number, sizeof(acc->account_number), "%u", id);
+            snprintf(acc->name, sizeof(acc->name), "Load %u", first + i);
+            snprintf(acc->id_number, sizeof(acc->id_number), "L%u", id);
+            strcpy(acc->pin, "1234");
+            acc->type = type_of(first + i);
+            acc->balance = OPENING_CENTS / 100.0;
+            ok = ok && store_put(acc);
+            if (index != NULL) {
+                fprintf(index, "%u\n", id);
+            }
+
+            TxRecord *rec = &records[i * 2];
+            memset(rec, 0, 2 * sizeof(TxRecord));
+            rec[0].op = TXOP_CREATE;
+            rec[0].to_id = id;
+            rec[1].op = TXOP_DEPOSIT;
+            rec[1].to_id = id;
+            rec[1].amount_cents = OPENING_CENTS;
+        }
+        if (emit_path != NULL) {
+            ok = ok && save_accounts(batch, n, false) == n;
+        }
+        if (write_log || emit_path != NULL) {
+            ok = ok && txlog_append_batch(records, n * 2) != 0;
+        }
+    }
+    if (index != NULL) {
+        fclose(index);
+    }
+    free(batch);
+    free(records);
+    return ok;
+}
+
+/* ---------- Writing a command file ---------- */
+
+static int emit_commands(const char *dir) {
+    FILE *fp = fopen(emit_path, "w");
+    if (fp == NULL) {
+        perror(emit_path);
+        return 1;
+    }
+    for (long i = 0; i < total_ops; i++) {
+        Operation op = make_operation(i);
+        double amount = op.cents / 100.0;
+        if (op.op == LEDGER_DEPOSIT) {
+            fprintf(fp, "deposit %u 1234 %.2f\n", FIRST_ACCOUNT + op.to, amount);
+        } else if (op.op == LEDGER_WITHDRAW) {
+            fprintf(fp, "withdraw %u 1234 %.2f\n", FIRST_ACCOUNT + op.from, amount);
+        } else {
+            fprintf(fp, "remit %u 1234 %u %.2f\n", FIRST_ACCOUNT + op.from,
+                    FIRST_ACCOUNT + op.to, amount);
+        }
+    }
+    fclose(fp);
+    printf("Wrote %ld commands to %s\n", total_ops, emit_path);
+    printf("Run them with: (cd %s && banking_system --batch %s)\n", dir, emit_path);
+    return 0;
+}
+
+/* ---------- Driving the ledger ---------- */
+
+static void sleep_until(double when) {
+    double wait = when - now_s();
+    if (wait > 0) {
+        struct timespec ts = { (time_t)wait, (long)((wait - (time_t)wait) * 1e9) };
+        nanosleep(&ts, NULL);
+    }
+}
+
+/* Client thread: operations index, index + threads, index + 2 * threads, ... */
+static void *client(void *arg) {
+    Client *c = arg;
+    double start = now_s();
+    double due = start;
+    double per_thread_rate = rate / threads;
+    uint64_t r = splitmix64(seed ^ (uint64_t)(c->index + 1) * 0xA24BAED4963EE407ull);
+
+    for (long i = c->index; i < total_ops; i += threads) {
+        Operation op = make_operation(i);
+        if (rate > 0) {
+            // Poisson arrivals: exponential gaps between operations
+            r = splitmix64(r);
+            due += -log(1.0 - unit(r)) / per_thread_rate;
+            sleep_until(due);
+        } else {
+            due = now_s();
+        }
+
+        int64_t fee = op.op == LEDGER_REMIT
+                      ? fee_for_remittance(type_of(op.from), type_of(op.to), op.cents) : 0;
+        LedgerResult result;
+        if (engine == ENGINE_LEDGER) {
+            LedgerTicket ticket;
+            ledger_submit(op.op, FIRST_ACCOUNT + op.from, FIRST_ACCOUNT + op.to, op.cents, fee, &ticket);
+            result = ledger_wait(&ticket);
+        } else {
+            result = posting_apply(op.op, FIRST_ACCOUNT + op.from, FIRST_ACCOUNT + op.to, op.cents, fee);
+        }
+        if (result != LEDGER_OK) {
+            c->rejected++;
+        } else {
+            c->moved_cents += op.op == LEDGER_DEPOSIT ? op.cents
+                              : op.op == LEDGER_WITHDRAW ? -op.cents : -fee;
+        }
+        double latency = now_s() - due;
+        c->latency_ns[c->done++] = latency > 0 ? (uint64_t)(latency * 1e9) : 0;
+    }
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_desc_i64(const void *a, const void *b) {
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x < y) - (x > y);
+}
+
+/* Share of all credits that went to the TOP_ACCOUNTS busiest accounts */
+static double top_credit_share(void) {
+    int64_t *credits = calloc(accounts, sizeof(int64_t));
+    if (credits == NULL) {
+        return 0;
+    }
+    long total = 0;
+    for (long i = 0; i < total_ops; i++) {
+        Operation op = make_operation(i);
+        if (op.op != LEDGER_WITHDRAW) {
+            credits[op.to]++;
+            total++;
+        }
+    }
+    qsort(credits, accounts, sizeof(int64_t), compare_desc_i64);
+    long top = 0;
+    for (uint32_t k = 0; k < TOP_ACCOUNTS && k < accounts; k++) {
+        top += credits[k];
+    }
+    free(credits);
+    return total > 0 ? 100.0 * top / total : 0;
+}
+
+static int drive(void) {
+    LedgerConfig config = { write_log, false, false };
+    bool started = engine == ENGINE_LEDGER ? ledger_start(&config)
+                                           : posting_start(engine == ENGINE_SHARDED);
+    if (!started) {
+        fprintf(stderr, "Could not start the engine\n");
+        return 1;
+    }
+    // Hot-set and Zipf credits go mostly to the lowest account numbers
+    for (uint32_t k = 0; engine == ENGINE_SHARDED && k < flag_hot && k < accounts; k++) {
+        posting_mark_hot(FIRST_ACCOUNT + k);
+    }
+
+    Client clients[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+    double start = now_s();
+    for (int t = 0; t < threads; t++) {
+        clients[t].index = t;
+        clients[t].done = 0;
+        clients[t].rejected = 0;
+        clients[t].moved_cents = 0;
+        clients[t].latency_ns = malloc((size_t)(total_ops / threads + 1) * sizeof(uint64_t));
+        if (clients[t].latency_ns == NULL || pthread_create(&tids[t], NULL, client, &clients[t]) != 0) {
+            fprintf(stderr, "Could not start client %d\n", t);
+            exit(1);
+        }
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    double seconds = now_s() - start;
+    LedgerStats stats;
+    PostingStats posting;
+    if (engine == ENGINE_LEDGER) {
+        ledger_stop(&stats);
+    } else {
+        posting_stop(&posting);
+    }
+
+    // Put every latency in one array to find the percentiles
+    long done = 0, rejected = 0;
+    int64_t expected = (int64_t)accounts * OPENING_CENTS;
+    for (int t = 0; t < threads; t++) {
+        done += clients[t].done;
+        rejected += clients[t].rejected;
+        expected += clients[t].moved_cents;
+    }
+    uint64_t *all = malloc((size_t)done * sizeof(uint64_t));
+    if (all == NULL) {
+        return 1;
+    }
+    long n = 0;
+    for (int t = 0; t < threads; t++) {
+        memcpy(all + n, clients[t].latency_ns, (size_t)clients[t].done * sizeof(uint64_t));
+        n += clients[t].done;
+        free(clients[t].latency_ns);
+    }
+    qsort(all, (size_t)n, sizeof(uint64_t), compare_u64);
+
+    printf("Throughput: %.0f ops/s (%ld ops in %.3f s, %ld rejected)\n",
+           done / seconds, done, seconds, rejected);
+    if (rate > 0) {
+        printf("Offered load: %.0f ops/s\n", rate);
+    }
+    static const double points[] = { 50, 90, 99, 99.9 };
+    printf("Latency (us):");
+    for (size_t p = 0; p < sizeof(points) / sizeof(points[0]); p++) {
+        long k = (long)(points[p] / 100.0 * (n - 1));
+        printf("  p%g %.1f", points[p], all[k] / 1e3);
+    }
+    printf("  max %.1f\n", all[n - 1] / 1e3);
+    if (engine == ENGINE_LEDGER) {
+        printf("Ledger: %llu batches, apply %.3f s, log %.3f s\n", (unsigned long long)stats.batches,
+               stats.apply_seconds, stats.log_seconds);
+    } else {
+        // Every cent must be accounted for, even with credits in deltas
+        int64_t total = 0;
+        const AccountHot *records = store_hot_records();
+        for (size_t i = 0; i < store_count(); i++) {
+            total += records[i].balance_cents;
+        }
+        printf("Posting: %llu lock waits, %u hot accounts, %llu delta merges\n",
+               (unsigned long long)posting.lock_waits, posting.hot_accounts,
+               (unsigned long long)posting.merges);
+        printf("Money check: %s (balances RM%.2f, expected RM%.2f)\n",
+               total == expected ? "OK" : "FAILED", total / 100.0, expected / 100.0);
+    }
+    free(all);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || !parse_options(argc, argv)) {
+        fprintf(stderr, "Usage: %s <dir> [--accounts N] [--ops N] [--threads N] "
+                "[--dist uniform|zipf[:S]|hot[:H:P]] [--mix D:W:R] [--rate R] "
+                "[--seed S] [--engine ledger|locked|sharded] [--flag-hot N] [--log] [--emit FILE]\n", argv[0]);
+        return 1;
+    }
+    if (dist == DIST_ZIPF) {
+        build_zipf();
+    }
+
+    // The database lives in <dir>/database, like in the real program
+    char emit_full[4096];
+    if (emit_path != NULL && emit_path[0] != '/' && getcwd(emit_full, sizeof(emit_full) - 256) != NULL) {
+        strcat(emit_full, "/");
+        strncat(emit_full, emit_path, 250);
+        emit_path = emit_full;
+    }
+    if ((mkdir(argv[1], 0755) != 0 && errno != EEXIST) || chdir(argv[1]) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    fees_init();
+
+    static const char *dist_names[] = { "uniform", "zipf", "hot-set" };
+    static const char *engine_names[] = { "ledger", "locked posting", "sharded posting" };
+    printf("%u accounts, %ld ops, %d threads, %s credits, mix %d:%d:%d, %s, %s, seed %llu\n",
+           accounts, total_ops, threads, dist_names[dist], mix[0], mix[1], mix[2],
+           rate > 0 ? "open loop" : "closed loop", engine_names[engine], (unsigned long long)seed);
+    printf("Credits to the %d busiest accounts: %.1f%%\n", TOP_ACCOUNTS, top_credit_share());
+
+    double start = now_s();
+    if (!create_accounts()) {
+        fprintf(stderr, "Could not create the accounts\n");
+        return 1;
+    }
+    printf("Created %u accounts in %.3f s\n", accounts, now_s() - start);
+
+    int result = emit_path != NULL ? emit_commands(argv[1]) : drive();
+    store_close();
+    free(zipf_cdf);
+    return result;
+}
@@ -0,0 +1,179 @@
+/* Benchmark: account file open latency, flat layout vs fan-out layout
+
+   Usage:
+     ./build/bench_open_latency <dir> <files> <flat|fanout> [samples]
+
+   Example (1 million and 10 million files):
+     ./build/bench_open_latency /data/bench1m 1000000 flat
+     ./build/bench_open_latency /data/bench1m 1000000 fanout
+     ./build/bench_open_latency /data/bench10m 10000000 fanout
+
+   How it works:
+   1. Create <files> small account files in <dir> using the chosen layout
+      (skipped if a previous run already created them)
+   2. Open and close <samples> random account files and time each one
+   3. Time a full listing of the directory tree
+   4. Print the latency percentiles
+
+   Drop the page cache between runs (echo 3 > /proc/sys/vm/drop_caches)
+   to measure cold opens instead of warm ones
+ */
+
+#include "layout.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define FIRST_ACCOUNT 10000000L
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Create the account files (one line each, like a tiny account file) */
+static int create_files(const char *dir, long files, bool fanout) {
+    char path[300], account[32];
+    for (long i = 0; i < files; i++) {
+        snprintf(account, sizeof(account), "%ld", FIRST_ACCOUNT + i);
+        if (fanout) {
+            if (!layout_prepare_fanout_path(dir, account, path, sizeof(path))) {
+                return -1;
+            }
+        } else {
+            layout_path_in(dir, account, false, path, sizeof(path));
+        }
+
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return -1;
+        }
+        char line[64];
+        int len = snprintf(line, sizeof(line), "Account Number: %s\n", account);
+        if (write(fd, line, (size_t)len) != len) {
+            close(fd);
+            return -1;
+        }
+        close(fd);
+
+        if ((i + 1) % 1000000 == 0) {
+            fprintf(stderr, "  created %ld files\n", i + 1);
+        }
+    }
+    return 0;
+}
+
+/* Count every entry in a folder (and its sub-folders, for the fan-out tree) */
+static long list_tree(const char *dir, int depth) {
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        return 0;
+    }
+    long count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        if (depth > 0) {
+            char sub[300];
+            snprintf(sub, sizeof(sub), "%s/%s", dir, entry->d_name);
+            count += list_tree(sub, depth - 1);
+        } else {
+            count++;
+        }
+    }
+    closedir(d);
+    return count;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <dir> <files> <flat|fanout> [samples]\n", argv[0]);
+        return 1;
+    }
+    const char *dir = argv[1];
+    long files = atol(argv[2]);
+    bool fanout = strcmp(argv[3], "fanout") == 0;
+    long samples = argc > 4 ? atol(argv[4]) : 100000;
+    if (files <= 0 || samples <= 0) {
+        fprintf(stderr, "Error: files and samples must be positive\n");
+        return 1;
+    }
+
+    // STEP 1: Create the files once (a marker remembers a finished setup)
+    char marker[300];
+    snprintf(marker, sizeof(marker), "%s/.bench_%s_%ld", dir, argv[3], files);
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        perror("mkdir");
+        return 1;
+    }
+    if (access(marker, F_OK) != 0) {
+        fprintf(stderr, "Creating %ld files (%s layout)...\n", files, argv[3]);
+        double start = now_ns();
+        if (create_files(dir, files, fanout) != 0) {
+            perror("create");
+            return 1;
+        }
+        fprintf(stderr, "  done in %.1f s\n", (now_ns() - start) / 1e9);
+        fclose(fopen(marker, "w"));
+    }
+
+    // STEP 2: Open random files and time each open + close
+    double *lat = malloc((size_t)samples * sizeof(double));
+    if (lat == NULL) {
+        return 1;
+    }
+    srand(12345);
+    char path[300], account[32];
+    double total = 0;
+    for (long i = 0; i < samples; i++) {
+        long n = (((long)rand() << 16) ^ rand()) % files;
+        snprintf(account, sizeof(account), "%ld", FIRST_ACCOUNT + n);
+        layout_path_in(dir, account, fanout, path, sizeof(path));
+
+        double start = now_ns();
+        int fd = open(path, O_RDONLY);
+        if (fd >= 0) {
+            close(fd);
+        }
+        lat[i] = now_ns() - start;
+        total += lat[i];
+        if (fd < 0) {
+            fprintf(stderr, "Error: %s is missing\n", path);
+            return 1;
+        }
+    }
+    qsort(lat, (size_t)samples, sizeof(double), compare_double);
+
+    // STEP 3: Time a full listing
+    double start = now_ns();
+    long listed = list_tree(dir, fanout ? 2 : 0);
+    double list_ms = (now_ns() - start) / 1e6;
+
+    // STEP 4: Report
+    printf("layout=%s files=%ld samples=%ld\n", argv[3], files, samples);
+    printf("open+close latency (us): mean %.2f  p50 %.2f  p90 %.2f  p99 %.2f  p99.9 %.2f  max %.2f\n",
+           total / samples / 1e3,
+           lat[samples / 2] / 1e3,
+           lat[samples * 90 / 100] / 1e3,
+           lat[samples * 99 / 100] / 1e3,
+           lat[samples * 999 / 1000] / 1e3,
+           lat[samples - 1] / 1e3);
+    printf("listing: %ld entries in %.1f ms\n", listed, list_ms);
+
+    free(lat);
+    return 0;
+}
@@ -0,0 +1,330 @@
+/* This file is the direct posting engine (see posting.h)
+
+   Locks:
+   The lock of an account is stripe_locks[hash(id) % POSTING_STRIPES].
+   Two accounts can share a stripe; a remittance then takes it once.
+   Credits try the lock first; when it is taken they count a wait on the
+   stripe, and after POSTING_HOT_THRESHOLD waits the account being
+   credited is made hot (the busiest receiver of a stripe is nearly
+   always the one that gets there)
+
+   Hot accounts:
+   hot_table is a small open addressing table that is only ever added to,
+   so looking an account up needs no lock. A slot is claimed with a
+   compare-and-swap, filled in, and then published by storing the account
+   number (release); readers load it with acquire, so a published slot is
+   always complete. A slot that is still being filled looks empty, and
+   the credit simply takes the lock that time
+
+   Merging a hot account: under its lock, every shard is swapped with 0
+   and the sum is added to the balance. A credit that lands during the
+   merge stays in its shard for the next one; nothing is lost
+ */
+
+#include "posting.h"
+#include "store.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define STRIPE_MASK (POSTING_STRIPES - 1)
+
+// One delta counter on its own cache line
+typedef struct {
+    int64_t cents;
+    char pad[56];
+} DeltaShard;
+
+typedef struct {
+    uint32_t account_id;      // 0 until the slot is published
+    uint32_t claimed;         // Set (with CAS) by the thread filling the slot
+    AccountHot *hot;          // The account's record in the store
+    char pad[48];
+    DeltaShard shards[POSTING_SHARDS];
+} HotAccount;
+
+static pthread_mutex_t stripe_locks[POSTING_STRIPES];
+static uint32_t stripe_waits[POSTING_STRIPES];
+static HotAccount hot_table[POSTING_MAX_HOT];
+
+static bool running = false;
+static bool auto_hot = false;
+static int stop_merger = 0;
+static pthread_t merger;
+static PostingStats stats;
+
+// Which shard this thread adds its credits to (chosen on first use)
+static __thread int my_shard = -1;
+static uint32_t next_shard = 0;
+
+static size_t hash_id(uint32_t id) {
+    uint32_t h = id * 2654435761u;
+    return (size_t)(h ^ (h >> 16));
+}
+
+static pthread_mutex_t *lock_of(uint32_t id) {
+    return &stripe_locks[hash_id(id) & STRIPE_MASK];
+}
+
+/* Find a published hot account (no lock)
+   Returns NULL if the account is not hot */
+static HotAccount *find_hot(uint32_t id) {
+    size_t start = hash_id(id) % POSTING_MAX_HOT;
+    for (size_t n = 0; n < POSTING_MAX_HOT; n++) {
+        HotAccount *h = &hot_table[(start + n) % POSTING_MAX_HOT];
+        uint32_t published = __atomic_load_n(&h->account_id, __ATOMIC_ACQUIRE);
+        if (published == id) {
+            return h;
+        }
+        if (published == 0 && !__atomic_load_n(&h->claimed, __ATOMIC_RELAXED)) {
+            return NULL;   // End of the probe chain
+        }
+    }
+    return NULL;
+}
+
+/* Add the deltas of a hot account to its balance (caller holds its lock) */
+static void merge_hot(HotAccount *h) {
+    int64_t sum = 0;
+    for (int s = 0; s < POSTING_SHARDS; s++) {
+        sum += __atomic_exchange_n(&h->shards[s].cents, 0, __ATOMIC_ACQ_REL);
+    }
+    if (sum != 0) {
+        h->hot->balance_cents += sum;
+        h->hot->version++;
+        store_seal_hot(h->hot);
+        __atomic_fetch_add(&stats.merges, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Lock an account's stripe, counting the wait if it was taken
+   Returns: true if the lock was free */
+static bool lock_account(uint32_t id) {
+    pthread_mutex_t *lock = lock_of(id);
+    if (pthread_mutex_trylock(lock) == 0) {
+        return true;
+    }
+    __atomic_fetch_add(&stats.lock_waits, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(lock);
+    return false;
+}
+
+/* Count a wait on the stripe of a credited account and make the account
+   hot once the stripe has been waited on often enough */
+static void note_credit_wait(uint32_t id) {
+    uint32_t *waits = &stripe_waits[hash_id(id) & STRIPE_MASK];
+    if (__atomic_add_fetch(waits, 1, __ATOMIC_RELAXED) >= POSTING_HOT_THRESHOLD) {
+        __atomic_store_n(waits, 0, __ATOMIC_RELAXED);
+        posting_mark_hot(id);
+    }
+}
+
+/* Merge thread: fold the deltas of every hot account into its balance */
+static void *merge_loop(void *arg) {
+    (void)arg;
+    struct timespec pause = { 0, POSTING_MERGE_MS * 1000000L };
+    while (!__atomic_load_n(&stop_merger, __ATOMIC_ACQUIRE)) {
+        nanosleep(&pause, NULL);
+        for (int i = 0; i < POSTING_MAX_HOT; i++) {
+            HotAccount *h = &hot_table[i];
+            uint32_t id = __atomic_load_n(&h->account_id, __ATOMIC_ACQUIRE);
+            if (id != 0) {
+                pthread_mutex_lock(lock_of(id));
+                merge_hot(h);
+                pthread_mutex_unlock(lock_of(id));
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Posting start function
+   Purpose: Open the store, reset the locks and hot table, and start the
+   merge thread
+ */
+bool posting_start(bool shard_hot) {
+    if (running || !store_open()) {
+        return false;
+    }
+    for (int i = 0; i < POSTING_STRIPES; i++) {
+        pthread_mutex_init(&stripe_locks[i], NULL);
+        stripe_waits[i] = 0;
+    }
+    memset(hot_table, 0, sizeof(hot_table));
+    memset(&stats, 0, sizeof(stats));
+    auto_hot = shard_hot;
+    stop_merger = 0;
+    if (pthread_create(&merger, NULL, merge_loop, NULL) != 0) {
+        return false;
+    }
+    running = true;
+    return true;
+}
+
+/* Posting mark hot function
+   Purpose: Send the credits of an account through delta counters
+
+   Returns: true if the account is hot (now or already)
+ */
+bool posting_mark_hot(uint32_t account_id) {
+    AccountHot *record = store_hot_ref(account_id);
+    if (record == NULL) {
+        return false;
+    }
+    size_t start = hash_id(account_id) % POSTING_MAX_HOT;
+    for (size_t n = 0; n < POSTING_MAX_HOT; n++) {
+        HotAccount *h = &hot_table[(start + n) % POSTING_MAX_HOT];
+        uint32_t expected = 0;
+        if (__atomic_compare_exchange_n(&h->claimed, &expected, 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            // Our slot: fill it in, then publish it
+            h->hot = record;
+            memset(h->shards, 0, sizeof(h->shards));
+            __atomic_store_n(&h->account_id, account_id, __ATOMIC_RELEASE);
+            __atomic_fetch_add(&stats.hot_accounts, 1, __ATOMIC_RELAXED);
+            return true;
+        }
+        // Taken: by this account (maybe still being filled), or by another one
+        uint32_t id = __atomic_load_n(&h->account_id, __ATOMIC_ACQUIRE);
+        while (id == 0) {
+            id = __atomic_load_n(&h->account_id, __ATOMIC_ACQUIRE);
+        }
+        if (id == account_id) {
+            return true;
+        }
+    }
+    return false;   // Table full
+}
+
+/* Credit a hot account through this thread's delta counter */
+static void credit_hot(HotAccount *h, int64_t cents) {
+    if (my_shard < 0) {
+        my_shard = (int)(__atomic_fetch_add(&next_shard, 1, __ATOMIC_RELAXED) % POSTING_SHARDS);
+    }
+    __atomic_fetch_add(&h->shards[my_shard].cents, cents, __ATOMIC_RELEASE);
+}
+
+/* Posting apply function
+   Purpose: Apply one command while other threads apply theirs
+
+   Locks taken:
+   - Deposit to a hot account: none (delta counter)
+   - Deposit to another account: the receiver's
+   - Withdrawal: the sender's (its deltas are merged first if it is hot)
+   - Remittance: the sender's, plus the receiver's unless it is hot
+ */
+LedgerResult posting_apply(LedgerOp op, uint32_t from_id, uint32_t to_id,
+                           int64_t amount_cents, int64_t fee_cents) {
+    AccountHot *from = NULL, *to = NULL;
+    if (op != LEDGER_DEPOSIT && (from = store_hot_ref(from_id)) == NULL) {
+        return LEDGER_NO_ACCOUNT;
+    }
+    if (op != LEDGER_WITHDRAW && (to = store_hot_ref(to_id)) == NULL) {
+        return LEDGER_NO_ACCOUNT;
+    }
+    HotAccount *hot_to = to != NULL ? find_hot(to_id) : NULL;
+
+    // STEP 1: Take the locks (lowest stripe first, one lock if they share it)
+    pthread_mutex_t *lock_from = from != NULL ? lock_of(from_id) : NULL;
+    pthread_mutex_t *lock_to = to != NULL && hot_to == NULL ? lock_of(to_id) : NULL;
+    if (lock_from == lock_to) {
+        lock_to = NULL;
+    }
+    pthread_mutex_t *first = lock_from, *second = lock_to;
+    uint32_t first_id = from_id, second_id = to_id;
+    if (first == NULL || (second != NULL && second < first)) {
+        first = lock_to;
+        second = lock_from;
+        first_id = to_id;
+        second_id = from_id;
+    }
+    bool credit_waited = false;
+    if (first != NULL && !lock_account(first_id)) {
+        credit_waited = first == lock_to;
+    }
+    if (second != NULL && !lock_account(second_id)) {
+        credit_waited = credit_waited || second == lock_to;
+    }
+
+    // STEP 2: Check and move the money
+    LedgerResult result = LEDGER_OK;
+    if (from != NULL) {
+        HotAccount *hot_from = find_hot(from_id);
+        if (hot_from != NULL) {
+            merge_hot(hot_from);   // Debits see the exact balance
+        }
+        if (from->balance_cents < amount_cents + fee_cents) {
+            result = LEDGER_NO_FUNDS;
+        } else {
+            from->balance_cents -= amount_cents + fee_cents;
+            from->version++;
+            store_seal_hot(from);
+        }
+    }
+    if (result == LEDGER_OK && to != NULL) {
+        if (hot_to != NULL) {
+            credit_hot(hot_to, amount_cents);
+        } else {
+            to->balance_cents += amount_cents;
+            to->version++;
+            store_seal_hot(to);
+        }
+    }
+
+    if (second != NULL) {
+        pthread_mutex_unlock(second);
+    }
+    if (first != NULL) {
+        pthread_mutex_unlock(first);
+    }
+
+    // STEP 3: A credit that had to wait may have found a hot account
+    if (auto_hot && credit_waited && to != NULL && hot_to == NULL) {
+        note_credit_wait(to_id);
+    }
+    return result;
+}
+
+bool posting_balance(uint32_t account_id, int64_t *balance_cents) {
+    AccountHot *record = store_hot_ref(account_id);
+    if (record == NULL) {
+        return false;
+    }
+    pthread_mutex_lock(lock_of(account_id));
+    HotAccount *h = find_hot(account_id);
+    if (h != NULL) {
+        merge_hot(h);
+    }
+    *balance_cents = record->balance_cents;
+    pthread_mutex_unlock(lock_of(account_id));
+    return true;
+}
+
+/* Posting stop function
+   Purpose: Stop the merge thread, merge the last deltas and write the
+   changed records to disk
+ */
+void posting_stop(PostingStats *out) {
+    if (!running) {
+        return;
+    }
+    __atomic_store_n(&stop_merger, 1, __ATOMIC_RELEASE);
+    pthread_join(merger, NULL);
+
+    for (int i = 0; i < POSTING_MAX_HOT; i++) {
+        if (hot_table[i].account_id != 0) {
+            merge_hot(&hot_table[i]);
+        }
+    }
+    store_sync(true);
+    for (int i = 0; i < POSTING_STRIPES; i++) {
+        pthread_mutex_destroy(&stripe_locks[i]);
+    }
+    running = false;
+    if (out != NULL) {
+        *out = stats;
+    }
+}
@@ -0,0 +1,68 @@
+/* Functions for direct (multi-writer) posting are declared in this file
+
+   The ledger (ledger.h) changes balances from one thread. Direct posting
+   lets many threads change the account store at the same time instead:
+   every account is protected by one of POSTING_STRIPES locks, and a
+   remittance takes the locks of both accounts (always in the same order,
+   so two threads can never wait for each other)
+
+   With per-account locks, a few very busy receivers (merchant accounts
+   taking most deposits and remittances) make every thread wait for the
+   same lock. Such accounts can be made "hot":
+   - A credit to a hot account does not take its lock; the amount is
+     added to one of POSTING_SHARDS delta counters (each thread uses its
+     own counter, on its own cache line) with one atomic add
+   - The deltas are merged into the real balance every POSTING_MERGE_MS
+     milliseconds, and before every debit or balance read, under the
+     account's lock, so debits and reads always see the exact balance
+   Accounts can be flagged hot with posting_mark_hot(), or are made hot
+   automatically when credits keep finding their lock taken
+
+   Only one program may change the store while posting is running, and
+   no accounts may be added or removed (like the ledger)
+
+   This is a benchmark engine for the load generator (--engine locked or
+   sharded), not part of banking_system: it changes the store only, with
+   no log records, limits or account files
+ */
+
+#ifndef POSTING_H
+#define POSTING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ledger.h"
+
+#define POSTING_STRIPES 4096       // Account locks (power of two)
+#define POSTING_SHARDS 16          // Delta counters per hot account
+#define POSTING_MAX_HOT 64         // Hot accounts at most
+#define POSTING_HOT_THRESHOLD 32   // Lock waits by credits before an account is made hot
+#define POSTING_MERGE_MS 100       // How often deltas are merged into the balances
+
+// Counters of a posting run
+typedef struct {
+    uint64_t lock_waits;      // Times a thread found an account lock taken
+    uint64_t merges;          // Times deltas were merged into a balance
+    uint32_t hot_accounts;    // Accounts that took credits through deltas
+} PostingStats;
+
+/* Get ready for posting (opens the account store)
+   shard_hot: make busy receivers hot automatically
+   Returns false if posting is already running or the store cannot be opened */
+bool posting_start(bool shard_hot);
+
+/* Apply one deposit, withdrawal or remittance (thread-safe)
+   Returns LEDGER_OK, LEDGER_NO_ACCOUNT or LEDGER_NO_FUNDS */
+LedgerResult posting_apply(LedgerOp op, uint32_t from_id, uint32_t to_id,
+                           int64_t amount_cents, int64_t fee_cents);
+
+// Make an account hot by hand. Returns false if it is unknown or the table is full
+bool posting_mark_hot(uint32_t account_id);
+
+// Exact balance of an account (merges its deltas first). Returns false if unknown
+bool posting_balance(uint32_t account_id, int64_t *balance_cents);
+
+// Merge every delta into the store and stop the merge thread
+void posting_stop(PostingStats *stats);
+
+#endif
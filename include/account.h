@@ -7,21 +7,78 @@
 #define ACCOUNT_H
 
 #include "types.h"
+#include <stddef.h>
 
 
 // Database Functions
 // Load an account from the database file
 bool load_account(const char *account_num, Account *acc);
 
-// Save an account to the database file
+// Save an account to the database file (written as version acc->version + 1)
 bool save_account(const Account *acc);
 
+/* Read an account file by its path; checksummed is set if it has a
+   checksum line (files from before checksums have none)
+   Returns: false if it is missing or damaged */
+bool read_account_file(const char *path, Account *acc, bool *checksummed);
+
+/* Optimistic updates
+   Nobody locks an account to read it: files are replaced with a rename, so
+   a reader sees the old or the new account, never half of one. A writer
+   loads its accounts, changes them in memory and then commits: the
+   commit only writes if no one else saved those accounts since they were
+   loaded (same version on disk), else the caller loads them again and
+   retries (up to COMMIT_ATTEMPTS times)
+
+   A commit of several accounts writes an intent first (INTENT_DIR), so
+   if the program stops between two files, the next one to lock those
+   accounts sets the written ones back: all of them or none
+ */
+typedef enum {
+    COMMIT_OK,         // Saved; every acc->version was increased
+    COMMIT_CONFLICT,   // Someone saved one of them first; nothing was written
+    COMMIT_FAILED      // An account is gone or could not be written
+} CommitResult;
+
+// Save accounts that were loaded earlier, if none changed on disk meanwhile
+CommitResult commit_accounts(Account *const accounts[], size_t count);
+
+/* Lock accounts against commits by other programs, for writers that must
+   load and save many accounts without a retry (bulk lists, standing
+   orders). A byte-range lock per account, released if the program dies */
+bool lock_account_records(const uint32_t *ids, size_t count);
+void unlock_account_records(const uint32_t *ids, size_t count);
+
+/* commit_accounts() for a writer that already holds the records of the
+   accounts (lock_account_records()): all of them are saved or none */
+CommitResult commit_held_accounts(Account *const accounts[], size_t count);
+
+/* Open a new account (name, ID, type and PIN already checked): give it a
+   number, save it, index it and log it. Prints an error on failure */
+bool open_new_account(Account *acc);
+
+/* Remove an account whose owner has been checked, and log its balance
+   leaving the bank. Prints an error on failure */
+bool remove_account(const char *account_num, double *final_balance);
+
 // Check if an account exists in the system
 bool account_exists(const char *account_num);
 
 // Verify the validity of an account number and PIN combination
 bool authenticate(const char *account_num, const char *pin);
 
+/* Check a PIN against a loaded account; every customer-facing check goes
+   through here. The fee income account (FEE_INCOME_ACCOUNT) and accounts
+   without a valid four-digit PIN never match */
+bool pin_matches(const Account *acc, const char *pin);
+
+// Batch Functions (many files at once through the I/O queue, see ioq.h)
+// Load many accounts; loaded[i] is true if accounts[i] was found. Returns how many loaded
+size_t load_accounts(const char *const account_nums[], Account accounts[], bool loaded[], size_t count);
+
+// Save many accounts (durable = fsync every file) and increase their versions. Returns how many were saved
+size_t save_accounts(Account accounts[], size_t count, bool durable);
+
 // Account Management Functions
 // Generate a new unique account number
 char* generate_account_number(void);
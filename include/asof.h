@@ -0,0 +1,54 @@
+/* Functions for point-in-time balance queries are declared in this file
+
+   "What was the balance of account X on 2024-01-31 at 14:00?" could be
+   answered by reading the whole log from the start, but that gets slower
+   every day. Instead, balance snapshots are written from time to time
+   (--snapshot, for example once a day from cron) into SNAPSHOT_DIR:
+     snap-<last transaction ID>-<time of that transaction>.bin
+   Each one holds the balance of every account after that transaction,
+   sorted by account number
+
+   A query then:
+   1. Picks the newest snapshot that is not newer than the asked time
+      (from the file names, nothing is opened)
+   2. Finds the account in it with a binary search
+   3. Adds only the log records after that snapshot up to the asked
+      time; txlog_query_after() uses the segment catalog and the
+      transaction IDs to jump straight to them
+   So the work depends on the time between two snapshots, not on the age
+   of the bank. SNAPSHOT_KEEP snapshots are kept (over a year of daily ones)
+
+   The first snapshot is copied from the account store; every later one
+   is the previous snapshot brought forward with the log
+ */
+
+#ifndef ASOF_H
+#define ASOF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SNAPSHOT_KEEP 400   // Older snapshots are removed
+
+// The answer to a point-in-time query
+typedef struct {
+    bool existed;            // false if the account was not open at that time
+    int64_t balance_cents;
+    uint64_t snapshot_id;    // Last transaction included in the snapshot used
+    int64_t snapshot_time;
+    long records_read;       // Log records read after the snapshot
+} AsOfBalance;
+
+/* Write a new balance snapshot (and remove the oldest ones)
+   Returns 0 on success, 1 if it could not be written */
+int take_snapshot(void);
+
+/* Find the balance an account had at a time (seconds since 1970)
+   Returns false if no snapshot is old enough or the files can't be read */
+bool balance_as_of(uint32_t account_id, int64_t when, AsOfBalance *out);
+
+/* --balance-at <account> "<YYYY-MM-DD HH:MM[:SS]>": print a past balance
+   Returns the exit code of the program */
+int print_balance_at(const char *account_num, const char *when_text);
+
+#endif
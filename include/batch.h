@@ -0,0 +1,22 @@
+/* Functions for running a file of transactions in ledger mode are declared
+   in this file
+
+   The file has one command per line:
+     deposit  <account> <pin> <amount>
+     withdraw <account> <pin> <amount>
+     remit    <sender> <pin> <receiver> <amount>
+   Blank lines and lines starting with '#' are skipped
+
+   Front-end threads check the commands (PIN, accounts, amounts) in
+   parallel and hand them to the ledger thread (see ledger.h), which
+   applies them one after another
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+/* Run every command of a file with "threads" front-end threads
+   Returns 0 if every command succeeded, 1 otherwise */
+int run_batch(const char *path, int threads);
+
+#endif
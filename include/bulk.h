@@ -0,0 +1,33 @@
+/* Functions for bulk remittances (one sender, many receivers) are declared
+   in this file
+
+   A bulk remittance pays a whole list at once (payroll, supplier runs):
+     --bulk <sender> <pin> <file>
+   where the file has one payment per line:
+     <receiver account> <amount>
+   (empty lines and lines starting with # are skipped)
+
+   It is all or nothing: the sender's PIN is checked once, every line is
+   checked (receiver exists, valid amount, fee by receiver type), and the
+   total of amounts + fees must fit in the sender's balance. If anything
+   is wrong, no money moves
+
+   To stay all or nothing after a crash, the final balances and the log
+   records are first written to BULK_JOURNAL. bulk_recover() finishes a
+   journal that was completed (and drops one that was not) the next time
+   the program starts, unless another program saved one of its accounts
+   since; then it reports the account and keeps the journal
+ */
+
+#ifndef BULK_H
+#define BULK_H
+
+/* Run a bulk remittance from a file
+   Returns the exit code of the program (0 if every payment was made) */
+int run_bulk(const char *sender_num, const char *pin, const char *path);
+
+/* Finish or drop a bulk remittance that was interrupted (called at start-up)
+   Does nothing if there is no journal or a bulk remittance is running */
+void bulk_recover(void);
+
+#endif
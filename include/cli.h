@@ -0,0 +1,47 @@
+/* Functions for the command-line subcommands are declared in this file
+
+   A script that needs one deposit or one balance used to drive the menu:
+   write "3\n<account>\n<pin>\n<amount>\n" into stdin and pick the numbers
+   out of the banners. Instead it can run one operation per call:
+     banking_system [--json|--tsv] balance  <account> <pin>
+     banking_system [--json|--tsv] deposit  <account> <pin> <amount>
+     banking_system [--json|--tsv] withdraw <account> <pin> <amount>
+     banking_system [--json|--tsv] remit    <from> <pin> <to> <amount>
+     banking_system [--json|--tsv] create   <name> <ID number> <savings|current> <pin>
+     banking_system [--json|--tsv] delete   <account> <pin> <last 4 of ID>
+
+   stdout gets exactly one result: a JSON object on one line (the default)
+   or, with --tsv, a line of field names and a line of values separated
+   by tabs. Error messages meant for people go to stderr. The exit code
+   tells a script what kind of problem there was (CliExit below)
+
+   A subcommand does only its own work: no banner, no menu, and no
+   count_accounts() scan of the index, so it takes well under a
+   millisecond however many accounts there are
+ */
+
+#ifndef CLI_H
+#define CLI_H
+
+#include <stdbool.h>
+
+// Exit codes of the subcommands
+typedef enum {
+    CLI_OK = 0,
+    CLI_FAILED = 1,      // Could not be saved or logged
+    CLI_USAGE = 2,       // Wrong arguments
+    CLI_AUTH = 3,        // No such account, or the wrong PIN (or ID)
+    CLI_NOT_FOUND = 4,   // The receiver of a remittance does not exist
+    CLI_INVALID = 5,     // Amount, name, ID, type or PIN not allowed
+    CLI_NO_FUNDS = 6,    // Not enough money
+    CLI_LIMIT = 7        // Over a velocity limit (see velocity.h)
+} CliExit;
+
+// true if arg is a subcommand (or --json/--tsv before one)
+bool cli_is_subcommand(const char *arg);
+
+/* Run the subcommand in argv[1] (after an optional --json or --tsv)
+   Returns the exit code of the program */
+int run_subcommand(int argc, char *argv[]);
+
+#endif
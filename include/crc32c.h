@@ -0,0 +1,18 @@
+/* The CRC32C checksum function is declared in this file
+   CRC32C (Castagnoli) is used to detect damaged records: log records,
+   the records of the account store and the account files
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Calculate the CRC32C of "len" bytes, continuing from a previous crc (start with 0)
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
+// How the checksums are calculated on this processor ("sse4.2" or "table")
+const char *crc32c_implementation(void);
+
+#endif
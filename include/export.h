@@ -0,0 +1,30 @@
+/* Functions for exporting every account are declared in this file
+
+   Usage:
+     banking_system --export <csv|json> [file|-] [--columns <list>]
+                    [--type savings|current] [--min <RM>] [--max <RM>] [--threads <n>]
+
+   The columns are account, name, id, type, balance and version (all of
+   them, in that order, unless --columns picks some, exp.
+   --columns account,balance). --type, --min and --max keep only the
+   accounts of one type or with a balance in the range. Without a file
+   (or with "-") the accounts are written to stdout.
+
+   CSV has a line of column names first. JSON is an array with one
+   object per line, so it can be read a line at a time as well.
+
+   The accounts are read from the compact store (run --migrate first),
+   not from the account files: several threads each format one piece of
+   the store into text at a time and the pieces are written out in store
+   order, so the output can be as big as the bank without being held in
+   memory
+ */
+
+#ifndef EXPORT_H
+#define EXPORT_H
+
+/* Run --export; argv[1] is "--export"
+   Returns the exit code of the program (0 if every account was written) */
+int export_accounts(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,38 @@
+/* Functions for the remittance fee schedule are declared in this file
+
+   The fee a sender pays depends on the sender's account type, the
+   receiver's account type and how much is sent. The rules are read from
+   FEES_CONFIG (or the built-in defaults below) once, when the first fee
+   is needed, and compiled into a table:
+
+     fee_table[sender type][receiver type][amount tier]
+
+   Finding a fee is then a few comparisons to pick the tier and one
+   lookup, the same for the menu, --batch and standing orders
+
+   Built-in defaults (used when FEES_CONFIG does not exist):
+   - Savings → Current: 2%
+   - Current → Savings: 3%
+   - Same type: 1%
+ */
+
+#ifndef FEES_H
+#define FEES_H
+
+#include <stdint.h>
+#include "types.h"
+
+#define FEE_MAX_TIERS 8   // Different "from amount" values the schedule can use
+
+/* Read FEES_CONFIG (or the defaults) and build the fee table, once
+   (fee_for_remittance() calls it; nothing else needs to) */
+void fees_init(void);
+
+/* Fee the sender pays for sending amount_cents from an account of type
+   "from" to an account of type "to" (in cents) */
+int64_t fee_for_remittance(AccountType from, AccountType to, int64_t amount_cents);
+
+// Print the compiled fee table (for "--fees")
+void fees_print_schedule(void);
+
+#endif
@@ -0,0 +1,43 @@
+/* Functions for the read-only follower are declared in this file
+
+   A follower is a second banking_system process that never writes to the
+   database. It reads the transaction log written by the primary (the menu,
+   --batch, --standing ...) and keeps its own copy of every balance in
+   memory, so balance and history lookups from reports or portals do not
+   touch the account files the primary is writing
+
+   How it works:
+   1. Start-up: every record already in the log is applied, oldest first
+      (like --replay, balances start at zero)
+   2. The active segment is kept open and read again every
+      FOLLOW_POLL_MS milliseconds; new records are applied as they appear.
+      The open file keeps working when the primary renames it into a
+      closed segment, and the footer tells the follower to move on
+   3. Queries arrive on a local (unix) socket, one line each:
+        balance <account>          current balance
+        history <account> [count]  last transactions of the account
+        status                     last applied transaction and the lag
+      Every answer ends with a line starting with "OK" or "ERR"
+
+   The replication lag is how many records of the log have not been
+   applied yet, and how many seconds older the last applied record is
+   than the newest one in the log
+ */
+
+#ifndef FOLLOWER_H
+#define FOLLOWER_H
+
+#define FOLLOW_POLL_MS 100      // How often the log is checked for new records
+#define FOLLOW_HISTORY 10       // Transactions remembered per account
+#define FOLLOW_MAX_CLIENTS 64   // Connections served at the same time
+
+/* Run the follower until it is stopped (Ctrl+C or SIGTERM)
+   socket_path may be NULL to use FOLLOW_SOCKET
+   Returns the exit code of the program */
+int run_follower(const char *socket_path);
+
+/* Send one query to a running follower and print the answer
+   Returns 0 if the answer was OK, 1 otherwise */
+int follower_query(const char *socket_path, const char *query);
+
+#endif
@@ -0,0 +1,43 @@
+/* Functions for checking the whole database for damage are declared in
+   this file
+
+   Usage:
+     banking_system --fsck [threads] [--quarantine]
+
+   Every record the bank keeps has a CRC32C checksum: the log records,
+   the hot and cold records of the account store and the account files
+   (their last line). --fsck checks all of them, with several threads at
+   once, and finds what does not fit together:
+   - damaged records: the checksum does not match (a file that was cut
+     off or changed by hand, a store record with wrong bytes)
+   - index entries without an account file, and account files that are
+     not in the index
+   - store records that are not in the index, and accounts that are
+     missing from the store
+   A few of each kind are listed; the report ends with CLEAN or with the
+   number of problems.
+
+   With --quarantine, what can be set aside is moved to QUARANTINE_DIR:
+   damaged and orphaned account files are moved there, index entries
+   without a file are taken out of the index (and written there), and
+   damaged or orphaned store records are taken out of the store (run
+   --migrate to copy the accounts in again from their files). The log is
+   never changed; its damaged records are copied there, and every reader
+   of the log already skips them.
+
+   Run it when no other program is using the database; a store that
+   changed during the check is reported, so it can be run again
+ */
+
+#ifndef FSCK_H
+#define FSCK_H
+
+#define FSCK_CHUNK 65536         // Store records checked as one piece of work
+#define FSCK_NAME_BATCH 256      // Names of the flat folder a thread takes at once
+#define FSCK_SHOW 20             // Problems of each kind that are listed
+
+/* Run --fsck; argv[1] is "--fsck"
+   Returns the exit code of the program (0 if nothing is wrong) */
+int fsck_database(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,104 @@
+/* Functions for asynchronous storage I/O are declared in this file
+
+   An I/O queue (IoQueue) lets a program start many reads, writes and
+   fsyncs at once and collect the results later, instead of waiting for
+   every operation before starting the next one. This matters most for
+   fsync and for reading many small account files: the disk can work on
+   hundreds of them at the same time
+
+   Two backends do the work:
+   - io_uring (Linux 5.6 or newer): operations are handed to the kernel in
+     batches with one system call and no extra threads
+   - A pool of worker threads doing ordinary blocking I/O, used when
+     io_uring is not available (older kernel, or disabled by the system)
+
+   How to use it:
+   1. Fill in an IoRequest for every operation (the caller owns the memory
+      and must keep it, and its buffer, until the callback has run)
+   2. ioq_queue() each request, then ioq_submit() to start the batch
+   3. ioq_poll() or ioq_drain() to collect results; the callback of every
+      finished request runs inside these calls, on the caller's thread
+
+   Nothing is thread-safe: one IoQueue belongs to one thread
+ */
+
+#ifndef IOQ_H
+#define IOQ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Kinds of operation
+typedef enum {
+    IOQ_READ,    // Read len bytes at offset into buf
+    IOQ_WRITE,   // Write len bytes from buf at offset
+    IOQ_FSYNC    // Flush the file to disk
+} IoOp;
+
+// Which backend to use
+typedef enum {
+    IOQ_AUTO,     // io_uring if possible, otherwise threads
+    IOQ_URING,    // io_uring only (ioq_create fails without it)
+    IOQ_THREADS   // Always the thread pool
+} IoBackend;
+
+typedef struct IoRequest IoRequest;
+typedef struct IoQueue IoQueue;
+
+// Called once a request has finished (req->result holds the outcome)
+typedef void (*IoDoneFn)(IoRequest *req);
+
+/* One asynchronous operation
+   - offset: Position in the file, or -1 for the current position
+     (for files opened with O_APPEND this appends to the end)
+   - sync: For IOQ_WRITE, also fsync the file after the write succeeded
+   - result: Bytes read or written (0 for fsync), or -errno on failure
+ */
+struct IoRequest {
+    IoOp op;
+    int fd;
+    void *buf;
+    size_t len;
+    int64_t offset;
+    bool sync;
+    long result;
+    IoDoneFn done;
+    void *ctx;          // For the caller, not used by the queue
+    IoRequest *next;    // Used by the queue
+};
+
+/* Create a queue that keeps up to "depth" requests in flight
+   "threads" is the pool size for the thread backend (0 = default)
+   Returns NULL if the queue could not be created */
+IoQueue *ioq_create(unsigned depth, int threads, IoBackend backend);
+
+// Wait for every request still in flight, then free the queue
+void ioq_destroy(IoQueue *q);
+
+// Name of the backend in use ("io_uring" or "threads")
+const char *ioq_backend_name(const IoQueue *q);
+
+/* Add a request to the next batch. If the queue is full this first waits
+   for some requests to finish (running their callbacks). If the kernel
+   keeps refusing new work, the request's callback runs at once with a
+   negative result */
+void ioq_queue(IoQueue *q, IoRequest *req);
+
+// Start every queued request. Returns the number started
+int ioq_submit(IoQueue *q);
+
+/* Submit the queued requests and wait until at least "min_complete" have
+   finished (0 = just collect what is already done). Returns the number
+   of callbacks that ran */
+int ioq_poll(IoQueue *q, int min_complete);
+
+/* Submit everything and wait until no request is in flight; if the kernel
+   stops taking requests, the ones it never took finish with -ECANCELED
+   (or the error) */
+void ioq_drain(IoQueue *q);
+
+// Number of requests queued or running
+size_t ioq_in_flight(const IoQueue *q);
+
+#endif
@@ -0,0 +1,37 @@
+/* Functions for the account file layout are declared in this file
+   Account files can be stored in two layouts:
+   - Flat: database/<account>.txt (the original layout)
+   - Fan-out: database/ab/cd/<account>.txt, where "ab" and "cd" come from a
+     hash of the account number, so no single directory gets too big
+
+   The fan-out layout is switched on by the FANOUT_MARKER file, which is
+   created by the layout migration (banking_system --migrate-layout)
+ */
+
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Check whether the database uses the fan-out layout
+bool layout_is_fanout(void);
+
+// Build the path of an account file inside "dir" for the given layout
+void layout_path_in(const char *dir, const char *account_num, bool fanout,
+                    char *path, size_t size);
+
+/* Check whether a file name is an account file ("<digits>.txt"); if it
+   is, the account number is copied into account_num */
+bool layout_is_account_file(const char *name, char *account_num, size_t size);
+
+// Build the fan-out path and create its two directory levels if needed
+bool layout_prepare_fanout_path(const char *dir, const char *account_num,
+                                char *path, size_t size);
+
+/* Move every flat account file into the fan-out tree using "threads" workers
+   The program can keep running while this happens
+   Returns the number of files moved, or -1 on error */
+long migrate_to_fanout(int threads);
+
+#endif
@@ -0,0 +1,94 @@
+/* Functions for the single-writer ledger engine are declared in this file
+
+   In ledger mode, balances are changed by exactly one thread, the ledger
+   thread. Any number of front-end threads check requests (account exists,
+   PIN, amount) in parallel and then publish a command into a ring buffer.
+   The ledger thread takes the commands out in order and:
+   1. Applies each one to the hot records of the account store
+   2. Writes the log records of a whole batch with one write
+   3. Publishes the result of every command back to its ticket
+
+   Front-end threads never take a lock: a slot of the ring is claimed with
+   one atomic compare-and-swap. The ledger thread never takes a lock
+   either, so the order in which commands leave the ring is the order in
+   which they are applied and logged (one total order)
+
+   Changed accounts get their text files rewritten every
+   LEDGER_FLUSH_SECS seconds and when the ledger stops
+
+   The ledger owns the store while it runs: ledger_start() waits until no
+   other program is saving an operation and holds the update lock (see
+   store_update_hold()) until ledger_stop(), so the menu, the subcommands,
+   --serve and --reconcile of other programs wait for the whole run
+   instead of saving over balances whose files are not written yet
+ */
+
+#ifndef LEDGER_H
+#define LEDGER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LEDGER_RING_SIZE 65536   // Commands the ring can hold (power of two)
+#define LEDGER_BATCH 4096        // Most commands applied per log write
+#define LEDGER_FLUSH_SECS 1      // How often account files are rewritten
+
+typedef enum {
+    LEDGER_DEPOSIT,
+    LEDGER_WITHDRAW,
+    LEDGER_REMIT
+} LedgerOp;
+
+typedef enum {
+    LEDGER_PENDING = 0,     // Not applied yet
+    LEDGER_OK,
+    LEDGER_NO_ACCOUNT,      // An account is not in the store
+    LEDGER_NO_FUNDS,        // Balance too low for amount + fee
+    LEDGER_LIMIT,           // A transaction limit would be broken
+    LEDGER_LOG_FAILED       // Applied, but the log write failed
+} LedgerResult;
+
+/* Where the ledger thread publishes the result of one command
+   The front-end keeps it alive until ledger_wait() returns */
+typedef struct {
+    uint32_t result;            // A LedgerResult, written last
+    uint64_t txn_id;            // Transaction ID in the log
+    int64_t from_balance_cents; // New balances after the command
+    int64_t to_balance_cents;
+} LedgerTicket;
+
+// Options for ledger_start()
+typedef struct {
+    bool write_log;     // Append every applied command to the transaction log
+    bool write_files;   // Rewrite the text files of changed accounts
+    bool check_limits;  // Apply the transaction limits (see velocity.h)
+} LedgerConfig;
+
+// Counters of a ledger run
+typedef struct {
+    uint64_t applied;        // Commands that changed balances
+    uint64_t rejected;       // Commands refused (no account, no funds, limits)
+    uint64_t batches;        // Log writes
+    double apply_seconds;    // Time spent applying commands only
+    double log_seconds;      // Time spent writing the log
+    double flush_seconds;    // Time spent rewriting account files
+} LedgerStats;
+
+/* Start the ledger thread (opens the account store first)
+   Returns false if it is already running or could not start */
+bool ledger_start(const LedgerConfig *config);
+
+/* Publish a command (thread-safe, lock-free). Waits while the ring is full
+   "ticket" may be NULL if the caller does not need the result */
+void ledger_submit(LedgerOp op, uint32_t from_id, uint32_t to_id,
+                   int64_t amount_cents, int64_t fee_cents, LedgerTicket *ticket);
+
+// Wait until the ledger thread has published the result of a ticket
+LedgerResult ledger_wait(LedgerTicket *ticket);
+
+/* Apply every command still in the ring, write the last batch and the
+   account files, and stop the ledger thread */
+void ledger_stop(LedgerStats *stats);
+
+#endif
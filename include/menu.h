@@ -40,4 +40,7 @@ void display_session_info(int account_count);
  */
 int get_menu_choice(void);
 
+// The menu option (1-6) a line of text asks for, or -1 if none
+int menu_choice_from_text(const char *input);
+
 #endif // MENU_H
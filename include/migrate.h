@@ -0,0 +1,17 @@
+/* Functions for migrating the text database into the compact store are
+   declared in this file
+
+   The migration walks INDEX_FILE, reads the account files with a pool of
+   worker threads and writes every account into the compact store
+   (accounts.hot / accounts.cold). Progress is saved to MIGRATE_CHECKPOINT
+   after every chunk, so an interrupted migration continues where it stopped
+ */
+
+#ifndef MIGRATE_H
+#define MIGRATE_H
+
+/* Migrate every account listed in the index into the compact store
+   Returns 0 if the migration finished and the verification passed */
+int migrate_to_store(int threads);
+
+#endif
@@ -0,0 +1,40 @@
+/* Functions for reconciling the ledger with the balances are declared in
+   this file
+
+   Money can only enter or leave the bank through the log: deposits,
+   withdrawals, remittance fees and closed accounts. So at any moment
+
+     sum of all balances = deposits - withdrawals - fees + fees booked
+                           - balances of closed accounts
+
+   The reconciliation job checks this, in total and per account type,
+   without stopping anyone:
+   - The snapshot is taken at a moment when no operation has saved its
+     accounts without logging them yet (store_update_hold(), held only
+     long enough to note the last transaction and copy the hot records).
+     The log is read up to that transaction and the store from the copy,
+     so operations that run meanwhile never show up as drift; the copy
+     takes sizeof(AccountHot) bytes of memory per account
+   - The log segments and the copy are cut into pieces and summed by
+     several threads at once
+
+   Fees: a remittance fee leaves the sender's account and used to go
+   nowhere. The job books every fee collected since the last run into the
+   fee income account (FEE_INCOME_ACCOUNT, created when first needed)
+   with one TXOP_FEE_INCOME log record, but only after a scan without
+   drift. Nobody can log into that account.
+   Fees refunded by reversals (TXOP_REVERSAL) count as negative fees, so
+   a refund of a fee that was already booked is taken back out of it
+ */
+
+#ifndef RECONCILE_H
+#define RECONCILE_H
+
+#define RECONCILE_CHUNK 65536      // Store records summed as one piece of work
+
+/* Reconcile the log with the account store using "threads" threads,
+   print a report and book the new fees
+   Returns 0 if everything agrees, 1 if drift was found or the job could not run */
+int reconcile_ledger(int threads);
+
+#endif
@@ -0,0 +1,17 @@
+/* Functions for replaying the transaction log are declared in this file
+
+   The replay engine reads every entry of the transaction log, rebuilds the
+   balance of every account starting from zero, and compares the result
+   with the balances in the account store. An audit can then confirm that
+   the ledger and the balances agree, or see exactly which entries do not
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+/* Replay the transaction log with "threads" worker threads and print a
+   report of every account whose balance differs from the store
+   Returns 0 if the ledger and the store agree, 1 otherwise */
+int replay_ledger(int threads);
+
+#endif
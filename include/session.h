@@ -0,0 +1,104 @@
+/* Functions for the dialogues (create, delete, deposit, withdraw, remit)
+   and the session server are declared in this file
+
+   Every dialogue is a state machine: a Session remembers which question
+   it asked last (its step) and what has been answered so far, and each
+   line the person types moves it on by one step. Nothing ever waits for
+   input inside a dialogue, so the same code serves:
+   - the menu: session_run_console() reads the lines from stdin, and
+     create_account(), deposit() ... are just that
+   - --serve: one program, one thread, thousands of people at once. Each
+     connection on a local socket gets its own Session and the menu, and
+     poll() says whose line has arrived
+
+   The prompts and messages are the ones the menu always showed; they are
+   written with print_message() (see utils.h), into the connection's
+   buffer under --serve
+
+   A Session is a few hundred bytes; a connection of --serve adds its
+   input and output buffers (SESSION_LINE_MAX and SESSION_OUTPUT_MAX)
+ */
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "types.h"
+#include <stddef.h>
+
+#define SESSION_LINE_MAX 256      // Longest line read (the rest is ignored)
+#define SESSION_OUTPUT_MAX 4096   // Output of one step under --serve
+#define SESSION_MAX_CLIENTS 4096  // Connections --serve handles at the same time
+
+typedef enum {
+    FLOW_CREATE,
+    FLOW_DELETE,
+    FLOW_DEPOSIT,
+    FLOW_WITHDRAW,
+    FLOW_REMIT,
+    FLOW_MENU          // The main menu (--serve only), which starts the others
+} SessionFlow;
+
+typedef struct {
+    SessionFlow flow;       // The dialogue being run
+    int step;               // 0 before it starts, then the question it waits for
+    bool done;              // The dialogue has ended
+    bool more_output;       // It has more to print (call session_continue())
+    bool in_menu;           // Go back to the menu when a dialogue ends
+    bool closed;            // The person chose Exit (or their input ended)
+
+    // What the dialogue has been told so far
+    char account_num[20];
+    char pin[PIN_LEN + 1];
+    char other_num[20];     // Receiver of a remittance
+    char id_last4[5];
+    long list_offset;       // Delete: next byte of INDEX_FILE to list
+    int listed;             // Delete: account numbers listed so far
+    Account acc;            // The account being served (or created)
+    Account other;          // The receiver of a remittance
+} Session;
+
+/* ---------- Running a dialogue ---------- */
+
+// Start a dialogue: show its title and first question
+void session_begin(Session *s, SessionFlow flow);
+
+// Give the dialogue the next line typed (without the newline); NULL if input ended
+void session_input(Session *s, const char *line);
+
+// Print more after the output so far was sent (when s->more_output is set)
+void session_continue(Session *s);
+
+// Run a dialogue with the keyboard and screen, until it ends
+void session_run_console(SessionFlow flow);
+
+/* Serve the menu to every connection on a local socket (NULL for
+   SESSION_SOCKET) until Ctrl+C or SIGTERM
+   Returns the exit code of the program */
+int run_session_server(const char *socket_path);
+
+/* ---------- For the dialogues ----------
+   A step function handles one line: step 0 prints the title and the
+   first question. The step functions are next to the code they use:
+   create and delete in account.c, the others in transaction.c */
+
+void create_account_step(Session *s, const char *line);
+void delete_account_step(Session *s, const char *line);
+void deposit_step(Session *s, const char *line);
+void withdraw_step(Session *s, const char *line);
+void remittance_step(Session *s, const char *line);
+
+// Ask the next question
+void session_prompt(Session *s, int step, const char *prompt);
+
+// The dialogue has ended
+void session_end(Session *s);
+
+/* Read a text answer into field (cut to fit, like get_string_input())
+   Returns: false if the input ended or the answer is empty (with a message) */
+bool session_text(const char *line, char *field, size_t size);
+
+/* Read a number answer (like get_double_input())
+   Returns: false if the input ended or it is not a number (with a message) */
+bool session_number(const char *line, double *value);
+
+#endif
@@ -0,0 +1,55 @@
+/* Functions for sharing the accounts between several running programs are
+   declared in this file
+
+   Every teller runs their own banking_system on the same database folder.
+   The balances themselves are already shared: the account store
+   (accounts.hot) is mapped into every program with MAP_SHARED, so all of
+   them read the same memory. What was missing is taking turns: two
+   deposits to one account could both read RM100, both add RM10 and both
+   save RM110, and one deposit was lost
+
+   Shared mode (turned on with --shared on, which creates SHARED_MARKER)
+   adds SHARED_STRIPES locks that all programs use. They live in the
+   memory-mapped file SHARED_LOCKS_FILE as process-shared pthread mutexes;
+   an account uses lock number hash(account) % SHARED_STRIPES. Every
+   operation takes the locks of its accounts, reads the balances again,
+   checks them, saves and logs, and only then lets go
+
+   The mutexes are "robust": if a program dies while it holds one, the
+   next program that asks for it gets it (instead of waiting forever) and
+   is told so. The accounts of that lock may then be saved but not logged;
+   --reconcile shows any such difference
+
+   Without shared mode the functions below do nothing
+ */
+
+#ifndef SHARED_H
+#define SHARED_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SHARED_STRIPES 1024   // Locks shared by all accounts
+
+// The locks one operation holds (always taken in increasing order)
+typedef struct {
+    uint16_t stripes[SHARED_STRIPES];
+    size_t count;
+} SharedHold;
+
+// true if shared mode is on
+bool shared_mode(void);
+
+/* --shared on|off: turn shared mode on or off
+   Returns the exit code of the program */
+int shared_command(const char *setting);
+
+/* Take the locks of some accounts (0 and repeated IDs are skipped)
+   Waits until no other program holds any of them */
+void shared_lock_accounts(SharedHold *hold, const uint32_t *ids, size_t count);
+
+// Let go of the locks taken by shared_lock_accounts()
+void shared_unlock_accounts(SharedHold *hold);
+
+#endif
@@ -0,0 +1,57 @@
+/* Functions for standing orders (recurring remittances) are declared in
+   this file
+
+   A standing order is a remittance that repeats: every day, every week or
+   every month (rent, payroll, ...). The orders are kept in STANDING_FILE,
+   one line per order, so they survive restarts
+
+   How orders are run:
+   1. Every order is put into a hierarchical timer wheel by its due time
+   2. The wheel is moved forward one minute at a time; the orders found in
+      a slot are all due in that minute and form one group
+   3. A group is run as one batch: every account is loaded once, all the
+      remittances are applied in memory with the normal fee rules, the
+      changed accounts are saved together and the log records are written
+      with one write
+   4. The order's next due time is saved BEFORE its group runs, so after a
+      crash an order is never paid twice (at worst one payment is missed,
+      and the log shows which)
+ */
+
+#ifndef STANDING_H
+#define STANDING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    REPEAT_DAILY,
+    REPEAT_WEEKLY,
+    REPEAT_MONTHLY
+} Recurrence;
+
+typedef struct StandingOrder {
+    uint32_t id;
+    uint32_t from_id;
+    uint32_t to_id;
+    int64_t amount_cents;
+    Recurrence repeat;
+    int day;               // Day of the month for monthly orders
+    int64_t next_due;      // Seconds since 1970
+    bool active;
+
+    // Used by the timer wheel
+    uint64_t due_tick;
+    struct StandingOrder *next;
+} StandingOrder;
+
+/* Handle "--standing <command> ..." from the command line
+   Commands: add, list, cancel, run, daemon (see README)
+   Returns the exit code of the program */
+int standing_command(int argc, char *argv[]);
+
+/* Run every order that is due at or before "now"
+   Returns the number of payments made, or -1 if the schedule could not be read */
+long standing_run_due(int64_t now);
+
+#endif
@@ -0,0 +1,96 @@
+/* Functions for the compact account store are declared in this file
+   The store keeps every account in two fixed-width files:
+   - HOT_STORE_FILE: dense array of AccountHot records (32 bytes each)
+   - COLD_STORE_FILE: AccountCold records (name and ID) at the same position
+   plus STORE_INDEX_FILE, a hash index from account id to record position
+
+   The text files in DATABASE_DIR are still written for every account,
+   so the store is a fast copy of the same data for scans and lookups.
+   Every record carries a CRC32C of its fields (checked by --fsck)
+ */
+
+#ifndef STORE_H
+#define STORE_H
+
+#include <stddef.h>
+#include "types.h"
+
+// Open (or create) the store files; called automatically by the other functions
+bool store_open(void);
+
+// Flush and close the store files
+void store_close(void);
+
+// Close the store files without waiting for the disk (the kernel still writes them)
+void store_detach(void);
+
+// Insert or update an account (both halves); the version increases by one
+bool store_put(const Account *acc);
+
+// Remove an account from the store
+bool store_remove(const char *account_num);
+
+/* Remove the records at these positions (highest first), even if they
+   are damaged, and rebuild the index */
+bool store_drop_records(const size_t *positions, size_t count);
+
+// Position of an account in the store, as the index says (-1 if not there)
+long store_position(uint32_t account_id);
+
+// Get the hot part of an account by its numeric id
+bool store_get_hot(uint32_t account_id, AccountHot *hot);
+
+// Get the cold part (name and ID) of an account by its numeric id
+bool store_get_cold(uint32_t account_id, AccountCold *cold);
+
+// Read "count" cold records in store order, starting at position "first"
+bool store_read_cold(size_t first, size_t count, AccountCold *out);
+
+/* Pointer to the hot record of an account, for updating it in place
+   Only for a single writer (the ledger thread, which holds the update
+   lock with store_update_hold() while it runs); the pointer is valid
+   until the next store_put() or store_remove(). Returns NULL if not found */
+AccountHot *store_hot_ref(uint32_t account_id);
+
+/* Set the checksum of a hot record; call after changing it in place
+   (store_put() does this itself) */
+void store_seal_hot(AccountHot *hot);
+
+// Check the checksum of a hot or a cold record
+bool store_hot_valid(const AccountHot *hot);
+bool store_cold_valid(const AccountCold *cold);
+
+/* Update windows (see store.c)
+   store_update_begin(): call before saving the accounts of an operation,
+   and store_update_end() after its log record is written.
+   store_update_hold(): wait until no operation is between the two and
+   keep new ones from starting, until store_update_end()
+   The handles are -1 if the lock file could not be used */
+int store_update_begin(void);
+int store_update_hold(void);
+void store_update_end(int handle);
+
+// Write changed hot records to disk (wait = true to wait until they are)
+bool store_sync(bool wait);
+
+/* Number of accounts in the store (a scan calls store_hot_records()
+   first: the count never goes past the records that call mapped) */
+size_t store_count(void);
+
+/* Counter that changes whenever any program puts or removes an account
+   (the same value before and after a scan means nothing changed during it) */
+uint32_t store_changes(void);
+
+// Increase that counter after changing hot records in place (store_hot_ref())
+void store_note_change(void);
+
+// Dense array of all hot records (store_count() entries) for fast scans
+const AccountHot *store_hot_records(void);
+
+// Hash a PIN for the hot record (salted with the account id)
+uint32_t store_pin_hash(uint32_t account_id, const char *pin);
+
+// Print the number of accounts and total balance per account type
+void store_print_report(void);
+
+#endif
@@ -0,0 +1,59 @@
+/* Functions for tracing where the time of an operation goes are declared in this file
+
+   Start the program with the environment variable BANK_TRACE set to a
+   file name, exp.
+     BANK_TRACE=trace.json ./banking_system --batch payments.txt
+   and every operation (a request: one menu operation, one subcommand,
+   one line of a batch, one bulk payment, one group of standing orders)
+   records when it started and ended, and so does every authenticate(),
+   load_account(), save_account(), commit_accounts(), load_accounts(),
+   save_accounts() and log write inside it (in ledger mode also the
+   ledger thread applying it, and the wait for its result). When the
+   program ends the spans are written to the file in the Chrome
+   trace-event format: open it in https://ui.perfetto.dev or
+   chrome://tracing to see every thread on a timeline. Each span shows
+   the number of the request it belongs to ("%p" in the file name is
+   replaced by the process ID, for several programs at once).
+
+   Every thread records into its own buffer, so threads never wait for
+   each other. Without BANK_TRACE a span costs one test of trace_enabled
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// true if BANK_TRACE was set when trace_start() ran
+extern bool trace_enabled;
+
+// Read BANK_TRACE; the file is written when the program exits
+void trace_start(void);
+
+// Write the file now (trace_start() arranges for this to happen at exit)
+void trace_flush(void);
+
+/* Record the start ('B') or end ('E') of a span of this thread, for the
+   request this thread is working on, or for another request */
+void trace_event(const char *name, char phase);
+void trace_event_for(const char *name, char phase, uint64_t request);
+
+/* Start a new request on this thread (the spans after it belong to it)
+   and end it again */
+void trace_request_begin(const char *name);
+void trace_request_end(const char *name);
+
+// The request this thread is working on (0 if none)
+uint64_t trace_request(void);
+
+// Name this thread on the timeline (exp. "ledger")
+void trace_thread_name(const char *name);
+
+// The names must be string constants: only the pointer is kept
+#define TRACE_BEGIN(name) do { if (trace_enabled) trace_event((name), 'B'); } while (0)
+#define TRACE_END(name) do { if (trace_enabled) trace_event((name), 'E'); } while (0)
+#define TRACE_REQUEST_BEGIN(name) do { if (trace_enabled) trace_request_begin(name); } while (0)
+#define TRACE_REQUEST_END(name) do { if (trace_enabled) trace_request_end(name); } while (0)
+
+#endif
@@ -5,6 +5,8 @@
 #ifndef TRANSACTION_H
 #define TRANSACTION_H
 
+#include "types.h"
+
 /* Deposit Function
    Purpose: Add money to a customer's account
    
@@ -43,11 +45,58 @@ void withdraw(void);
    7. Save both accounts
    8. Log the transaction
    
-   Transfer Fees:
+   Transfer Fees (defaults, see fees.h to change them):
    - Savings → Current: 2%
    - Current → Savings: 3%
    - Same type: 1%
  */
 void remittance(void);
 
+/* The same operations without the menu, for callers that already have
+   every input (the command-line subcommands, see cli.h). Nothing is
+   asked and no banner is printed; a check that fails prints its error
+   message, and the status says which kind of problem it was */
+typedef enum {
+    TXN_OK = 0,
+    TXN_AUTH_FAILED,   // No such account, or the wrong PIN
+    TXN_NOT_FOUND,     // The receiver does not exist
+    TXN_INVALID,       // Amount not allowed, or a transfer to the same account
+    TXN_NO_FUNDS,      // Not enough money (amount + fee)
+    TXN_LIMIT,         // Over a velocity limit (see velocity.h)
+    TXN_FAILED,        // The accounts could not be saved
+    TXN_NOT_LOGGED     // The accounts were saved, but the log record could not be written
+} TxnStatus;
+
+// What a successful operation did
+typedef struct {
+    uint64_t txn_id;            // ID of its log record
+    double fee;                 // Remittance fee (0 for the others)
+    double balance;             // New balance (of the sender, for a remittance)
+    double receiver_balance;    // New balance of the receiver of a remittance
+} TxnResult;
+
+// Load an account if the PIN is right (TXN_OK or TXN_AUTH_FAILED)
+TxnStatus load_authenticated(const char *account_num, const char *pin, Account *acc);
+
+TxnStatus deposit_amount(const char *account_num, const char *pin, double amount, TxnResult *out);
+TxnStatus withdraw_amount(const char *account_num, const char *pin, double amount, TxnResult *out);
+TxnStatus remit_amount(const char *sender_num, const char *pin, const char *receiver_num,
+                       double amount, TxnResult *out);
+
+/* Every operation above shows its transaction ID (the ID of its log
+   record). An operator can look a transaction up by that ID, or reverse
+   it: money goes back to where it came from, and a remittance fee is
+   refunded. A transaction can only be reversed once (REVERSAL_INDEX keeps
+   one bit per transaction ID), and a reversal itself cannot be reversed
+ */
+
+/* Print one transaction
+   Returns 0 if it was found, 1 if not */
+int show_transaction(uint64_t txn_id);
+
+/* Reverse a deposit, withdrawal or remittance
+   Returns 0 on success, 1 if it was refused (not found, already reversed,
+   not enough money left in the account that has to give it back) */
+int reverse_transaction(uint64_t txn_id);
+
 #endif 
@@ -0,0 +1,166 @@
+/* Functions for the binary transaction log are declared in this file
+
+   Every operation is written as one fixed-width 64-byte record (TxRecord)
+   with a CRC32C checksum. Because every record has the same size, a log
+   file can be memory mapped and scanned like an array
+
+   The log is split into segments inside TXLOG_DIR:
+   - active.bin: the segment new records are appended to
+   - seg-<first transaction ID>.bin: closed segments, each ending with a
+     TxFooter (time range, transaction ID range and record count)
+   - catalog.txt: one line per closed segment, so a time-range query only
+     opens the segments it needs
+   The active segment is closed when it reaches TXLOG_SEGMENT_BYTES or
+   when its first record is more than TXLOG_SEGMENT_SECS old. Closed
+   segments are gzip-compressed in the background if TXLOG_COMPRESS_MARKER
+   exists
+
+   The logcat program turns the binary log back into the text format
+   ("[2024-01-31 10:00:00] Deposit: Account 12345678, Amount: RM10.00")
+ */
+
+#ifndef TXLOG_H
+#define TXLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Kinds of operation that are recorded in the log
+typedef enum {
+    TXOP_CREATE = 1,     // Account opened (to_id)
+    TXOP_DELETE = 2,     // Account closed (from_id), amount = balance it still held
+    TXOP_DEPOSIT = 3,    // Money in (to_id)
+    TXOP_WITHDRAW = 4,   // Money out (from_id)
+    TXOP_REMIT = 5,      // Transfer from_id → to_id, sender also pays fee
+    TXOP_SESSION_END = 6, // User exited the system
+    TXOP_FEE_INCOME = 7, // Fees booked into the fee income account (to_id);
+                         // ref_id = last transaction whose fees are included
+    TXOP_REVERSAL = 8    // Undo of transaction ref_id: amount leaves from_id,
+                         // amount + fee (a refunded fee) goes to to_id
+                         // (0 = from or to outside the bank)
+} TxOp;
+
+// Outcome of the operation
+typedef enum {
+    TXSTATUS_OK = 0,
+    TXSTATUS_FAILED = 1
+} TxStatus;
+
+/* One log record (exactly 64 bytes)
+   - magic: TXLOG_MAGIC, marks the start of a valid record
+   - txn_id: Transaction ID, increases by one for every record
+   - timestamp: Seconds since 1970 (time(NULL))
+   - from_id / to_id: Account numbers (0 when not used)
+   - amount_cents / fee_cents: Money in whole cents
+   - ref_id: ID of another transaction this one refers to (0 if none)
+   - order_id: Standing order that made this transaction (0 if none)
+   - checksum: CRC32C of the first 60 bytes
+ */
+typedef struct {
+    uint32_t magic;
+    uint8_t op;
+    uint8_t status;
+    uint16_t reserved;
+    uint64_t txn_id;
+    int64_t timestamp;
+    uint32_t from_id;
+    uint32_t to_id;
+    int64_t amount_cents;
+    int64_t fee_cents;
+    uint64_t ref_id;
+    uint32_t order_id;
+    uint32_t checksum;
+} TxRecord;
+
+#define TXLOG_MAGIC 0x31525854u   /* "TXR1" */
+
+/* Footer written at the end of a closed segment (64 bytes, like a record) */
+typedef struct {
+    uint32_t magic;
+    uint32_t reserved;
+    int64_t first_ts;
+    int64_t last_ts;
+    uint64_t first_id;
+    uint64_t last_id;
+    uint64_t count;
+    uint64_t reserved2;
+    uint32_t reserved3;
+    uint32_t checksum;
+} TxFooter;
+
+#define TXLOG_FOOTER_MAGIC 0x31465854u   /* "TXF1" */
+
+// Description of one segment (from the catalog, or read from the active one)
+typedef struct {
+    char path[128];
+    int64_t first_ts;
+    int64_t last_ts;
+    uint64_t first_id;
+    uint64_t last_id;
+    uint64_t count;
+    bool active;
+} TxSegment;
+
+// A read-only view of the records of one segment
+typedef struct {
+    const TxRecord *records;
+    size_t count;
+    size_t map_size;
+    bool owned;        // true if records were decompressed into memory
+} TxLogView;
+
+// Called for every record of a query; return false to stop early
+typedef bool (*TxVisitFn)(const TxRecord *rec, void *ctx);
+
+/* Append a record to the log; the transaction ID is filled in
+   Returns the new transaction ID, or 0 if the record could not be written */
+uint64_t txlog_append(TxOp op, uint32_t from_id, uint32_t to_id,
+                      int64_t amount_cents, int64_t fee_cents, TxStatus status);
+
+/* Append many records with one write; the caller fills in op, status,
+   accounts and amounts, and the magic, IDs, time and checksums are added.
+   Returns the transaction ID of the first record, or 0 on failure */
+uint64_t txlog_append_batch(TxRecord *recs, size_t count);
+
+/* List every segment, oldest first (closed ones from the catalog, then the
+   active one). The caller frees the array. Returns the number of segments */
+size_t txlog_segments(TxSegment **segments);
+
+// Map one segment for scanning (compressed segments are unpacked into memory)
+bool txlog_map_segment(const TxSegment *segment, TxLogView *view);
+
+// Release a view created by txlog_map_segment()
+void txlog_unmap(TxLogView *view);
+
+/* Visit every valid record with from_ts <= timestamp <= to_ts, opening only
+   the segments whose time range overlaps. Returns the number of records
+   visited, or -1 if the log could not be read */
+long txlog_query(int64_t from_ts, int64_t to_ts, TxVisitFn fn, void *ctx);
+
+/* Visit every valid record with txn_id > after_id and timestamp <= to_ts,
+   opening only the segments that can hold one. Returns the number of
+   records visited, or -1 if the log could not be read */
+long txlog_query_after(uint64_t after_id, int64_t to_ts, TxVisitFn fn, void *ctx);
+
+/* Read the record of one transaction
+   Transaction IDs have no gaps inside a segment and every record has the
+   same size, so the catalog's first IDs are the index: the record sits at
+   (txn_id - first ID) * 64 bytes into its segment
+   Returns false if there is no valid record with that ID */
+bool txlog_find(uint64_t txn_id, TxRecord *out);
+
+// Check the magic number and checksum of a record
+bool txlog_record_valid(const TxRecord *rec);
+
+// Fill in the checksum of a record
+void txlog_seal(TxRecord *rec);
+
+/* Write a record in the text log format, without the timestamp
+   (exp. "Deposit: Account 12345678, Amount: RM10.00") */
+void txlog_describe(const TxRecord *rec, char *buf, size_t size);
+
+// Write the "[YYYY-MM-DD HH:MM:SS]" timestamp of a record
+void txlog_format_time(const TxRecord *rec, char *buf, size_t size);
+
+#endif
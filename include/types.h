@@ -5,13 +5,14 @@
    Contents:
    1. Constants - Maximum values and limits
    2. Enums - Types of accounts
-   3. Structs - Account data structure
+   3. Structs - Account data structure (and its hot/cold halves)
  */
 
 #ifndef TYPES_H
 #define TYPES_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 
 //CONSTANTS - system limits and configuration
@@ -22,11 +23,49 @@
 #define MAX_ACCOUNTS 1000        
 #define DATABASE_DIR "database"   
 #define INDEX_FILE "database/accounts_index.txt"  
-#define TRANSACTION_LOG "database/transaction.log" 
+#define TRANSACTION_LOG "database/transaction.log"  /* Old text log (read by --replay) */
+#define TXLOG_FILE "database/transaction.bin"        /* Single-file log (moved into TXLOG_DIR) */
+#define TXLOG_DIR "database/txlog"                  
+#define TXLOG_ACTIVE "database/txlog/active.bin"    
+#define TXLOG_CATALOG "database/txlog/catalog.txt"  
+#define TXLOG_LOCK "database/txlog/.lock"           
+#define TXLOG_COMPRESS_MARKER "database/txlog/.compress"  
+#define TXLOG_SEGMENT_BYTES (64L * 1024 * 1024)     
+#define TXLOG_SEGMENT_SECS 86400                    
 #define MIN_ACCOUNT_NUM 1000000   
 #define MAX_ACCOUNT_NUM 999999999 
 #define MAX_DEPOSIT 50000.0       
 #define MIN_AMOUNT 0.01       
+#define VELOCITY_FILE "database/velocity.dat"   
+#define VELOCITY_LOCK "database/velocity.lock"   // Per-account locks of velocity_init_for()
+#define LIMITS_CONFIG "database/limits.cfg"     
+#define FEES_CONFIG "database/fees.cfg"
+#define VELOCITY_CHECKPOINT_OPS 64              
+#define VELOCITY_CHECKPOINT_SECS 60             
+#define HOT_STORE_FILE "database/accounts.hot"     
+#define COLD_STORE_FILE "database/accounts.cold"   
+#define STORE_INDEX_FILE "database/accounts.hix"   
+#define STORE_UPDATE_LOCK "database/accounts.lock"
+#define FANOUT_MARKER "database/.fanout"           
+#define MIGRATE_CHECKPOINT "database/migrate.ckpt"  
+#define MIGRATE_WRITTEN "database/migrate.written"   // Accounts the migration wrote
+#define STANDING_FILE "database/standing_orders.txt"
+#define FOLLOW_SOCKET "database/follower.sock"
+#define SESSION_SOCKET "database/sessions.sock"
+#define BULK_JOURNAL "database/bulk.journal"
+#define BULK_LOCK "database/bulk.lock"
+#define RECONCILE_LOCK "database/reconcile.lock"
+#define SHARED_MARKER "database/.shared"            // Shared mode is on (see shared.h)
+#define SHARED_LOCKS_FILE "database/accounts.mutex"
+#define RECORD_LOCK_FILE "database/accounts.rlk"   // Byte-range locks, one byte per account number
+#define INTENT_DIR "database/intents"              // Commits of several accounts that are under way
+#define COMMIT_ATTEMPTS 16                           // Tries before a conflicting update gives up
+#define REVERSAL_INDEX "database/reversed.idx"   // One bit per transaction ID (see transaction.h)
+#define SNAPSHOT_DIR "database/snapshots"   // Balance snapshots for --balance-at
+#define QUARANTINE_DIR "database/quarantine"   // Damaged and orphaned records (see fsck.h)
+#define FEE_INCOME_ACCOUNT "1000000"   // Remittance fees are booked here (see reconcile.h)
+#define TRACE_ENV "BANK_TRACE"         // Environment variable naming the trace file (see trace.h)
+#define TRACE_BUFFER_EVENTS 16384       // Events in one block of a thread's trace buffer
 
 /* Account types enum
    Defines the two types of bank accounts:
@@ -38,6 +77,9 @@ typedef enum {
     CURRENT   
 } AccountType;
 
+// Number of account types (used to size tables indexed by AccountType)
+#define ACCOUNT_TYPE_COUNT 2
+
 /* 
    Account Structure
    All of a bank account's data is stored in this structure:
@@ -55,6 +97,42 @@ typedef struct {
     AccountType type;            
     char pin[PIN_LEN + 1];       
     double balance;         
+    uint32_t version;          // Saves of this account so far (see commit_accounts())
 } Account;
 
-#endif 
+/*
+   Hot part of an account (exactly 32 bytes)
+   The fields that reports, interest runs and reconciliation need for every
+   account. These records are kept together in one dense array, so a scan
+   over all balances only reads 32 bytes per account:
+   - account_id: The account number as a number (12345678)
+   - type: SAVINGS or CURRENT
+   - balance_cents: Balance in whole cents (RM12.34 is stored as 1234)
+   - pin_hash: Hash of the PIN (the PIN itself is never stored here)
+   - version: Increases by one every time the account is saved
+   - checksum: CRC32C of the fields before it (see store_seal_hot())
+ */
+typedef struct {
+    uint32_t account_id;
+    uint32_t type;
+    int64_t balance_cents;
+    uint32_t pin_hash;
+    uint32_t version;
+    uint32_t checksum;
+    uint32_t reserved;
+} AccountHot;
+
+/*
+   Cold part of an account (128 bytes)
+   Customer details that are only needed when showing or checking them,
+   stored in a separate file at the same position as the hot record
+   (checksum: CRC32C of the fields before it)
+ */
+typedef struct {
+    uint32_t account_id;
+    char name[MAX_NAME_LEN];
+    char id_number[MAX_ID_LEN];
+    uint32_t checksum;
+} AccountCold;
+
+#endif
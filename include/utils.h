@@ -2,17 +2,39 @@
    The system-wide utility and helper functions are declared in this file
    
    Categories:
-   1. Input Functions - Safe user input handling
-   2. Validation Functions - Validation of Data
-   3. File System Functions - Management of directories
-   4. Logging Functions - Transaction logging
+   1. Output Functions - Prompts and messages (to stdout or a session)
+   2. Input Functions - Safe user input handling
+   3. Validation Functions - Validation of Data
+   4. File System Functions - Management of directories
    5. Conversion Functions - Conversions of Data Types
+   
+   (Transaction logging is in txlog.h)
  */
 
 #ifndef UTILS_H
 #define UTILS_H
 
 #include "types.h"
+#include <stddef.h>
+
+ // Output Functions
+
+/* Where print_message() writes: a session's buffer (see session.h), so one
+   program can talk to many people at once */
+typedef struct {
+    char *text;
+    size_t size;
+    size_t length;
+} MessageBuffer;
+
+// Send this thread's messages to "buffer" (NULL: back to stdout)
+void set_message_buffer(MessageBuffer *buffer);
+
+// printf() to stdout, or to the message buffer that was set
+void print_message(const char *format, ...);
+
+// Bytes that still fit into the message buffer (SIZE_MAX for stdout)
+size_t message_room(void);
 
  // Input Handling Functions
 
@@ -47,11 +69,6 @@ bool is_valid_id(const char *id);
 // Create the database directory if it doesn't already exist
 void create_database_dir(void);
 
- // Logging Functions
-
-// In the log file, record details about a transaction or system event
-void log_transaction(const char *action);
-
  // Conversion Functions
 
 // Convert theAccountType enum to string ("Savings" or "Current")
@@ -60,4 +77,13 @@ const char* account_type_to_string(AccountType type);
 // Convert string input to the corresponding AccountType enum (SAVINGS or CURRENT)
 AccountType string_to_account_type(const char *str);
 
+// Convert an account number string ("12345678") to a number (0 if it is not valid)
+unsigned int account_id_from_string(const char *account_num);
+
+// Convert a money amount in RM to a whole number of cents (12.34 → 1234)
+long long amount_to_cents(double amount);
+
+// Convert a local time "YYYY-MM-DD[ HH:MM[:SS]]" to seconds since 1970 (false if invalid)
+bool parse_date_time(const char *text, int64_t *out);
+
 #endif 
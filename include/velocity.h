@@ -0,0 +1,65 @@
+/* Functions for the velocity and daily limit engine are declared in this file
+   These functions restrict how much money and how many operations can move
+   through a single account per minute, per hour and per day
+
+   How it works:
+   1. Every account that has been used gets a small counter entry in memory
+   2. Each entry keeps a sliding-window counter for every (operation, window) pair
+   3. deposit(), withdraw() and remittance() ask the engine before moving money
+   4. The counters are written to VELOCITY_FILE every so often (checkpoint)
+      so the limits still hold after the program restarts
+ */
+
+#ifndef VELOCITY_H
+#define VELOCITY_H
+
+#include <stdbool.h>
+#include "types.h"
+
+// Operation types that the limits engine keeps counters for
+typedef enum {
+    VEL_DEPOSIT,
+    VEL_WITHDRAW,
+    VEL_REMIT,
+    VEL_OP_COUNT
+} VelocityOp;
+
+// Time windows that the limits apply to
+typedef enum {
+    VEL_MINUTE,
+    VEL_HOUR,
+    VEL_DAY,
+    VEL_WINDOW_COUNT
+} VelocityWindow;
+
+/* A single limit: at most max_count operations and at most max_cents money
+   inside one window. A value of 0 means "no limit" */
+typedef struct {
+    unsigned int max_count;
+    long long max_cents;
+} VelocityLimit;
+
+// Load the limits configuration and the last checkpoint of the counters
+void velocity_init(void);
+
+/* The same for a program that only moves money for these accounts: only
+   their counters are loaded (a checkpoint always adds what this program
+   counted to the counters in the file, whichever way it started), and
+   they stay locked until velocity_shutdown(), so programs for the same
+   account count one after the other. Call it before locking the accounts */
+void velocity_init_for(const char *const account_nums[], int count);
+
+// Write a final checkpoint of the counters (called when the program exits)
+void velocity_shutdown(void);
+
+// Check whether an operation of amount_cents would break any limit (no disk I/O)
+bool velocity_check(const char *account_num, AccountType type,
+                    VelocityOp op, long long amount_cents);
+
+// Count an operation that has been completed successfully
+void velocity_record(const char *account_num, VelocityOp op, long long amount_cents);
+
+// Get the limit configured for an account type, operation and window
+VelocityLimit velocity_get_limit(AccountType type, VelocityOp op, VelocityWindow window);
+
+#endif
@@ -4,10 +4,29 @@
 
 #include "account.h"
 #include "utils.h"
+#include "store.h"
+#include "layout.h"
+#include "txlog.h"
+#include "ioq.h"
+#include "shared.h"
+#include "trace.h"
+#include "session.h"
+#include "crc32c.h"
 #include <stdio.h>   
 #include <stdlib.h>   
 #include <string.h>  
 #include <time.h>      
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+
+// Largest account file (all fields at their maximum length fit easily)
+#define ACCOUNT_TEXT_MAX 512
+
+// Requests kept in flight by the batch functions
+#define BATCH_DEPTH 256
 
 /* By reading the index file, which contains the list of all account numbers, 
    it determines the total number of bank accounts in the system
@@ -33,10 +52,15 @@ int count_accounts(void) {
     return count;
 }
 
+static int open_account_fd(const char *account_num);
+
 /*
   Verifies whether an account number is already exists
   By doing this, you can avoid duplicate account numbers
   
+  Every account has its own file, so this only tries to open that file
+  instead of reading the whole index (which grows with the bank)
+  
   Parameters:
     account_num - The account number to be verified
   
@@ -44,25 +68,12 @@ int count_accounts(void) {
     true if the account exists, false else
  */
 bool account_exists(const char *account_num) {
-    // Open the index file 
-    FILE *fp = fopen(INDEX_FILE, "r");
-    if (fp == NULL) {
-        return false;  
-    }
-    
-    /* Read each line (each account number) to compare and find a duplicate 
-       true if you find it*/
-    char line[100];
-    while (fgets(line, sizeof(line), fp) != NULL) {
-        line[strcspn(line, "\n")] = 0;  
-        if (strcmp(line, account_num) == 0) { 
-            fclose(fp);
-            return true;
-        }
+    int fd = open_account_fd(account_num);
+    if (fd < 0) {
+        return false;
     }
-    
-    fclose(fp);
-    return false; 
+    close(fd);
+    return true;
 }
 
 /*
@@ -81,7 +92,8 @@ bool account_exists(const char *account_num) {
  */
 char* generate_account_number(void) {
     static char account_num[20];  
-    srand(time(NULL));  
+    // The process ID too, so programs started in the same second differ
+    srand((unsigned int)time(NULL) ^ ((unsigned int)getpid() << 16));  
     
     int attempts = 0;
     do {
@@ -107,11 +119,129 @@ char* generate_account_number(void) {
         if (attempts > 100) {
             return NULL;
         }
-    } while (account_exists(account_num)); 
+    } while (account_exists(account_num) || strcmp(account_num, FEE_INCOME_ACCOUNT) == 0); 
     
     return account_num;  
 }
 
+/*
+  Opens an account file for reading, wherever it is stored
+  
+  In the flat layout the file is database/12345678.txt
+  In the fan-out layout it is database/ab/cd/12345678.txt, but while a
+  layout migration is running the file may still be in the flat folder,
+  so we look in the fan-out tree, then the flat folder, then the fan-out
+  tree again (in case it was moved between the first two looks)
+  
+  Returns:
+    The open file descriptor, or -1 if the account file doesn't exist
+ */
+static int open_account_fd(const char *account_num) {
+    char filename[300];
+    bool fanout = layout_is_fanout();
+    
+    layout_path_in(DATABASE_DIR, account_num, fanout, filename, sizeof(filename));
+    int fd = open(filename, O_RDONLY);
+    if (fd >= 0 || !fanout) {
+        return fd;
+    }
+    
+    layout_path_in(DATABASE_DIR, account_num, false, filename, sizeof(filename));
+    fd = open(filename, O_RDONLY);
+    if (fd >= 0) {
+        return fd;
+    }
+    
+    layout_path_in(DATABASE_DIR, account_num, true, filename, sizeof(filename));
+    return open(filename, O_RDONLY);
+}
+
+/*
+  Reads the fields of an account file (already read into memory)
+  
+  The last line is "Checksum: <CRC32C of everything before it>". Files
+  written before checksums existed have none; they are accepted if they
+  end with a whole line (a cut-off file ends in the middle of one)
+  
+  Parameters:
+    text - The whole file, ending with '\0'
+    acc - A pointer to the account structure to fill with data
+  
+  Returns:
+    true if every field was found and the checksum matches, false else
+ */
+static bool parse_account_text(const char *text, Account *acc) {
+    // STEP 1: Check the checksum (or that an old file is complete)
+    const char *sum_line = strstr(text, "\nChecksum: ");
+    if (sum_line != NULL) {
+        unsigned int stored;
+        size_t covered = (size_t)(sum_line + 1 - text);
+        if (sscanf(sum_line + 1, "Checksum: %8x", &stored) != 1 ||
+            stored != crc32c(0, text, covered)) {
+            return false;
+        }
+    } else {
+        size_t len = strlen(text);
+        if (len == 0 || text[len - 1] != '\n') {
+            return false;
+        }
+    }
+    
+    // STEP 2: Read the fields
+    // %n stores how many characters were used, so each field starts where
+    // the previous one ended
+    char type_str[20];
+    int used = 0;
+    if (sscanf(text, "Account Number: %19s\n%n", acc->account_number, &used) != 1) return false;
+    text += used;
+    if (sscanf(text, "Name: %99[^\n]\n%n", acc->name, &used) != 1) return false;
+    text += used;
+    if (sscanf(text, "ID Number: %19s\n%n", acc->id_number, &used) != 1) return false;
+    text += used;
+    if (sscanf(text, "Account Type: %19s\n%n", type_str, &used) != 1) return false;
+    text += used;
+    if (sscanf(text, "PIN: %4s\n%n", acc->pin, &used) != 1) return false;
+    text += used;
+    if (sscanf(text, "Balance: %lf\n%n", &acc->balance, &used) != 1) return false;
+    text += used;
+    // Files written before versions existed have no version line
+    if (sscanf(text, "Version: %u", &acc->version) != 1) {
+        acc->version = 0;
+    }
+    
+    // Convert the account type string to an enum value
+    acc->type = string_to_account_type(type_str);
+    return true;
+}
+
+/*
+  Writes the fields of an account in the account file format
+  The version written is one more than the version that was loaded,
+  and the checksum line comes last
+  
+  Returns:
+    The length of the text, or -1 if it did not fit in the buffer
+ */
+static int format_account_text(const Account *acc, char *buf, size_t size) {
+    int len = snprintf(buf, size,
+                       "Account Number: %s\n"
+                       "Name: %s\n"
+                       "ID Number: %s\n"
+                       "Account Type: %s\n"
+                       "PIN: %s\n"
+                       "Balance: %.2f\n"
+                       "Version: %u\n",
+                       acc->account_number, acc->name, acc->id_number,
+                       account_type_to_string(acc->type), acc->pin, acc->balance,
+                       acc->version + 1);
+    if (len < 0 || (size_t)len >= size) {
+        return -1;
+    }
+    int sum_len = snprintf(buf + len, size - (size_t)len, "Checksum: %08x\n",
+                           (unsigned int)crc32c(0, buf, (size_t)len));
+    return sum_len < 0 || (size_t)sum_len >= size - (size_t)len ? -1 : len + sum_len;
+}
+
 /*
   Loads data from an account's file into an Account structure
   (Like taking a client's info out of the filing cabinet)
@@ -121,35 +251,142 @@ char* generate_account_number(void) {
     acc - A pointer to the account structure to fill with data
   
   Returns:
-    true if the account loaded successfuly, false else
+    true if the account loaded successfuly, false else (with a warning
+    if the file is there but damaged)
  */
 bool load_account(const char *account_num, Account *acc) {
-    // Build the filename: database/12345678.txt 
-    char filename[100];
-    sprintf(filename, "%s/%s.txt", DATABASE_DIR, account_num);
+    TRACE_BEGIN("load_account");
     
     // Try to open the account file 
-    FILE *fp = fopen(filename, "r");
+    bool ok = false;
+    int fd = open_account_fd(account_num);
+    if (fd >= 0) {
+        // Read the whole file (it is always small) and then every field inside it
+        char text[ACCOUNT_TEXT_MAX];
+        ssize_t len = read(fd, text, sizeof(text) - 1);
+        close(fd);
+        if (len > 0) {
+            text[len] = '\0';
+            ok = parse_account_text(text, acc);
+        }
+        if (!ok) {
+            fprintf(stderr, "Warning: The file of account %s is damaged (see --fsck)\n", account_num);
+        }
+    }
+    
+    TRACE_END("load_account");
+    return ok;
+}
+
+/*
+  Reads an account file by its path (used by --fsck, which also finds
+  files that are not in the index)
+  
+  Parameters:
+    path - The account file
+    acc - Filled with its fields
+    checksummed - Set to true if the file has a checksum line
+  
+  Returns:
+    true if the file could be read and is not damaged, false else
+ */
+bool read_account_file(const char *path, Account *acc, bool *checksummed) {
+    char text[ACCOUNT_TEXT_MAX];
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    ssize_t len = read(fd, text, sizeof(text) - 1);
+    close(fd);
+    if (len <= 0) {
+        return false;
+    }
+    text[len] = '\0';
+    *checksummed = strstr(text, "\nChecksum: ") != NULL;
+    return parse_account_text(text, acc);
+}
+
+/*
+  Puts a newly written file in the place of an account file
+  
+  rename() over an existing file makes ext4 start writing the new file's
+  data out at once (its "replace via rename" heuristic, which never waited
+  for the disk either), and that took from 0.3 to several milliseconds
+  per save. Exchanging the two names with renameat2(RENAME_EXCHANGE) is
+  just as atomic for readers and skips it; the old file then has the
+  temporary name and is removed. rename() is used where the exchange is
+  not available (a new account, an older kernel or another file system)
+  
+  Returns:
+    0 on success, -1 else
+ */
+static int replace_file(const char *temp, const char *path) {
+#if defined(SYS_renameat2) && defined(RENAME_EXCHANGE)
+    if (syscall(SYS_renameat2, AT_FDCWD, temp, AT_FDCWD, path, RENAME_EXCHANGE) == 0) {
+        unlink(temp);
+        return 0;
+    }
+#endif
+    return rename(temp, path);
+}
+
+/* Name a file is written under before it is renamed over "path"; the
+   thread id is in it, so two threads saving one account never share it */
+static void temp_path(const char *path, char *temp, size_t size) {
+    snprintf(temp, size, "%s.%ld.%ld.tmp", path, (long)getpid(), (long)syscall(SYS_gettid));
+}
+
+// The work of save_account() (below), outside its trace span
+static bool write_account_file(const Account *acc) {
+    // Build the filename: database/12345678.txt (or database/ab/cd/12345678.txt)
+    char filename[300];
+    bool fanout = layout_is_fanout();
+    if (fanout) {
+        if (!layout_prepare_fanout_path(DATABASE_DIR, acc->account_number,
+                                        filename, sizeof(filename))) {
+            return false;
+        }
+    } else {
+        layout_path_in(DATABASE_DIR, acc->account_number, false, filename, sizeof(filename));
+    }
+    
+    /* Other programs may read the file at any moment without a lock, so it
+       is written under another name and renamed over the old one: a reader
+       sees either the old or the new account, never half of it */
+    char temp[340];
+    temp_path(filename, temp, sizeof(temp));
+
+    // Open the file for writing
+    FILE *fp = fopen(temp, "w");
     if (fp == NULL) {
-        return false; 
+        return false;  
     }
     
-    // Read every field inside the file 
-    char type_str[20];
-    if (fscanf(fp, "Account Number: %s\n", acc->account_number) != 1 ||
-        fscanf(fp, "Name: %[^\n]\n", acc->name) != 1 ||
-        fscanf(fp, "ID Number: %s\n", acc->id_number) != 1 ||
-        fscanf(fp, "Account Type: %s\n", type_str) != 1 ||
-        fscanf(fp, "PIN: %s\n", acc->pin) != 1 ||
-        fscanf(fp, "Balance: %lf\n", &acc->balance) != 1) {
+    // Write each field to the file in a specific format
+    char text[ACCOUNT_TEXT_MAX];
+    int len = format_account_text(acc, text, sizeof(text));
+    if (len < 0 || fwrite(text, 1, (size_t)len, fp) != (size_t)len) {
         fclose(fp);
-        return false;  
+        remove(temp);
+        return false;
     }
     
-    // Convert the account type string to an enum value
-    acc->type = string_to_account_type(type_str);
-    fclose(fp);
-    return true;  
+    if (fclose(fp) != 0 || replace_file(temp, filename) != 0) {
+        remove(temp);
+        return false;
+    }
+    
+    // In the fan-out layout, an old copy in the flat folder is now out of date
+    if (fanout) {
+        layout_path_in(DATABASE_DIR, acc->account_number, false, filename, sizeof(filename));
+        remove(filename);
+    }
+    
+    // Keep the compact store (hot/cold records) up to date as well
+    if (!store_put(acc)) {
+        fprintf(stderr, "Warning: Could not update the account store\n");
+    }
+    return true; 
 }
 
 /*
@@ -164,289 +401,910 @@ bool load_account(const char *account_num, Account *acc) {
     true if the saving was successful, false else
  */
 bool save_account(const Account *acc) {
-    // Build the filename: database/12345678.txt 
-    char filename[100];
-    sprintf(filename, "%s/%s.txt", DATABASE_DIR, acc->account_number);
+    TRACE_BEGIN("save_account");
+    bool ok = write_account_file(acc);
+    TRACE_END("save_account");
+    return ok;
+}
+
+/* One account file being read or written by a batch function */
+typedef struct {
+    IoRequest req;
+    char text[ACCOUNT_TEXT_MAX];
+    Account *account;   // Where a loaded account goes
+    bool *ok;           // Set to true when the file was read/written
+    char path[300];     // File a save is renamed to
+} AccountIo;
+
+// Called when an account file has been read: parse it
+static void account_read_done(IoRequest *req) {
+    AccountIo *io = req->ctx;
+    close(req->fd);
+    if (req->result > 0) {
+        io->text[req->result] = '\0';
+        *io->ok = parse_account_text(io->text, io->account);
+    }
+}
+
+// Called when an account file has been written (and synced)
+static void account_write_done(IoRequest *req) {
+    AccountIo *io = req->ctx;
+    close(req->fd);
+    *io->ok = req->result == (long)req->len;
+}
+
+// The work of load_accounts() (below), outside its trace span
+static size_t read_account_files(const char *const account_nums[], Account accounts[], bool loaded[],
+                                 size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        loaded[i] = false;
+    }
     
-    // Open the file for writing (creates a new one or overwrites an existing one)
-    FILE *fp = fopen(filename, "w");
-    if (fp == NULL) {
-        return false;  
+    IoQueue *q = ioq_create(BATCH_DEPTH, 0, IOQ_AUTO);
+    AccountIo *slots = malloc(BATCH_DEPTH * sizeof(AccountIo));
+    if (q == NULL || slots == NULL) {
+        // No I/O queue: load them one by one
+        ioq_destroy(q);
+        free(slots);
+        size_t done = 0;
+        for (size_t i = 0; i < count; i++) {
+            loaded[i] = load_account(account_nums[i], &accounts[i]);
+            done += loaded[i];
+        }
+        return done;
     }
     
-    // Write each field to the file in a specific format
-    fprintf(fp, "Account Number: %s\n", acc->account_number);
-    fprintf(fp, "Name: %s\n", acc->name);
-    fprintf(fp, "ID Number: %s\n", acc->id_number);
-    fprintf(fp, "Account Type: %s\n", account_type_to_string(acc->type));
-    fprintf(fp, "PIN: %s\n", acc->pin);
-    fprintf(fp, "Balance: %.2f\n", acc->balance);  
+    // STEP 1: Start the reads, one batch of BATCH_DEPTH files at a time
+    for (size_t start = 0; start < count; start += BATCH_DEPTH) {
+        size_t end = start + BATCH_DEPTH < count ? start + BATCH_DEPTH : count;
+        for (size_t i = start; i < end; i++) {
+            AccountIo *io = &slots[i - start];
+            int fd = open_account_fd(account_nums[i]);
+            if (fd < 0) {
+                continue;
+            }
+            io->account = &accounts[i];
+            io->ok = &loaded[i];
+            io->req.op = IOQ_READ;
+            io->req.fd = fd;
+            io->req.buf = io->text;
+            io->req.len = sizeof(io->text) - 1;
+            io->req.offset = 0;
+            io->req.sync = false;
+            io->req.done = account_read_done;
+            io->req.ctx = io;
+            ioq_queue(q, &io->req);
+        }
+        // STEP 2: Wait for the batch; the callbacks parse every file
+        ioq_drain(q);
+    }
     
-    fclose(fp);
-    return true; 
+    ioq_destroy(q);
+    free(slots);
+    size_t done = 0;
+    for (size_t i = 0; i < count; i++) {
+        done += loaded[i];
+    }
+    return done;
 }
 
 /*
-  Verifies whether the given PIN and the account's PIN match
-  (Like verifying a password)
+  Loads many accounts at once
+  
+  Instead of reading one file, waiting, then reading the next, up to
+  BATCH_DEPTH reads are handed to the I/O queue together, so the disk
+  works on all of them at the same time (see ioq.h)
   
   Parameters:
-    account_num - Account number for authentication
-    pin - PIN to verify
+    account_nums - The account numbers to load
+    accounts - Filled with the loaded accounts
+    loaded - loaded[i] is set to true if accounts[i] was loaded
+    count - How many accounts
   
   Returns:
-    True if the PIN is accurate, false else
+    The number of accounts loaded
  */
-bool authenticate(const char *account_num, const char *pin) {
-    Account acc;
+size_t load_accounts(const char *const account_nums[], Account accounts[], bool loaded[], size_t count) {
+    TRACE_BEGIN("load_accounts");
+    size_t result = read_account_files(account_nums, accounts, loaded, count);
+    TRACE_END("load_accounts");
+    return result;
+}
+
+// The work of save_accounts() (below), outside its trace span
+static size_t write_account_files(Account accounts[], size_t count, bool durable) {
+    IoQueue *q = ioq_create(BATCH_DEPTH, 0, IOQ_AUTO);
+    AccountIo *slots = malloc(BATCH_DEPTH * sizeof(AccountIo));
+    bool *saved = calloc(count > 0 ? count : 1, sizeof(bool));
+    if (q == NULL || slots == NULL || saved == NULL) {
+        ioq_destroy(q);
+        free(slots);
+        free(saved);
+        size_t done = 0;
+        for (size_t i = 0; i < count; i++) {
+            done += save_account(&accounts[i]);
+        }
+        return done;
+    }
     
-    // Load the account from file
-    if (!load_account(account_num, &acc)) {
-        return false;  
+    bool fanout = layout_is_fanout();
+    size_t done = 0;
+    for (size_t start = 0; start < count; start += BATCH_DEPTH) {
+        size_t end = start + BATCH_DEPTH < count ? start + BATCH_DEPTH : count;
+        
+        // STEP 1: Open every file of the batch and start its write
+        for (size_t i = start; i < end; i++) {
+            AccountIo *io = &slots[i - start];
+            char filename[300];
+            if (fanout) {
+                if (!layout_prepare_fanout_path(DATABASE_DIR, accounts[i].account_number,
+                                                filename, sizeof(filename))) {
+                    continue;
+                }
+            } else {
+                layout_path_in(DATABASE_DIR, accounts[i].account_number, false,
+                               filename, sizeof(filename));
+            }
+            int len = format_account_text(&accounts[i], io->text, sizeof(io->text));
+            // Written under another name and renamed in STEP 2, like save_account()
+            char temp[340];
+            snprintf(io->path, sizeof(io->path), "%s", filename);
+            temp_path(filename, temp, sizeof(temp));
+            int fd = len < 0 ? -1 : open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                continue;
+            }
+            io->ok = &saved[i];
+            io->req.op = IOQ_WRITE;
+            io->req.fd = fd;
+            io->req.buf = io->text;
+            io->req.len = (size_t)len;
+            io->req.offset = 0;
+            io->req.sync = durable;
+            io->req.done = account_write_done;
+            io->req.ctx = io;
+            ioq_queue(q, &io->req);
+        }
+        ioq_drain(q);
+        
+        // STEP 2: Same bookkeeping as save_account() for the files written
+        for (size_t i = start; i < end; i++) {
+            if (saved[i]) {
+                char temp[340];
+                const char *path = slots[i - start].path;
+                temp_path(path, temp, sizeof(temp));
+                if (replace_file(temp, path) != 0) {
+                    remove(temp);
+                    saved[i] = false;
+                }
+            }
+            if (!saved[i]) {
+                continue;
+            }
+            if (fanout) {
+                char filename[300];
+                layout_path_in(DATABASE_DIR, accounts[i].account_number, false,
+                               filename, sizeof(filename));
+                remove(filename);
+            }
+            if (!store_put(&accounts[i])) {
+                fprintf(stderr, "Warning: Could not update the account store\n");
+            }
+            // The file now has the next version; so does the copy in memory
+            accounts[i].version++;
+            done++;
+        }
     }
     
-    // Compare the provided PIN with the stored one
-    return strcmp(acc.pin, pin) == 0;  
+    ioq_destroy(q);
+    free(slots);
+    free(saved);
+    return done;
 }
 
 /*
-  This feature guide the user open a new bank account
-  It gathers all required data and verifies every input
+  Saves many accounts at once
   
-  Steps:
-    1. Obtain the customer's full name
-    2. Obtain the customer's ID number
-    3. Select the account type (Savings or Current)
-    4. Set a four-digit PIN
-    5. Generate unique account number
-    6. Save to the database
+  Works like save_account() for every account, but the file writes (and
+  fsyncs) are done in batches through the I/O queue. The version of every
+  account saved is increased, so the same accounts can be saved again
+  
+  Parameters:
+    accounts - The accounts to save
+    count - How many accounts
+    durable - true to fsync every file before returning
+  
+  Returns:
+    The number of accounts saved
  */
-void create_account(void) {
-    Account acc;      
-    char input[100];  
-    
-    printf("\n========================================\n");
-    printf("       CREATE NEW BANK ACCOUNT\n");
-    printf("========================================\n");
-    
-    /*
-       STEP 1: 
-       Ask for the customer's full name and verify it
-     */
-    if (!get_string_input(acc.name, MAX_NAME_LEN, "Enter full name: ")) {
-        printf("Error: Failed to read name.\n");
-        return;
+size_t save_accounts(Account accounts[], size_t count, bool durable) {
+    TRACE_BEGIN("save_accounts");
+    size_t result = write_account_files(accounts, count, durable);
+    TRACE_END("save_accounts");
+    return result;
+}
+
+/*
+  Record locks: one byte of RECORD_LOCK_FILE per account number, locked
+  with fcntl(). The file stays empty; a byte-range lock does not need the
+  bytes to exist. fcntl() locks belong to the program and disappear when
+  it ends (or crashes), and closing any descriptor of the file drops all
+  of them, so the file is opened once and kept open
+ */
+static int record_lock_fd = -1;
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static bool set_record_lock(uint32_t id, short type) {
+    struct flock fl;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = (off_t)id;
+    fl.l_len = 1;
+    return fcntl(record_lock_fd, F_SETLKW, &fl) == 0;
+}
+
+/*
+  Commit intents: a commit of more than one account first writes what it
+  is about to do to INTENT_DIR/<account number>, one name (hard link) for
+  every account of the commit. A file is replaced with a rename, so one
+  account is always saved whole; the intent covers the time between the
+  first and the last file of the commit:
+  
+    INTENT <pid>
+    ACCOUNT <account> <version before> <balance before> <balance after>
+  
+  The names are made and removed while the commit holds the records of
+  its accounts. So whoever holds the record of an account and still finds
+  its intent knows the commit stopped halfway (the program crashed or was
+  killed), and undoes it: every account of the intent that was already
+  written (version before + 1, balance after) gets its old balance back.
+  lock_account_records() does this before anyone changes those accounts,
+  so a half-done commit is never built on. Like the account files, the
+  intent is not fsynced: it covers a program that stops, not the machine.
+  An intent can name any number of accounts (a group of standing orders
+  commits all of its accounts at once)
+ */
+#define INTENT_RECOVERY_TRIES 4
+
+typedef struct {
+    char account_number[20];
+    uint32_t version;          // Version on disk before the commit
+    int64_t before_cents;
+    int64_t after_cents;
+} IntentEntry;
+
+static void intent_path(uint32_t id, char *path, size_t size) {
+    snprintf(path, size, "%s/%u", INTENT_DIR, id);
+}
+
+/* Read the intent that names an account
+   Returns: the number of accounts in it (0 if there is none), in
+   *entries (caller frees), and the program that wrote it in *pid */
+static size_t read_intent(uint32_t id, IntentEntry **entries, long *pid) {
+    char path[64];
+    intent_path(id, path, sizeof(path));
+    *entries = NULL;
+    *pid = -1;
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return 0;
     }
-    
-    // Validate name (checks for special characters, length, etc.)
-    if (!is_valid_name(acc.name)) {
-        return;  
+    char line[128];
+    size_t count = 0, capacity = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        IntentEntry e;
+        long long before, after;
+        if (sscanf(line, "INTENT %ld", pid) == 1) {
+            continue;
+        }
+        if (sscanf(line, "ACCOUNT %19s %u %lld %lld", e.account_number, &e.version,
+                   &before, &after) != 4) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 8;
+            IntentEntry *bigger = realloc(*entries, capacity * sizeof(IntentEntry));
+            if (bigger == NULL) {
+                break;
+            }
+            *entries = bigger;
+        }
+        e.before_cents = before;
+        e.after_cents = after;
+        (*entries)[count++] = e;
+    }
+    fclose(fp);
+    return count;
+}
+
+static void remove_intent(const uint32_t *ids, size_t count) {
+    char path[64];
+    for (size_t i = 0; i < count; i++) {
+        intent_path(ids[i], path, sizeof(path));
+        unlink(path);
     }
+}
+
+/* Write the intent of a commit (the caller holds the records of the accounts)
+   Returns: false if it could not be written (nothing was left behind) */
+static bool write_intent(const uint32_t *ids, const IntentEntry *entries, size_t count) {
+    char path[64], link_path[64];
+    intent_path(ids[0], path, sizeof(path));
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 && mkdir(INTENT_DIR, 0755) == 0) {
+        fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);   // First commit ever
+    }
+    if (fd < 0) {
+        return false;
+    }
+    size_t size = count * 80 + 32;
+    char *text = malloc(size);
+    bool ok = text != NULL;
+    if (ok) {
+        size_t len = (size_t)snprintf(text, size, "INTENT %ld\n", (long)getpid());
+        for (size_t i = 0; i < count; i++) {
+            len += (size_t)snprintf(text + len, size - len, "ACCOUNT %s %u %lld %lld\n",
+                                    entries[i].account_number, entries[i].version,
+                                    (long long)entries[i].before_cents,
+                                    (long long)entries[i].after_cents);
+        }
+        ok = write(fd, text, len) == (ssize_t)len;
+        free(text);
+    }
+    ok = close(fd) == 0 && ok;
     
-    /* STEP 2:
-       Ask for the customer's identification number and verify it
-     */
-    if (!get_string_input(acc.id_number, MAX_ID_LEN, "Enter ID number: ")) {
-        printf("Error: Failed to read ID number.\n");
+    size_t linked = 1;
+    for (; ok && linked < count; linked++) {
+        intent_path(ids[linked], link_path, sizeof(link_path));
+        ok = link(path, link_path) == 0;
+    }
+    if (!ok) {
+        remove_intent(ids, linked);
+    }
+    return ok;
+}
+
+/* Undo the accounts of an intent that were already written
+   Returns: false if an account was changed by someone else since
+   (it is left as it is and reported) */
+static bool roll_back_intent(const IntentEntry *entries, size_t count) {
+    bool ok = true;
+    for (size_t i = 0; i < count; i++) {
+        const IntentEntry *e = &entries[i];
+        Account acc;
+        if (!load_account(e->account_number, &acc) || acc.version == e->version) {
+            continue;   // Not written by the commit (or closed since)
+        }
+        if (acc.version == e->version + 1 && amount_to_cents(acc.balance) == e->after_cents) {
+            acc.balance = e->before_cents / 100.0;
+            if (save_account(&acc)) {
+                continue;
+            }
+        }
+        fprintf(stderr, "Warning: Account %s of an unfinished commit could not be set back "
+                "to RM%.2f\n", e->account_number, e->before_cents / 100.0);
+        ok = false;
+    }
+    return ok;
+}
+
+/* Is there an intent on this account that no live commit of this program owns? */
+static bool has_stale_intent(uint32_t id) {
+    char path[64];
+    intent_path(id, path, sizeof(path));
+    if (access(path, F_OK) != 0) {
+        return false;
+    }
+    IntentEntry *entries;
+    long pid;
+    size_t count = read_intent(id, &entries, &pid);
+    free(entries);
+    return count == 0 || pid != (long)getpid();
+}
+
+/* Undo the unfinished commit whose intent names this account
+   (called without any record held; its own records are taken here) */
+static void recover_intent(uint32_t id) {
+    IntentEntry *entries, *now = NULL;
+    long pid;
+    size_t count = read_intent(id, &entries, &pid);
+    uint32_t *ids = malloc((count + 1) * sizeof(uint32_t));
+    uint32_t *now_ids = NULL;
+    size_t taken = 0;
+    if (ids == NULL) {
+        free(entries);
         return;
     }
     
-    // Validate ID number 
-    if (!is_valid_id(acc.id_number)) {
-        return;  
+    // STEP 1: Lock every account of the intent (and the one it was found on)
+    ids[0] = id;
+    for (size_t i = 0; i < count; i++) {
+        ids[i + 1] = account_id_from_string(entries[i].account_number);
+    }
+    qsort(ids, count + 1, sizeof(uint32_t), compare_u32);
+    while (taken <= count && set_record_lock(ids[taken], F_WRLCK)) {
+        taken++;
     }
     
-    /* STEP 3: 
-       Allow the user to select between a Current and Savings account
-     */
-    printf("Select account type:\n");
-    printf("1. Savings\n");
-    printf("2. Current\n");
-    printf("Enter choice: ");
+    /* STEP 2: Read it again now that nobody can be writing it; if it
+       names an account that is not locked, it is left for the next try */
+    size_t now_count = taken == count + 1 ? read_intent(id, &now, &pid) : 0;
+    now_ids = taken == count + 1 ? malloc((now_count + 1) * sizeof(uint32_t)) : NULL;
+    if (now_ids != NULL) {
+        bool covered = true;
+        now_ids[0] = id;
+        for (size_t i = 0; i < now_count; i++) {
+            now_ids[i + 1] = account_id_from_string(now[i].account_number);
+            covered = covered && bsearch(&now_ids[i + 1], ids, count + 1, sizeof(uint32_t),
+                                         compare_u32) != NULL;
+        }
+        
+        // STEP 3: Undo what was written, then remove every name of the intent
+        if (covered && pid != (long)getpid()) {
+            if (now_count > 0) {
+                roll_back_intent(now, now_count);
+                fprintf(stderr, "Warning: An unfinished commit of program %ld was undone "
+                        "(%zu accounts)\n", pid, now_count);
+            }
+            remove_intent(now_ids, now_count + 1);
+        }
+    }
+    for (size_t i = 0; i < taken; i++) {
+        set_record_lock(ids[i], F_UNLCK);
+    }
+    free(entries);
+    free(now);
+    free(ids);
+    free(now_ids);
+}
+
+/*
+  Locks the records of some accounts (in increasing order, so two
+  programs can never each hold a lock the other one waits for)
+  
+  An account that is still named by the intent of a commit that stopped
+  halfway is put right first (see the commit intents above)
+  
+  Returns:
+    true if every lock was taken, false else (none are held then)
+ */
+bool lock_account_records(const uint32_t *ids, size_t count) {
+    if (record_lock_fd < 0) {
+        record_lock_fd = open(RECORD_LOCK_FILE, O_RDWR | O_CREAT, 0644);
+        if (record_lock_fd < 0) {
+            return false;
+        }
+    }
+    uint32_t *sorted = malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+    if (sorted == NULL) {
+        return false;
+    }
+    memcpy(sorted, ids, count * sizeof(uint32_t));
+    qsort(sorted, count, sizeof(uint32_t), compare_u32);
     
-    if (fgets(input, sizeof(input), stdin) == NULL) {
-        printf("Error: Failed to read account type.\n");
-        return;
+    for (int attempt = 0; attempt < INTENT_RECOVERY_TRIES; attempt++) {
+        size_t taken = 0;
+        for (; taken < count; taken++) {
+            if (!set_record_lock(sorted[taken], F_WRLCK)) {
+                break;
+            }
+        }
+        size_t stale = 0;
+        while (taken == count && stale < count && !has_stale_intent(sorted[stale])) {
+            stale++;
+        }
+        if (taken == count && stale == count) {
+            free(sorted);
+            return true;
+        }
+        unlock_account_records(sorted, taken);
+        if (taken < count) {
+            break;
+        }
+        recover_intent(sorted[stale]);
+    }
+    fprintf(stderr, "Warning: Could not lock the records of %zu accounts\n", count);
+    free(sorted);
+    return false;
+}
+
+void unlock_account_records(const uint32_t *ids, size_t count) {
+    for (size_t i = 0; i < count && record_lock_fd >= 0; i++) {
+        set_record_lock(ids[i], F_UNLCK);
+    }
+}
+
+/*
+  Saves accounts whose records are held (see commit_accounts() below,
+  which locks them first, and commit_held_accounts() in account.h)
+  
+  Returns:
+    COMMIT_OK, COMMIT_CONFLICT or COMMIT_FAILED; unless it is COMMIT_OK,
+    no account was changed on disk
+ */
+static CommitResult commit_held(Account *const accounts[], const uint32_t ids[], size_t count) {
+    IntentEntry *intent = malloc((count > 0 ? count : 1) * sizeof(IntentEntry));
+    if (intent == NULL) {
+        return COMMIT_FAILED;
     }
     
-    // Convert the input to a number and set the account type
-    int type_choice = atoi(input);
-    if (type_choice == 1) {
-        acc.type = SAVINGS;  
-    } else if (type_choice == 2) {
-        acc.type = CURRENT; 
-    } else {
-        printf("Error: Invalid account type.\n");
-        return;
+    // STEP 1: Check the versions
+    CommitResult result = COMMIT_OK;
+    for (size_t i = 0; i < count && result == COMMIT_OK; i++) {
+        Account on_disk;
+        if (!load_account(accounts[i]->account_number, &on_disk)) {
+            result = COMMIT_FAILED;
+        } else if (on_disk.version != accounts[i]->version) {
+            result = COMMIT_CONFLICT;
+        } else {
+            IntentEntry *e = &intent[i];
+            snprintf(e->account_number, sizeof(e->account_number), "%s", on_disk.account_number);
+            e->version = on_disk.version;
+            e->before_cents = amount_to_cents(on_disk.balance);
+            e->after_cents = amount_to_cents(accounts[i]->balance);
+        }
     }
     
-    /* STEP 4:
-       Request the user to generate a four-digit PIN for security
-       Continue requesting until they provide a working PIN
-     */
-    do {
-        if (!get_string_input(acc.pin, PIN_LEN + 1, "Enter 4-digit PIN: ")) {
-            printf("Error: Failed to read PIN.\n");
-            return;
+    // STEP 2: Write the intent (one file is saved whole anyway), then the accounts
+    bool with_intent = count > 1 && result == COMMIT_OK;
+    if (with_intent && !write_intent(ids, intent, count)) {
+        result = COMMIT_FAILED;
+    }
+    size_t saved = 0;
+    for (; saved < count && result == COMMIT_OK; saved++) {
+        if (!save_account(accounts[saved])) {
+            result = COMMIT_FAILED;
         }
-        
-        // Check if PIN is valid (should be exactly four digits) 
-        if (!is_valid_pin(acc.pin)) {
-            printf("Error: PIN must be exactly 4 digits.\n");
+    }
+    if (with_intent) {
+        // A save failed: undo the ones before it, so it is still neither
+        if (result != COMMIT_OK) {
+            roll_back_intent(intent, saved);
         }
-    } while (!is_valid_pin(acc.pin));  
+        remove_intent(ids, count);
+    }
+    if (result == COMMIT_OK) {
+        for (size_t i = 0; i < count; i++) {
+            accounts[i]->version++;
+        }
+    }
+    free(intent);
+    return result;
+}
+
+// The work of commit_accounts() (below), outside its trace span
+static CommitResult commit_locked(Account *const accounts[], size_t count) {
+    uint32_t *ids = malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+    if (ids == NULL) {
+        return COMMIT_FAILED;
+    }
+    for (size_t i = 0; i < count; i++) {
+        ids[i] = account_id_from_string(accounts[i]->account_number);
+    }
     
-    /* STEP 5: 
-       Create a unique random account number
-     */
+    // Lock, check and save, let go
+    CommitResult result = COMMIT_FAILED;
+    if (lock_account_records(ids, count)) {
+        result = commit_held(accounts, ids, count);
+        unlock_account_records(ids, count);
+    }
+    free(ids);
+    return result;
+}
+
+CommitResult commit_held_accounts(Account *const accounts[], size_t count) {
+    uint32_t *ids = malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+    if (ids == NULL) {
+        return COMMIT_FAILED;
+    }
+    for (size_t i = 0; i < count; i++) {
+        ids[i] = account_id_from_string(accounts[i]->account_number);
+    }
+    TRACE_BEGIN("commit_accounts");
+    CommitResult result = commit_held(accounts, ids, count);
+    TRACE_END("commit_accounts");
+    free(ids);
+    return result;
+}
+
+/*
+  Saves accounts that were loaded earlier, unless another program saved
+  one of them in the meantime (compare-and-swap on the version)
+  
+  How it works:
+  1. Lock the records of the accounts (only for the few microseconds of
+     the check and the write; readers never take these locks)
+  2. Read every account's version on disk; if one is not the version
+     that was loaded, someone else was faster: write nothing
+  3. Save them all (each is written as version + 1)
+  
+  Returns:
+    COMMIT_OK, COMMIT_CONFLICT (load again and retry) or COMMIT_FAILED
+ */
+CommitResult commit_accounts(Account *const accounts[], size_t count) {
+    TRACE_BEGIN("commit_accounts");
+    CommitResult result = commit_locked(accounts, count);
+    TRACE_END("commit_accounts");
+    return result;
+}
+
+/*
+  Opens a new account whose name, ID number, type and PIN have already
+  been checked (used by create_account() and the "create" subcommand)
+  
+  How it works:
+    1. Create a unique random account number
+    2. Start with a zero balance
+    3. Save the account file and add it to the index
+    4. Log the new account
+  
+  Returns:
+    true if it was opened (acc->account_number is set), false else
+    (an error message was printed)
+ */
+bool open_new_account(Account *acc) {
     char *account_num = generate_account_number();
     if (account_num == NULL) {
-        printf("Error: Failed to generate unique account number.\n");
-        return;
+        print_message("Error: Failed to generate unique account number.\n");
+        return false;
     }
-    strcpy(acc.account_number, account_num);
+    strcpy(acc->account_number, account_num);
     
     // Set starting balance to zero (new accounts start empty) 
-    acc.balance = 0.0;
+    acc->balance = 0.0;
+    acc->version = 0;
     
-    /* STEP 6: 
-       Save the account file and add to index
-     */
-    
-    // Save the account data to a file 
-    if (!save_account(&acc)) {
-        printf("Error: Failed to save account.\n");
-        return;
+    // Save the account data to a file (in one update window with the index
+    // entry, so --fsck never finds the file without it, see store_update_begin())
+    int update = store_update_begin();
+    if (!save_account(acc)) {
+        store_update_end(update);
+        print_message("Error: Failed to save account.\n");
+        return false;
     }
     
     // Add the account number to the index file 
     FILE *fp = fopen(INDEX_FILE, "a");  /* 'a' means append mode */
     if (fp != NULL) {
-        fprintf(fp, "%s\n", acc.account_number);
+        fprintf(fp, "%s\n", acc->account_number);
         fclose(fp);
     }
+    store_update_end(update);
     
     // Log this action to keep the records
-    char log_msg[200];
-    sprintf(log_msg, "Created account %s for %s", acc.account_number, acc.name);
-    log_transaction(log_msg);
-    
-    /* STEP 7: 
-       Show the user's updated account information along with a successful message
-
-     */
-    printf("\n========================================\n");
-    printf("Account created successfully!\n");
-    printf("========================================\n");
-    printf("IMPORTANT: Please save this information!\n");
-    printf("========================================\n");
-    printf("Account Number: %s\n", acc.account_number);
-    printf("Name: %s\n", acc.name);
-    printf("Account Type: %s\n", account_type_to_string(acc.type));
-    printf("PIN: ****\n");  
-    printf("Initial Balance: RM%.2f\n", acc.balance);
-    printf("========================================\n");
-    printf("NOTE: Keep your Account Number and PIN\n");
-    printf("      safe for future transactions.\n");
-    printf("========================================\n");
+    txlog_append(TXOP_CREATE, 0, account_id_from_string(acc->account_number), 0, 0, TXSTATUS_OK);
+    return true;
 }
 
 /*
-  DELETE ACCOUNT - Remove an Account from the System
-  Once the user's identification has been confirmed, this function deletes a bank account
-  It requires three security checks:
-    1. There must be an account number
-    2. The ID's final four characters must match
-    3. The PIN needs to be accurate
+  Verifies whether the given PIN and the account's PIN match
+  (Like verifying a password)
   
-  (This requires appropriate proof)
+  Parameters:
+    account_num - Account number for authentication
+    pin - PIN to verify
+  
+  Returns:
+    True if the PIN is accurate, false else
  */
-void delete_account(void) {
-    char account_num[20];      
-    char id_last4[5];          
-    char pin[PIN_LEN + 1];    
-    
-    printf("\n========================================\n");
-    printf("         DELETE BANK ACCOUNT\n");
-    printf("========================================\n");
+bool authenticate(const char *account_num, const char *pin) {
+    Account acc;
+    TRACE_BEGIN("authenticate");
     
-    /* STEP 1: 
-       Provide a list of all account numbers so the user is aware of the accounts
-     */
-    FILE *fp = fopen(INDEX_FILE, "r");
-    if (fp == NULL) {
-        printf("No accounts found.\n");
-        return;
-    }
+    // Load the account from file, then compare the provided PIN with the stored one
+    bool ok = load_account(account_num, &acc) && pin_matches(&acc, pin);
     
-    printf("Existing account numbers:\n");
-    char line[100];
-    int count = 0;
-    while (fgets(line, sizeof(line), fp) != NULL) {
-        line[strcspn(line, "\n")] = 0;
-        printf("  - %s\n", line);
-        count++;
+    TRACE_END("authenticate");
+    return ok;
+}
+
+/*
+  Compares a PIN with the one of a loaded account
+  The bank's own fee income account can not be used by customers, so it
+  never matches, and neither does a stored PIN that is not four digits
+  (exp. a damaged file), whatever was typed
+ */
+bool pin_matches(const Account *acc, const char *pin) {
+    if (strcmp(acc->account_number, FEE_INCOME_ACCOUNT) == 0 || !is_valid_pin(acc->pin)) {
+        return false;
     }
-    fclose(fp);
+    return strcmp(acc->pin, pin) == 0;
+}
+
+/*
+  This feature guide the user open a new bank account
+  It gathers all required data and verifies every input
+  
+  Steps:
+    1. Obtain the customer's full name
+    2. Obtain the customer's ID number
+    3. Select the account type (Savings or Current)
+    4. Set a four-digit PIN
+    5. Generate unique account number
+    6. Save to the database
+ */
+enum { CREATE_NAME = 1, CREATE_ID, CREATE_TYPE, CREATE_PIN };
+
+void create_account_step(Session *s, const char *line) {
+    Account *acc = &s->acc;
     
-    // Check if there are any accounts to delete
-    if (count == 0) {
-        printf("No accounts found.\n");
+    switch (s->step) {
+    case 0:
+        print_message("\n========================================\n");
+        print_message("       CREATE NEW BANK ACCOUNT\n");
+        print_message("========================================\n");
+        
+        /*
+           STEP 1: 
+           Ask for the customer's full name and verify it
+         */
+        session_prompt(s, CREATE_NAME, "Enter full name: ");
         return;
-    }
-    
-    /* STEP 2: 
-       Get the account number to delete
-     */
-    if (!get_string_input(account_num, 20, "\nEnter account number to delete: ")) {
+        
+    case CREATE_NAME:
+        if (!session_text(line, acc->name, MAX_NAME_LEN)) {
+            print_message("Error: Failed to read name.\n");
+            break;
+        }
+        
+        // Validate name (checks for special characters, length, etc.)
+        if (!is_valid_name(acc->name)) {
+            break;
+        }
+        
+        /* STEP 2:
+           Ask for the customer's identification number and verify it
+         */
+        session_prompt(s, CREATE_ID, "Enter ID number: ");
         return;
-    }
-    
-    // Try to load the account 
-    Account acc;
-    if (!load_account(account_num, &acc)) {
-        printf("Error: Account not found.\n");
+        
+    case CREATE_ID:
+        if (!session_text(line, acc->id_number, MAX_ID_LEN)) {
+            print_message("Error: Failed to read ID number.\n");
+            break;
+        }
+        
+        // Validate ID number 
+        if (!is_valid_id(acc->id_number)) {
+            break;
+        }
+        
+        /* STEP 3: 
+           Allow the user to select between a Current and Savings account
+         */
+        print_message("Select account type:\n");
+        print_message("1. Savings\n");
+        print_message("2. Current\n");
+        session_prompt(s, CREATE_TYPE, "Enter choice: ");
         return;
-    }
-    
-    /* STEP 3: 
-       Ask for the last four characters of ID as first security check
-     */
-    if (!get_string_input(id_last4, 5, "Enter last 4 characters of ID number: ")) {
+        
+    case CREATE_TYPE:
+        if (line == NULL) {
+            print_message("Error: Failed to read account type.\n");
+            break;
+        }
+        
+        // Convert the input to a number and set the account type
+        int type_choice = atoi(line);
+        if (type_choice == 1) {
+            acc->type = SAVINGS;  
+        } else if (type_choice == 2) {
+            acc->type = CURRENT; 
+        } else {
+            print_message("Error: Invalid account type.\n");
+            break;
+        }
+        
+        /* STEP 4:
+           Request the user to generate a four-digit PIN for security
+           Continue requesting until they provide a working PIN
+         */
+        session_prompt(s, CREATE_PIN, "Enter 4-digit PIN: ");
         return;
+        
+    case CREATE_PIN:
+        if (!session_text(line, acc->pin, PIN_LEN + 1)) {
+            print_message("Error: Failed to read PIN.\n");
+            break;
+        }
+        
+        // Check if PIN is valid (should be exactly four digits) 
+        if (!is_valid_pin(acc->pin)) {
+            print_message("Error: PIN must be exactly 4 digits.\n");
+            session_prompt(s, CREATE_PIN, "Enter 4-digit PIN: ");
+            return;
+        }
+        
+        // STEP 5-6: Give it a number, save it and add it to the index
+        if (!open_new_account(acc)) {
+            break;
+        }
+        
+        /* STEP 7: 
+           Show the user's updated account information along with a successful message
+
+         */
+        print_message("\n========================================\n");
+        print_message("Account created successfully!\n");
+        print_message("========================================\n");
+        print_message("IMPORTANT: Please save this information!\n");
+        print_message("========================================\n");
+        print_message("Account Number: %s\n", acc->account_number);
+        print_message("Name: %s\n", acc->name);
+        print_message("Account Type: %s\n", account_type_to_string(acc->type));
+        print_message("PIN: ****\n");  
+        print_message("Initial Balance: RM%.2f\n", acc->balance);
+        print_message("========================================\n");
+        print_message("NOTE: Keep your Account Number and PIN\n");
+        print_message("      safe for future transactions.\n");
+        print_message("========================================\n");
+        break;
     }
+    session_end(s);
+}
+
+void create_account(void) {
+    session_run_console(FLOW_CREATE);
+}
+
+/*
+  Removes an account whose owner has already been checked: its file, its
+  store record and its line of the index, and logs the balance it still
+  held leaving the bank (used by delete_account() and the "delete"
+  subcommand, see cli.h)
+  
+  Parameters:
+    account_num - The account to remove
+    final_balance - Set to the balance it held (may be NULL)
+  
+  Returns:
+    true if it was removed, false else (an error message was printed)
+ */
+bool remove_account(const char *account_num, double *final_balance) {
+    Account acc;
     
-    /* STEP 4: Verify with PIN
-       Ask for PIN as an additional security measure
-     */
-    if (!get_string_input(pin, PIN_LEN + 1, "Enter 4-digit PIN: ")) {
-        return;
+    /* In shared mode, wait for operations on this account. Its record is
+       locked too, so no commit_accounts() can save it again between
+       reading its final balance and removing the file */
+    SharedHold hold;
+    uint32_t ids[1] = { account_id_from_string(account_num) };
+    shared_lock_accounts(&hold, ids, 1);
+    if (!lock_account_records(ids, 1)) {
+        shared_unlock_accounts(&hold);
+        print_message("Error: Could not lock the account.\n");
+        return false;
     }
-    
-    /* STEP 5: 
-       Compare the last four characters of stored ID with what user have entered
-     */
-    int id_len = strlen(acc.id_number);
-    if (id_len < 4 || strcmp(&acc.id_number[id_len - 4], id_last4) != 0) {
-        printf("Error: ID verification failed.\n");
-        return;
+    if (!load_account(account_num, &acc)) {
+        unlock_account_records(ids, 1);
+        shared_unlock_accounts(&hold);
+        print_message("Error: Account not found.\n");
+        return false;
     }
-    
-    /* STEP 6: 
-       Verify if the PIN matches or not
-     */
-    if (!authenticate(account_num, pin)) {
-        printf("Error: PIN verification failed.\n");
-        return;
+
+    // The file is in the fan-out tree or (before/while migrating) the flat folder
+    int update = store_update_begin();
+    char filename[300];
+    layout_path_in(DATABASE_DIR, account_num, true, filename, sizeof(filename));
+    int removed = layout_is_fanout() ? remove(filename) : -1;
+    if (removed != 0) {
+        layout_path_in(DATABASE_DIR, account_num, false, filename, sizeof(filename));
+        removed = remove(filename);
     }
-    
-    char filename[100];
-    sprintf(filename, "%s/%s.txt", DATABASE_DIR, account_num);
-    if (remove(filename) != 0) {
-        printf("Error: Failed to delete account file.\n");
-        return;
+    if (removed != 0) {
+        store_update_end(update);
+        unlock_account_records(ids, 1);
+        shared_unlock_accounts(&hold);
+        print_message("Error: Failed to delete account file.\n");
+        return false;
     }
+    store_remove(account_num);
     
+    char line[100];
     FILE *index_fp = fopen(INDEX_FILE, "r");
     FILE *temp_fp = fopen("database/temp_index.txt", "w");
     
@@ -464,11 +1322,160 @@ void delete_account(void) {
         rename("database/temp_index.txt", INDEX_FILE);
     }
     
-    char log_msg[200];
-    sprintf(log_msg, "Deleted account %s", account_num);
-    log_transaction(log_msg);
+    // The balance the account still held leaves the bank with it
+    txlog_append(TXOP_DELETE, account_id_from_string(account_num), 0,
+                 amount_to_cents(acc.balance), 0, TXSTATUS_OK);
+    store_update_end(update);
+    unlock_account_records(ids, 1);
+    shared_unlock_accounts(&hold);
+    if (final_balance != NULL) {
+        *final_balance = acc.balance;
+    }
+    return true;
+}
+
+/*
+  DELETE ACCOUNT - Remove an Account from the System
+  Once the user's identification has been confirmed, this function deletes a bank account
+  It requires three security checks:
+    1. There must be an account number
+    2. The ID's final four characters must match
+    3. The PIN needs to be accurate
+  
+  (This requires appropriate proof)
+ */
+enum { DELETE_LIST = 1, DELETE_ACCOUNT, DELETE_ID, DELETE_PIN };
+
+/* List the account numbers from s->list_offset on, as many as fit in the
+   output (all of them on the screen; under --serve the rest comes with
+   session_continue() once this part was sent)
+   Returns: true when the whole index was listed */
+static bool list_account_numbers(Session *s) {
+    FILE *fp = fopen(INDEX_FILE, "r");
+    if (fp == NULL || fseek(fp, s->list_offset, SEEK_SET) != 0) {
+        if (fp != NULL) {
+            fclose(fp);
+        }
+        return true;
+    }
     
-    printf("\n========================================\n");
-    printf("Account %s deleted successfully!\n", account_num);
-    printf("========================================\n");
+    char line[100];
+    bool finished = false;
+    while (message_room() > 128) {
+        if (fgets(line, sizeof(line), fp) == NULL) {
+            finished = true;
+            break;
+        }
+        line[strcspn(line, "\n")] = 0;
+        print_message("  - %s\n", line);
+        s->listed++;
+    }
+    s->list_offset = ftell(fp);
+    fclose(fp);
+    return finished;
+}
+
+void delete_account_step(Session *s, const char *line) {
+    switch (s->step) {
+    case 0:
+        print_message("\n========================================\n");
+        print_message("         DELETE BANK ACCOUNT\n");
+        print_message("========================================\n");
+        
+        /* STEP 1: 
+           Provide a list of all account numbers so the user is aware of the accounts
+         */
+        if (access(INDEX_FILE, R_OK) != 0) {
+            print_message("No accounts found.\n");
+            break;
+        }
+        print_message("Existing account numbers:\n");
+        s->step = DELETE_LIST;
+        s->list_offset = 0;
+        s->listed = 0;
+        // Fall through - list the first part
+        
+    case DELETE_LIST:
+        if (!list_account_numbers(s)) {
+            s->more_output = true;
+            return;
+        }
+        
+        // Check if there are any accounts to delete
+        if (s->listed == 0) {
+            print_message("No accounts found.\n");
+            break;
+        }
+        
+        /* STEP 2: 
+           Get the account number to delete
+         */
+        session_prompt(s, DELETE_ACCOUNT, "\nEnter account number to delete: ");
+        return;
+        
+    case DELETE_ACCOUNT:
+        if (!session_text(line, s->account_num, sizeof(s->account_num))) {
+            break;
+        }
+        
+        // Try to load the account 
+        if (!load_account(s->account_num, &s->acc)) {
+            print_message("Error: Account not found.\n");
+            break;
+        }
+        
+        /* STEP 3: 
+           Ask for the last four characters of ID as first security check
+         */
+        session_prompt(s, DELETE_ID, "Enter last 4 characters of ID number: ");
+        return;
+        
+    case DELETE_ID:
+        if (!session_text(line, s->id_last4, sizeof(s->id_last4))) {
+            break;
+        }
+        
+        /* STEP 4: Verify with PIN
+           Ask for PIN as an additional security measure
+         */
+        session_prompt(s, DELETE_PIN, "Enter 4-digit PIN: ");
+        return;
+        
+    case DELETE_PIN:
+        if (!session_text(line, s->pin, sizeof(s->pin))) {
+            break;
+        }
+        
+        /* STEP 5: 
+           Compare the last four characters of stored ID with what user have entered
+         */
+        int id_len = strlen(s->acc.id_number);
+        if (id_len < 4 || strcmp(&s->acc.id_number[id_len - 4], s->id_last4) != 0) {
+            print_message("Error: ID verification failed.\n");
+            break;
+        }
+        
+        /* STEP 6: 
+           Verify if the PIN matches or not
+         */
+        if (!authenticate(s->account_num, s->pin)) {
+            print_message("Error: PIN verification failed.\n");
+            break;
+        }
+        
+        // STEP 7: Remove it
+        if (!remove_account(s->account_num, NULL)) {
+            break;
+        }
+        
+        print_message("\n========================================\n");
+        print_message("Account %s deleted successfully!\n", s->account_num);
+        print_message("========================================\n");
+        break;
+    }
+    session_end(s);
+}
+
+void delete_account(void) {
+    session_run_console(FLOW_DELETE);
 }
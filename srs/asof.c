@@ -0,0 +1,622 @@
+/* This file writes balance snapshots and answers point-in-time balance
+   queries (see asof.h)
+
+   Snapshot file format:
+     SnapHeader                     (magic, number of entries, last
+                                     transaction ID and its time)
+     SnapEntry x count              (account number and balance in cents,
+                                     sorted by account number)
+   A snapshot is written to a temporary file, flushed to the disk and then
+   renamed, so a snapshot that exists is always complete
+
+   Bringing a snapshot forward:
+   The previous snapshot is loaded into a hash table, and the log records
+   that follow it are applied like --replay does (only successful ones:
+   CREATE opens at zero, DELETE closes, deposits and fee income add,
+   withdrawals take away, a remittance takes amount + fee from the sender
+   and gives the amount to the receiver, a reversal moves the money back).
+   The log is only appended to, so this needs no lock: the records up to
+   the last transaction seen at the start never change
+ */
+
+#include "asof.h"
+#include "store.h"
+#include "txlog.h"
+#include "utils.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_MAGIC 0x31504E53u   /* "SNP1" */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t txn_id;
+    int64_t timestamp;
+} SnapHeader;
+
+typedef struct {
+    uint32_t account_id;
+    uint32_t open;          // 1 while the account exists (always 1 in a file)
+    int64_t balance_cents;
+} SnapEntry;
+
+// One snapshot file, known from its name only
+typedef struct {
+    uint64_t txn_id;
+    int64_t timestamp;
+} SnapName;
+
+// Balances while a snapshot is brought forward (open addressing on account_id)
+typedef struct {
+    SnapEntry *slots;
+    size_t capacity;
+    size_t used;
+} BalanceTable;
+
+// A new snapshot is complete up to this transaction
+typedef struct {
+    BalanceTable *table;
+    uint64_t end_id;
+    uint64_t last_id;
+    int64_t last_ts;
+    long applied;
+} ForwardState;
+
+// What a query adds up for its one account
+typedef struct {
+    uint32_t account_id;
+    AsOfBalance *answer;
+} QueryState;
+
+/* ---------- Snapshot files ---------- */
+
+static void snapshot_path(const SnapName *name, char *path, size_t size) {
+    snprintf(path, size, "%s/snap-%020llu-%lld.bin", SNAPSHOT_DIR,
+             (unsigned long long)name->txn_id, (long long)name->timestamp);
+}
+
+static int compare_names(const void *a, const void *b) {
+    const SnapName *x = a, *y = b;
+    return (x->txn_id > y->txn_id) - (x->txn_id < y->txn_id);
+}
+
+/* List the snapshots, oldest first (the caller frees the array)
+   Returns: The number of snapshots */
+static size_t list_snapshots(SnapName **names) {
+    *names = NULL;
+    DIR *dir = opendir(SNAPSHOT_DIR);
+    if (dir == NULL) {
+        return 0;
+    }
+
+    size_t count = 0, capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        unsigned long long id;
+        long long ts;
+        char tail[8];
+        if (sscanf(entry->d_name, "snap-%llu-%lld%7s", &id, &ts, tail) != 3 ||
+            strcmp(tail, ".bin") != 0) {
+            continue;   // Temporary files and anything else
+        }
+        if (count == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            SnapName *bigger = realloc(*names, capacity * sizeof(SnapName));
+            if (bigger == NULL) {
+                break;
+            }
+            *names = bigger;
+        }
+        (*names)[count].txn_id = id;
+        (*names)[count].timestamp = ts;
+        count++;
+    }
+    closedir(dir);
+
+    if (count > 0) {
+        qsort(*names, count, sizeof(SnapName), compare_names);
+    }
+    return count;
+}
+
+/* Map a snapshot file and check its header
+   Returns: The header (entries follow it), or NULL */
+static const SnapHeader *map_snapshot(const SnapName *name, size_t *map_size) {
+    char path[256];
+    snapshot_path(name, path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(SnapHeader)) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    const SnapHeader *header = map;
+    if (header->magic != SNAPSHOT_MAGIC ||
+        sizeof(SnapHeader) + header->count * sizeof(SnapEntry) > (size_t)st.st_size) {
+        munmap(map, (size_t)st.st_size);
+        return NULL;
+    }
+    *map_size = (size_t)st.st_size;
+    return header;
+}
+
+/* Write a snapshot: temporary file, flush, then rename
+   "entries" must be sorted by account number and hold open accounts only */
+static bool write_snapshot(const SnapName *name, const SnapEntry *entries, size_t count) {
+    char path[256], temp[300];
+    snapshot_path(name, path, sizeof(path));
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+
+    FILE *file = fopen(temp, "wb");
+    if (file == NULL) {
+        printf("Error: Could not create %s\n", temp);
+        return false;
+    }
+    SnapHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SNAPSHOT_MAGIC;
+    header.count = count;
+    header.txn_id = name->txn_id;
+    header.timestamp = name->timestamp;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              (count == 0 || fwrite(entries, sizeof(SnapEntry), count, file) == count);
+    ok = fflush(file) == 0 && ok;
+    ok = fsync(fileno(file)) == 0 && ok;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temp, path) != 0) {
+        printf("Error: Could not write %s\n", path);
+        unlink(temp);
+        return false;
+    }
+    return true;
+}
+
+/* ---------- Balance table ---------- */
+
+static size_t slot_of(const BalanceTable *t, uint32_t id) {
+    size_t i = (id * 2654435761u) & (t->capacity - 1);
+    while (t->slots[i].account_id != 0 && t->slots[i].account_id != id) {
+        i = (i + 1) & (t->capacity - 1);
+    }
+    return i;
+}
+
+static bool table_init(BalanceTable *t, size_t expected) {
+    t->capacity = 1024;
+    while (t->capacity < expected * 2) {
+        t->capacity *= 2;
+    }
+    t->used = 0;
+    t->slots = calloc(t->capacity, sizeof(SnapEntry));
+    return t->slots != NULL;
+}
+
+/* Find an account's entry, adding a closed one if it is new
+   Returns: The entry, or NULL if memory ran out */
+static SnapEntry *table_entry(BalanceTable *t, uint32_t id) {
+    if ((t->used + 1) * 2 > t->capacity) {
+        BalanceTable bigger;
+        if (!table_init(&bigger, t->capacity)) {
+            return NULL;
+        }
+        for (size_t i = 0; i < t->capacity; i++) {
+            if (t->slots[i].account_id != 0) {
+                bigger.slots[slot_of(&bigger, t->slots[i].account_id)] = t->slots[i];
+                bigger.used++;
+            }
+        }
+        free(t->slots);
+        *t = bigger;
+    }
+    SnapEntry *e = &t->slots[slot_of(t, id)];
+    if (e->account_id == 0) {
+        e->account_id = id;
+        t->used++;
+    }
+    return e;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    uint32_t x = ((const SnapEntry *)a)->account_id, y = ((const SnapEntry *)b)->account_id;
+    return (x > y) - (x < y);
+}
+
+/* Move the open accounts of the table to the start of its slots, sorted
+   Returns: The number of open accounts */
+static size_t table_sorted(BalanceTable *t) {
+    size_t count = 0;
+    for (size_t i = 0; i < t->capacity; i++) {
+        if (t->slots[i].account_id != 0 && t->slots[i].open) {
+            t->slots[count++] = t->slots[i];
+        }
+    }
+    qsort(t->slots, count, sizeof(SnapEntry), compare_entries);
+    return count;
+}
+
+/* ---------- Taking a snapshot ---------- */
+
+static bool add_cents(BalanceTable *t, uint32_t id, int64_t cents) {
+    SnapEntry *e = table_entry(t, id);
+    if (e == NULL) {
+        return false;
+    }
+    e->balance_cents += cents;
+    return true;
+}
+
+// Apply one log record to the table (records after end_id are left for next time)
+static bool forward_record(const TxRecord *rec, void *ctx) {
+    ForwardState *f = ctx;
+    if (rec->txn_id > f->end_id) {
+        return false;
+    }
+    f->last_id = rec->txn_id;
+    f->last_ts = rec->timestamp;
+    f->applied++;
+    if (rec->status != TXSTATUS_OK) {
+        return true;  // Nothing was changed by a failed operation
+    }
+
+    SnapEntry *e;
+    bool ok = true;
+    switch (rec->op) {
+        case TXOP_CREATE:
+            e = table_entry(f->table, rec->to_id);
+            if ((ok = e != NULL)) {
+                e->open = 1;
+                e->balance_cents = 0;
+            }
+            break;
+        case TXOP_DELETE:
+            e = table_entry(f->table, rec->from_id);
+            if ((ok = e != NULL)) {
+                e->open = 0;
+                e->balance_cents = 0;
+            }
+            break;
+        case TXOP_DEPOSIT:
+        case TXOP_FEE_INCOME:
+            ok = add_cents(f->table, rec->to_id, rec->amount_cents);
+            break;
+        case TXOP_WITHDRAW:
+            ok = add_cents(f->table, rec->from_id, -rec->amount_cents);
+            break;
+        case TXOP_REMIT:
+            ok = add_cents(f->table, rec->from_id, -(rec->amount_cents + rec->fee_cents)) &&
+                 add_cents(f->table, rec->to_id, rec->amount_cents);
+            break;
+        case TXOP_REVERSAL:
+            ok = (rec->from_id == 0 || add_cents(f->table, rec->from_id, -rec->amount_cents)) &&
+                 (rec->to_id == 0 || add_cents(f->table, rec->to_id, rec->amount_cents + rec->fee_cents));
+            break;
+        default:
+            break;
+    }
+    if (!ok) {
+        f->end_id = 0;   // Out of memory: stop, and report it below
+    }
+    return ok;
+}
+
+/* Copy the balances out of the account store
+   Taken while no operation is between saving and logging, so the copy
+   matches the log exactly up to the last transaction noted here */
+static bool snapshot_from_store(BalanceTable *t, SnapName *name) {
+    TxSegment *segments;
+    int hold = store_update_hold();
+    size_t segment_count = txlog_segments(&segments);
+    const AccountHot *hot = store_hot_records();
+    size_t count = store_count();
+    bool ok = table_init(t, count);
+    for (size_t i = 0; ok && i < count; i++) {
+        SnapEntry *e = table_entry(t, hot[i].account_id);
+        if ((ok = e != NULL)) {
+            e->open = 1;
+            e->balance_cents = hot[i].balance_cents;
+        }
+    }
+    store_update_end(hold);
+
+    name->txn_id = 0;
+    name->timestamp = (int64_t)time(NULL);
+    if (segment_count > 0 && segments[segment_count - 1].count > 0) {
+        name->txn_id = segments[segment_count - 1].last_id;
+        name->timestamp = segments[segment_count - 1].last_ts;
+    }
+    free(segments);
+    return ok;
+}
+
+/* Load a snapshot into the table and apply the log records that follow it
+   Returns: false if it could not be read; *changed is false if there was
+   nothing new in the log */
+static bool snapshot_forward(BalanceTable *t, const SnapName *base, SnapName *name, bool *changed) {
+    size_t map_size;
+    const SnapHeader *header = map_snapshot(base, &map_size);
+    if (header == NULL) {
+        printf("Error: Snapshot of transaction %llu could not be read.\n",
+               (unsigned long long)base->txn_id);
+        return false;
+    }
+    const SnapEntry *entries = (const SnapEntry *)(header + 1);
+    bool ok = table_init(t, header->count);
+    for (uint64_t i = 0; ok && i < header->count; i++) {
+        SnapEntry *e = table_entry(t, entries[i].account_id);
+        if ((ok = e != NULL)) {
+            e->open = 1;
+            e->balance_cents = entries[i].balance_cents;
+        }
+    }
+    munmap((void *)header, map_size);
+    if (!ok) {
+        printf("Error: Not enough memory for the snapshot.\n");
+        return false;
+    }
+
+    // The end is fixed now; records written meanwhile go into the next snapshot
+    TxSegment *segments;
+    size_t segment_count = txlog_segments(&segments);
+    ForwardState f = { t, base->txn_id, base->txn_id, base->timestamp, 0 };
+    if (segment_count > 0 && segments[segment_count - 1].count > 0) {
+        f.end_id = segments[segment_count - 1].last_id;
+    }
+    free(segments);
+
+    uint64_t wanted = f.end_id;
+    if (wanted > base->txn_id) {
+        txlog_query_after(base->txn_id, INT64_MAX, forward_record, &f);
+    }
+    if (f.end_id == 0 && wanted != 0) {
+        printf("Error: Not enough memory for the snapshot.\n");
+        return false;
+    }
+    name->txn_id = f.last_id;
+    name->timestamp = f.last_ts;
+    *changed = f.last_id != base->txn_id;
+    return true;
+}
+
+/* Take snapshot function
+   Purpose: Write a new balance snapshot
+
+   STEP 1: Only one snapshot is taken at a time
+   STEP 2: Start from the newest snapshot (or from the store the first time)
+   STEP 3: Write the new file
+   STEP 4: Remove snapshots beyond SNAPSHOT_KEEP
+ */
+int take_snapshot(void) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // STEP 1: Lock
+    mkdir(SNAPSHOT_DIR, 0755);
+    int lock = open(SNAPSHOT_DIR "/.lock", O_RDWR | O_CREAT, 0644);
+    if (lock < 0 || flock(lock, LOCK_EX | LOCK_NB) != 0) {
+        printf("Error: Another snapshot is being taken.\n");
+        if (lock >= 0) {
+            close(lock);
+        }
+        return 1;
+    }
+
+    // STEP 2: Build the balances
+    SnapName *names;
+    size_t count = list_snapshots(&names);
+    BalanceTable table = { NULL, 0, 0 };
+    SnapName name;
+    bool changed = true;
+    bool ok;
+    if (count == 0) {
+        ok = snapshot_from_store(&table, &name);
+        if (!ok) {
+            printf("Error: Not enough memory for the snapshot.\n");
+        }
+    } else {
+        ok = snapshot_forward(&table, &names[count - 1], &name, &changed);
+    }
+
+    // STEP 3: Write it
+    int result = 1;
+    if (ok && !changed) {
+        printf("Snapshot of transaction %llu is already up to date.\n",
+               (unsigned long long)name.txn_id);
+        result = 0;
+    } else if (ok) {
+        size_t accounts = table_sorted(&table);
+        if (write_snapshot(&name, table.slots, accounts)) {
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+            printf("Snapshot of %zu accounts up to transaction %llu written in %.1f ms.\n",
+                   accounts, (unsigned long long)name.txn_id, ms);
+            result = 0;
+            count++;
+        }
+    }
+    free(table.slots);
+
+    // STEP 4: Keep only the newest SNAPSHOT_KEEP (the list is oldest first)
+    for (size_t i = 0; result == 0 && i + SNAPSHOT_KEEP < count; i++) {
+        char path[256];
+        snapshot_path(&names[i], path, sizeof(path));
+        unlink(path);
+    }
+    free(names);
+
+    flock(lock, LOCK_UN);
+    close(lock);
+    return result;
+}
+
+/* ---------- Queries ---------- */
+
+// Apply one log record to the account being asked about
+static bool query_record(const TxRecord *rec, void *ctx) {
+    QueryState *q = ctx;
+    AsOfBalance *a = q->answer;
+    a->records_read++;
+    if (rec->status != TXSTATUS_OK) {
+        return true;
+    }
+
+    switch (rec->op) {
+        case TXOP_CREATE:
+            if (rec->to_id == q->account_id) {
+                a->existed = true;
+                a->balance_cents = 0;
+            }
+            break;
+        case TXOP_DELETE:
+            if (rec->from_id == q->account_id) {
+                a->existed = false;
+                a->balance_cents = 0;
+            }
+            break;
+        case TXOP_DEPOSIT:
+        case TXOP_FEE_INCOME:
+            if (rec->to_id == q->account_id) {
+                a->balance_cents += rec->amount_cents;
+            }
+            break;
+        case TXOP_WITHDRAW:
+            if (rec->from_id == q->account_id) {
+                a->balance_cents -= rec->amount_cents;
+            }
+            break;
+        case TXOP_REMIT:
+            if (rec->from_id == q->account_id) {
+                a->balance_cents -= rec->amount_cents + rec->fee_cents;
+            }
+            if (rec->to_id == q->account_id) {
+                a->balance_cents += rec->amount_cents;
+            }
+            break;
+        case TXOP_REVERSAL:
+            if (rec->from_id == q->account_id) {
+                a->balance_cents -= rec->amount_cents;
+            }
+            if (rec->to_id == q->account_id) {
+                a->balance_cents += rec->amount_cents + rec->fee_cents;
+            }
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+/* Balance as of function
+   Purpose: Find the balance an account had at a past time
+
+   STEP 1: Pick the newest snapshot taken no later than "when"
+   STEP 2: Binary search the account in it
+   STEP 3: Apply the account's log records after the snapshot, up to "when"
+ */
+bool balance_as_of(uint32_t account_id, int64_t when, AsOfBalance *out) {
+    memset(out, 0, sizeof(*out));
+
+    // STEP 1: Snapshot (names are oldest first)
+    SnapName *names;
+    size_t count = list_snapshots(&names);
+    size_t pick = count;
+    for (size_t i = count; i > 0; i--) {
+        if (names[i - 1].timestamp <= when) {
+            pick = i - 1;
+            break;
+        }
+    }
+    if (pick == count) {
+        free(names);
+        return false;
+    }
+    SnapName base = names[pick];
+    free(names);
+
+    // STEP 2: Account in the snapshot
+    size_t map_size;
+    const SnapHeader *header = map_snapshot(&base, &map_size);
+    if (header == NULL) {
+        return false;
+    }
+    const SnapEntry *entries = (const SnapEntry *)(header + 1);
+    size_t low = 0, high = header->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (entries[mid].account_id < account_id) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low < header->count && entries[low].account_id == account_id) {
+        out->existed = true;
+        out->balance_cents = entries[low].balance_cents;
+    }
+    out->snapshot_id = header->txn_id;
+    out->snapshot_time = header->timestamp;
+    munmap((void *)header, map_size);
+
+    // STEP 3: Log after the snapshot
+    QueryState q = { account_id, out };
+    return txlog_query_after(out->snapshot_id, when, query_record, &q) >= 0;
+}
+
+int print_balance_at(const char *account_num, const char *when_text) {
+    uint32_t id = account_id_from_string(account_num);
+    int64_t when;
+    if (id == 0) {
+        printf("Error: Invalid account number.\n");
+        return 1;
+    }
+    if (!parse_date_time(when_text, &when)) {
+        printf("Error: Time must look like \"YYYY-MM-DD HH:MM\".\n");
+        return 1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    AsOfBalance a;
+    bool found = balance_as_of(id, when, &a);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+    if (!found) {
+        printf("Error: No balance snapshot is that old (take one with --snapshot).\n");
+        return 1;
+    }
+    TxRecord stamp;
+    char time_text[32], snap_text[32];
+    stamp.timestamp = when;
+    txlog_format_time(&stamp, time_text, sizeof(time_text));
+    stamp.timestamp = a.snapshot_time;
+    txlog_format_time(&stamp, snap_text, sizeof(snap_text));
+
+    if (a.existed) {
+        printf("%s Account %s balance: RM%.2f\n", time_text, account_num, a.balance_cents / 100.0);
+    } else {
+        printf("%s Account %s did not exist.\n", time_text, account_num);
+    }
+    printf("(Snapshot of transaction %llu %s + %ld log records, %.2f ms)\n",
+           (unsigned long long)a.snapshot_id, snap_text, a.records_read, ms);
+    return 0;
+}
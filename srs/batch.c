@@ -0,0 +1,231 @@
+/* This file runs a file of transactions in ledger mode (see batch.h)
+
+   How it works:
+   1. The account store is opened and the ledger thread is started
+   2. Every front-end thread takes the next line of the file, checks it
+      (PIN, accounts, amount, fee) and submits it to the ledger
+   3. The front-end waits for its ticket and counts the result
+   4. When the file is finished the ledger is stopped, which writes the
+      last log batch and the changed account files
+ */
+
+#include "batch.h"
+#include "ledger.h"
+#include "account.h"
+#include "fees.h"
+#include "store.h"
+#include "utils.h"
+#include "velocity.h"
+#include "trace.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#define MAX_BATCH_THREADS 64
+
+// The input file, shared by every front-end thread
+typedef struct {
+    FILE *fp;
+    pthread_mutex_t lock;
+    long line_no;
+    long ok;
+    long failed;
+} BatchInput;
+
+// Messages for the ledger results
+static const char *ledger_messages[] = {
+    "pending", "ok", "account not found", "insufficient funds",
+    "transaction limit reached", "could not write the transaction log"
+};
+
+/* Read the next line that holds a command
+   Returns: false at the end of the file */
+static bool next_line(BatchInput *in, char *line, size_t size, long *line_no) {
+    bool found = false;
+    pthread_mutex_lock(&in->lock);
+    while (!found && fgets(line, (int)size, in->fp) != NULL) {
+        in->line_no++;
+        char *p = line + strspn(line, " \t");
+        found = *p != '\0' && *p != '\n' && *p != '#';
+    }
+    *line_no = in->line_no;
+    pthread_mutex_unlock(&in->lock);
+    return found;
+}
+
+/* Turn an amount into cents
+   Returns: false if it is not positive, too large, or has more than 2 decimals */
+static bool amount_ok(double amount, double max, int64_t *cents) {
+    if (amount <= 0 || amount > max) {
+        return false;
+    }
+    *cents = amount_to_cents(amount);
+    double diff = amount * 100 - (double)*cents;
+    return diff < 1e-6 && diff > -1e-6;
+}
+
+/* Check one command and hand it to the ledger
+   Returns: NULL if it was submitted, otherwise why it was refused */
+static const char *check_and_submit(const char *line, LedgerTicket *ticket) {
+    char op[16], account_num[20], pin[PIN_LEN + 2], receiver_num[20];
+    double amount;
+    int64_t cents;
+    Account acc;
+
+    if (sscanf(line, "%15s", op) != 1) {
+        return "unreadable line";
+    }
+    bool is_remit = strcmp(op, "remit") == 0;
+    int fields = is_remit ? sscanf(line, "%*s %19s %5s %19s %lf", account_num, pin, receiver_num, &amount)
+                          : sscanf(line, "%*s %19s %5s %lf", account_num, pin, &amount);
+    if (fields != (is_remit ? 4 : 3)) {
+        return "missing fields";
+    }
+
+    // The PIN is checked against the account file, like authenticate()
+    if (!load_account(account_num, &acc) || !pin_matches(&acc, pin)) {
+        return "authentication failed";
+    }
+    uint32_t account_id = account_id_from_string(account_num);
+
+    if (strcmp(op, "deposit") == 0) {
+        if (!amount_ok(amount, MAX_DEPOSIT, &cents)) {
+            return "invalid amount";
+        }
+        ledger_submit(LEDGER_DEPOSIT, 0, account_id, cents, 0, ticket);
+    } else if (strcmp(op, "withdraw") == 0) {
+        if (!amount_ok(amount, 999999999.99, &cents)) {
+            return "invalid amount";
+        }
+        ledger_submit(LEDGER_WITHDRAW, account_id, 0, cents, 0, ticket);
+    } else if (is_remit) {
+        Account receiver;
+        if (strcmp(account_num, receiver_num) == 0) {
+            return "cannot transfer to the same account";
+        }
+        if (!load_account(receiver_num, &receiver)) {
+            return "receiver account not found";
+        }
+        if (!amount_ok(amount, 999999999.99, &cents)) {
+            return "invalid amount";
+        }
+        int64_t fee = fee_for_remittance(acc.type, receiver.type, cents);
+        ledger_submit(LEDGER_REMIT, account_id, account_id_from_string(receiver_num),
+                      cents, fee, ticket);
+    } else {
+        return "unknown command";
+    }
+    return NULL;
+}
+
+// Front-end thread: check, submit and wait, one line at a time
+static void *front_end(void *arg) {
+    BatchInput *in = arg;
+    char line[256];
+    long line_no;
+    long ok = 0, failed = 0;
+    trace_thread_name("front-end");
+
+    while (next_line(in, line, sizeof(line), &line_no)) {
+        // One request per line: the checks here and the ledger's work for it
+        TRACE_REQUEST_BEGIN("batch_line");
+        LedgerTicket ticket;
+        const char *error = check_and_submit(line, &ticket);
+        if (error == NULL) {
+            LedgerResult result = ledger_wait(&ticket);
+            error = result == LEDGER_OK ? NULL : ledger_messages[result];
+        }
+        TRACE_REQUEST_END("batch_line");
+        if (error != NULL) {
+            printf("Line %ld: %s\n", line_no, error);
+            failed++;
+        } else {
+            ok++;
+        }
+    }
+
+    pthread_mutex_lock(&in->lock);
+    in->ok += ok;
+    in->failed += failed;
+    pthread_mutex_unlock(&in->lock);
+    return NULL;
+}
+
+/* Run batch function
+   Purpose: Apply every command of a file through the ledger thread
+
+   Parameters:
+     path - The command file
+     threads - Number of front-end threads
+
+   Returns: 0 if every command succeeded, 1 otherwise
+ */
+int run_batch(const char *path, int threads) {
+    if (threads < 1) threads = 1;
+    if (threads > MAX_BATCH_THREADS) threads = MAX_BATCH_THREADS;
+
+    BatchInput in;
+    memset(&in, 0, sizeof(in));
+    in.fp = fopen(path, "r");
+    if (in.fp == NULL) {
+        printf("Error: Cannot open %s\n", path);
+        return 1;
+    }
+    if (store_count() == 0) {
+        printf("Error: The account store is empty. Run --migrate first.\n");
+        fclose(in.fp);
+        return 1;
+    }
+    pthread_mutex_init(&in.lock, NULL);
+
+    // STEP 1: Start the ledger (limits are checked by the ledger thread)
+    velocity_init();
+    LedgerConfig config = { true, true, true };
+    if (!ledger_start(&config)) {
+        printf("Error: Could not start the ledger.\n");
+        fclose(in.fp);
+        return 1;
+    }
+
+    // STEP 2: Start the front-end threads and wait for the end of the file
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_t tids[MAX_BATCH_THREADS];
+    bool started[MAX_BATCH_THREADS];
+    for (int i = 0; i < threads; i++) {
+        started[i] = pthread_create(&tids[i], NULL, front_end, &in) == 0;
+        if (!started[i]) {
+            front_end(&in);  // No thread: do the work ourselves
+        }
+    }
+    for (int i = 0; i < threads; i++) {
+        if (started[i]) {
+            pthread_join(tids[i], NULL);
+        }
+    }
+
+    // STEP 3: Stop the ledger (writes the last batch and the account files)
+    LedgerStats stats;
+    ledger_stop(&stats);
+    velocity_shutdown();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("\n========================================\n");
+    printf("          BATCH RESULT\n");
+    printf("========================================\n");
+    printf("Commands: %ld   Succeeded: %ld   Failed: %ld\n", in.ok + in.failed, in.ok, in.failed);
+    printf("Time: %.3f s (%.0f commands/s, %d front-end threads)\n", seconds,
+           seconds > 0 ? (in.ok + in.failed) / seconds : 0.0, threads);
+    printf("Ledger: %llu applied in %llu batches, apply %.3f s, log %.3f s, files %.3f s\n",
+           (unsigned long long)stats.applied, (unsigned long long)stats.batches,
+           stats.apply_seconds, stats.log_seconds, stats.flush_seconds);
+    printf("========================================\n");
+
+    pthread_mutex_destroy(&in.lock);
+    fclose(in.fp);
+    return in.failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,661 @@
+/* This file runs bulk remittances (see bulk.h)
+
+   Journal format (BULK_JOURNAL, one item per line):
+     BULK <sender> <start time> <payments> <accounts>
+     ACCOUNT <account> <final balance in cents> <version before>
+                                                   (sender first)
+     LEG <receiver> <amount cents> <fee cents>     (one per payment)
+     COMMIT
+     LOGGED                                        (log records written)
+
+   Only one bulk remittance runs at a time: it holds an exclusive lock on
+   BULK_LOCK from start to end. A program that starts while one is running
+   sees the lock taken and leaves its journal alone
+
+   The journal holds final balances, not changes, so writing it again
+   after a crash gives the same result however many times it is done.
+   It also holds the version every account had before, so that a balance
+   is only written again if nobody else saved that account since the
+   crash (their update would be lost). Without the COMMIT line nothing
+   had been changed yet, and the journal is simply removed
+ */
+
+#include "bulk.h"
+#include "account.h"
+#include "fees.h"
+#include "store.h"
+#include "txlog.h"
+#include "utils.h"
+#include "velocity.h"
+#include "shared.h"
+#include "trace.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+
+#define MAX_BULK_AMOUNT 999999999.99
+#define MAX_SHOWN_ERRORS 20
+
+// One payment of the file
+typedef struct {
+    uint32_t to_id;
+    int64_t amount_cents;
+    int64_t fee_cents;
+    long line_no;
+} BulkLeg;
+
+// Everything needed to apply (or apply again) a bulk remittance
+typedef struct {
+    uint32_t sender_id;
+    int64_t started;        // Seconds since 1970; the log records are not older
+    BulkLeg *legs;
+    size_t leg_count;
+    Account *accounts;      // Sender first, then the receivers by account number
+    size_t account_count;
+} BulkPlan;
+
+/* Take the bulk lock (mode: LOCK_EX, or LOCK_EX | LOCK_NB to not wait)
+   Returns: The lock's file descriptor, or -1 if it was not taken */
+static int lock_bulk(int mode) {
+    int fd = open(BULK_LOCK, O_RDWR | O_CREAT, 0644);
+    if (fd >= 0 && flock(fd, mode) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+static void unlock_bulk(int fd) {
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+static void free_plan(BulkPlan *p) {
+    free(p->legs);
+    free(p->accounts);
+}
+
+static int compare_ids(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Report a bad line (only the first few are shown) */
+static void line_error(long *errors, long line_no, const char *why) {
+    if (++*errors <= MAX_SHOWN_ERRORS) {
+        printf("Line %ld: %s\n", line_no, why);
+    }
+}
+
+/* Read the payments of a bulk file
+   Returns: false if the file cannot be read or any line is invalid
+   (every line is checked, so all the mistakes are shown at once) */
+static bool read_legs(const char *path, uint32_t sender_id, BulkLeg **out, size_t *count,
+                      long *errors) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        printf("Error: Cannot open %s\n", path);
+        return false;
+    }
+
+    size_t capacity = 64, n = 0;
+    BulkLeg *legs = malloc(capacity * sizeof(BulkLeg));
+    char line[200];
+    long line_no = 0;
+    while (legs != NULL && fgets(line, sizeof(line), fp) != NULL) {
+        line_no++;
+        char *p = line + strspn(line, " \t");
+        if (*p == '\0' || *p == '\n' || *p == '#') {
+            continue;
+        }
+
+        char receiver_num[20];
+        double amount;
+        if (sscanf(p, "%19s %lf", receiver_num, &amount) != 2) {
+            line_error(errors, line_no, "expected <receiver> <amount>");
+            continue;
+        }
+        uint32_t to_id = account_id_from_string(receiver_num);
+        if (to_id == 0) {
+            line_error(errors, line_no, "invalid account number");
+            continue;
+        }
+        if (to_id == sender_id) {
+            line_error(errors, line_no, "cannot transfer to the same account");
+            continue;
+        }
+        int64_t cents = amount_to_cents(amount);
+        double diff = amount * 100 - (double)cents;
+        if (amount <= 0 || amount > MAX_BULK_AMOUNT || diff > 1e-6 || diff < -1e-6) {
+            line_error(errors, line_no, "invalid amount");
+            continue;
+        }
+
+        if (n == capacity) {
+            capacity *= 2;
+            BulkLeg *bigger = realloc(legs, capacity * sizeof(BulkLeg));
+            if (bigger == NULL) {
+                free(legs);
+                legs = NULL;
+                break;
+            }
+            legs = bigger;
+        }
+        legs[n].to_id = to_id;
+        legs[n].amount_cents = cents;
+        legs[n].fee_cents = 0;
+        legs[n].line_no = line_no;
+        n++;
+    }
+    fclose(fp);
+
+    if (legs == NULL) {
+        printf("Error: Out of memory reading %s\n", path);
+        return false;
+    }
+    *out = legs;
+    *count = n;
+    return *errors == 0;
+}
+
+/* Load the sender and every receiver (receivers once each, sorted)
+   Returns: false if a receiver does not exist */
+static bool load_plan_accounts(BulkPlan *p, const Account *sender, long *errors) {
+    uint32_t *ids = malloc(p->leg_count * sizeof(uint32_t));
+    char (*numbers)[12] = malloc((p->leg_count + 1) * sizeof(*numbers));
+    const char **names = malloc((p->leg_count + 1) * sizeof(char *));
+    bool *loaded = malloc((p->leg_count + 1) * sizeof(bool));
+    p->accounts = malloc((p->leg_count + 1) * sizeof(Account));
+    if (ids == NULL || numbers == NULL || names == NULL || loaded == NULL || p->accounts == NULL) {
+        printf("Error: Out of memory loading the receivers\n");
+        free(ids); free(numbers); free(names); free(loaded);
+        return false;
+    }
+
+    // Every receiver once, by account number
+    for (size_t i = 0; i < p->leg_count; i++) {
+        ids[i] = p->legs[i].to_id;
+    }
+    qsort(ids, p->leg_count, sizeof(uint32_t), compare_ids);
+    size_t unique = 0;
+    for (size_t i = 0; i < p->leg_count; i++) {
+        if (unique == 0 || ids[unique - 1] != ids[i]) {
+            ids[unique++] = ids[i];
+        }
+    }
+
+    // One batch of reads for all of them (position 0 is the sender)
+    p->accounts[0] = *sender;
+    for (size_t i = 0; i < unique; i++) {
+        snprintf(numbers[i], sizeof(numbers[i]), "%u", ids[i]);
+        names[i] = numbers[i];
+    }
+    load_accounts(names, p->accounts + 1, loaded, unique);
+    p->account_count = unique + 1;
+
+    bool ok = true;
+    for (size_t i = 0; i < p->leg_count; i++) {
+        uint32_t *pos = bsearch(&p->legs[i].to_id, ids, unique, sizeof(uint32_t), compare_ids);
+        if (!loaded[pos - ids]) {
+            line_error(errors, p->legs[i].line_no, "receiver account not found");
+            ok = false;
+        }
+    }
+    free(ids); free(numbers); free(names); free(loaded);
+    return ok;
+}
+
+/* Find a receiver in the plan's sorted accounts (never the sender) */
+static Account *plan_receiver(BulkPlan *p, uint32_t id) {
+    size_t low = 1, high = p->account_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        uint32_t mid_id = account_id_from_string(p->accounts[mid].account_number);
+        if (mid_id == id) {
+            return &p->accounts[mid];
+        }
+        if (mid_id < id) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return NULL;
+}
+
+/* Write the journal and make sure it is on disk before anything changes
+   Returns: false if it could not be written (nothing has been changed) */
+static bool write_journal(const BulkPlan *p) {
+    FILE *fp = fopen(BULK_JOURNAL, "w");
+    if (fp == NULL) {
+        return false;
+    }
+    fprintf(fp, "BULK %u %lld %zu %zu\n", p->sender_id, (long long)p->started,
+            p->leg_count, p->account_count);
+    for (size_t i = 0; i < p->account_count; i++) {
+        fprintf(fp, "ACCOUNT %s %lld %u\n", p->accounts[i].account_number,
+                amount_to_cents(p->accounts[i].balance), p->accounts[i].version);
+    }
+    for (size_t i = 0; i < p->leg_count; i++) {
+        fprintf(fp, "LEG %u %lld %lld\n", p->legs[i].to_id,
+                (long long)p->legs[i].amount_cents, (long long)p->legs[i].fee_cents);
+    }
+    // The body must be on disk before COMMIT is, or a crash could keep a
+    // COMMIT line after a torn body
+    bool ok = fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    ok = ok && fprintf(fp, "COMMIT\n") > 0 && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok) {
+        unlink(BULK_JOURNAL);
+    }
+    return ok;
+}
+
+/* Mark the journal's log records as written */
+static void journal_logged(void) {
+    FILE *fp = fopen(BULK_JOURNAL, "a");
+    if (fp != NULL) {
+        fprintf(fp, "LOGGED\n");
+        fflush(fp);
+        fsync(fileno(fp));
+        fclose(fp);
+    }
+}
+
+/* Finding a plan's records in the log: they were written with one write,
+   so they are next to each other and in the order of the legs */
+typedef struct {
+    const BulkPlan *plan;
+    size_t matched;
+    bool found;
+} LogSearch;
+
+static bool leg_matches(const BulkPlan *p, size_t i, const TxRecord *rec) {
+    return rec->op == TXOP_REMIT && rec->status == TXSTATUS_OK &&
+           rec->from_id == p->sender_id && rec->to_id == p->legs[i].to_id &&
+           rec->amount_cents == p->legs[i].amount_cents &&
+           rec->fee_cents == p->legs[i].fee_cents;
+}
+
+static bool visit_log(const TxRecord *rec, void *ctx) {
+    LogSearch *s = ctx;
+    if (!leg_matches(s->plan, s->matched, rec)) {
+        s->matched = 0;
+    }
+    if (leg_matches(s->plan, s->matched, rec)) {
+        s->matched++;
+    }
+    s->found = s->matched == s->plan->leg_count;
+    return !s->found;
+}
+
+/* Apply a plan: sender first (one write), then the receivers in account
+   number order (batches of writes), then one log write for every leg
+   Returns: false if an account could not be saved */
+static bool apply_accounts_and_log(const BulkPlan *p, bool check_log) {
+    bool ok = save_accounts(p->accounts, 1, true) == 1;
+    size_t receivers = p->account_count - 1;
+    ok = save_accounts(p->accounts + 1, receivers, true) == receivers && ok;
+    if (!ok) {
+        return false;   // Keep the journal: the next start tries again
+    }
+
+    if (check_log) {
+        // The records may have been written just before the crash
+        LogSearch search = { p, 0, false };
+        txlog_query(p->started, INT64_MAX, visit_log, &search);
+        if (search.found) {
+            return true;
+        }
+    }
+    TxRecord *records = calloc(p->leg_count, sizeof(TxRecord));
+    if (records == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < p->leg_count; i++) {
+        records[i].op = TXOP_REMIT;
+        records[i].status = TXSTATUS_OK;
+        records[i].from_id = p->sender_id;
+        records[i].to_id = p->legs[i].to_id;
+        records[i].amount_cents = p->legs[i].amount_cents;
+        records[i].fee_cents = p->legs[i].fee_cents;
+    }
+    txlog_append_batch(records, p->leg_count);
+    free(records);
+    return true;
+}
+
+// The same, as one update window (see store_update_begin())
+static bool apply_plan(const BulkPlan *p, bool check_log) {
+    int update = store_update_begin();
+    bool ok = apply_accounts_and_log(p, check_log);
+    store_update_end(update);
+    return ok;
+}
+
+static void recover_journal(void);
+
+/* Lock the sender and every receiver of a list: the shared mode locks
+   (see shared.h) and the records, so that no commit_accounts() of another
+   program saves one of them between loading and saving the list
+   Returns: The locked IDs (give them to unlock_list()), or NULL if there
+            was no memory or the records could not be locked */
+static uint32_t *lock_list(const BulkPlan *p, SharedHold *hold) {
+    hold->count = 0;
+    uint32_t *ids = malloc((p->leg_count + 1) * sizeof(uint32_t));
+    if (ids == NULL) {
+        return NULL;
+    }
+    ids[0] = p->sender_id;
+    for (size_t i = 0; i < p->leg_count; i++) {
+        ids[i + 1] = p->legs[i].to_id;
+    }
+    shared_lock_accounts(hold, ids, p->leg_count + 1);
+    if (!lock_account_records(ids, p->leg_count + 1)) {
+        shared_unlock_accounts(hold);
+        free(ids);
+        return NULL;
+    }
+    return ids;
+}
+
+static void unlock_list(const BulkPlan *p, SharedHold *hold, uint32_t *ids) {
+    unlock_account_records(ids, p->leg_count + 1);
+    shared_unlock_accounts(hold);
+    free(ids);
+}
+
+/* Check and pay a list whose lines have been read (steps 2 to 4 below)
+   "ok" is false if a line was wrong; the receivers are still looked up
+   so that every mistake is shown */
+static int settle_list(BulkPlan *p, const char *sender_num, bool ok, long *errors) {
+    // The sender is read again now that its lock is held
+    Account sender;
+    if (!load_account(sender_num, &sender)) {
+        printf("Error: Failed to load sender account.\n");
+        return 1;
+    }
+    if (p->leg_count > 0) {
+        // Also look up the receivers of the good lines, to show every mistake
+        ok = load_plan_accounts(p, &sender, errors) && ok;
+    }
+    if (!ok) {
+        if (*errors > MAX_SHOWN_ERRORS) {
+            printf("... and %ld more\n", *errors - MAX_SHOWN_ERRORS);
+        }
+        printf("Bulk remittance cancelled: nothing was transferred.\n");
+        return 1;
+    }
+
+    // STEP 3: Fees by receiver type, then the totals
+    int64_t total_amount = 0, total_fees = 0;
+    for (size_t i = 0; i < p->leg_count; i++) {
+        BulkLeg *leg = &p->legs[i];
+        Account *receiver = plan_receiver(p, leg->to_id);
+        leg->fee_cents = fee_for_remittance(sender.type, receiver->type, leg->amount_cents);
+        total_amount += leg->amount_cents;
+        total_fees += leg->fee_cents;
+        receiver->balance = (amount_to_cents(receiver->balance) + leg->amount_cents) / 100.0;
+    }
+    printf("Payments: %zu to %zu accounts\n", p->leg_count, p->account_count - 1);
+    printf("Total Amount: RM%.2f\n", total_amount / 100.0);
+    printf("Total Fees: RM%.2f\n", total_fees / 100.0);
+    printf("Total Deduction: RM%.2f\n", (total_amount + total_fees) / 100.0);
+
+    int64_t balance = amount_to_cents(sender.balance);
+    if (total_amount + total_fees > balance) {
+        printf("Error: Insufficient funds (balance RM%.2f).\n", balance / 100.0);
+        printf("Bulk remittance cancelled: nothing was transferred.\n");
+        return 1;
+    }
+    // The limits see the whole list as one remittance of the total
+    if (!velocity_check(sender_num, sender.type, VEL_REMIT, total_amount)) {
+        printf("Bulk remittance cancelled: nothing was transferred.\n");
+        return 1;
+    }
+    p->accounts[0].balance = (balance - total_amount - total_fees) / 100.0;
+
+    // STEP 4: Journal, accounts and log
+    p->started = (int64_t)time(NULL);
+    if (!write_journal(p)) {
+        printf("Error: Cannot write %s; nothing was transferred.\n", BULK_JOURNAL);
+        return 1;
+    }
+    if (!apply_plan(p, false)) {
+        printf("Error: Failed to save accounts; the transfer will be finished "
+               "the next time the program starts.\n");
+        return 1;
+    }
+    journal_logged();
+    unlink(BULK_JOURNAL);
+    velocity_record(sender_num, VEL_REMIT, total_amount);
+
+    printf("\n========================================\n");
+    printf("Bulk remittance successful!\n");
+    printf("Sender New Balance: RM%.2f\n", p->accounts[0].balance);
+    printf("========================================\n");
+    return 0;
+}
+
+/* Run bulk function
+   Purpose: Pay every line of a file from one account, all or nothing
+
+   Steps:
+   1. Check the sender's PIN (once)
+   2. Read and check every line, then load all the receivers at once
+   3. Work out each fee from the receiver's type and check the total
+      (amounts + fees) against the sender's balance and limits
+   4. Write the journal, then the accounts and the log, then remove it
+ */
+static int pay_list(const char *sender_num, const char *pin, const char *path) {
+    BulkPlan plan;
+    memset(&plan, 0, sizeof(plan));
+    long errors = 0;
+
+    // STEP 1: Authenticate the sender
+    if (!authenticate(sender_num, pin)) {
+        printf("Error: Authentication failed.\n");
+        return 1;
+    }
+    plan.sender_id = account_id_from_string(sender_num);
+
+    // STEP 2: Read the payments
+    bool ok = read_legs(path, plan.sender_id, &plan.legs, &plan.leg_count, &errors);
+    if (ok && plan.leg_count == 0) {
+        printf("Error: %s has no payments.\n", path);
+        ok = false;
+    }
+    // Only the sender's limits are counted (before the accounts are locked)
+    const char *counted[1] = { sender_num };
+    velocity_init_for(counted, 1);
+    // Nobody else changes these accounts until the list is paid
+    SharedHold hold;
+    uint32_t *locked = lock_list(&plan, &hold);
+    if (locked == NULL) {
+        printf("Error: Could not lock the accounts of the list.\n");
+        velocity_shutdown();
+        free_plan(&plan);
+        return 1;
+    }
+    int result = settle_list(&plan, sender_num, ok, &errors);
+    unlock_list(&plan, &hold, locked);
+    velocity_shutdown();
+    free_plan(&plan);
+    return result;
+}
+
+int run_bulk(const char *sender_num, const char *pin, const char *path) {
+    int lock = lock_bulk(LOCK_EX);
+    if (lock < 0) {
+        printf("Error: Cannot lock %s\n", BULK_LOCK);
+        return 1;
+    }
+    // A bulk remittance that stopped while we waited for the lock is finished first
+    recover_journal();
+    TRACE_REQUEST_BEGIN("bulk");
+    int result = pay_list(sender_num, pin, path);
+    TRACE_REQUEST_END("bulk");
+    unlock_bulk(lock);
+    return result;
+}
+
+/* Read a journal back (the versions before go to p->accounts[i].version;
+   *versioned is false if a line has none, in a journal of an older program)
+   Returns: false if it has no COMMIT line (it was never finished) */
+static bool read_journal(BulkPlan *p, bool *logged, bool *versioned) {
+    FILE *fp = fopen(BULK_JOURNAL, "r");
+    if (fp == NULL) {
+        return false;
+    }
+    char line[200];
+    bool committed = false;
+    size_t legs = 0, accounts = 0;
+    *logged = false;
+    *versioned = true;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char number[20];
+        unsigned int id, version;
+        long long a, b;
+        size_t n_legs, n_accounts;
+        int fields;
+        if (sscanf(line, "BULK %u %lld %zu %zu", &id, &a, &n_legs, &n_accounts) == 4 &&
+            p->legs == NULL) {
+            p->sender_id = id;
+            p->started = a;
+            p->legs = calloc(n_legs, sizeof(BulkLeg));
+            p->accounts = calloc(n_accounts, sizeof(Account));
+            p->leg_count = n_legs;
+            p->account_count = n_accounts;
+            if (p->legs == NULL || p->accounts == NULL) {
+                break;
+            }
+        } else if ((fields = sscanf(line, "ACCOUNT %19s %lld %u", number, &a, &version)) >= 2 &&
+                   p->accounts != NULL && accounts < p->account_count) {
+            strcpy(p->accounts[accounts].account_number, number);
+            p->accounts[accounts].version = fields == 3 ? version : 0;
+            *versioned = *versioned && fields == 3;
+            p->accounts[accounts++].balance = a / 100.0;
+        } else if (sscanf(line, "LEG %u %lld %lld", &id, &a, &b) == 3 && p->legs != NULL &&
+                   legs < p->leg_count) {
+            p->legs[legs].to_id = id;
+            p->legs[legs].amount_cents = a;
+            p->legs[legs++].fee_cents = b;
+        } else if (strcmp(line, "COMMIT\n") == 0) {
+            committed = legs == p->leg_count && accounts == p->account_count && p->legs != NULL;
+        } else if (strcmp(line, "LOGGED\n") == 0) {
+            *logged = true;
+        }
+    }
+    fclose(fp);
+    return committed;
+}
+
+/* Check journal accounts function
+   Purpose: Load the accounts of a journal (with their locks held) and
+   make sure nobody else changed one since the crash
+
+   An account still has its version from before (the crash came before
+   it was written) or that version + 1 and the journal's balance (it was
+   written). Anything else means another program saved it since, and
+   writing the journal's balance would throw that update away
+   Returns: false if an account is missing or was changed (it is reported)
+ */
+static bool check_journal_accounts(BulkPlan *p) {
+    for (size_t i = 0; i < p->account_count; i++) {
+        Account *acc = &p->accounts[i];
+        double balance = acc->balance;
+        uint32_t before = acc->version;
+        char number[20];
+        strcpy(number, acc->account_number);
+        if (!load_account(number, acc)) {
+            fprintf(stderr, "Warning: Account %s of the interrupted bulk remittance "
+                    "is missing; the journal was kept\n", number);
+            return false;
+        }
+        bool untouched = acc->version == before;
+        bool written = acc->version == before + 1 &&
+                       amount_to_cents(acc->balance) == amount_to_cents(balance);
+        if (!untouched && !written) {
+            fprintf(stderr, "Warning: Account %s was changed after the interrupted bulk "
+                    "remittance (version %u, expected %u); the journal was kept, "
+                    "check it by hand\n", number, acc->version, before);
+            return false;
+        }
+        // Only the balances come from the journal
+        acc->balance = balance;
+    }
+    return true;
+}
+
+/* Recover journal function (caller holds the bulk lock)
+   Purpose: Finish a bulk remittance that was interrupted by a crash
+
+   - No COMMIT line: the crash happened before anything was changed; the
+     journal is removed
+   - COMMIT line: the accounts are locked like a running bulk remittance
+     locks them. If none was changed by another program since the crash,
+     the final balances are written again (the names, PINs and types are
+     read from the account files), and the log records are written if
+     they cannot be found in the log. Otherwise nothing is written and
+     the journal is kept for someone to look at
+ */
+static void recover_journal(void) {
+    if (access(BULK_JOURNAL, F_OK) != 0) {
+        return;
+    }
+    BulkPlan plan;
+    memset(&plan, 0, sizeof(plan));
+    bool logged, versioned;
+    if (!read_journal(&plan, &logged, &versioned)) {
+        fprintf(stderr, "Warning: An unfinished bulk remittance was found; "
+                "nothing had been transferred and it was dropped\n");
+        free_plan(&plan);
+        unlink(BULK_JOURNAL);
+        return;
+    }
+    if (!versioned) {
+        fprintf(stderr, "Warning: %s has no account versions (an older program wrote it); "
+                "it was kept, check it by hand\n", BULK_JOURNAL);
+        free_plan(&plan);
+        return;
+    }
+
+    SharedHold hold;
+    uint32_t *locked = lock_list(&plan, &hold);
+    if (locked == NULL) {
+        fprintf(stderr, "Warning: Could not lock the accounts of the interrupted bulk "
+                "remittance; the journal was kept\n");
+        free_plan(&plan);
+        return;
+    }
+    if (check_journal_accounts(&plan)) {
+        if (apply_plan(&plan, !logged)) {
+            unlink(BULK_JOURNAL);
+            fprintf(stderr, "Warning: An interrupted bulk remittance from %u was finished "
+                    "(%zu payments)\n", plan.sender_id, plan.leg_count);
+        } else {
+            fprintf(stderr, "Warning: Could not save the accounts of the interrupted bulk "
+                    "remittance; the journal was kept\n");
+        }
+    }
+    unlock_list(&plan, &hold, locked);
+    free_plan(&plan);
+}
+
+// Start-up check: only a journal nobody holds the lock for is recovered
+void bulk_recover(void) {
+    if (access(BULK_JOURNAL, F_OK) != 0) {
+        return;
+    }
+    int lock = lock_bulk(LOCK_EX | LOCK_NB);
+    if (lock < 0) {
+        return;   // A bulk remittance is running; the journal is its own
+    }
+    recover_journal();
+    unlock_bulk(lock);
+}
@@ -0,0 +1,332 @@
+/* This file runs the command-line subcommands (see cli.h)
+
+   Each subcommand checks its arguments, calls the same functions as the
+   menu (deposit_amount(), open_new_account(), ...) and fills a small
+   list of fields, which is printed once at the end as JSON or TSV.
+   The functions it calls print their error messages with printf(), so
+   stdout is pointed at stderr while they run and the result is written
+   to a copy of the real stdout
+ */
+
+#include "cli.h"
+#include "account.h"
+#include "transaction.h"
+#include "utils.h"
+#include "velocity.h"
+#include "bulk.h"
+#include "store.h"
+#include "trace.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define CLI_MAX_FIELDS 12
+
+// The fields of one result, in the order they are printed
+typedef struct {
+    const char *names[CLI_MAX_FIELDS];
+    char values[CLI_MAX_FIELDS][128];
+    bool quoted[CLI_MAX_FIELDS];    // Text (a JSON string) or a number
+    int count;
+} CliResult;
+
+static void add_field(CliResult *r, const char *name, bool quoted, const char *format, ...) {
+    if (r->count >= CLI_MAX_FIELDS) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vsnprintf(r->values[r->count], sizeof(r->values[0]), format, args);
+    va_end(args);
+    r->names[r->count] = name;
+    r->quoted[r->count] = quoted;
+    r->count++;
+}
+
+static void print_json_text(FILE *out, const char *text) {
+    fputc('"', out);
+    for (; *text; text++) {
+        unsigned char c = (unsigned char)*text;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void print_result(FILE *out, bool tsv, const CliResult *r) {
+    if (tsv) {
+        for (int i = 0; i < r->count; i++) {
+            fprintf(out, "%s%s", i > 0 ? "\t" : "", r->names[i]);
+        }
+        fputc('\n', out);
+        for (int i = 0; i < r->count; i++) {
+            // A tab or line break inside a value would break the columns
+            fputs(i > 0 ? "\t" : "", out);
+            for (const char *c = r->values[i]; *c; c++) {
+                fputc(*c == '\t' || *c == '\n' ? ' ' : *c, out);
+            }
+        }
+        fputc('\n', out);
+        return;
+    }
+    fputc('{', out);
+    for (int i = 0; i < r->count; i++) {
+        fprintf(out, "%s\"%s\":", i > 0 ? "," : "", r->names[i]);
+        if (r->quoted[i]) {
+            print_json_text(out, r->values[i]);
+        } else {
+            fputs(r->values[i], out);
+        }
+    }
+    fputs("}\n", out);
+}
+
+// The result of a failed subcommand: its exit code and a name for it
+static int fail(CliResult *r, CliExit code) {
+    static const char *names[] = {
+        "ok", "failed", "usage", "auth_failed", "not_found",
+        "invalid", "insufficient_funds", "limit_exceeded"
+    };
+    add_field(r, "status", true, "error");
+    add_field(r, "error", true, "%s", names[code]);
+    add_field(r, "exit_code", false, "%d", (int)code);
+    return code;
+}
+
+static int fail_txn(CliResult *r, TxnStatus status) {
+    switch (status) {
+        case TXN_AUTH_FAILED: return fail(r, CLI_AUTH);
+        case TXN_NOT_FOUND:   return fail(r, CLI_NOT_FOUND);
+        case TXN_INVALID:     return fail(r, CLI_INVALID);
+        case TXN_NO_FUNDS:    return fail(r, CLI_NO_FUNDS);
+        case TXN_LIMIT:       return fail(r, CLI_LIMIT);
+        default:              return fail(r, CLI_FAILED);
+    }
+}
+
+/* Read an amount argument
+   Returns: false if it is not a number */
+static bool parse_amount(const char *text, double *amount) {
+    char *end;
+    errno = 0;
+    *amount = strtod(text, &end);
+    if (end == text || *end != '\0' || errno == ERANGE) {
+        fprintf(stderr, "Error: %s is not an amount.\n", text);
+        return false;
+    }
+    return true;
+}
+
+/* ---------- The subcommands ----------
+   args[0] is the name of the subcommand; each returns its exit code */
+
+static int cmd_balance(char **args, CliResult *r) {
+    Account acc;
+    if (load_authenticated(args[1], args[2], &acc) != TXN_OK) {
+        fprintf(stderr, "Error: Authentication failed.\n");
+        return fail(r, CLI_AUTH);
+    }
+    add_field(r, "status", true, "ok");
+    add_field(r, "account", true, "%s", acc.account_number);
+    add_field(r, "name", true, "%s", acc.name);
+    add_field(r, "type", true, "%s", account_type_to_string(acc.type));
+    add_field(r, "balance", false, "%.2f", acc.balance);
+    return CLI_OK;
+}
+
+static int cmd_money(char **args, CliResult *r) {
+    bool remit = strcmp(args[0], "remit") == 0;
+    double amount;
+    if (!parse_amount(args[remit ? 4 : 3], &amount)) {
+        return fail(r, CLI_INVALID);
+    }
+
+    TxnResult done;
+    TxnStatus status;
+    // A bulk remittance a crash interrupted is finished before money moves
+    bulk_recover();
+    // Only this account's limits are counted (the sender, for a remittance)
+    const char *counted[1] = { args[1] };
+    velocity_init_for(counted, 1);
+    if (remit) {
+        status = remit_amount(args[1], args[2], args[3], amount, &done);
+    } else if (strcmp(args[0], "deposit") == 0) {
+        status = deposit_amount(args[1], args[2], amount, &done);
+    } else {
+        status = withdraw_amount(args[1], args[2], amount, &done);
+    }
+    velocity_shutdown();
+    if (status == TXN_AUTH_FAILED) {
+        fprintf(stderr, "Error: Authentication failed.\n");
+    } else if (status == TXN_NOT_FOUND) {
+        fprintf(stderr, "Error: Receiver account not found.\n");
+    } else if (status == TXN_NO_FUNDS) {
+        fprintf(stderr, "Error: Insufficient funds.\n");
+    } else if (status == TXN_FAILED) {
+        fprintf(stderr, "Error: Failed to save the accounts.\n");
+    } else if (status == TXN_NOT_LOGGED) {
+        fprintf(stderr, "Error: Saved (balance RM%.2f), but not written to the transaction log.\n",
+                done.balance);
+    }
+    if (status != TXN_OK) {
+        return fail_txn(r, status);
+    }
+
+    add_field(r, "status", true, "ok");
+    add_field(r, "txn_id", false, "%llu", (unsigned long long)done.txn_id);
+    add_field(r, "account", true, "%s", args[1]);
+    add_field(r, "amount", false, "%.2f", amount);
+    add_field(r, "balance", false, "%.2f", done.balance);
+    if (remit) {
+        add_field(r, "to", true, "%s", args[3]);
+        add_field(r, "fee", false, "%.2f", done.fee);
+        add_field(r, "to_balance", false, "%.2f", done.receiver_balance);
+    }
+    return CLI_OK;
+}
+
+static int cmd_create(char **args, CliResult *r) {
+    Account acc;
+    memset(&acc, 0, sizeof(acc));
+    if (strlen(args[1]) >= sizeof(acc.name) || strlen(args[2]) >= sizeof(acc.id_number) ||
+        strlen(args[4]) >= sizeof(acc.pin)) {
+        fprintf(stderr, "Error: Name, ID number or PIN is too long.\n");
+        return fail(r, CLI_INVALID);
+    }
+    strcpy(acc.name, args[1]);
+    strcpy(acc.id_number, args[2]);
+    strcpy(acc.pin, args[4]);
+    if (strcmp(args[3], "savings") == 0) {
+        acc.type = SAVINGS;
+    } else if (strcmp(args[3], "current") == 0) {
+        acc.type = CURRENT;
+    } else {
+        fprintf(stderr, "Error: Account type must be savings or current.\n");
+        return fail(r, CLI_INVALID);
+    }
+    if (!is_valid_name(acc.name) || !is_valid_id(acc.id_number)) {
+        return fail(r, CLI_INVALID);
+    }
+    if (!is_valid_pin(acc.pin)) {
+        printf("Error: PIN must be exactly 4 digits.\n");
+        return fail(r, CLI_INVALID);
+    }
+    if (!open_new_account(&acc)) {
+        return fail(r, CLI_FAILED);
+    }
+    add_field(r, "status", true, "ok");
+    add_field(r, "account", true, "%s", acc.account_number);
+    add_field(r, "name", true, "%s", acc.name);
+    add_field(r, "type", true, "%s", account_type_to_string(acc.type));
+    add_field(r, "balance", false, "%.2f", acc.balance);
+    return CLI_OK;
+}
+
+static int cmd_delete(char **args, CliResult *r) {
+    // The same two checks as the menu: the PIN and the end of the ID number
+    Account acc;
+    size_t id_len;
+    if (load_authenticated(args[1], args[2], &acc) != TXN_OK ||
+        (id_len = strlen(acc.id_number)) < 4 || strcmp(&acc.id_number[id_len - 4], args[3]) != 0) {
+        fprintf(stderr, "Error: Authentication failed.\n");
+        return fail(r, CLI_AUTH);
+    }
+    double final_balance;
+    bulk_recover();   // Its final balance must include a list a crash interrupted
+    if (!remove_account(args[1], &final_balance)) {
+        return fail(r, CLI_FAILED);
+    }
+    add_field(r, "status", true, "ok");
+    add_field(r, "account", true, "%s", args[1]);
+    add_field(r, "final_balance", false, "%.2f", final_balance);
+    return CLI_OK;
+}
+
+typedef struct {
+    const char *name;
+    int arguments;             // Arguments after the name
+    const char *usage;
+    int (*run)(char **args, CliResult *r);
+} Subcommand;
+
+static const Subcommand subcommands[] = {
+    { "balance",  2, "balance <account> <pin>",                          cmd_balance },
+    { "deposit",  3, "deposit <account> <pin> <amount>",                 cmd_money },
+    { "withdraw", 3, "withdraw <account> <pin> <amount>",                cmd_money },
+    { "remit",    4, "remit <from> <pin> <to> <amount>",                 cmd_money },
+    { "create",   4, "create <name> <ID number> <savings|current> <pin>", cmd_create },
+    { "delete",   3, "delete <account> <pin> <last 4 of ID>",            cmd_delete },
+};
+
+#define SUBCOMMAND_COUNT (sizeof(subcommands) / sizeof(subcommands[0]))
+
+static const Subcommand *find_subcommand(const char *name) {
+    for (size_t i = 0; i < SUBCOMMAND_COUNT; i++) {
+        if (strcmp(subcommands[i].name, name) == 0) {
+            return &subcommands[i];
+        }
+    }
+    return NULL;
+}
+
+bool cli_is_subcommand(const char *arg) {
+    return strcmp(arg, "--json") == 0 || strcmp(arg, "--tsv") == 0 || find_subcommand(arg) != NULL;
+}
+
+/* Run subcommand function
+   Purpose: Run one subcommand and print its result
+
+   How it works:
+   1. Read the output format and find the subcommand
+   2. Keep a copy of stdout for the result; send everything else that is
+      printed (error messages of the checks) to stderr
+   3. Run it and print the result
+ */
+int run_subcommand(int argc, char *argv[]) {
+    // STEP 1: Format and subcommand
+    bool tsv = false;
+    int first = 1;
+    if (strcmp(argv[1], "--json") == 0 || strcmp(argv[1], "--tsv") == 0) {
+        tsv = strcmp(argv[1], "--tsv") == 0;
+        first = 2;
+    }
+    const Subcommand *cmd = first < argc ? find_subcommand(argv[first]) : NULL;
+    if (cmd == NULL || argc - first - 1 != cmd->arguments) {
+        fprintf(stderr, "Usage: banking_system [--json|--tsv] <subcommand>\n");
+        for (size_t i = 0; i < SUBCOMMAND_COUNT; i++) {
+            fprintf(stderr, "  %s\n", subcommands[i].usage);
+        }
+        return CLI_USAGE;
+    }
+
+    // STEP 2: Only the result goes to stdout
+    fflush(stdout);
+    int result_fd = dup(STDOUT_FILENO);
+    FILE *out = result_fd >= 0 ? fdopen(result_fd, "w") : NULL;
+    if (out == NULL || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+        fprintf(stderr, "Error: Cannot set up the output.\n");
+        return CLI_FAILED;
+    }
+
+    // STEP 3: Run it
+    CliResult result;
+    result.count = 0;
+    add_field(&result, "command", true, "%s", cmd->name);
+    TRACE_REQUEST_BEGIN(cmd->name);
+    int code = cmd->run(&argv[first], &result);
+    TRACE_REQUEST_END(cmd->name);
+    store_detach();
+    fflush(stdout);
+    print_result(out, tsv, &result);
+    fclose(out);
+    return code;
+}
@@ -0,0 +1,86 @@
+/* This file calculates CRC32C checksums
+   
+   How it works:
+   x86 processors with SSE4.2 have an instruction that adds 8 bytes to a
+   CRC32C at a time; it is used when the processor has it (checked once,
+   with cpuid). Everywhere else a table of 256 values is built the first
+   time it is needed, then the data is processed one byte at a time
+   using that table. Both give the same checksums
+ */
+
+#include "crc32c.h"
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define CRC32C_HAVE_SSE42 1
+#endif
+
+#define CRC32C_POLY 0x82F63B78u   /* Castagnoli polynomial (reversed) */
+
+typedef uint32_t (*CrcFunction)(uint32_t crc, const unsigned char *p, size_t len);
+
+static uint32_t table[256];
+static CrcFunction crc_function;
+static const char *crc_name;
+static pthread_once_t setup_once = PTHREAD_ONCE_INIT;
+
+/* One byte at a time with the lookup table (crc is already inverted) */
+static uint32_t crc32c_table(uint32_t crc, const unsigned char *p, size_t len) {
+    while (len--) {
+        crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef CRC32C_HAVE_SSE42
+/* Eight bytes at a time with the crc32 instruction (only called when
+   cpuid says the processor has SSE4.2) */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len) {
+    uint64_t c = crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);   // The data does not have to be aligned
+        c = _mm_crc32_u64(c, word);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)c;
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+/* Build the lookup table (one entry for every possible byte) and pick
+   the fastest way this processor has */
+static void setup(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        }
+        table[i] = c;
+    }
+    crc_function = crc32c_table;
+    crc_name = "table";
+#ifdef CRC32C_HAVE_SSE42
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc_function = crc32c_sse42;
+        crc_name = "sse4.2";
+    }
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&setup_once, setup);
+    return ~crc_function(~crc, data, len);
+}
+
+const char *crc32c_implementation(void) {
+    pthread_once(&setup_once, setup);
+    return crc_name;
+}
@@ -0,0 +1,575 @@
+/* This file is the account export (see export.h)
+
+   How the work is shared:
+   The store is cut into pieces of EXPORT_CHUNK accounts. Every thread
+   takes the next piece that nobody has taken, reads its cold records
+   (names and IDs) with one read and formats the piece into a buffer of
+   its own. The main thread writes the buffers out in piece order, one
+   write() per piece, so the output is always in store order however the
+   threads are scheduled.
+
+   There are only a few buffers (slots), and a thread waits before
+   starting a piece that is too far ahead of the writer, so memory stays
+   the same for ten accounts or ten million. Numbers are turned into
+   digits by hand: printf() would have to read its format string again
+   for every field of every account
+ */
+
+#include "export.h"
+#include "store.h"
+#include "utils.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define EXPORT_CHUNK 8192
+#define MAX_EXPORT_THREADS 64
+#define EXPORT_MAX_COLUMNS 6
+
+// Longest line one account can become: every character of the name and
+// ID escaped as \u00XX in JSON, plus the names and numbers of all columns
+#define EXPORT_ROW_MAX (256 + 6 * (MAX_NAME_LEN + MAX_ID_LEN))
+
+typedef enum { COL_ACCOUNT, COL_NAME, COL_ID, COL_TYPE, COL_BALANCE, COL_VERSION } Column;
+
+static const char *column_names[EXPORT_MAX_COLUMNS] = {
+    "account", "name", "id", "type", "balance", "version"
+};
+
+// What to write, from the command line
+typedef struct {
+    bool json;
+    Column columns[EXPORT_MAX_COLUMNS];
+    int column_count;
+    bool need_cold;            // A name or ID column was asked for
+    int type;                  // -1 for every type
+    int64_t min_cents;
+    int64_t max_cents;
+    int threads;
+    const char *path;          // NULL for stdout
+} ExportOptions;
+
+// A buffer for one piece that is being formatted or waiting to be written
+typedef struct {
+    char *text;
+    size_t length;
+    size_t rows;
+    bool ready;                // Formatted, not written yet
+} ExportSlot;
+
+typedef struct {
+    const ExportOptions *options;
+    const AccountHot *records;
+    size_t count;
+    size_t chunks;
+    ExportSlot *slots;
+    size_t slot_count;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;     // A slot became ready
+    pthread_cond_t emptied;    // The writer finished a slot
+    size_t next_chunk;         // Next piece to take (under lock)
+    size_t written;            // Pieces written so far (under lock)
+    bool stop;                 // The writer failed: take no more pieces
+    size_t rows;               // Accounts written so far (writer only)
+} Export;
+
+/* ---------- Formatting without printf ---------- */
+
+static char *put_text(char *p, const char *text) {
+    size_t length = strlen(text);
+    memcpy(p, text, length);
+    return p + length;
+}
+
+static char *put_u64(char *p, uint64_t value) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    while (n > 0) {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+// Cents as ringgit with two decimals, exp. 12345 -> 123.45
+static char *put_cents(char *p, int64_t cents) {
+    uint64_t magnitude = cents < 0 ? (uint64_t)0 - (uint64_t)cents : (uint64_t)cents;
+    if (cents < 0) {
+        *p++ = '-';
+    }
+    p = put_u64(p, magnitude / 100);
+    *p++ = '.';
+    *p++ = (char)('0' + magnitude % 100 / 10);
+    *p++ = (char)('0' + magnitude % 10);
+    return p;
+}
+
+// A fixed-width field of the cold record, which may fill it completely
+static size_t field_length(const char *field, size_t size) {
+    size_t n = 0;
+    while (n < size && field[n] != '\0') {
+        n++;
+    }
+    return n;
+}
+
+static char *put_json_text(char *p, const char *text, size_t length) {
+    static const char hex[] = "0123456789abcdef";
+    *p++ = '"';
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '"' || c == '\\') {
+            *p++ = '\\';
+            *p++ = (char)c;
+        } else if (c < 0x20) {
+            p = put_text(p, "\\u00");
+            *p++ = hex[c >> 4];
+            *p++ = hex[c & 15];
+        } else {
+            *p++ = (char)c;
+        }
+    }
+    *p++ = '"';
+    return p;
+}
+
+// Quoted only if needed (a comma, a quote or a line break inside)
+static char *put_csv_text(char *p, const char *text, size_t length) {
+    bool quote = false;
+    for (size_t i = 0; i < length && !quote; i++) {
+        quote = text[i] == ',' || text[i] == '"' || text[i] == '\n' || text[i] == '\r';
+    }
+    if (!quote) {
+        memcpy(p, text, length);
+        return p + length;
+    }
+    *p++ = '"';
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == '"') {
+            *p++ = '"';
+        }
+        *p++ = text[i];
+    }
+    *p++ = '"';
+    return p;
+}
+
+/* Format one account as a line of CSV, or as ",\n{...}" for JSON (the
+   writer drops the comma before the first account of the file) */
+static char *put_row(char *p, const ExportOptions *o, const AccountHot *hot,
+                     const AccountCold *cold) {
+    if (o->json) {
+        *p++ = ',';
+        *p++ = '\n';
+        *p++ = '{';
+    }
+    for (int i = 0; i < o->column_count; i++) {
+        Column column = o->columns[i];
+        if (o->json) {
+            if (i > 0) {
+                *p++ = ',';
+            }
+            *p++ = '"';
+            p = put_text(p, column_names[column]);
+            *p++ = '"';
+            *p++ = ':';
+        } else if (i > 0) {
+            *p++ = ',';
+        }
+        const char *text = NULL;
+        size_t length = 0;
+        switch (column) {
+            case COL_ACCOUNT:
+                p = put_u64(p, hot->account_id);
+                continue;
+            case COL_BALANCE:
+                p = put_cents(p, hot->balance_cents);
+                continue;
+            case COL_VERSION:
+                p = put_u64(p, hot->version);
+                continue;
+            case COL_TYPE:
+                text = account_type_to_string(hot->type == SAVINGS ? SAVINGS : CURRENT);
+                length = strlen(text);
+                break;
+            case COL_NAME:
+                text = cold->name;
+                length = field_length(cold->name, sizeof(cold->name));
+                break;
+            case COL_ID:
+                text = cold->id_number;
+                length = field_length(cold->id_number, sizeof(cold->id_number));
+                break;
+        }
+        p = o->json ? put_json_text(p, text, length) : put_csv_text(p, text, length);
+    }
+    if (o->json) {
+        *p++ = '}';
+    } else {
+        *p++ = '\n';
+    }
+    return p;
+}
+
+static bool row_wanted(const ExportOptions *o, const AccountHot *hot) {
+    return (o->type < 0 || (int)hot->type == o->type) &&
+           hot->balance_cents >= o->min_cents && hot->balance_cents <= o->max_cents;
+}
+
+/* Format one piece of the store into its slot */
+static void format_chunk(Export *e, size_t chunk, ExportSlot *slot, AccountCold *cold) {
+    const ExportOptions *o = e->options;
+    size_t start = chunk * EXPORT_CHUNK;
+    size_t end = start + EXPORT_CHUNK < e->count ? start + EXPORT_CHUNK : e->count;
+
+    // The names and IDs of the whole piece at once (only if they are printed)
+    bool have_cold = o->need_cold && cold != NULL && store_read_cold(start, end - start, cold);
+    AccountCold missing;
+    memset(&missing, 0, sizeof(missing));
+
+    char *p = slot->text;
+    slot->rows = 0;
+    for (size_t i = start; i < end; i++) {
+        const AccountHot *hot = &e->records[i];
+        if (hot->account_id == 0 || !row_wanted(o, hot)) {
+            continue;
+        }
+        const AccountCold *c = &missing;
+        if (have_cold && cold[i - start].account_id == hot->account_id) {
+            c = &cold[i - start];
+        } else if (o->need_cold && store_get_cold(hot->account_id, &missing)) {
+            // Moved by a removal while we read: look it up by its id
+            c = &missing;
+        }
+        p = put_row(p, o, hot, c);
+        slot->rows++;
+    }
+    slot->length = (size_t)(p - slot->text);
+}
+
+/* Export thread: take pieces until there are none left */
+static void *export_worker(void *arg) {
+    Export *e = arg;
+    AccountCold *cold = e->options->need_cold ? malloc(EXPORT_CHUNK * sizeof(AccountCold)) : NULL;
+    for (;;) {
+        pthread_mutex_lock(&e->lock);
+        // Wait until the writer has emptied the slot the next piece goes into
+        while (!e->stop && e->next_chunk < e->chunks &&
+               e->next_chunk >= e->written + e->slot_count) {
+            pthread_cond_wait(&e->emptied, &e->lock);
+        }
+        if (e->stop || e->next_chunk >= e->chunks) {
+            pthread_mutex_unlock(&e->lock);
+            break;
+        }
+        size_t chunk = e->next_chunk++;
+        pthread_mutex_unlock(&e->lock);
+
+        ExportSlot *slot = &e->slots[chunk % e->slot_count];
+        format_chunk(e, chunk, slot, cold);
+
+        pthread_mutex_lock(&e->lock);
+        slot->ready = true;
+        pthread_cond_broadcast(&e->filled);
+        pthread_mutex_unlock(&e->lock);
+    }
+    free(cold);
+    return NULL;
+}
+
+static bool write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+/* Write one formatted piece
+   Returns: false if the output could not be written */
+static bool write_piece(Export *e, int fd, const ExportSlot *slot) {
+    const char *text = slot->text;
+    size_t length = slot->length;
+    if (e->options->json && e->rows == 0 && length > 0) {
+        text++;                // No comma before the first account
+        length--;
+    }
+    e->rows += slot->rows;
+    return write_all(fd, text, length);
+}
+
+/* Write the pieces in order as the threads finish them
+   Returns: false if the output could not be written */
+static bool write_chunks(Export *e, int fd) {
+    for (size_t chunk = 0; chunk < e->chunks; chunk++) {
+        ExportSlot *slot = &e->slots[chunk % e->slot_count];
+        pthread_mutex_lock(&e->lock);
+        while (!slot->ready) {
+            pthread_cond_wait(&e->filled, &e->lock);
+        }
+        pthread_mutex_unlock(&e->lock);
+
+        bool ok = write_piece(e, fd, slot);
+
+        pthread_mutex_lock(&e->lock);
+        slot->ready = false;
+        e->written++;
+        e->stop = !ok;
+        pthread_cond_broadcast(&e->emptied);
+        pthread_mutex_unlock(&e->lock);
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* ---------- Command line ---------- */
+
+static bool parse_columns(const char *list, ExportOptions *o) {
+    o->column_count = 0;
+    const char *p = list;
+    while (*p != '\0') {
+        size_t length = strcspn(p, ",");
+        int found = -1;
+        for (int c = 0; c < EXPORT_MAX_COLUMNS; c++) {
+            if (strlen(column_names[c]) == length && strncmp(p, column_names[c], length) == 0) {
+                found = c;
+            }
+        }
+        if (found < 0 || o->column_count == EXPORT_MAX_COLUMNS) {
+            fprintf(stderr, "Error: Unknown column in %s (account, name, id, type, balance, "
+                    "version).\n", list);
+            return false;
+        }
+        o->columns[o->column_count++] = (Column)found;
+        p += length;
+        if (*p == ',') {
+            p++;
+        }
+    }
+    return o->column_count > 0;
+}
+
+static bool parse_ringgit(const char *text, int64_t *cents) {
+    char *end;
+    errno = 0;
+    double value = strtod(text, &end);
+    if (end == text || *end != '\0' || errno == ERANGE || value > 9e15 || value < -9e15) {
+        fprintf(stderr, "Error: %s is not an amount.\n", text);
+        return false;
+    }
+    *cents = (int64_t)(value * 100.0 + (value < 0 ? -0.5 : 0.5));
+    return true;
+}
+
+static bool parse_options(int argc, char *argv[], ExportOptions *o) {
+    memset(o, 0, sizeof(*o));
+    for (int c = 0; c < EXPORT_MAX_COLUMNS; c++) {
+        o->columns[c] = (Column)c;
+    }
+    o->column_count = EXPORT_MAX_COLUMNS;
+    o->type = -1;
+    o->min_cents = INT64_MIN;
+    o->max_cents = INT64_MAX;
+    o->threads = 4;
+
+    if (argc < 3 || (strcmp(argv[2], "csv") != 0 && strcmp(argv[2], "json") != 0)) {
+        return false;
+    }
+    o->json = strcmp(argv[2], "json") == 0;
+    int i = 3;
+    if (i < argc && strncmp(argv[i], "--", 2) != 0) {
+        o->path = strcmp(argv[i], "-") == 0 ? NULL : argv[i];
+        i++;
+    }
+    for (; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char *value = argv[i + 1];
+        if (strcmp(argv[i], "--columns") == 0) {
+            if (!parse_columns(value, o)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--type") == 0) {
+            if (strcmp(value, "savings") == 0) {
+                o->type = SAVINGS;
+            } else if (strcmp(value, "current") == 0) {
+                o->type = CURRENT;
+            } else {
+                fprintf(stderr, "Error: Account type must be savings or current.\n");
+                return false;
+            }
+        } else if (strcmp(argv[i], "--min") == 0) {
+            if (!parse_ringgit(value, &o->min_cents)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--max") == 0) {
+            if (!parse_ringgit(value, &o->max_cents)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            o->threads = atoi(value);
+        } else {
+            return false;
+        }
+    }
+    if (o->threads < 1) o->threads = 1;
+    if (o->threads > MAX_EXPORT_THREADS) o->threads = MAX_EXPORT_THREADS;
+    for (int c = 0; c < o->column_count; c++) {
+        o->need_cold = o->need_cold || o->columns[c] == COL_NAME || o->columns[c] == COL_ID;
+    }
+    return true;
+}
+
+/* Write the start of the file: the column names (CSV) or "[" (JSON) */
+static bool write_header(int fd, const ExportOptions *o) {
+    char header[128];
+    char *p = header;
+    if (o->json) {
+        *p++ = '[';
+    } else {
+        for (int c = 0; c < o->column_count; c++) {
+            if (c > 0) {
+                *p++ = ',';
+            }
+            p = put_text(p, column_names[o->columns[c]]);
+        }
+        *p++ = '\n';
+    }
+    return write_all(fd, header, (size_t)(p - header));
+}
+
+/* Export accounts function
+   Purpose: Write every account (that passes the filters) to a file
+
+   How it works:
+   1. Read the options and open the output
+   2. Map the store again (another program may have made it bigger) and
+      note its change counter
+   3. Start the threads and write their pieces in order
+   4. Finish the file and warn if the store changed while it was read
+ */
+int export_accounts(int argc, char *argv[]) {
+    // STEP 1: Options and output
+    ExportOptions options;
+    if (!parse_options(argc, argv, &options)) {
+        fprintf(stderr, "Usage: --export <csv|json> [file|-] [--columns account,name,id,type,"
+                "balance,version]\n"
+                "       [--type savings|current] [--min <RM>] [--max <RM>] [--threads <n>]\n");
+        return 1;
+    }
+    int fd = STDOUT_FILENO;
+    if (options.path != NULL) {
+        fd = open(options.path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "Error: Could not create %s\n", options.path);
+            return 1;
+        }
+    }
+
+    // STEP 2: The store as it is now
+    store_close();
+    if (!store_open() || store_count() == 0) {
+        fprintf(stderr, "Error: The account store is empty. Run --migrate first.\n");
+        if (fd != STDOUT_FILENO) {
+            close(fd);
+        }
+        return 1;
+    }
+    uint32_t changes_before = store_changes();
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    Export e;
+    memset(&e, 0, sizeof(e));
+    e.options = &options;
+    e.records = store_hot_records();
+    e.count = store_count();
+    e.chunks = (e.count + EXPORT_CHUNK - 1) / EXPORT_CHUNK;
+    e.slot_count = (size_t)options.threads * 2;
+    e.slots = calloc(e.slot_count, sizeof(ExportSlot));
+    bool ok = e.slots != NULL;
+    for (size_t s = 0; ok && s < e.slot_count; s++) {
+        e.slots[s].text = malloc((size_t)EXPORT_CHUNK * EXPORT_ROW_MAX);
+        ok = e.slots[s].text != NULL;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: Not enough memory for the export.\n");
+    }
+    pthread_mutex_init(&e.lock, NULL);
+    pthread_cond_init(&e.filled, NULL);
+    pthread_cond_init(&e.emptied, NULL);
+
+    // STEP 3: The threads format, this thread writes
+    ok = ok && write_header(fd, &options);
+    if (ok) {
+        pthread_t tids[MAX_EXPORT_THREADS];
+        int started = 0;
+        for (int i = 0; i < options.threads; i++) {
+            if (pthread_create(&tids[started], NULL, export_worker, &e) == 0) {
+                started++;
+            }
+        }
+        if (started > 0) {
+            ok = write_chunks(&e, fd);
+            for (int i = 0; i < started; i++) {
+                pthread_join(tids[i], NULL);
+            }
+        } else {
+            // No thread: format and write every piece here, one at a time
+            AccountCold *cold = malloc(EXPORT_CHUNK * sizeof(AccountCold));
+            for (size_t chunk = 0; ok && chunk < e.chunks; chunk++) {
+                format_chunk(&e, chunk, &e.slots[0], cold);
+                ok = write_piece(&e, fd, &e.slots[0]);
+            }
+            free(cold);
+        }
+    }
+
+    // STEP 4: End of the file
+    if (ok && options.json) {
+        ok = write_all(fd, e.rows > 0 ? "\n]\n" : "]\n", e.rows > 0 ? 3 : 2);
+    }
+    if (fd != STDOUT_FILENO && close(fd) != 0) {
+        ok = false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (!ok) {
+        fprintf(stderr, "Error: The export could not be written.\n");
+    } else {
+        fprintf(stderr, "Exported %zu of %zu accounts in %.3f s.\n", e.rows, e.count, seconds);
+        if (store_changes() != changes_before) {
+            fprintf(stderr, "Warning: Accounts changed during the export; run it again "
+                    "for a copy from a single moment.\n");
+        }
+    }
+    pthread_mutex_destroy(&e.lock);
+    pthread_cond_destroy(&e.filled);
+    pthread_cond_destroy(&e.emptied);
+    for (size_t s = 0; e.slots != NULL && s < e.slot_count; s++) {
+        free(e.slots[s].text);
+    }
+    free(e.slots);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,248 @@
+/* This file builds and reads the remittance fee table (see fees.h)
+
+   Fee schedule file format (one rule per line, # starts a comment):
+     <from type|*> <to type|*> <from amount RM> <percent> <flat RM> <min RM> <max RM>
+
+   Example:
+     *        *        0       1.0   0     0     0      (1% for everything)
+     savings  current  0       2.0   0     0.50  0      (2%, at least RM0.50)
+     savings  current  10000   1.5   0     0     500    (1.5% from RM10000, at most RM500)
+
+   - "*" matches every account type
+   - A rule applies to amounts from "from amount" up to the next rule's
+     "from amount" for the same pair of types
+   - A max of 0 means no maximum
+   - When two rules cover the same amounts, the later line wins
+   If the file exists it replaces the whole built-in schedule: pairs of
+   types without a rule pay no fee
+ */
+
+#include "fees.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define MAX_FEE_RULES 128
+#define ANY_TYPE -1
+
+// One line of the schedule (amounts in cents, percent in millionths)
+typedef struct {
+    int from;              // Account type, or ANY_TYPE
+    int to;
+    int64_t start_cents;   // Smallest amount the rule applies to
+    int64_t rate_ppm;      // 1% = 10000
+    int64_t flat_cents;
+    int64_t min_cents;
+    int64_t max_cents;     // 0 = no maximum
+} FeeRule;
+
+// One cell of the compiled table
+typedef struct {
+    int64_t rate_ppm;
+    int64_t flat_cents;
+    int64_t min_cents;
+    int64_t max_cents;     // INT64_MAX when there is no maximum
+} FeeCell;
+
+static const FeeRule default_rules[] = {
+    { ANY_TYPE, ANY_TYPE, 0, 10000, 0, 0, 0 },   // Same type: 1%
+    { SAVINGS,  CURRENT,  0, 20000, 0, 0, 0 },   // Savings → Current: 2%
+    { CURRENT,  SAVINGS,  0, 30000, 0, 0, 0 },   // Current → Savings: 3%
+};
+
+static FeeCell fee_table[ACCOUNT_TYPE_COUNT][ACCOUNT_TYPE_COUNT][FEE_MAX_TIERS];
+static pthread_once_t fees_built = PTHREAD_ONCE_INIT;
+static int64_t tier_start[FEE_MAX_TIERS];   // Unused tiers start at INT64_MAX
+static int tier_count;
+
+/* Turn "savings", "current" or "*" into a type
+   Returns: false if the name is not a known account type */
+static bool parse_type(const char *name, int *type) {
+    if (strcmp(name, "*") == 0) {
+        *type = ANY_TYPE;
+        return true;
+    }
+    for (int t = 0; t < ACCOUNT_TYPE_COUNT; t++) {
+        if (strcasecmp(name, account_type_to_string((AccountType)t)) == 0) {
+            *type = t;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Read the rules of FEES_CONFIG
+   Returns: The number of rules, or -1 if the file does not exist */
+static int load_rules(FeeRule *rules, int max_rules) {
+    FILE *fp = fopen(FEES_CONFIG, "r");
+    if (fp == NULL) {
+        return -1;
+    }
+
+    char line[200];
+    int line_no = 0, count = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line_no++;
+        line[strcspn(line, "#\n")] = '\0';
+
+        char from_str[20], to_str[20];
+        double start, percent, flat, min, max;
+        int fields = sscanf(line, "%19s %19s %lf %lf %lf %lf %lf",
+                            from_str, to_str, &start, &percent, &flat, &min, &max);
+        if (fields <= 0) {
+            continue;  // Empty line or comment
+        }
+
+        FeeRule *r = &rules[count];
+        if (fields != 7 || !parse_type(from_str, &r->from) || !parse_type(to_str, &r->to) ||
+            start < 0 || percent < 0 || flat < 0 || min < 0 || max < 0 || count == max_rules) {
+            fprintf(stderr, "Warning: %s line %d is invalid and was ignored\n",
+                    FEES_CONFIG, line_no);
+            continue;
+        }
+        r->start_cents = amount_to_cents(start);
+        r->rate_ppm = (int64_t)(percent * 10000 + 0.5);
+        r->flat_cents = amount_to_cents(flat);
+        r->min_cents = amount_to_cents(min);
+        r->max_cents = amount_to_cents(max);
+        count++;
+    }
+    fclose(fp);
+    return count;
+}
+
+/* Collect the different starting amounts of the rules as tiers (sorted) */
+static void build_tiers(const FeeRule *rules, int count) {
+    tier_count = 1;
+    tier_start[0] = 0;
+    for (int i = 0; i < count; i++) {
+        int64_t start = rules[i].start_cents;
+        bool known = false;
+        for (int t = 0; t < tier_count; t++) {
+            known = known || tier_start[t] == start;
+        }
+        if (known) {
+            continue;
+        }
+        if (tier_count == FEE_MAX_TIERS) {
+            fprintf(stderr, "Warning: Fee schedule has more than %d amount tiers; "
+                    "RM%.2f was ignored\n", FEE_MAX_TIERS, start / 100.0);
+            continue;
+        }
+        // Insert in order
+        int t = tier_count++;
+        while (t > 0 && tier_start[t - 1] > start) {
+            tier_start[t] = tier_start[t - 1];
+            t--;
+        }
+        tier_start[t] = start;
+    }
+    for (int t = tier_count; t < FEE_MAX_TIERS; t++) {
+        tier_start[t] = INT64_MAX;
+    }
+}
+
+/* Build fee table function
+   Purpose: Build the fee table from FEES_CONFIG or the defaults
+
+   For every (from, to, tier) cell the rule used is the matching one with
+   the highest starting amount that is not above the tier's start (the
+   later line if two are equal)
+ */
+static void build_fee_table(void) {
+    FeeRule rules[MAX_FEE_RULES];
+    int count = load_rules(rules, MAX_FEE_RULES);
+    if (count < 0) {
+        count = (int)(sizeof(default_rules) / sizeof(default_rules[0]));
+        memcpy(rules, default_rules, sizeof(default_rules));
+    }
+    build_tiers(rules, count);
+
+    for (int from = 0; from < ACCOUNT_TYPE_COUNT; from++) {
+        for (int to = 0; to < ACCOUNT_TYPE_COUNT; to++) {
+            for (int t = 0; t < FEE_MAX_TIERS; t++) {
+                const FeeRule *best = NULL;
+                for (int i = 0; i < count; i++) {
+                    const FeeRule *r = &rules[i];
+                    bool matches = (r->from == ANY_TYPE || r->from == from) &&
+                                   (r->to == ANY_TYPE || r->to == to) &&
+                                   r->start_cents <= tier_start[t];
+                    if (matches && (best == NULL || r->start_cents >= best->start_cents)) {
+                        best = r;
+                    }
+                }
+
+                FeeCell *cell = &fee_table[from][to][t];
+                memset(cell, 0, sizeof(*cell));
+                cell->max_cents = INT64_MAX;
+                if (best != NULL) {
+                    cell->rate_ppm = best->rate_ppm;
+                    cell->flat_cents = best->flat_cents;
+                    cell->min_cents = best->min_cents;
+                    cell->max_cents = best->max_cents > 0 ? best->max_cents : INT64_MAX;
+                }
+            }
+        }
+    }
+}
+
+/* Build the table the first time a fee is needed (only once, even when
+   several threads ask at the same moment), so a program that charges
+   no fee never reads FEES_CONFIG */
+void fees_init(void) {
+    pthread_once(&fees_built, build_fee_table);
+}
+
+/* Fee for remittance function
+   Purpose: Look up the fee of one transfer
+
+   The tier is found by counting the tier starts that are not above the
+   amount (unused tiers start at INT64_MAX and never count), so there is
+   no search and no branch on the schedule itself
+ */
+int64_t fee_for_remittance(AccountType from, AccountType to, int64_t amount_cents) {
+    fees_init();
+    int tier = 0;
+    for (int t = 1; t < FEE_MAX_TIERS; t++) {
+        tier += amount_cents >= tier_start[t];
+    }
+
+    const FeeCell *cell = &fee_table[from][to][tier];
+    int64_t fee = (amount_cents * cell->rate_ppm + 500000) / 1000000 + cell->flat_cents;
+    fee = fee < cell->min_cents ? cell->min_cents : fee;
+    fee = fee > cell->max_cents ? cell->max_cents : fee;
+    return fee;
+}
+
+/* Fees print schedule function
+   Purpose: Show the compiled table, one line per (from, to, tier) */
+void fees_print_schedule(void) {
+    fees_init();
+    printf("\n========================================\n");
+    printf("          REMITTANCE FEES\n");
+    printf("========================================\n");
+    printf("%-8s %-8s %13s %8s %8s %8s %10s\n", "From", "To", "Amount from", "Percent",
+           "Flat", "Min", "Max");
+    for (int from = 0; from < ACCOUNT_TYPE_COUNT; from++) {
+        for (int to = 0; to < ACCOUNT_TYPE_COUNT; to++) {
+            for (int t = 0; t < tier_count; t++) {
+                const FeeCell *cell = &fee_table[from][to][t];
+                char start[24], max[24] = "none";
+                snprintf(start, sizeof(start), "RM%.2f", tier_start[t] / 100.0);
+                if (cell->max_cents != INT64_MAX) {
+                    snprintf(max, sizeof(max), "RM%.2f", cell->max_cents / 100.0);
+                }
+                printf("%-8s %-8s %13s %7.3f%% %8.2f %8.2f %10s\n",
+                       account_type_to_string((AccountType)from),
+                       account_type_to_string((AccountType)to),
+                       start, cell->rate_ppm / 10000.0,
+                       cell->flat_cents / 100.0, cell->min_cents / 100.0, max);
+            }
+        }
+    }
+    printf("========================================\n");
+}
@@ -0,0 +1,580 @@
+/* This file is the read-only follower (see follower.h)
+
+   The follower has one thread. It waits in poll() for queries, and every
+   FOLLOW_POLL_MS milliseconds (or after a query) it reads whatever the
+   primary has added to the log. Because the same thread applies records
+   and answers queries, an answer always matches one point of the log:
+   the transaction ID it reports
+
+   Following the log across segments:
+   - The active segment is opened read-only and read from an offset
+   - When the primary closes it, the file is renamed but our descriptor
+     still points at it, so we read up to the footer and then open the
+     new active.bin (the old descriptor is kept until the new file is a
+     different one, so its inode number cannot be reused in between)
+   - If a transaction ID is skipped, a whole segment was closed while we
+     were not looking; the catalog is read again and that segment is
+     applied from its closed file
+ */
+
+#include "follower.h"
+#include "txlog.h"
+#include "utils.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define READ_RECORDS 256       // Records read from the log at once
+#define QUERY_MAX 256          // Longest query line
+#define REPLY_MAX 4096         // Longest answer
+
+// What the follower knows about one account
+typedef struct {
+    uint32_t account_id;        // 0 means the slot is empty
+    bool deleted;
+    int64_t balance_cents;
+    TxRecord *history;          // Last FOLLOW_HISTORY records (allocated on first use)
+    uint32_t history_count;     // Records ever added to the history
+} FollowAccount;
+
+typedef struct {
+    FollowAccount *table;       // Open addressing hash table
+    size_t capacity;
+    size_t used;
+
+    uint64_t applied_id;        // Last transaction applied
+    int64_t applied_ts;         // Time of that transaction
+    uint64_t damaged;           // Records skipped because of a bad checksum
+
+    int fd;                     // Segment being followed (-1 if none)
+    off_t offset;               // Next record to read from it
+    bool at_footer;             // The segment has been read up to its footer
+} Follower;
+
+typedef struct {
+    int fd;
+    size_t len;
+    char buf[QUERY_MAX];
+} Client;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_stop_signal(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static size_t hash_id(uint32_t id) {
+    uint32_t h = id * 2654435761u;
+    return (size_t)(h ^ (h >> 16));
+}
+
+/* Find (or add) an account in the table */
+static FollowAccount *find_account(Follower *f, uint32_t id, bool create) {
+    if (create && (f->used + 1) * 10 > f->capacity * 7) {
+        // Grow the table to twice the size
+        FollowAccount *old = f->table;
+        size_t old_capacity = f->capacity;
+        f->capacity = old_capacity ? old_capacity * 2 : 4096;
+        f->table = calloc(f->capacity, sizeof(FollowAccount));
+        if (f->table == NULL) {
+            fprintf(stderr, "Error: Out of memory in the follower\n");
+            exit(1);
+        }
+        f->used = 0;
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old[i].account_id != 0) {
+                *find_account(f, old[i].account_id, true) = old[i];
+            }
+        }
+        free(old);
+    }
+    if (f->capacity == 0) {
+        return NULL;
+    }
+
+    size_t mask = f->capacity - 1;
+    size_t i = hash_id(id) & mask;
+    while (f->table[i].account_id != 0) {
+        if (f->table[i].account_id == id) {
+            return &f->table[i];
+        }
+        i = (i + 1) & mask;
+    }
+    if (!create) {
+        return NULL;
+    }
+    memset(&f->table[i], 0, sizeof(FollowAccount));
+    f->table[i].account_id = id;
+    f->used++;
+    return &f->table[i];
+}
+
+/* Add a record to the history of an account, and change its balance */
+static void touch_account(Follower *f, uint32_t id, const TxRecord *rec, int64_t delta_cents) {
+    FollowAccount *acc = find_account(f, id, true);
+    if (acc->history == NULL) {
+        acc->history = malloc(FOLLOW_HISTORY * sizeof(TxRecord));
+        if (acc->history == NULL) {
+            fprintf(stderr, "Error: Out of memory in the follower\n");
+            exit(1);
+        }
+    }
+    acc->history[acc->history_count++ % FOLLOW_HISTORY] = *rec;
+
+    if (rec->status != TXSTATUS_OK) {
+        return;  // Failed operations are shown in the history but change nothing
+    }
+    if (rec->op == TXOP_CREATE) {
+        acc->balance_cents = 0;   // The number may have been used by a closed account
+        acc->deleted = false;
+    } else if (rec->op == TXOP_DELETE) {
+        acc->deleted = true;
+    } else {
+        acc->balance_cents += delta_cents;
+    }
+}
+
+/* Apply one valid record (records that were already applied are ignored) */
+static void apply_record(Follower *f, const TxRecord *rec) {
+    if (rec->txn_id <= f->applied_id) {
+        return;
+    }
+    switch (rec->op) {
+        case TXOP_CREATE:
+        case TXOP_DEPOSIT:
+        case TXOP_FEE_INCOME:
+            touch_account(f, rec->to_id, rec, rec->amount_cents);
+            break;
+        case TXOP_DELETE:
+        case TXOP_WITHDRAW:
+            touch_account(f, rec->from_id, rec, -rec->amount_cents);
+            break;
+        case TXOP_REMIT:
+            touch_account(f, rec->from_id, rec, -(rec->amount_cents + rec->fee_cents));
+            touch_account(f, rec->to_id, rec, rec->amount_cents);
+            break;
+        case TXOP_REVERSAL:
+            if (rec->from_id != 0) {
+                touch_account(f, rec->from_id, rec, -rec->amount_cents);
+            }
+            if (rec->to_id != 0) {
+                touch_account(f, rec->to_id, rec, rec->amount_cents + rec->fee_cents);
+            }
+            break;
+        default:
+            break;
+    }
+    f->applied_id = rec->txn_id;
+    f->applied_ts = rec->timestamp;
+}
+
+/* Apply every closed segment that holds transactions we have not seen
+   (at start-up: the whole log except the active segment) */
+static void catch_up(Follower *f) {
+    TxSegment *segments;
+    size_t count = txlog_segments(&segments);
+    for (size_t s = 0; s < count; s++) {
+        if (segments[s].active || segments[s].last_id <= f->applied_id) {
+            continue;
+        }
+        TxLogView view;
+        if (!txlog_map_segment(&segments[s], &view)) {
+            fprintf(stderr, "Warning: Could not read log segment %s\n", segments[s].path);
+            continue;
+        }
+        for (size_t i = 0; i < view.count; i++) {
+            if (txlog_record_valid(&view.records[i])) {
+                apply_record(f, &view.records[i]);
+            } else {
+                f->damaged++;
+            }
+        }
+        txlog_unmap(&view);
+    }
+    free(segments);
+}
+
+/* Open the active segment if it is not the file we already follow
+   Returns: true if a new file is being followed */
+static bool follow_active(Follower *f) {
+    int fd = open(TXLOG_ACTIVE, O_RDONLY);
+    if (fd < 0) {
+        fd = open(TXLOG_FILE, O_RDONLY);  // Log from before segments existed
+    }
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat now, old;
+    if (f->fd >= 0 && fstat(fd, &now) == 0 && fstat(f->fd, &old) == 0 &&
+        now.st_ino == old.st_ino && now.st_dev == old.st_dev) {
+        close(fd);   // Not renamed yet: still the segment we have read
+        return false;
+    }
+    if (f->fd >= 0) {
+        close(f->fd);
+    }
+    f->fd = fd;
+    f->offset = 0;
+    f->at_footer = false;
+    return true;
+}
+
+/* Read and apply the records added to the followed segment since last time */
+static void read_new_records(Follower *f) {
+    static TxRecord buffer[READ_RECORDS];
+
+    if (f->fd < 0 || f->at_footer) {
+        if (!follow_active(f)) {
+            return;
+        }
+    }
+
+    for (;;) {
+        ssize_t got = pread(f->fd, buffer, sizeof(buffer), f->offset);
+        size_t count = got > 0 ? (size_t)got / sizeof(TxRecord) : 0;
+        if (count == 0) {
+            return;  // Nothing new (a half-written record is read next time)
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            const TxRecord *rec = &buffer[i];
+            if (rec->magic == TXLOG_FOOTER_MAGIC) {
+                // Closed by the primary: continue with the new active segment
+                f->at_footer = true;
+                if (follow_active(f)) {
+                    read_new_records(f);
+                }
+                return;
+            }
+            if (!txlog_record_valid(rec)) {
+                if (i + 1 == count && (size_t)got == sizeof(buffer)) {
+                    break;  // Read it again with the records after it
+                }
+                if (i + 1 == count) {
+                    return;  // Last record of the file: may still be being written
+                }
+                f->damaged++;
+                f->offset += (off_t)sizeof(TxRecord);
+                continue;
+            }
+            if (rec->txn_id > f->applied_id + 1) {
+                catch_up(f);   // A whole segment was closed in between
+                if (rec->txn_id > f->applied_id + 1) {
+                    fprintf(stderr, "Warning: Transactions %llu to %llu are missing from the log\n",
+                            (unsigned long long)f->applied_id + 1,
+                            (unsigned long long)rec->txn_id - 1);
+                }
+            }
+            apply_record(f, rec);
+            f->offset += (off_t)sizeof(TxRecord);
+        }
+    }
+}
+
+/* Work out how far behind the primary we are
+   records: Records in the followed segment that are not applied yet
+   seconds: How much older our last record is than the newest one */
+static void replication_lag(const Follower *f, uint64_t *records, int64_t *seconds) {
+    *records = 0;
+    *seconds = 0;
+    struct stat st;
+    if (f->fd < 0 || fstat(f->fd, &st) != 0) {
+        return;
+    }
+
+    off_t end = st.st_size - st.st_size % (off_t)sizeof(TxRecord);
+    TxRecord newest;
+    while (end > f->offset &&
+           pread(f->fd, &newest, sizeof(newest), end - (off_t)sizeof(TxRecord)) == sizeof(newest) &&
+           newest.magic == TXLOG_FOOTER_MAGIC) {
+        end -= (off_t)sizeof(TxRecord);
+    }
+    if (end <= f->offset) {
+        return;
+    }
+    *records = (uint64_t)(end - f->offset) / sizeof(TxRecord);
+    if (txlog_record_valid(&newest) && newest.timestamp > f->applied_ts) {
+        *seconds = newest.timestamp - f->applied_ts;
+    }
+}
+
+/* Answer one query line into "reply"
+   Returns: The length of the answer */
+static size_t answer_query(Follower *f, const char *line, char *reply, size_t size) {
+    char command[16], number[20];
+    int count = FOLLOW_HISTORY;
+    int fields = sscanf(line, "%15s %19s %d", command, number, &count);
+    size_t len = 0;
+
+    if (fields >= 1 && strcmp(command, "status") == 0) {
+        uint64_t behind;
+        int64_t seconds;
+        char when[40] = "[no transactions yet]";
+        replication_lag(f, &behind, &seconds);
+        if (f->applied_id != 0) {
+            TxRecord last;
+            last.timestamp = f->applied_ts;
+            txlog_format_time(&last, when, sizeof(when));
+        }
+        return (size_t)snprintf(reply, size,
+                                "OK applied txn %llu %s, %llu records behind, lag %lld s, "
+                                "%zu accounts, %llu damaged records\n",
+                                (unsigned long long)f->applied_id, when,
+                                (unsigned long long)behind, (long long)seconds,
+                                f->used, (unsigned long long)f->damaged);
+    }
+
+    bool is_balance = fields >= 1 && strcmp(command, "balance") == 0;
+    bool is_history = fields >= 1 && strcmp(command, "history") == 0;
+    if (!is_balance && !is_history) {
+        return (size_t)snprintf(reply, size, "ERR unknown query (use balance, history or status)\n");
+    }
+    uint32_t id = fields >= 2 ? account_id_from_string(number) : 0;
+    if (id == 0) {
+        return (size_t)snprintf(reply, size, "ERR invalid account number\n");
+    }
+    FollowAccount *acc = find_account(f, id, false);
+    if (acc == NULL) {
+        return (size_t)snprintf(reply, size, "ERR account %u not found\n", id);
+    }
+
+    if (is_balance) {
+        if (acc->deleted) {
+            return (size_t)snprintf(reply, size, "ERR account %u is closed\n", id);
+        }
+        return (size_t)snprintf(reply, size, "OK %u RM%.2f as of txn %llu\n", id,
+                                acc->balance_cents / 100.0, (unsigned long long)f->applied_id);
+    }
+
+    // History: oldest of the last "count" records first
+    uint32_t kept = acc->history_count < FOLLOW_HISTORY ? acc->history_count : FOLLOW_HISTORY;
+    if (count < 1 || (uint32_t)count > kept) {
+        count = (int)kept;
+    }
+    for (uint32_t n = acc->history_count - (uint32_t)count; n < acc->history_count; n++) {
+        const TxRecord *rec = &acc->history[n % FOLLOW_HISTORY];
+        char when[40], what[160];
+        txlog_format_time(rec, when, sizeof(when));
+        txlog_describe(rec, what, sizeof(what));
+        int wrote = snprintf(reply + len, size - len, "%llu %s %s\n",
+                             (unsigned long long)rec->txn_id, when, what);
+        if (wrote < 0 || (size_t)wrote >= size - len) {
+            break;
+        }
+        len += (size_t)wrote;
+    }
+    int wrote = snprintf(reply + len, size - len, "OK %d transactions as of txn %llu\n",
+                         count, (unsigned long long)f->applied_id);
+    return wrote > 0 && (size_t)wrote < size - len ? len + (size_t)wrote : len;
+}
+
+/* Read what a client sent and answer every complete line
+   Returns: false when the client is gone */
+static bool serve_client(Follower *f, Client *c) {
+    static char reply[REPLY_MAX];
+
+    ssize_t got = read(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len);
+    if (got <= 0) {
+        return false;
+    }
+    c->len += (size_t)got;
+    c->buf[c->len] = '\0';
+
+    // Answer from the newest state of the log
+    read_new_records(f);
+
+    char *line = c->buf;
+    char *newline;
+    while ((newline = strchr(line, '\n')) != NULL) {
+        *newline = '\0';
+        size_t len = answer_query(f, line, reply, sizeof(reply));
+        for (size_t sent = 0; sent < len; ) {
+            ssize_t n = send(c->fd, reply + sent, len - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                return false;
+            }
+            sent += (size_t)n;
+        }
+        line = newline + 1;
+    }
+
+    // Keep the unfinished line; a line that fills the buffer is refused
+    c->len = strlen(line);
+    memmove(c->buf, line, c->len);
+    return c->len < sizeof(c->buf) - 1;
+}
+
+/* Create the listening socket (a stale socket file is removed first) */
+static int open_socket(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Error: Socket path is too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        printf("Error: Cannot listen on %s (%s)\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Run follower function
+   Purpose: Keep a read-only copy of every balance and answer queries
+
+   Parameters:
+     socket_path - Where to listen (NULL for FOLLOW_SOCKET)
+
+   Returns: 0 when stopped normally, 1 if the socket could not be opened
+ */
+int run_follower(const char *socket_path) {
+    const char *path = socket_path != NULL ? socket_path : FOLLOW_SOCKET;
+    Follower f;
+    memset(&f, 0, sizeof(f));
+    f.fd = -1;
+
+    // STEP 1: Apply the closed segments, then the active one
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    catch_up(&f);
+    read_new_records(&f);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("Follower loaded %zu accounts up to txn %llu in %.3f s\n", f.used,
+           (unsigned long long)f.applied_id,
+           (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    // STEP 2: Listen for queries
+    int listen_fd = open_socket(path);
+    if (listen_fd < 0) {
+        return 1;
+    }
+    signal(SIGINT, on_stop_signal);
+    signal(SIGTERM, on_stop_signal);
+    printf("Answering queries on %s (Ctrl+C to stop)\n", path);
+    fflush(stdout);
+
+    // STEP 3: Wait for queries and new records until we are stopped
+    struct pollfd fds[FOLLOW_MAX_CLIENTS + 1];
+    Client clients[FOLLOW_MAX_CLIENTS];
+    int client_count = 0;
+    while (!stop_requested) {
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for (int i = 0; i < client_count; i++) {
+            fds[i + 1].fd = clients[i].fd;
+            fds[i + 1].events = POLLIN;
+        }
+        int ready = poll(fds, (nfds_t)client_count + 1, FOLLOW_POLL_MS);
+        if (ready < 0 && errno != EINTR) {
+            break;
+        }
+
+        read_new_records(&f);
+        if (ready <= 0) {
+            continue;
+        }
+
+        // Clients first (removing one moves the last into its place)
+        for (int i = client_count - 1; i >= 0; i--) {
+            if (fds[i + 1].revents != 0 && !serve_client(&f, &clients[i])) {
+                close(clients[i].fd);
+                clients[i] = clients[--client_count];
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd >= 0 && client_count == FOLLOW_MAX_CLIENTS) {
+                close(fd);   // Too many connections; the client can try again
+            } else if (fd >= 0) {
+                clients[client_count].fd = fd;
+                clients[client_count].len = 0;
+                client_count++;
+            }
+        }
+    }
+
+    for (int i = 0; i < client_count; i++) {
+        close(clients[i].fd);
+    }
+    close(listen_fd);
+    unlink(path);
+    if (f.fd >= 0) {
+        close(f.fd);
+    }
+    for (size_t i = 0; i < f.capacity; i++) {
+        free(f.table[i].history);
+    }
+    free(f.table);
+    printf("\nFollower stopped at txn %llu\n", (unsigned long long)f.applied_id);
+    return 0;
+}
+
+/* Follower query function
+   Purpose: Send one query line to a follower and print its answer
+
+   Returns: 0 if the last line of the answer starts with "OK", 1 otherwise
+ */
+int follower_query(const char *socket_path, const char *query) {
+    const char *path = socket_path != NULL ? socket_path : FOLLOW_SOCKET;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        printf("Error: No follower is running on %s\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+
+    // Send the query, then say we are done so the follower closes after answering
+    char line[QUERY_MAX];
+    int len = snprintf(line, sizeof(line), "%s\n", query);
+    if (len <= 0 || (size_t)len >= sizeof(line) || write(fd, line, (size_t)len) != len) {
+        printf("Error: Could not send the query\n");
+        close(fd);
+        return 1;
+    }
+    shutdown(fd, SHUT_WR);
+
+    char reply[REPLY_MAX + 1];
+    size_t size = 0;
+    ssize_t got;
+    while (size < REPLY_MAX && (got = read(fd, reply + size, REPLY_MAX - size)) > 0) {
+        size += (size_t)got;
+    }
+    close(fd);
+    reply[size] = '\0';
+    fputs(reply, stdout);
+
+    // The answer ends with "OK ..." or "ERR ..."
+    char *last = size > 1 ? reply + size - 1 : reply;
+    while (last > reply && last[-1] != '\n') {
+        last--;
+    }
+    return strncmp(last, "OK", 2) == 0 ? 0 : 1;
+}
@@ -0,0 +1,790 @@
+/* This file is the integrity check (see fsck.h)
+
+   How the work is shared:
+   The account numbers of the index file are read first and sorted, so
+   every thread can look one up. The pieces of work are then chunks of
+   FSCK_CHUNK store records, the 256 top folders of the fan-out layout,
+   the flat folder (every thread helps with it, taking FSCK_NAME_BATCH
+   names at a time) and the log segments. Every thread takes the next
+   piece that nobody has taken (one atomic counter) and keeps its own
+   list of problems; the lists are put together at the end
+
+   An account file found in a folder marks its index entry; the entries
+   that no file marked have lost their file
+ */
+
+#include "fsck.h"
+#include "account.h"
+#include "store.h"
+#include "txlog.h"
+#include "layout.h"
+#include "crc32c.h"
+#include "utils.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define MAX_FSCK_THREADS 64
+#define FANOUT_FOLDERS 256
+#define STORE_RETRIES 3      // Looks at a hot record that is being changed in place
+
+typedef enum {
+    PROBLEM_DAMAGED_FILE,      // Checksum or fields of an account file are wrong
+    PROBLEM_ORPHAN_FILE,       // Account file that is not in the index
+    PROBLEM_MISSING_FILE,      // Index entry without an account file
+    PROBLEM_DUPLICATE_ENTRY,   // Account number that is in the index more than once
+    PROBLEM_NOT_IN_STORE,      // Account that has a file but no store record
+    PROBLEM_DAMAGED_STORE,     // Store record with a wrong checksum or index entry
+    PROBLEM_ORPHAN_STORE,      // Store record whose account is not in the index
+    PROBLEM_DAMAGED_LOG,       // Log record with a wrong checksum
+    PROBLEM_KINDS
+} ProblemKind;
+
+static const char *const problem_titles[PROBLEM_KINDS] = {
+    "Damaged account files",
+    "Account files not in the index",
+    "Index entries without a file",
+    "Index entries listed twice",
+    "Accounts missing from the store",
+    "Damaged store records",
+    "Store records not in the index",
+    "Damaged log records"
+};
+
+typedef struct {
+    ProblemKind kind;
+    uint32_t account_id;   // 0 if it is not known
+    size_t position;       // Position in the store, or record number in a log segment
+    char path[128];        // Account file or log segment ("" for the others)
+} Problem;
+
+// What one thread (and then the whole check) found
+typedef struct {
+    Problem *items;
+    size_t count;
+    size_t capacity;
+    uint64_t files;            // Account files checked
+    uint64_t unchecksummed;    // ... of which have no checksum line yet
+    uint64_t store_records;
+    uint64_t log_records;
+    int unreadable;            // Log segments that could not be read
+} Findings;
+
+/* One check: pieces 0 .. store_chunks-1 are store chunks, then the
+   fan-out folders, then one piece per thread for the flat folder, then
+   the log segments */
+typedef struct {
+    uint32_t *index_ids;       // Account numbers of the index file, sorted
+    size_t index_count;
+    unsigned char *has_file;   // Set for an index entry when its file is found
+
+    size_t store_count;
+    size_t store_chunks;
+    const TxSegment *segments;
+    size_t segment_count;
+    int threads;
+    size_t pieces;
+    size_t next_piece;         // Taken with an atomic add
+
+    DIR *flat;                 // The flat folder, shared by all threads
+    pthread_mutex_t flat_lock;
+} Check;
+
+typedef struct {
+    Check *check;
+    Findings found;
+    AccountCold *cold;         // One chunk of cold records
+} CheckWorker;
+
+static void add_problem(Findings *f, ProblemKind kind, uint32_t account_id,
+                        size_t position, const char *path) {
+    if (f->count == f->capacity) {
+        size_t capacity = f->capacity ? f->capacity * 2 : 64;
+        Problem *items = realloc(f->items, capacity * sizeof(Problem));
+        if (items == NULL) {
+            return;   // Out of memory: the problem is not listed
+        }
+        f->items = items;
+        f->capacity = capacity;
+    }
+    Problem *p = &f->items[f->count++];
+    p->kind = kind;
+    p->account_id = account_id;
+    p->position = position;
+    snprintf(p->path, sizeof(p->path), "%s", path != NULL ? path : "");
+}
+
+/* Find an account number in the sorted index entries
+   Returns: its entry, or -1 if it is not in the index */
+static long find_entry(const Check *c, uint32_t id) {
+    size_t low = 0, high = c->index_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (c->index_ids[mid] < id) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low < c->index_count && c->index_ids[low] == id ? (long)low : -1;
+}
+
+/* Check one account file: is it in the index, in the store, and whole? */
+static void check_file(Check *c, Findings *f, const char *path, const char *account_num) {
+    uint32_t id = account_id_from_string(account_num);
+    f->files++;
+
+    long entry = find_entry(c, id);
+    if (entry < 0) {
+        add_problem(f, PROBLEM_ORPHAN_FILE, id, 0, path);
+    } else {
+        __atomic_store_n(&c->has_file[entry], 1, __ATOMIC_RELAXED);
+    }
+
+    Account acc;
+    bool checksummed = false;
+    if (!read_account_file(path, &acc, &checksummed) ||
+        strcmp(acc.account_number, account_num) != 0) {
+        add_problem(f, PROBLEM_DAMAGED_FILE, id, 0, path);
+        return;
+    }
+    if (!checksummed) {
+        f->unchecksummed++;
+    }
+    if (c->store_count > 0 && entry >= 0 && store_position(id) < 0) {
+        add_problem(f, PROBLEM_NOT_IN_STORE, id, 0, path);
+    }
+}
+
+/* Check every account file of one top folder of the fan-out layout */
+static void check_fanout_folder(Check *c, Findings *f, int folder) {
+    char top[64], sub[128], path[300], account_num[32];
+    snprintf(top, sizeof(top), "%s/%02x", DATABASE_DIR, folder);
+    DIR *outer = opendir(top);
+    if (outer == NULL) {
+        return;   // No account hashed into this folder (or not fan-out at all)
+    }
+    struct dirent *level;
+    while ((level = readdir(outer)) != NULL) {
+        if (strlen(level->d_name) != 2 || level->d_name[0] == '.') {
+            continue;   // The sub-folders are two hex digits
+        }
+        snprintf(sub, sizeof(sub), "%s/%.2s", top, level->d_name);
+        DIR *inner = opendir(sub);
+        if (inner == NULL) {
+            continue;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(inner)) != NULL) {
+            if (layout_is_account_file(entry->d_name, account_num, sizeof(account_num))) {
+                snprintf(path, sizeof(path), "%s/%s.txt", sub, account_num);
+                check_file(c, f, path, account_num);
+            }
+        }
+        closedir(inner);
+    }
+    closedir(outer);
+}
+
+/* Help with the flat folder: take names from the shared stream, then
+   check those files without holding the lock, until it is empty */
+static void check_flat_folder(Check *c, Findings *f) {
+    char batch[FSCK_NAME_BATCH][32];
+    char path[300];
+    if (c->flat == NULL) {
+        return;
+    }
+    for (;;) {
+        int count = 0;
+        pthread_mutex_lock(&c->flat_lock);
+        struct dirent *entry;
+        while (count < FSCK_NAME_BATCH && (entry = readdir(c->flat)) != NULL) {
+            if (layout_is_account_file(entry->d_name, batch[count], sizeof(batch[0]))) {
+                count++;
+            }
+        }
+        pthread_mutex_unlock(&c->flat_lock);
+        if (count == 0) {
+            return;
+        }
+        for (int i = 0; i < count; i++) {
+            layout_path_in(DATABASE_DIR, batch[i], false, path, sizeof(path));
+            check_file(c, f, path, batch[i]);
+        }
+    }
+}
+
+/* Check whether a store record is whole and the index points at it; a
+   hot record another program is changing may be looked at halfway, so
+   one that looks damaged is looked at again */
+static bool store_record_ok(size_t position, const AccountCold *cold) {
+    const AccountHot *records = store_hot_records();
+    AccountHot hot = records[position];
+    for (int retry = 0; !store_hot_valid(&hot) && retry < STORE_RETRIES; retry++) {
+        struct timespec pause = { 0, 1000000 };
+        nanosleep(&pause, NULL);
+        hot = records[position];
+    }
+    return store_hot_valid(&hot) && store_cold_valid(cold) &&
+           cold->account_id == hot.account_id &&
+           store_position(hot.account_id) == (long)position;
+}
+
+/* Check one chunk of store records */
+static void check_store_chunk(Check *c, CheckWorker *w, size_t chunk) {
+    Findings *f = &w->found;
+    size_t start = chunk * FSCK_CHUNK;
+    size_t end = start + FSCK_CHUNK < c->store_count ? start + FSCK_CHUNK : c->store_count;
+    const AccountHot *records = store_hot_records();
+    bool have_cold = store_read_cold(start, end - start, w->cold);
+
+    for (size_t i = start; i < end; i++) {
+        uint32_t id = records[i].account_id;
+        f->store_records++;
+        if (!have_cold || !store_record_ok(i, &w->cold[i - start])) {
+            add_problem(f, PROBLEM_DAMAGED_STORE, id, i, NULL);
+        } else if (find_entry(c, id) < 0) {
+            add_problem(f, PROBLEM_ORPHAN_STORE, id, i, NULL);
+        }
+    }
+}
+
+/* Check every record of one log segment */
+static void check_segment(const TxSegment *segment, Findings *f) {
+    TxLogView view;
+    if (!txlog_map_segment(segment, &view)) {
+        fprintf(stderr, "Warning: Could not read log segment %s\n", segment->path);
+        f->unreadable++;
+        return;
+    }
+    for (size_t i = 0; i < view.count; i++) {
+        f->log_records++;
+        if (txlog_record_valid(&view.records[i])) {
+            continue;
+        }
+        if (segment->active && i == view.count - 1) {
+            continue;   // The newest record may still be being written
+        }
+        add_problem(f, PROBLEM_DAMAGED_LOG, 0, i, segment->path);
+    }
+    txlog_unmap(&view);
+}
+
+/* Check thread: take pieces of work until there are none left */
+static void *check_worker(void *arg) {
+    CheckWorker *w = arg;
+    Check *c = w->check;
+    size_t fanout_end = c->store_chunks + FANOUT_FOLDERS;
+    size_t flat_end = fanout_end + (size_t)c->threads;
+    for (;;) {
+        size_t piece = __atomic_fetch_add(&c->next_piece, 1, __ATOMIC_RELAXED);
+        if (piece >= c->pieces) {
+            return NULL;
+        }
+        if (piece < c->store_chunks) {
+            check_store_chunk(c, w, piece);
+        } else if (piece < fanout_end) {
+            check_fanout_folder(c, &w->found, (int)(piece - c->store_chunks));
+        } else if (piece < flat_end) {
+            check_flat_folder(c, &w->found);
+        } else {
+            check_segment(&c->segments[piece - flat_end], &w->found);
+        }
+    }
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Read the account numbers of the index file as they are now, sorted
+   (an account listed twice is there twice)
+   Returns: the numbers (free() them), or NULL if there is no memory */
+static uint32_t *load_index_ids(size_t *count) {
+    size_t capacity = 4096;
+    uint32_t *ids = malloc(capacity * sizeof(uint32_t));
+    *count = 0;
+    if (ids == NULL) {
+        return NULL;
+    }
+    FILE *fp = fopen(INDEX_FILE, "r");
+    if (fp != NULL) {
+        char line[100];
+        while (fgets(line, sizeof(line), fp) != NULL) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] == '\0') {
+                continue;
+            }
+            if (*count == capacity) {
+                capacity *= 2;
+                uint32_t *more = realloc(ids, capacity * sizeof(uint32_t));
+                if (more == NULL) {
+                    fclose(fp);
+                    free(ids);
+                    return NULL;
+                }
+                ids = more;
+            }
+            ids[(*count)++] = account_id_from_string(line);
+        }
+        fclose(fp);
+    }
+    qsort(ids, *count, sizeof(uint32_t), compare_u32);
+    return ids;
+}
+
+/* Read the account numbers of the index file, sorted, without the
+   duplicates (which are added to the findings)
+   Returns: false if there is no memory for them */
+static bool read_index(Check *c, Findings *f) {
+    c->index_ids = load_index_ids(&c->index_count);
+    if (c->index_ids == NULL) {
+        return false;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < c->index_count; i++) {
+        if (kept > 0 && c->index_ids[kept - 1] == c->index_ids[i]) {
+            add_problem(f, PROBLEM_DUPLICATE_ENTRY, c->index_ids[i], 0, NULL);
+        } else {
+            c->index_ids[kept++] = c->index_ids[i];
+        }
+    }
+    c->index_count = kept;
+    c->has_file = calloc(kept + 1, 1);
+    return c->has_file != NULL;
+}
+
+/* Run the check with "threads" threads and put their findings together */
+static void run_check(Check *c, Findings *out) {
+    CheckWorker workers[MAX_FSCK_THREADS];
+    pthread_t tids[MAX_FSCK_THREADS];
+    bool started[MAX_FSCK_THREADS];
+    for (int i = 0; i < c->threads; i++) {
+        memset(&workers[i], 0, sizeof(CheckWorker));
+        workers[i].check = c;
+        workers[i].cold = malloc(FSCK_CHUNK * sizeof(AccountCold));
+        if (workers[i].cold == NULL) {
+            workers[i].cold = malloc(sizeof(AccountCold));   // Store chunks then read as damaged
+        }
+        started[i] = pthread_create(&tids[i], NULL, check_worker, &workers[i]) == 0;
+        if (!started[i]) {
+            check_worker(&workers[i]);   // No thread: do the work ourselves
+        }
+    }
+
+    for (int i = 0; i < c->threads; i++) {
+        if (started[i]) {
+            pthread_join(tids[i], NULL);
+        }
+        Findings *f = &workers[i].found;
+        Problem *items = f->count > 0 ? realloc(out->items, (out->count + f->count) * sizeof(Problem))
+                                      : out->items;
+        if (items != NULL) {
+            memcpy(items + out->count, f->items, f->count * sizeof(Problem));
+            out->items = items;
+            out->count += f->count;
+            out->capacity = out->count;
+        }
+        out->files += f->files;
+        out->unchecksummed += f->unchecksummed;
+        out->store_records += f->store_records;
+        out->log_records += f->log_records;
+        out->unreadable += f->unreadable;
+        free(f->items);
+        free(workers[i].cold);
+    }
+}
+
+// Order of the report: by kind, then file, then position, then account
+static int compare_problems(const void *a, const void *b) {
+    const Problem *x = a, *y = b;
+    if (x->kind != y->kind) {
+        return x->kind < y->kind ? -1 : 1;
+    }
+    int by_path = strcmp(x->path, y->path);
+    if (by_path != 0) {
+        return by_path;
+    }
+    if (x->position != y->position) {
+        return x->position < y->position ? -1 : 1;
+    }
+    return compare_u32(&x->account_id, &y->account_id);
+}
+
+static void print_problem(const Problem *p) {
+    switch (p->kind) {
+        case PROBLEM_DAMAGED_FILE:
+        case PROBLEM_ORPHAN_FILE:
+        case PROBLEM_NOT_IN_STORE:
+            printf("  - %s\n", p->path);
+            break;
+        case PROBLEM_MISSING_FILE:
+        case PROBLEM_DUPLICATE_ENTRY:
+            printf("  - account %u\n", p->account_id);
+            break;
+        case PROBLEM_DAMAGED_STORE:
+        case PROBLEM_ORPHAN_STORE:
+            printf("  - position %zu (account %u)\n", p->position, p->account_id);
+            break;
+        default:
+            printf("  - %s record %zu\n", p->path, p->position);
+            break;
+    }
+}
+
+static void print_report(const Findings *f, const Check *c, double seconds) {
+    printf("\n========================================\n");
+    printf("           INTEGRITY CHECK\n");
+    printf("========================================\n");
+    printf("Checksums:      CRC32C (%s)\n", crc32c_implementation());
+    printf("Account files:  %llu checked, %llu without a checksum yet\n",
+           (unsigned long long)f->files, (unsigned long long)f->unchecksummed);
+    printf("Index entries:  %zu\n", c->index_count);
+    printf("Store records:  %llu checked\n", (unsigned long long)f->store_records);
+    printf("Log records:    %llu checked in %zu segments\n",
+           (unsigned long long)f->log_records, c->segment_count);
+    printf("Time:           %.3f s\n", seconds);
+
+    size_t shown = 0;
+    for (size_t i = 0; i < f->count; i++) {
+        const Problem *p = &f->items[i];
+        if (i == 0 || p->kind != f->items[i - 1].kind) {
+            size_t same = 0;
+            while (i + same < f->count && f->items[i + same].kind == p->kind) {
+                same++;
+            }
+            printf("----------------------------------------\n");
+            printf("%s: %zu\n", problem_titles[p->kind], same);
+            shown = 0;
+        }
+        if (shown < FSCK_SHOW) {
+            print_problem(p);
+        } else if (shown == FSCK_SHOW) {
+            printf("  ...\n");
+        }
+        shown++;
+    }
+    printf("========================================\n");
+    if (f->count == 0) {
+        printf("Result: CLEAN\n");
+    } else {
+        printf("Result: %zu PROBLEMS FOUND\n", f->count);
+    }
+    printf("========================================\n");
+}
+
+/* Move a file into QUARANTINE_DIR (under a new name if it is taken) */
+static bool move_to_quarantine(const char *path) {
+    const char *name = strrchr(path, '/');
+    name = name != NULL ? name + 1 : path;
+    char target[300];
+    snprintf(target, sizeof(target), "%s/%s", QUARANTINE_DIR, name);
+    for (int n = 1; access(target, F_OK) == 0; n++) {
+        snprintf(target, sizeof(target), "%s/%s.%d", QUARANTINE_DIR, name, n);
+    }
+    return rename(path, target) == 0;
+}
+
+/* Check again, with the store held, that an account file still has the
+   problem found before: a file that was being saved could be read
+   halfway, and a new account's file is saved before its number is added
+   to the index ("now" is the index as it is under the hold) */
+static bool file_still_bad(const Problem *p, const uint32_t *now, size_t now_count) {
+    if (p->kind == PROBLEM_ORPHAN_FILE) {
+        return now != NULL &&
+               bsearch(&p->account_id, now, now_count, sizeof(uint32_t), compare_u32) == NULL;
+    }
+    const char *name = strrchr(p->path, '/');
+    char account_num[32];
+    Account acc;
+    bool checksummed = false;
+    return !layout_is_account_file(name != NULL ? name + 1 : p->path, account_num, sizeof(account_num)) ||
+           !read_account_file(p->path, &acc, &checksummed) ||
+           strcmp(acc.account_number, account_num) != 0;
+}
+
+/* Take the index entries that lost their file out of the index, and
+   write them to QUARANTINE_DIR/index_entries.txt
+   Returns: the number of entries taken out */
+static size_t quarantine_index_entries(const uint32_t *ids, size_t count) {
+    char path[300], line[100];
+    snprintf(path, sizeof(path), "%s/index_entries.txt", QUARANTINE_DIR);
+    FILE *index_fp = fopen(INDEX_FILE, "r");
+    FILE *temp_fp = fopen("database/temp_index.txt", "w");
+    FILE *out_fp = fopen(path, "a");
+    size_t removed = 0;
+    if (index_fp != NULL && temp_fp != NULL && out_fp != NULL) {
+        while (fgets(line, sizeof(line), index_fp) != NULL) {
+            line[strcspn(line, "\r\n")] = '\0';
+            uint32_t id = account_id_from_string(line);
+            if (line[0] != '\0' && bsearch(&id, ids, count, sizeof(uint32_t), compare_u32) != NULL) {
+                fprintf(out_fp, "%s\n", line);
+                removed++;
+            } else {
+                fprintf(temp_fp, "%s\n", line);
+            }
+        }
+    }
+    if (index_fp != NULL) fclose(index_fp);
+    if (out_fp != NULL) fclose(out_fp);
+    if (temp_fp != NULL && fclose(temp_fp) == 0 && removed > 0) {
+        rename("database/temp_index.txt", INDEX_FILE);
+    } else {
+        remove("database/temp_index.txt");
+        removed = 0;
+    }
+    return removed;
+}
+
+// Store problems by position, whatever their kind
+static int compare_positions(const void *a, const void *b) {
+    const Problem *x = a, *y = b;
+    return x->position < y->position ? -1 : x->position > y->position;
+}
+
+/* Take damaged and orphaned records out of the store, after writing
+   them (hot record, then cold record) to QUARANTINE_DIR/store_records.bin
+   The positions were found before the store was held, so each record is
+   checked again first
+   Returns: the number of records taken out */
+static size_t quarantine_store_records(const Problem *items, size_t count, const Check *c) {
+    size_t *positions = malloc((count + 1) * sizeof(size_t));
+    char path[300];
+    snprintf(path, sizeof(path), "%s/store_records.bin", QUARANTINE_DIR);
+    FILE *out_fp = fopen(path, "ab");
+    if (positions == NULL || out_fp == NULL) {
+        free(positions);
+        if (out_fp != NULL) fclose(out_fp);
+        return 0;
+    }
+
+    // The problems are in position order: go from the highest down
+    // (a record taken out is replaced by the last one)
+    size_t n = 0;
+    const AccountHot *records = store_hot_records();
+    for (size_t i = count; i-- > 0; ) {
+        const Problem *p = &items[i];
+        AccountCold cold;
+        if (p->position >= store_count() || !store_read_cold(p->position, 1, &cold)) {
+            continue;
+        }
+        bool still = p->kind == PROBLEM_DAMAGED_STORE
+                         ? !store_record_ok(p->position, &cold)
+                         : records[p->position].account_id == p->account_id &&
+                           find_entry(c, p->account_id) < 0;
+        if (still) {
+            fwrite(&records[p->position], sizeof(AccountHot), 1, out_fp);
+            fwrite(&cold, sizeof(cold), 1, out_fp);
+            positions[n++] = p->position;
+        }
+    }
+    fclose(out_fp);
+    bool ok = n == 0 || store_drop_records(positions, n);
+    free(positions);
+    return ok ? n : 0;
+}
+
+/* Copy damaged log records to QUARANTINE_DIR/log_records.bin */
+static size_t copy_log_records(const Problem *items, size_t count, const Check *c) {
+    char path[300];
+    snprintf(path, sizeof(path), "%s/log_records.bin", QUARANTINE_DIR);
+    FILE *out_fp = fopen(path, "ab");
+    size_t copied = 0;
+    for (size_t s = 0; s < c->segment_count && out_fp != NULL; s++) {
+        TxLogView view;
+        bool mapped = false;
+        for (size_t i = 0; i < count; i++) {
+            if (strcmp(items[i].path, c->segments[s].path) != 0) {
+                continue;
+            }
+            if (!mapped && !(mapped = txlog_map_segment(&c->segments[s], &view))) {
+                break;
+            }
+            if (items[i].position < view.count) {
+                copied += fwrite(&view.records[items[i].position], sizeof(TxRecord), 1, out_fp);
+            }
+        }
+        if (mapped) {
+            txlog_unmap(&view);
+        }
+    }
+    if (out_fp != NULL) {
+        fclose(out_fp);
+    }
+    return copied;
+}
+
+/* Quarantine function
+   Purpose: Set aside what the check found (see fsck.h)
+
+   Other programs are kept from saving accounts meanwhile (the store is
+   held, see store_update_hold())
+ */
+static void quarantine(const Findings *f, const Check *c) {
+    if (mkdir(QUARANTINE_DIR, 0755) != 0 && access(QUARANTINE_DIR, F_OK) != 0) {
+        printf("Error: Cannot create %s\n", QUARANTINE_DIR);
+        return;
+    }
+    int hold = store_update_hold();
+    size_t files = 0, entries = 0, records = 0, log_records = 0;
+    size_t missing_count = 0, store_first = 0, store_count_found = 0, log_first = 0, log_count = 0;
+    uint32_t *missing = malloc((f->count + 1) * sizeof(uint32_t));
+    size_t now_count = 0;
+    uint32_t *now = load_index_ids(&now_count);
+
+    // The files and entries were found before the hold, so each is checked again
+    for (size_t i = 0; i < f->count; i++) {
+        const Problem *p = &f->items[i];
+        char account_num[32];
+        switch (p->kind) {
+            case PROBLEM_DAMAGED_FILE:
+            case PROBLEM_ORPHAN_FILE:
+                if (file_still_bad(p, now, now_count)) {
+                    files += move_to_quarantine(p->path);
+                }
+                break;
+            case PROBLEM_MISSING_FILE:
+                snprintf(account_num, sizeof(account_num), "%u", p->account_id);
+                if (missing != NULL && !account_exists(account_num)) {
+                    missing[missing_count++] = p->account_id;
+                }
+                break;
+            case PROBLEM_DAMAGED_STORE:
+            case PROBLEM_ORPHAN_STORE:
+                if (store_count_found++ == 0) {
+                    store_first = i;
+                }
+                break;
+            case PROBLEM_DAMAGED_LOG:
+                if (log_count++ == 0) {
+                    log_first = i;
+                }
+                break;
+            default:
+                break;   // Duplicates and accounts missing from the store are only reported
+        }
+    }
+    if (missing_count > 0) {
+        qsort(missing, missing_count, sizeof(uint32_t), compare_u32);
+        entries = quarantine_index_entries(missing, missing_count);
+    }
+    free(missing);
+    free(now);
+
+    // Damaged and orphaned store records are next to each other in the list
+    if (store_count_found > 0) {
+        Problem *store_items = malloc(store_count_found * sizeof(Problem));
+        if (store_items != NULL) {
+            memcpy(store_items, &f->items[store_first], store_count_found * sizeof(Problem));
+            qsort(store_items, store_count_found, sizeof(Problem), compare_positions);
+            records = quarantine_store_records(store_items, store_count_found, c);
+            free(store_items);
+        }
+    }
+    if (log_count > 0) {
+        log_records = copy_log_records(&f->items[log_first], log_count, c);
+    }
+    store_update_end(hold);
+
+    printf("Quarantined in %s: %zu account files, %zu index entries, %zu store records\n",
+           QUARANTINE_DIR, files, entries, records);
+    if (log_records > 0) {
+        printf("Copied %zu damaged log records there (the log itself is not changed)\n", log_records);
+    }
+    if (records > 0) {
+        printf("Run --migrate to copy the accounts back into the store from their files.\n");
+    }
+}
+
+/* Fsck database function
+   Purpose: Check every record of the database (see fsck.h)
+
+   Steps:
+   1. Read the options and the sorted index
+   2. Check the store, the account files and the log with several threads
+   3. Find the index entries whose file was not found
+   4. Print the report, and quarantine what was found if asked to
+ */
+int fsck_database(int argc, char *argv[]) {
+    // STEP 1: Options and the index
+    int threads = 4;
+    bool want_quarantine = false;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--quarantine") == 0) {
+            want_quarantine = true;
+        } else if (atoi(argv[i]) > 0) {
+            threads = atoi(argv[i]);
+        } else {
+            printf("Error: Unknown --fsck option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (threads > MAX_FSCK_THREADS) threads = MAX_FSCK_THREADS;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    Check c;
+    Findings found;
+    memset(&c, 0, sizeof(c));
+    memset(&found, 0, sizeof(found));
+    if (!read_index(&c, &found)) {
+        printf("Error: Out of memory.\n");
+        return 1;
+    }
+
+    // STEP 2: Check everything in parallel
+    TxSegment *segments = NULL;
+    c.segment_count = txlog_segments(&segments);
+    c.segments = segments;
+    store_hot_records();   // Maps the records other programs added, for store_count()
+    c.store_count = store_count();
+    c.store_chunks = (c.store_count + FSCK_CHUNK - 1) / FSCK_CHUNK;
+    c.threads = threads;
+    c.pieces = c.store_chunks + FANOUT_FOLDERS + (size_t)threads + c.segment_count;
+    c.flat = opendir(DATABASE_DIR);
+    pthread_mutex_init(&c.flat_lock, NULL);
+    uint32_t changes_before = store_changes();
+
+    run_check(&c, &found);
+    if (c.flat != NULL) {
+        closedir(c.flat);
+    }
+    pthread_mutex_destroy(&c.flat_lock);
+
+    // STEP 3: Index entries that no file marked
+    for (size_t i = 0; i < c.index_count; i++) {
+        if (!c.has_file[i]) {
+            add_problem(&found, PROBLEM_MISSING_FILE, c.index_ids[i], 0, NULL);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // STEP 4: Report, and quarantine
+    qsort(found.items, found.count, sizeof(Problem), compare_problems);
+    print_report(&found, &c, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    if (found.unreadable > 0) {
+        fprintf(stderr, "Warning: %d log segments could not be read\n", found.unreadable);
+    }
+    if (store_changes() != changes_before) {
+        fprintf(stderr, "Warning: The store changed during the check; "
+                "run --fsck again when the bank is quiet\n");
+    }
+    if (want_quarantine && found.count > 0) {
+        quarantine(&found, &c);
+    }
+
+    int result = found.count == 0 && found.unreadable == 0 ? 0 : 1;
+    free(found.items);
+    free(c.index_ids);
+    free(c.has_file);
+    free(segments);
+    return result;
+}
@@ -0,0 +1,567 @@
+/* This file contains the asynchronous I/O queue (see ioq.h)
+
+   io_uring backend:
+   The kernel shares two ring buffers with the program. We write requests
+   (SQEs) into the submission ring and tell the kernel about them with one
+   io_uring_enter() call per batch; finished requests appear as CQEs in the
+   completion ring. There is no liburing here, so the rings are set up with
+   the raw system calls and read with atomic loads/stores
+
+   A write with sync = true becomes two linked SQEs (write, then fsync);
+   the kernel only starts the fsync once the write has finished
+
+   When io_uring_enter() keeps failing, requests the kernel has not taken
+   yet are cancelled (their callbacks see -ECANCELED or the error), and
+   the ones it took are still waited for: their results appear in the
+   completion ring without any system call
+
+   Thread backend:
+   Requests go onto a "pending" list that worker threads take from. Each
+   worker does the blocking call and puts the request on a "done" list.
+   Callbacks always run in ioq_poll(), on the caller's thread, just like
+   with io_uring
+ */
+
+#include "ioq.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define DEFAULT_THREADS 8
+#define MAX_THREADS 256
+#define URING_RETRIES 1000   // Tries (1 ms apart) before a busy kernel counts as a failure
+
+// The low bit of user_data marks the write half of a write + fsync pair
+#define LINKED_WRITE 1u
+
+struct IoQueue {
+    IoBackend backend;
+    unsigned depth;
+    size_t in_flight;
+
+    // io_uring backend
+    int ring_fd;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned sq_entries;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned to_submit;
+
+    // Thread backend
+    pthread_t workers[MAX_THREADS];
+    int thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    IoRequest *staged, *staged_tail;     // Queued, not submitted yet
+    IoRequest *pending, *pending_tail;   // Waiting for a worker
+    IoRequest *done, *done_tail;         // Finished, callback not run yet
+    bool stopping;
+};
+
+
+/* ---------- io_uring backend ---------- */
+
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete) {
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/* Set up the rings
+   Returns: false if io_uring is not available (the caller falls back) */
+static bool uring_open(IoQueue *q) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    q->ring_fd = uring_setup(q->depth, &params);
+    if (q->ring_fd < 0) {
+        return false;
+    }
+
+    // IORING_OP_READ/WRITE with offset -1 need Linux 5.6 (same feature flag)
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(q->ring_fd);
+        return false;
+    }
+
+    q->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    q->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        if (q->cq_ring_size > q->sq_ring_size) {
+            q->sq_ring_size = q->cq_ring_size;
+        }
+        q->cq_ring_size = q->sq_ring_size;
+    }
+
+    q->sq_ring = mmap(NULL, q->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      q->ring_fd, IORING_OFF_SQ_RING);
+    if (q->sq_ring == MAP_FAILED) {
+        close(q->ring_fd);
+        return false;
+    }
+    q->cq_ring = single_mmap ? q->sq_ring
+                             : mmap(NULL, q->cq_ring_size, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, q->ring_fd, IORING_OFF_CQ_RING);
+    q->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    q->sqes = q->cq_ring == MAP_FAILED ? MAP_FAILED
+                                       : mmap(NULL, q->sqes_size, PROT_READ | PROT_WRITE,
+                                              MAP_SHARED | MAP_POPULATE, q->ring_fd, IORING_OFF_SQES);
+    if (q->cq_ring == MAP_FAILED || q->sqes == MAP_FAILED) {
+        if (q->cq_ring != MAP_FAILED && !single_mmap) {
+            munmap(q->cq_ring, q->cq_ring_size);
+        }
+        munmap(q->sq_ring, q->sq_ring_size);
+        close(q->ring_fd);
+        return false;
+    }
+
+    char *sq = q->sq_ring, *cq = q->cq_ring;
+    q->sq_head = (unsigned *)(sq + params.sq_off.head);
+    q->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    q->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    q->sq_array = (unsigned *)(sq + params.sq_off.array);
+    q->sq_entries = params.sq_entries;
+    q->cq_head = (unsigned *)(cq + params.cq_off.head);
+    q->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    q->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    q->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+}
+
+static void uring_close(IoQueue *q) {
+    munmap(q->sqes, q->sqes_size);
+    if (q->cq_ring != q->sq_ring) {
+        munmap(q->cq_ring, q->cq_ring_size);
+    }
+    munmap(q->sq_ring, q->sq_ring_size);
+    close(q->ring_fd);
+}
+
+static void pause_briefly(void) {
+    struct timespec pause = { 0, 1000000 };
+    nanosleep(&pause, NULL);
+}
+
+/* Hand the queued SQEs to the kernel and optionally wait for completions
+   Returns: false on an error (errno is EAGAIN or EBUSY if the kernel is
+   only short of resources: collect results, then try again) */
+static bool uring_flush(IoQueue *q, unsigned wait_for) {
+    for (;;) {
+        int ret = uring_enter(q->ring_fd, q->to_submit, wait_for);
+        if (ret >= 0) {
+            q->to_submit -= (unsigned)ret;
+            return true;
+        }
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+}
+
+static bool uring_busy(void) {
+    return errno == EAGAIN || errno == EBUSY;
+}
+
+static unsigned uring_free_slots(IoQueue *q) {
+    return q->sq_entries - (*q->sq_tail - __atomic_load_n(q->sq_head, __ATOMIC_ACQUIRE));
+}
+
+/* Take the n-th free submission slot after the tail (the caller makes
+   sure there is one). It belongs to the kernel once uring_publish() moves
+   the tail past it */
+static struct io_uring_sqe *uring_slot(IoQueue *q, unsigned n) {
+    unsigned index = (*q->sq_tail + n) & *q->sq_mask;
+    struct io_uring_sqe *sqe = &q->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    q->sq_array[index] = index;
+    return sqe;
+}
+
+static void uring_publish(IoQueue *q, unsigned count) {
+    // Release: the kernel must see the filled-in slots before the new tail
+    __atomic_store_n(q->sq_tail, *q->sq_tail + count, __ATOMIC_RELEASE);
+    q->to_submit += count;
+}
+
+static int uring_reap(IoQueue *q);
+
+/* Put a request into the submission ring
+   Returns: false (errno set) if the kernel kept the ring full */
+static bool uring_queue(IoQueue *q, IoRequest *req) {
+    // A request needs up to two slots (write + fsync); the kernel frees them as it takes SQEs
+    for (int tries = 0; uring_free_slots(q) < 2; tries++) {
+        if (tries == URING_RETRIES) {
+            errno = EAGAIN;
+            return false;
+        }
+        if (!uring_flush(q, 0) && !uring_busy()) {
+            return false;
+        }
+        if (uring_free_slots(q) < 2) {
+            uring_reap(q);
+            pause_briefly();
+        }
+    }
+
+    bool linked = req->op == IOQ_WRITE && req->sync;
+    struct io_uring_sqe *sqe = uring_slot(q, 0);
+    switch (req->op) {
+        case IOQ_READ:
+        case IOQ_WRITE:
+            sqe->opcode = req->op == IOQ_READ ? IORING_OP_READ : IORING_OP_WRITE;
+            sqe->fd = req->fd;
+            sqe->addr = (uint64_t)(uintptr_t)req->buf;
+            sqe->len = (uint32_t)req->len;
+            sqe->off = (uint64_t)req->offset;   // -1 = current position
+            break;
+        case IOQ_FSYNC:
+            sqe->opcode = IORING_OP_FSYNC;
+            sqe->fd = req->fd;
+            break;
+    }
+    sqe->user_data = (uint64_t)(uintptr_t)req | (linked ? LINKED_WRITE : 0);
+
+    if (linked) {
+        sqe->flags |= IOSQE_IO_LINK;
+        struct io_uring_sqe *sync = uring_slot(q, 1);
+        sync->opcode = IORING_OP_FSYNC;
+        sync->fd = req->fd;
+        sync->user_data = (uint64_t)(uintptr_t)req;
+    }
+    uring_publish(q, linked ? 2 : 1);
+    return true;
+}
+
+/* Collect every CQE that is ready and run the callbacks
+   Returns: The number of callbacks that ran */
+static int uring_reap(IoQueue *q) {
+    int finished = 0;
+    for (;;) {
+        unsigned head = *q->cq_head;
+        if (head == __atomic_load_n(q->cq_tail, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        struct io_uring_cqe *cqe = &q->cqes[head & *q->cq_mask];
+        uint64_t data = cqe->user_data;
+        long res = cqe->res;
+        // Give the slot back before the callback (it may queue more work)
+        __atomic_store_n(q->cq_head, head + 1, __ATOMIC_RELEASE);
+
+        IoRequest *req = (IoRequest *)(uintptr_t)(data & ~(uint64_t)LINKED_WRITE);
+        if (data & LINKED_WRITE) {
+            req->result = res;   // The fsync completion follows
+            continue;
+        }
+        if (req->op == IOQ_WRITE && req->sync) {
+            // Keep the byte count unless the fsync failed
+            if (req->result >= 0 && res < 0) {
+                req->result = res;
+            }
+        } else {
+            req->result = res;
+        }
+        q->in_flight--;
+        finished++;
+        if (req->done != NULL) {
+            req->done(req);
+        }
+    }
+    return finished;
+}
+
+/* Take back the SQEs the kernel has not taken yet and run their
+   callbacks with "error" (without SQPOLL the kernel only reads the ring
+   inside io_uring_enter(), so they can be taken back between calls)
+   Returns: The number of callbacks that ran */
+static int uring_cancel_queued(IoQueue *q, long error) {
+    unsigned head = __atomic_load_n(q->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *q->sq_tail;
+    __atomic_store_n(q->sq_tail, head, __ATOMIC_RELEASE);
+    q->to_submit = 0;
+
+    int cancelled = 0;
+    for (unsigned i = head; i != tail; i++) {
+        uint64_t data = q->sqes[q->sq_array[i & *q->sq_mask]].user_data;
+        if (data & LINKED_WRITE) {
+            continue;   // The fsync SQE after it finishes the request
+        }
+        IoRequest *req = (IoRequest *)(uintptr_t)data;
+        req->result = error;
+        q->in_flight--;
+        cancelled++;
+        if (req->done != NULL) {
+            req->done(req);
+        }
+    }
+    return cancelled;
+}
+
+
+/* ---------- Thread backend ---------- */
+
+// Do one request with ordinary blocking calls
+static void run_blocking(IoRequest *req) {
+    ssize_t n = 0;
+    switch (req->op) {
+        case IOQ_READ:
+            n = req->offset < 0 ? read(req->fd, req->buf, req->len)
+                                : pread(req->fd, req->buf, req->len, (off_t)req->offset);
+            break;
+        case IOQ_WRITE:
+            n = req->offset < 0 ? write(req->fd, req->buf, req->len)
+                                : pwrite(req->fd, req->buf, req->len, (off_t)req->offset);
+            if (n >= 0 && req->sync && fsync(req->fd) != 0) {
+                n = -1;
+            }
+            break;
+        case IOQ_FSYNC:
+            n = fsync(req->fd);
+            break;
+    }
+    req->result = n < 0 ? -errno : (long)n;
+}
+
+static void *worker_main(void *arg) {
+    IoQueue *q = arg;
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+        while (q->pending == NULL && !q->stopping) {
+            pthread_cond_wait(&q->work_ready, &q->lock);
+        }
+        if (q->pending == NULL) {
+            break;  // Stopping and nothing left to do
+        }
+        IoRequest *req = q->pending;
+        q->pending = req->next;
+        pthread_mutex_unlock(&q->lock);
+
+        run_blocking(req);
+
+        pthread_mutex_lock(&q->lock);
+        req->next = NULL;
+        if (q->done == NULL) {
+            q->done = req;
+        } else {
+            q->done_tail->next = req;
+        }
+        q->done_tail = req;
+        pthread_cond_signal(&q->work_done);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+static bool threads_open(IoQueue *q, int threads) {
+    if (threads <= 0) threads = DEFAULT_THREADS;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    if ((unsigned)threads > q->depth) threads = (int)q->depth;
+
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->work_ready, NULL);
+    pthread_cond_init(&q->work_done, NULL);
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&q->workers[i], NULL, worker_main, q) != 0) {
+            break;
+        }
+        q->thread_count++;
+    }
+    return q->thread_count > 0;
+}
+
+static void threads_close(IoQueue *q) {
+    pthread_mutex_lock(&q->lock);
+    q->stopping = true;
+    pthread_cond_broadcast(&q->work_ready);
+    pthread_mutex_unlock(&q->lock);
+    for (int i = 0; i < q->thread_count; i++) {
+        pthread_join(q->workers[i], NULL);
+    }
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->work_ready);
+    pthread_cond_destroy(&q->work_done);
+}
+
+static int threads_submit(IoQueue *q) {
+    if (q->staged == NULL) {
+        return 0;
+    }
+    int count = 0;
+    for (IoRequest *req = q->staged; req != NULL; req = req->next) {
+        count++;
+    }
+    pthread_mutex_lock(&q->lock);
+    if (q->pending == NULL) {
+        q->pending = q->staged;
+    } else {
+        q->pending_tail->next = q->staged;
+    }
+    q->pending_tail = q->staged_tail;
+    pthread_cond_broadcast(&q->work_ready);
+    pthread_mutex_unlock(&q->lock);
+    q->staged = q->staged_tail = NULL;
+    return count;
+}
+
+/* Run the callbacks of finished requests, waiting for at least one if
+   "wait" is set. Returns: The number of callbacks that ran */
+static int threads_reap(IoQueue *q, bool wait) {
+    pthread_mutex_lock(&q->lock);
+    while (wait && q->done == NULL) {
+        pthread_cond_wait(&q->work_done, &q->lock);
+    }
+    IoRequest *list = q->done;
+    q->done = q->done_tail = NULL;
+    pthread_mutex_unlock(&q->lock);
+
+    int finished = 0;
+    while (list != NULL) {
+        IoRequest *req = list;
+        list = req->next;
+        q->in_flight--;
+        finished++;
+        if (req->done != NULL) {
+            req->done(req);
+        }
+    }
+    return finished;
+}
+
+
+/* ---------- Public functions ---------- */
+
+IoQueue *ioq_create(unsigned depth, int threads, IoBackend backend) {
+    IoQueue *q = calloc(1, sizeof(IoQueue));
+    if (q == NULL) {
+        return NULL;
+    }
+    q->depth = depth > 0 ? depth : 64;
+    q->ring_fd = -1;
+
+    if (backend != IOQ_THREADS && uring_open(q)) {
+        q->backend = IOQ_URING;
+        return q;
+    }
+    if (backend == IOQ_URING || !threads_open(q, threads)) {
+        free(q);
+        return NULL;
+    }
+    q->backend = IOQ_THREADS;
+    return q;
+}
+
+void ioq_destroy(IoQueue *q) {
+    if (q == NULL) {
+        return;
+    }
+    ioq_drain(q);
+    if (q->backend == IOQ_URING) {
+        uring_close(q);
+    } else {
+        threads_close(q);
+    }
+    free(q);
+}
+
+const char *ioq_backend_name(const IoQueue *q) {
+    return q->backend == IOQ_URING ? "io_uring" : "threads";
+}
+
+void ioq_queue(IoQueue *q, IoRequest *req) {
+    // Never keep more than "depth" requests in flight
+    while (q->in_flight >= q->depth) {
+        ioq_poll(q, 1);
+    }
+
+    req->result = 0;
+    req->next = NULL;
+    q->in_flight++;
+    if (q->backend == IOQ_URING) {
+        if (!uring_queue(q, req)) {
+            // The kernel takes no more work: the request fails at once
+            q->in_flight--;
+            req->result = -errno;
+            if (req->done != NULL) {
+                req->done(req);
+            }
+        }
+    } else {
+        if (q->staged == NULL) {
+            q->staged = req;
+        } else {
+            q->staged_tail->next = req;
+        }
+        q->staged_tail = req;
+    }
+}
+
+int ioq_submit(IoQueue *q) {
+    if (q->backend == IOQ_THREADS) {
+        return threads_submit(q);
+    }
+    unsigned before = q->to_submit;
+    uring_flush(q, 0);
+    return (int)(before - q->to_submit);
+}
+
+int ioq_poll(IoQueue *q, int min_complete) {
+    if ((size_t)min_complete > q->in_flight) {
+        min_complete = (int)q->in_flight;
+    }
+    ioq_submit(q);
+
+    int finished = q->backend == IOQ_URING ? uring_reap(q) : threads_reap(q, false);
+    int busy = 0;
+    while (finished < min_complete) {
+        if (q->backend == IOQ_URING) {
+            if (!uring_flush(q, 1)) {
+                if (!uring_busy() || busy++ == URING_RETRIES) {
+                    int error = errno;
+                    fprintf(stderr, "Warning: io_uring_enter failed (%s)\n", strerror(error));
+                    errno = error;   // For ioq_drain()
+                    break;
+                }
+                pause_briefly();
+            }
+            finished += uring_reap(q);
+        } else {
+            finished += threads_reap(q, true);
+        }
+    }
+    return finished;
+}
+
+void ioq_drain(IoQueue *q) {
+    while (q->in_flight > 0) {
+        if (ioq_poll(q, (int)q->in_flight) > 0 || q->backend != IOQ_URING) {
+            continue;
+        }
+        // io_uring_enter() failed: cancel what the kernel has not taken, and
+        // wait for the rest in the completion ring (the kernel owns their buffers)
+        int error = errno;
+        uring_cancel_queued(q, -(uring_busy() ? ECANCELED : error));
+        while (q->in_flight > 0) {
+            if (uring_reap(q) == 0) {
+                pause_briefly();
+            }
+        }
+    }
+}
+
+size_t ioq_in_flight(const IoQueue *q) {
+    return q->in_flight;
+}
@@ -0,0 +1,287 @@
+/* This file decides where each account file lives on disk, and moves an
+   existing flat database into the fan-out layout
+
+   Why a fan-out layout?
+   With millions of files in one folder, every open() has to search a huge
+   directory and listing it takes a very long time. Spreading the files over
+   256 x 256 sub-folders keeps each folder small (about 150 files per folder
+   at 10 million accounts)
+ */
+
+#include "layout.h"
+#include "types.h"
+#include "account.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define MIGRATE_BATCH 256   // File names a worker takes from the directory at once
+
+
+/* Check whether the database uses the fan-out layout
+   The marker file is checked on every call (it is a single stat), so a
+   running program switches layout as soon as a migration starts
+ */
+bool layout_is_fanout(void) {
+    return access(FANOUT_MARKER, F_OK) == 0;
+}
+
+/* Hash the account number (FNV-1a) to pick its two sub-folders */
+static unsigned int layout_hash(const char *account_num) {
+    unsigned int h = 2166136261u;
+    for (; *account_num; account_num++) {
+        h = (h ^ (unsigned char)*account_num) * 16777619u;
+    }
+    return h;
+}
+
+/* Layout path function
+   Purpose: Build the path of an account file
+
+   Examples (dir = "database"):
+     flat:    database/12345678.txt
+     fan-out: database/3f/a2/12345678.txt
+ */
+void layout_path_in(const char *dir, const char *account_num, bool fanout,
+                    char *path, size_t size) {
+    if (fanout) {
+        unsigned int h = layout_hash(account_num);
+        snprintf(path, size, "%s/%02x/%02x/%s.txt", dir, h & 0xFF, (h >> 8) & 0xFF, account_num);
+    } else {
+        snprintf(path, size, "%s/%s.txt", dir, account_num);
+    }
+}
+
+/* Prepare fan-out path function
+   Purpose: Build the fan-out path and make sure both sub-folders exist
+
+   Returns: false if a folder could not be created
+ */
+bool layout_prepare_fanout_path(const char *dir, const char *account_num,
+                                char *path, size_t size) {
+    unsigned int h = layout_hash(account_num);
+    char folder[300];
+
+    snprintf(folder, sizeof(folder), "%s/%02x", dir, h & 0xFF);
+    if (mkdir(folder, 0755) != 0 && errno != EEXIST) {
+        return false;
+    }
+    snprintf(folder, sizeof(folder), "%s/%02x/%02x", dir, h & 0xFF, (h >> 8) & 0xFF);
+    if (mkdir(folder, 0755) != 0 && errno != EEXIST) {
+        return false;
+    }
+
+    layout_path_in(dir, account_num, true, path, size);
+    return true;
+}
+
+/* Check whether a directory entry is an account file ("<digits>.txt")
+   If it is, the account number is copied into account_num
+ */
+bool layout_is_account_file(const char *name, char *account_num, size_t size) {
+    size_t len = strlen(name);
+    if (len < 5 || len - 4 >= size || strcmp(name + len - 4, ".txt") != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < len - 4; i++) {
+        if (!isdigit((unsigned char)name[i])) {
+            return false;
+        }
+    }
+    memcpy(account_num, name, len - 4);
+    account_num[len - 4] = '\0';
+    return true;
+}
+
+// Work shared by all migration workers
+typedef struct {
+    DIR *dir;
+    pthread_mutex_t lock;
+    long moved;      // Files moved by all workers (protected by lock)
+    bool failed;
+} MigrateJob;
+
+/* Read the version written in an account file (0 if it has none or
+   cannot be read) */
+static unsigned int file_version(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+    char line[128];
+    unsigned int version = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "Version: %u", &version) == 1) {
+            break;
+        }
+    }
+    fclose(fp);
+    return version;
+}
+
+/* Move one flat file into the fan-out tree
+
+   link() + unlink() is used instead of rename(): link() never replaces an
+   existing file. If the fan-out path is already there, it is either the
+   same file (a pass that stopped after link()) or a copy the program
+   saved since; the flat file is then removed only if it is the same
+   inode, or if it is not newer than the fan-out copy. A newer flat file
+   replaces the fan-out one. All of it is done under the account's record
+   lock (see account.h), so no commit renames a new flat file into place
+   between link() and unlink(), or writes either file while they are compared.
+   Readers never see the account missing, because load_account() looks in
+   the fan-out tree, then the flat folder, then the fan-out tree again
+ */
+static bool migrate_file(const char *account_num) {
+    char flat[300], fanout[300];
+    layout_path_in(DATABASE_DIR, account_num, false, flat, sizeof(flat));
+    if (!layout_prepare_fanout_path(DATABASE_DIR, account_num, fanout, sizeof(fanout))) {
+        return false;
+    }
+
+    uint32_t id = (uint32_t)strtoul(account_num, NULL, 10);
+    if (!lock_account_records(&id, 1)) {
+        return false;
+    }
+    bool ok;
+    struct stat flat_st, fanout_st;
+    if (link(flat, fanout) == 0) {
+        ok = unlink(flat) == 0 || errno == ENOENT;
+    } else if (errno != EEXIST) {
+        ok = errno == ENOENT;  // Already moved by someone else
+    } else if (stat(flat, &flat_st) != 0) {
+        ok = errno == ENOENT;
+    } else if (stat(fanout, &fanout_st) != 0) {
+        // The fan-out copy went away: the account was deleted meanwhile
+        ok = errno == ENOENT && (unlink(flat) == 0 || errno == ENOENT);
+    } else if ((flat_st.st_ino == fanout_st.st_ino && flat_st.st_dev == fanout_st.st_dev) ||
+               file_version(flat) <= file_version(fanout)) {
+        ok = unlink(flat) == 0 || errno == ENOENT;
+    } else {
+        ok = rename(flat, fanout) == 0;
+    }
+    unlock_account_records(&id, 1);
+    return ok;
+}
+
+/* Migration worker
+   Takes up to MIGRATE_BATCH names from the shared directory stream,
+   then moves them without holding the lock
+ */
+static void *migrate_worker(void *arg) {
+    MigrateJob *job = arg;
+    char (*batch)[32] = malloc(MIGRATE_BATCH * sizeof(*batch));
+    long moved = 0;
+
+    if (batch == NULL) {
+        job->failed = true;
+        return NULL;
+    }
+
+    for (;;) {
+        int count = 0;
+        pthread_mutex_lock(&job->lock);
+        struct dirent *entry;
+        while (count < MIGRATE_BATCH && (entry = readdir(job->dir)) != NULL) {
+            if (layout_is_account_file(entry->d_name, batch[count], sizeof(*batch))) {
+                count++;
+            }
+        }
+        pthread_mutex_unlock(&job->lock);
+
+        if (count == 0) {
+            break;  // The directory has been read to the end
+        }
+        for (int i = 0; i < count; i++) {
+            if (migrate_file(batch[i])) {
+                moved++;
+            } else {
+                fprintf(stderr, "Warning: Could not move account %s\n", batch[i]);
+                job->failed = true;
+            }
+        }
+    }
+
+    free(batch);
+    pthread_mutex_lock(&job->lock);
+    job->moved += moved;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+/* Migrate to fan-out function
+   Purpose: Move a flat database into the fan-out layout while it is in use
+
+   How it works:
+   1. Create the marker file, so every save from now on goes to the fan-out tree
+   2. Start the worker threads, which share one directory stream
+   3. Repeat the pass until no flat files are left (files saved by a program
+      that was in the middle of a save when the marker appeared)
+
+   Returns: The number of files moved, or -1 if something went wrong
+ */
+long migrate_to_fanout(int threads) {
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    // STEP 1: Switch new saves to the fan-out layout
+    FILE *marker = fopen(FANOUT_MARKER, "w");
+    if (marker == NULL) {
+        fprintf(stderr, "Error: Could not create %s\n", FANOUT_MARKER);
+        return -1;
+    }
+    fprintf(marker, "fan-out layout: %s/xx/yy/<account>.txt\n", DATABASE_DIR);
+    fclose(marker);
+
+    pthread_t *workers = malloc((size_t)threads * sizeof(pthread_t));
+    if (workers == NULL) {
+        return -1;
+    }
+
+    long total = 0;
+    bool failed = false;
+    for (int pass = 0; pass < 3; pass++) {
+        // STEP 2: One pass over the flat folder with all workers
+        MigrateJob job;
+        job.dir = opendir(DATABASE_DIR);
+        job.moved = 0;
+        job.failed = false;
+        if (job.dir == NULL) {
+            failed = true;
+            break;
+        }
+        pthread_mutex_init(&job.lock, NULL);
+
+        int started = 0;
+        for (int i = 0; i < threads; i++) {
+            if (pthread_create(&workers[i], NULL, migrate_worker, &job) == 0) {
+                started++;
+            }
+        }
+
+        for (int i = 0; i < started; i++) {
+            pthread_join(workers[i], NULL);
+        }
+        long moved = job.moved;
+
+        pthread_mutex_destroy(&job.lock);
+        closedir(job.dir);
+        total += moved;
+        failed = failed || job.failed || started == 0;
+
+        // STEP 3: Stop when a pass finds nothing left to move
+        if (moved == 0 || failed) {
+            break;
+        }
+    }
+
+    free(workers);
+    return failed ? -1 : total;
+}
@@ -0,0 +1,460 @@
+/* This file is the single-writer ledger engine (see ledger.h)
+
+   The ring buffer:
+   Every slot has a sequence number. A slot at position pos is free for
+   a producer when its sequence is pos, and holds a command for the ledger
+   thread when its sequence is pos + 1. Producers claim a position with
+   a compare-and-swap on enqueue_pos, fill the slot, then set its sequence
+   (release). The ledger thread reads the slot, then gives it back by
+   setting the sequence to pos + LEDGER_RING_SIZE (the next lap)
+
+   Only the ledger thread changes balances, so applying a command is just
+   a few memory writes to the mapped hot records, with no locks at all
+ */
+
+#include "ledger.h"
+#include "store.h"
+#include "txlog.h"
+#include "account.h"
+#include "velocity.h"
+#include "trace.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#define RING_MASK (LEDGER_RING_SIZE - 1)
+
+// One command in the ring
+typedef struct {
+    uint64_t sequence;
+    LedgerOp op;
+    uint32_t from_id;
+    uint32_t to_id;
+    int64_t amount_cents;
+    int64_t fee_cents;
+    LedgerTicket *ticket;
+    uint64_t request;       // Request of the producer, for the trace (see trace.h)
+} LedgerSlot;
+
+/* The positions are written by different threads, so each one gets its
+   own cache line (otherwise every claim would slow down the ledger) */
+typedef struct {
+    uint64_t enqueue_pos;   // Next position for a producer (shared)
+    char pad1[56];
+    uint64_t dequeue_pos;   // Next position for the ledger thread (only it)
+    char pad2[56];
+    int stop;               // Set by ledger_stop()
+    char pad3[60];
+} RingState;
+
+// The result of one applied command, kept until its batch is logged
+typedef struct {
+    LedgerTicket *ticket;
+    LedgerResult result;
+    int64_t from_balance;
+    int64_t to_balance;
+    long record;            // Index in the log batch, -1 if not logged
+} PendingResult;
+
+static LedgerSlot *ring = NULL;
+static RingState state;
+static pthread_t ledger_thread;
+static bool running = false;
+static int update_hold = -1;    // The update lock, held from start to stop
+static LedgerConfig config;
+static LedgerStats stats;
+
+// Accounts changed since their text files were last written (a hash set)
+static uint32_t *dirty = NULL;
+static size_t dirty_capacity = 0;
+static size_t dirty_count = 0;
+
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ---------- Changed accounts ---------- */
+
+static void dirty_insert(uint32_t id);
+
+static void dirty_grow(void) {
+    uint32_t *old = dirty;
+    size_t old_capacity = dirty_capacity;
+    dirty_capacity = old_capacity ? old_capacity * 2 : 4096;
+    dirty = calloc(dirty_capacity, sizeof(uint32_t));
+    dirty_count = 0;
+    if (dirty == NULL) {
+        fprintf(stderr, "Error: Out of memory in the ledger\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i] != 0) {
+            dirty_insert(old[i]);
+        }
+    }
+    free(old);
+}
+
+static void dirty_insert(uint32_t id) {
+    if ((dirty_count + 1) * 2 > dirty_capacity) {
+        dirty_grow();
+    }
+    size_t mask = dirty_capacity - 1;
+    size_t i = (id * 2654435761u) & mask;
+    while (dirty[i] != 0) {
+        if (dirty[i] == id) {
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+    dirty[i] = id;
+    dirty_count++;
+}
+
+/* Flush files function
+   Purpose: Rewrite the text files of every changed account
+
+   The files are read and written in batches through the I/O queue
+   (load_accounts / save_accounts), only the balance changes
+ */
+static void flush_files(void) {
+    if (!config.write_files || dirty_count == 0) {
+        return;
+    }
+    double start = now_s();
+
+    size_t count = dirty_count;
+    char (*numbers)[12] = malloc(count * sizeof(*numbers));
+    const char **names = malloc(count * sizeof(char *));
+    Account *accounts = malloc(count * sizeof(Account));
+    bool *loaded = malloc(count * sizeof(bool));
+    if (numbers == NULL || names == NULL || accounts == NULL || loaded == NULL) {
+        fprintf(stderr, "Warning: Could not rewrite account files (out of memory)\n");
+        free(numbers); free(names); free(accounts); free(loaded);
+        return;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < dirty_capacity; i++) {
+        if (dirty[i] != 0) {
+            snprintf(numbers[n], sizeof(numbers[n]), "%u", dirty[i]);
+            names[n] = numbers[n];
+            n++;
+        }
+    }
+    load_accounts(names, accounts, loaded, n);
+
+    // Put the current balance into every account that could be read
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++) {
+        AccountHot *hot = store_hot_ref((uint32_t)strtoul(names[i], NULL, 10));
+        if (loaded[i] && hot != NULL) {
+            accounts[i].balance = hot->balance_cents / 100.0;
+            accounts[kept++] = accounts[i];
+        }
+    }
+    if (save_accounts(accounts, kept, false) != kept) {
+        fprintf(stderr, "Warning: Some account files could not be rewritten\n");
+    }
+
+    memset(dirty, 0, dirty_capacity * sizeof(uint32_t));
+    dirty_count = 0;
+    free(numbers); free(names); free(accounts); free(loaded);
+    stats.flush_seconds += now_s() - start;
+}
+
+/* ---------- The ledger thread ---------- */
+
+// Check (and count) the transaction limits; only used in ledger mode
+static bool within_limits(uint32_t id, const AccountHot *hot, VelocityOp op, int64_t cents) {
+    char number[12];
+    snprintf(number, sizeof(number), "%u", id);
+    if (!velocity_check(number, (AccountType)hot->type, op, cents)) {
+        return false;
+    }
+    velocity_record(number, op, cents);
+    return true;
+}
+
+/* Apply one command to the hot records
+   Returns: The result; the log record is filled in if it succeeded */
+static LedgerResult apply(const LedgerSlot *cmd, TxRecord *rec, PendingResult *out) {
+    AccountHot *from = NULL, *to = NULL;
+    if (cmd->op != LEDGER_DEPOSIT && (from = store_hot_ref(cmd->from_id)) == NULL) {
+        return LEDGER_NO_ACCOUNT;
+    }
+    if (cmd->op != LEDGER_WITHDRAW && (to = store_hot_ref(cmd->to_id)) == NULL) {
+        return LEDGER_NO_ACCOUNT;
+    }
+    if (from != NULL && from->balance_cents < cmd->amount_cents + cmd->fee_cents) {
+        return LEDGER_NO_FUNDS;
+    }
+
+    static const VelocityOp limit_ops[] = { VEL_DEPOSIT, VEL_WITHDRAW, VEL_REMIT };
+    if (config.check_limits &&
+        !within_limits(from != NULL ? cmd->from_id : cmd->to_id, from != NULL ? from : to,
+                       limit_ops[cmd->op], cmd->amount_cents)) {
+        return LEDGER_LIMIT;
+    }
+
+    if (from != NULL) {
+        from->balance_cents -= cmd->amount_cents + cmd->fee_cents;
+        from->version++;
+        store_seal_hot(from);
+        out->from_balance = from->balance_cents;
+    }
+    if (to != NULL) {
+        to->balance_cents += cmd->amount_cents;
+        to->version++;
+        store_seal_hot(to);
+        out->to_balance = to->balance_cents;
+    }
+
+    static const TxOp log_ops[] = { TXOP_DEPOSIT, TXOP_WITHDRAW, TXOP_REMIT };
+    memset(rec, 0, sizeof(*rec));
+    rec->op = (uint8_t)log_ops[cmd->op];
+    rec->status = TXSTATUS_OK;
+    rec->from_id = from != NULL ? cmd->from_id : 0;
+    rec->to_id = to != NULL ? cmd->to_id : 0;
+    rec->amount_cents = cmd->amount_cents;
+    rec->fee_cents = cmd->fee_cents;
+    return LEDGER_OK;
+}
+
+/* Write the log records of a batch, then publish every result
+   A result is only published once its log record has been written */
+static void commit_batch(TxRecord *records, size_t logged, PendingResult *results, size_t count) {
+    uint64_t first_id = 0;
+    bool log_ok = true;
+    if (config.write_log && logged > 0) {
+        double start = now_s();
+        first_id = txlog_append_batch(records, logged);
+        log_ok = first_id != 0;
+        stats.log_seconds += now_s() - start;
+    }
+    stats.batches++;
+    if (logged > 0) {
+        store_note_change();   // Readers that compare store_changes() see the batch
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        PendingResult *r = &results[i];
+        if (r->ticket == NULL) {
+            continue;
+        }
+        LedgerResult result = r->result;
+        if (result == LEDGER_OK && !log_ok) {
+            result = LEDGER_LOG_FAILED;
+        }
+        r->ticket->txn_id = r->record >= 0 && first_id != 0 ? first_id + (uint64_t)r->record : 0;
+        r->ticket->from_balance_cents = r->from_balance;
+        r->ticket->to_balance_cents = r->to_balance;
+        __atomic_store_n(&r->ticket->result, (uint32_t)result, __ATOMIC_RELEASE);
+    }
+}
+
+// Wait a little when the ring is empty: spin first, then give up the CPU
+static void idle_wait(unsigned rounds) {
+    if (rounds < 64) {
+        return;
+    }
+    if (rounds < 1024) {
+        sched_yield();
+        return;
+    }
+    struct timespec pause = { 0, 100000 };   // 0.1 ms
+    nanosleep(&pause, NULL);
+}
+
+static void *ledger_main(void *arg) {
+    (void)arg;
+    trace_thread_name("ledger");
+    TxRecord *records = malloc(LEDGER_BATCH * sizeof(TxRecord));
+    PendingResult *results = malloc(LEDGER_BATCH * sizeof(PendingResult));
+    if (records == NULL || results == NULL) {
+        fprintf(stderr, "Error: Out of memory in the ledger\n");
+        exit(1);
+    }
+
+    double last_flush = now_s();
+    unsigned idle_rounds = 0;
+    for (;;) {
+        // STEP 1: Apply up to LEDGER_BATCH commands, in ring order
+        double start = now_s();
+        size_t count = 0, logged = 0;
+        while (count < LEDGER_BATCH) {
+            LedgerSlot *slot = &ring[state.dequeue_pos & RING_MASK];
+            if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != state.dequeue_pos + 1) {
+                break;  // Ring is empty
+            }
+
+            PendingResult *r = &results[count++];
+            r->ticket = slot->ticket;
+            r->from_balance = r->to_balance = 0;
+            r->record = -1;
+            if (trace_enabled) {
+                trace_event_for("ledger_apply", 'B', slot->request);
+            }
+            r->result = apply(slot, &records[logged], r);
+            if (trace_enabled) {
+                trace_event_for("ledger_apply", 'E', slot->request);
+            }
+            if (r->result == LEDGER_OK) {
+                r->record = (long)logged++;
+                if (config.write_files) {
+                    if (slot->op != LEDGER_DEPOSIT) dirty_insert(slot->from_id);
+                    if (slot->op != LEDGER_WITHDRAW) dirty_insert(slot->to_id);
+                }
+                stats.applied++;
+            } else {
+                stats.rejected++;
+            }
+
+            // Give the slot back to the producers (next lap of the ring)
+            __atomic_store_n(&slot->sequence, state.dequeue_pos + LEDGER_RING_SIZE, __ATOMIC_RELEASE);
+            state.dequeue_pos++;
+        }
+        stats.apply_seconds += now_s() - start;
+
+        // STEP 2: Log the batch and publish the results
+        if (count > 0) {
+            commit_batch(records, logged, results, count);
+            idle_rounds = 0;
+        } else if (__atomic_load_n(&state.stop, __ATOMIC_ACQUIRE)) {
+            // Stop was requested after the last submit, and the ring is empty
+            LedgerSlot *slot = &ring[state.dequeue_pos & RING_MASK];
+            if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != state.dequeue_pos + 1) {
+                break;
+            }
+        } else {
+            idle_wait(idle_rounds++);
+        }
+
+        // STEP 3: Rewrite the files of changed accounts now and then
+        if (now_s() - last_flush >= LEDGER_FLUSH_SECS) {
+            flush_files();
+            last_flush = now_s();
+        }
+    }
+
+    flush_files();
+    store_sync(true);
+    free(records);
+    free(results);
+    return NULL;
+}
+
+/* ---------- Public functions ---------- */
+
+bool ledger_start(const LedgerConfig *cfg) {
+    if (running || !store_open()) {
+        return false;
+    }
+    // Take the store for the whole run (see ledger.h)
+    update_hold = store_update_hold();
+    if (update_hold < 0) {
+        fprintf(stderr, "Error: Could not take the store for the ledger (%s)\n", STORE_UPDATE_LOCK);
+        return false;
+    }
+    ring = malloc(LEDGER_RING_SIZE * sizeof(LedgerSlot));
+    if (ring == NULL) {
+        store_update_end(update_hold);
+        update_hold = -1;
+        return false;
+    }
+    for (uint64_t i = 0; i < LEDGER_RING_SIZE; i++) {
+        ring[i].sequence = i;
+    }
+    memset(&state, 0, sizeof(state));
+    memset(&stats, 0, sizeof(stats));
+    config = *cfg;
+
+    if (pthread_create(&ledger_thread, NULL, ledger_main, NULL) != 0) {
+        free(ring);
+        ring = NULL;
+        store_update_end(update_hold);
+        update_hold = -1;
+        return false;
+    }
+    running = true;
+    return true;
+}
+
+void ledger_submit(LedgerOp op, uint32_t from_id, uint32_t to_id,
+                   int64_t amount_cents, int64_t fee_cents, LedgerTicket *ticket) {
+    if (ticket != NULL) {
+        ticket->result = LEDGER_PENDING;
+    }
+
+    // Claim a position: the slot must be free (sequence == pos)
+    uint64_t pos = __atomic_load_n(&state.enqueue_pos, __ATOMIC_RELAXED);
+    LedgerSlot *slot;
+    for (;;) {
+        slot = &ring[pos & RING_MASK];
+        uint64_t seq = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)(seq - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&state.enqueue_pos, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+            // Another producer got it first; pos now holds the new position
+        } else if (diff < 0) {
+            sched_yield();  // Ring is full: let the ledger thread catch up
+            pos = __atomic_load_n(&state.enqueue_pos, __ATOMIC_RELAXED);
+        } else {
+            pos = __atomic_load_n(&state.enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->op = op;
+    slot->from_id = from_id;
+    slot->to_id = to_id;
+    slot->amount_cents = amount_cents;
+    slot->fee_cents = fee_cents;
+    slot->ticket = ticket;
+    slot->request = trace_request();
+    // Publish: the ledger thread may read the slot from now on
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+}
+
+LedgerResult ledger_wait(LedgerTicket *ticket) {
+    uint32_t result;
+    unsigned spins = 0;
+    TRACE_BEGIN("ledger_wait");
+    while ((result = __atomic_load_n(&ticket->result, __ATOMIC_ACQUIRE)) == LEDGER_PENDING) {
+        if (++spins > 100) {
+            sched_yield();
+        }
+    }
+    TRACE_END("ledger_wait");
+    return (LedgerResult)result;
+}
+
+void ledger_stop(LedgerStats *out) {
+    if (!running) {
+        return;
+    }
+    __atomic_store_n(&state.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(ledger_thread, NULL);
+    running = false;
+    // The files are written: other programs may save again
+    store_update_end(update_hold);
+    update_hold = -1;
+
+    free(ring);
+    ring = NULL;
+    free(dirty);
+    dirty = NULL;
+    dirty_capacity = dirty_count = 0;
+    if (out != NULL) {
+        *out = stats;
+    }
+}
@@ -0,0 +1,170 @@
+/*
+  logcat - print the binary transaction log as text
+
+  The banking system writes database/txlog/ as fixed-width binary records
+  (split into segments). This program prints them in the old text log
+  format, one line per record, so people can read (and grep) the log:
+
+    [2024-01-31 10:00:00] Deposit: Account 12345678, Amount: RM10.00
+
+  Usage (from the project folder):
+    ./logcat                      print every record
+    ./logcat --ids                also print the transaction ID of each record
+    ./logcat --segments           list the segments of the log
+    ./logcat --from "2024-01-31 00:00:00" --to "2024-02-01 00:00:00"
+                                  print only records in this time range
+                                  (only the segments that overlap are read)
+
+  Damaged records (wrong checksum) are reported on stderr and skipped
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "types.h"
+#include "txlog.h"
+#include "store.h"
+
+
+static bool show_ids = false;
+static bool have_store = false;
+
+// Print one record in the text log format
+static bool print_record(const TxRecord *rec, void *ctx) {
+    (void)ctx;
+    char when[32], text[200];
+    txlog_format_time(rec, when, sizeof(when));
+    txlog_describe(rec, text, sizeof(text));
+    if (show_ids) {
+        printf("%llu ", (unsigned long long)rec->txn_id);
+    }
+    printf("%s %s", when, text);
+
+    // The old log also had the customer's name for new accounts
+    AccountCold cold;
+    if (have_store && rec->op == TXOP_CREATE && store_get_cold(rec->to_id, &cold)) {
+        printf(" for %s", cold.name);
+    }
+    printf("\n");
+    return true;
+}
+
+/* Read a local time like "2024-01-31 10:00:00" (or just "2024-01-31")
+   Returns: true if the text was a valid time */
+static bool parse_time(const char *text, int64_t *out) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    int n = sscanf(text, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                   &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    if (n != 3 && n != 6) {
+        return false;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    time_t t = mktime(&tm);
+    if (t == (time_t)-1) {
+        return false;
+    }
+    *out = (int64_t)t;
+    return true;
+}
+
+// Print one line per segment (name, record count, time range)
+static void list_segments(const TxSegment *segments, size_t count) {
+    for (size_t s = 0; s < count; s++) {
+        TxRecord first, last;
+        memset(&first, 0, sizeof(first));
+        memset(&last, 0, sizeof(last));
+        first.timestamp = segments[s].first_ts;
+        last.timestamp = segments[s].last_ts;
+
+        char from[32], to[32];
+        txlog_format_time(&first, from, sizeof(from));
+        txlog_format_time(&last, to, sizeof(to));
+        printf("%s  %llu records  IDs %llu-%llu  %s - %s%s\n", segments[s].path,
+               (unsigned long long)segments[s].count,
+               (unsigned long long)segments[s].first_id,
+               (unsigned long long)segments[s].last_id,
+               from, to, segments[s].active ? "  (active)" : "");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    bool list_only = false, ranged = false;
+    int64_t from_ts = INT64_MIN, to_ts = INT64_MAX;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--ids") == 0) {
+            show_ids = true;
+        } else if (strcmp(argv[i], "--segments") == 0) {
+            list_only = true;
+        } else if ((strcmp(argv[i], "--from") == 0 || strcmp(argv[i], "--to") == 0) && i + 1 < argc) {
+            int64_t *target = argv[i][2] == 'f' ? &from_ts : &to_ts;
+            if (!parse_time(argv[i + 1], target)) {
+                fprintf(stderr, "Invalid time \"%s\" (use YYYY-MM-DD HH:MM:SS)\n", argv[i + 1]);
+                return 1;
+            }
+            ranged = true;
+            i++;
+        } else {
+            fprintf(stderr, "Usage: %s [--ids] [--segments] [--from TIME] [--to TIME]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    TxSegment *segments;
+    size_t count = txlog_segments(&segments);
+    if (count == 0) {
+        fprintf(stderr, "No transaction log found (%s)\n", TXLOG_DIR);
+        free(segments);
+        return 1;
+    }
+    if (list_only) {
+        list_segments(segments, count);
+        free(segments);
+        return 0;
+    }
+
+    // Large output buffer: the log can be gigabytes long
+    static char out_buffer[1 << 20];
+    setvbuf(stdout, out_buffer, _IOFBF, sizeof(out_buffer));
+
+    // Names are looked up in the account store, if there is one
+    have_store = access(HOT_STORE_FILE, F_OK) == 0;
+
+    // A time range only needs the segments that overlap it
+    if (ranged) {
+        free(segments);
+        long printed = txlog_query(from_ts, to_ts, print_record, NULL);
+        store_close();
+        return printed < 0 ? 1 : 0;
+    }
+
+    int damaged = 0;
+    for (size_t s = 0; s < count; s++) {
+        TxLogView view;
+        if (!txlog_map_segment(&segments[s], &view)) {
+            fprintf(stderr, "Warning: could not read segment %s\n", segments[s].path);
+            damaged++;
+            continue;
+        }
+        for (size_t i = 0; i < view.count; i++) {
+            const TxRecord *rec = &view.records[i];
+            if (!txlog_record_valid(rec)) {
+                fprintf(stderr, "Warning: damaged record in %s at offset %zu\n",
+                        segments[s].path, i * sizeof(TxRecord));
+                damaged++;
+                continue;
+            }
+            print_record(rec, NULL);
+        }
+        txlog_unmap(&view);
+    }
+
+    free(segments);
+    store_close();
+    return damaged > 0 ? 2 : 0;
+}
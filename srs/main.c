@@ -5,23 +5,186 @@
 
 #include <stdio.h>      
 #include <stdbool.h>    
+#include <string.h>     
 #include "types.h"     
 #include "menu.h"       
 #include "account.h"    
 #include "transaction.h"
 #include "utils.h"     
+#include "velocity.h"
+#include "store.h"
+#include "layout.h"
+#include "migrate.h"
+#include "replay.h"
+#include "txlog.h"
+#include "batch.h"
+#include "standing.h"
+#include "follower.h"
+#include "fees.h"
+#include "bulk.h"
+#include "reconcile.h"
+#include "asof.h"
+#include "shared.h"
+#include "cli.h"
+#include "export.h"
+#include "trace.h"
+#include "session.h"
+#include "fsck.h"
+#include <stdlib.h>
 
 
-int main(void) {
+int main(int argc, char *argv[]) {
     // Variables we'll need throughout the program 
     int choice;          
     bool running = true;  
     
      // Set up everything we need, before the bank opens
     
+    // Record where the time goes if BANK_TRACE names a file (see trace.h)
+    trace_start();
+    
     // If the database folder doesn't already exist, create it
     create_database_dir();
     
+    /* Subcommands for scripts (see cli.h): one operation, printed as JSON
+       or TSV, exp. banking_system deposit 12345678 1234 50.00
+       (the fee table is built by the first fee, see fees.h, and only the
+       subcommands that move money look for a bulk journal) */
+    if (argc > 1 && cli_is_subcommand(argv[1])) {
+        return run_subcommand(argc, argv);
+    }
+
+    // Finish a bulk remittance that a crash interrupted (see bulk.h)
+    bulk_recover();
+    
+    /* Command line options run a single job instead of the menu
+       --report: show account totals per type (reads only the hot records)
+       --migrate-layout [threads]: move account files into the fan-out layout
+       --migrate [threads]: copy the text database into the compact store
+       --replay [threads]: rebuild balances from the log and compare them
+       --reconcile [threads]: check total balances against the log, book fees
+       --batch <file> [threads]: run a file of transactions in ledger mode
+       --standing <command>: add, list, cancel or run standing orders
+       --bulk <sender> <pin> <file>: pay every line of a file, all or nothing
+       --shared on|off: lock accounts between programs that run at the same time
+       --txn <id>: show one transaction
+       --reverse <id>: undo a deposit, withdrawal or remittance
+       --snapshot: write a balance snapshot (for --balance-at)
+       --balance-at <account> "<YYYY-MM-DD HH:MM>": show a past balance
+       --fees: show the remittance fee schedule
+       --follow [socket]: serve read-only balance queries from the log
+       --query <query>: ask a running follower (exp. --query balance 12345678)
+       --export <csv|json> [file] [filters]: write every account to a file
+       --serve [socket]: serve the menu to many connections at once
+       --fsck [threads] [--quarantine]: check every checksum, find orphans
+     */
+    if (argc > 1) {
+        if (strcmp(argv[1], "--report") == 0) {
+            store_print_report();
+            store_close();
+            return 0;
+        }
+        if (strcmp(argv[1], "--migrate-layout") == 0) {
+            int threads = argc > 2 ? atoi(argv[2]) : 8;
+            long moved = migrate_to_fanout(threads);
+            if (moved < 0) {
+                fprintf(stderr, "Error: Layout migration did not finish.\n");
+                return 1;
+            }
+            printf("Moved %ld account files into the fan-out layout.\n", moved);
+            return 0;
+        }
+        if (strcmp(argv[1], "--migrate") == 0) {
+            int result = migrate_to_store(argc > 2 ? atoi(argv[2]) : 8);
+            store_close();
+            return result;
+        }
+        if (strcmp(argv[1], "--replay") == 0) {
+            int result = replay_ledger(argc > 2 ? atoi(argv[2]) : 4);
+            store_close();
+            return result;
+        }
+        if (strcmp(argv[1], "--reconcile") == 0) {
+            int result = reconcile_ledger(argc > 2 ? atoi(argv[2]) : 4);
+            store_close();
+            return result;
+        }
+        if (strcmp(argv[1], "--batch") == 0 && argc > 2) {
+            int result = run_batch(argv[2], argc > 3 ? atoi(argv[3]) : 8);
+            store_close();
+            return result;
+        }
+        if (strcmp(argv[1], "--standing") == 0) {
+            int result = standing_command(argc, argv);
+            store_close();
+            return result;
+        }
+        if (strcmp(argv[1], "--bulk") == 0 && argc > 4) {
+            int result = run_bulk(argv[2], argv[3], argv[4]);
+            store_close();
+            return result;
+        }
+        if (strcmp(argv[1], "--shared") == 0 && argc > 2) {
+            return shared_command(argv[2]);
+        }
+        if (strcmp(argv[1], "--txn") == 0 && argc > 2) {
+            return show_transaction(strtoull(argv[2], NULL, 10));
+        }
+        if (strcmp(argv[1], "--reverse") == 0 && argc > 2) {
+            int result = reverse_transaction(strtoull(argv[2], NULL, 10));
+            store_close();
+            return result;
+        }
+        if (strcmp(argv[1], "--snapshot") == 0) {
+            int result = take_snapshot();
+            store_close();
+            return result;
+        }
+        if (strcmp(argv[1], "--balance-at") == 0 && argc > 3) {
+            return print_balance_at(argv[2], argv[3]);
+        }
+        if (strcmp(argv[1], "--fees") == 0) {
+            fees_print_schedule();
+            return 0;
+        }
+        if (strcmp(argv[1], "--follow") == 0) {
+            return run_follower(argc > 2 ? argv[2] : NULL);
+        }
+        if (strcmp(argv[1], "--serve") == 0) {
+            return run_session_server(argc > 2 ? argv[2] : NULL);
+        }
+        if (strcmp(argv[1], "--fsck") == 0) {
+            int result = fsck_database(argc, argv);
+            store_close();
+            return result;
+        }
+        if (strcmp(argv[1], "--export") == 0) {
+            int result = export_accounts(argc, argv);
+            store_close();
+            return result;
+        }
+        if (strcmp(argv[1], "--query") == 0 && argc > 2) {
+            // The words are joined with spaces (a query that does not fit is refused)
+            char query[200] = "";
+            size_t length = 0;
+            for (int i = 2; i < argc; i++) {
+                int n = snprintf(query + length, sizeof(query) - length, "%s ", argv[i]);
+                if (n < 0 || (size_t)n >= sizeof(query) - length) {
+                    fprintf(stderr, "Error: The query is too long (at most %zu characters).\n",
+                            sizeof(query) - 1);
+                    return 1;
+                }
+                length += (size_t)n;
+            }
+            return follower_query(NULL, query);
+        }
+        fprintf(stderr, "Unknown option: %s\n", argv[1]);
+        return 1;
+    }
+    
+    // Load the transaction limits and the counters saved by the last session
+    velocity_init();
+    
     // Count the number of accounts and display session info
     int account_count = count_accounts();
     display_session_info(account_count);
@@ -39,28 +202,40 @@ int main(void) {
         // We call the appropriate function based on the user's selection
         switch (choice) {
             case 1: 
+                TRACE_REQUEST_BEGIN("create_account");
                 create_account();
+                TRACE_REQUEST_END("create_account");
                 break;
                 
             case 2: 
+                TRACE_REQUEST_BEGIN("delete_account");
                 delete_account();
+                TRACE_REQUEST_END("delete_account");
                 break;
                 
             case 3:  
+                TRACE_REQUEST_BEGIN("deposit");
                 deposit();
+                TRACE_REQUEST_END("deposit");
                 break;
                 
             case 4: 
+                TRACE_REQUEST_BEGIN("withdraw");
                 withdraw();
+                TRACE_REQUEST_END("withdraw");
                 break;
                 
             case 5:  
+                TRACE_REQUEST_BEGIN("remittance");
                 remittance();
+                TRACE_REQUEST_END("remittance");
                 break;
                 
             case 6:  
                 printf("\nThank you for using our Banking System!\n");
-                log_transaction("User exited the system"); 
+                txlog_append(TXOP_SESSION_END, 0, 0, 0, 0, TXSTATUS_OK);
+                velocity_shutdown();
+                store_close();
                 running = false;  
                 break;
                 
@@ -4,6 +4,7 @@
  */
 
 #include "menu.h"
+#include "utils.h"
 #include <stdio.h>     
 #include <stdlib.h>   
 #include <string.h>  
@@ -12,18 +13,18 @@
 
 //This function shows every banking operation that is available
 void display_menu(void) {
-    printf("\n");
-    printf("========================================\n");
-    printf("         BANKING SYSTEM MENU\n");
-    printf("========================================\n");
-    printf("1. Create New Bank Account\n");     
-    printf("2. Delete Bank Account\n");         
-    printf("3. Deposit\n");                     
-    printf("4. Withdrawal\n");                   
-    printf("5. Remittance\n");                 
-    printf("6. Exit\n");                   
-    printf("========================================\n");
-    printf("Enter your choice (number or keyword): ");
+    print_message("\n");
+    print_message("========================================\n");
+    print_message("         BANKING SYSTEM MENU\n");
+    print_message("========================================\n");
+    print_message("1. Create New Bank Account\n");     
+    print_message("2. Delete Bank Account\n");         
+    print_message("3. Deposit\n");                     
+    print_message("4. Withdrawal\n");                   
+    print_message("5. Remittance\n");                 
+    print_message("6. Exit\n");                   
+    print_message("========================================\n");
+    print_message("Enter your choice (number or keyword): ");
 }
 
 /*
@@ -84,6 +85,17 @@ int get_menu_choice(void) {
         while ((c = getchar()) != '\n' && c != EOF);
     }
     
+    return menu_choice_from_text(input);
+}
+
+/*
+  Works out the menu option of one line of text (without its newline);
+  used by get_menu_choice() and by the sessions of --serve (see session.h)
+  
+  Returns:
+    1-6, or -1 if it does not match any option
+ */
+int menu_choice_from_text(const char *input) {
     /* STEP 3: 
     To match keywords, convert to lowercase
       This enables us to match "Deposit," "DEPOSIT," and "deposit" in the same way
@@ -0,0 +1,326 @@
+/* This file migrates an existing text database into the compact store
+
+   How it works:
+   1. Read up to MIGRATE_CHUNK account numbers from the index file
+   2. The worker threads load those account files in parallel
+   3. The main thread writes the chunk into the store, in index order
+   4. A checkpoint (index position, counts and checksums) is saved, and
+      every account written is noted in MIGRATE_WRITTEN
+   5. Repeat until the end of the index, then verify the store
+
+   Only one chunk is in memory at a time, so the memory used stays the
+   same no matter how many accounts the database has
+ */
+
+#include "migrate.h"
+#include "account.h"
+#include "store.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MIGRATE_CHUNK 4096
+#define MAX_MIGRATE_THREADS 64
+
+// One account written by the migration (a record of MIGRATE_WRITTEN)
+typedef struct {
+    uint32_t account_id;
+    uint32_t version;          // Version of its hot record right after the write
+    int64_t balance_cents;
+} WrittenAccount;
+
+// Progress that is saved in the checkpoint file
+typedef struct {
+    long offset;          // Byte position in the index file to continue from
+    long lines;           // Index lines processed so far
+    long migrated;        // Accounts written into the store
+    long missing;         // Index entries whose account file could not be read
+    long long balance;    // Sum of all migrated balances (cents)
+    unsigned long long hash;  // Checksum of (account id, balance) pairs
+} MigrateProgress;
+
+// One chunk of work shared by the worker threads
+typedef struct {
+    char (*numbers)[20];  // Account numbers read from the index
+    Account *accounts;    // Accounts loaded by the workers
+    bool *loaded;         // Whether each account loaded successfully
+    int count;
+    int threads;
+} MigrateChunk;
+
+typedef struct {
+    MigrateChunk *chunk;
+    int worker;
+} MigrateWorker;
+
+
+/* Mix an account id and balance into one number for the checksum
+   Adding these up gives the same result in any order, so the store can be
+   checked by a plain scan at the end */
+static unsigned long long mix_account(uint32_t id, long long balance_cents) {
+    unsigned long long x = ((unsigned long long)id << 32) ^ (unsigned long long)balance_cents;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/* Save the progress (written to a temporary file, then renamed) */
+static bool save_checkpoint(const MigrateProgress *p) {
+    char temp_name[100];
+    sprintf(temp_name, "%s.tmp", MIGRATE_CHECKPOINT);
+
+    FILE *fp = fopen(temp_name, "w");
+    if (fp == NULL) {
+        return false;
+    }
+    fprintf(fp, "%ld %ld %ld %ld %lld %llu\n", p->offset, p->lines, p->migrated,
+            p->missing, p->balance, p->hash);
+    if (fclose(fp) != 0) {
+        return false;
+    }
+    return rename(temp_name, MIGRATE_CHECKPOINT) == 0;
+}
+
+/* Load the progress of an interrupted migration (if there is one) */
+static bool load_checkpoint(MigrateProgress *p) {
+    FILE *fp = fopen(MIGRATE_CHECKPOINT, "r");
+    if (fp == NULL) {
+        return false;
+    }
+    bool ok = fscanf(fp, "%ld %ld %ld %ld %lld %llu", &p->offset, &p->lines, &p->migrated,
+                     &p->missing, &p->balance, &p->hash) == 6;
+    fclose(fp);
+    return ok;
+}
+
+/* Worker thread: load every n-th account of the chunk */
+static void *load_worker(void *arg) {
+    MigrateWorker *w = arg;
+    MigrateChunk *chunk = w->chunk;
+    for (int i = w->worker; i < chunk->count; i += chunk->threads) {
+        chunk->loaded[i] = load_account(chunk->numbers[i], &chunk->accounts[i]);
+    }
+    return NULL;
+}
+
+/* Load a whole chunk using all the worker threads */
+static void load_chunk(MigrateChunk *chunk) {
+    pthread_t tids[MAX_MIGRATE_THREADS];
+    MigrateWorker workers[MAX_MIGRATE_THREADS];
+    bool started[MAX_MIGRATE_THREADS];
+
+    for (int i = 0; i < chunk->threads; i++) {
+        workers[i].chunk = chunk;
+        workers[i].worker = i;
+        started[i] = pthread_create(&tids[i], NULL, load_worker, &workers[i]) == 0;
+        if (!started[i]) {
+            load_worker(&workers[i]);  // No thread: do this share ourselves
+        }
+    }
+    for (int i = 0; i < chunk->threads; i++) {
+        if (started[i]) {
+            pthread_join(tids[i], NULL);
+        }
+    }
+}
+
+/* Verify function
+   Purpose: Check that the store holds what the migration wrote
+
+   Only the accounts in MIGRATE_WRITTEN are checked (accounts that were
+   in the store before, or opened during the migration, are not part of
+   it): each one is looked up in the store, and the number of accounts
+   and both checksums are calculated again and compared with the
+   migration totals. An account whose hot record has a newer version was
+   saved by the bank after it was migrated; it is counted as changed,
+   with the balance the migration wrote
+ */
+static bool verify_store(const MigrateProgress *p) {
+    FILE *fp = fopen(MIGRATE_WRITTEN, "rb");
+    long found = 0, changed = 0, lost = 0;
+    long long balance = 0;
+    unsigned long long hash = 0;
+    WrittenAccount chunk[1024];
+    size_t n;
+    while (fp != NULL && (n = fread(chunk, sizeof(WrittenAccount), 1024, fp)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            AccountHot hot;
+            if (!store_get_hot(chunk[i].account_id, &hot)) {
+                lost++;
+                continue;
+            }
+            int64_t cents = hot.balance_cents;
+            if (hot.version != chunk[i].version) {
+                changed++;
+                cents = chunk[i].balance_cents;
+            }
+            found++;
+            balance += cents;
+            hash += mix_account(chunk[i].account_id, cents);
+        }
+    }
+    if (fp != NULL) {
+        fclose(fp);
+    }
+
+    printf("Accounts:  migrated %ld, found in store %ld\n", p->migrated, found);
+    printf("Balance:   migrated RM%.2f, store RM%.2f\n", p->balance / 100.0, balance / 100.0);
+    printf("Checksum:  migrated %016llx, store %016llx\n", p->hash, hash);
+    if (changed > 0) {
+        printf("Changed:   %ld accounts were saved again since they were migrated\n", changed);
+    }
+    return lost == 0 && found == p->migrated && balance == p->balance && hash == p->hash;
+}
+
+/* Migrate to store function
+   Purpose: Copy every account in the text database into the compact store
+
+   Parameters:
+     threads - Number of worker threads that read account files
+
+   Returns: 0 if everything was migrated and verified, 1 otherwise
+ */
+int migrate_to_store(int threads) {
+    if (threads < 1) threads = 1;
+    if (threads > MAX_MIGRATE_THREADS) threads = MAX_MIGRATE_THREADS;
+
+    FILE *index = fopen(INDEX_FILE, "r");
+    if (index == NULL) {
+        printf("No accounts found.\n");
+        return 0;
+    }
+    if (!store_open()) {
+        fclose(index);
+        return 1;
+    }
+
+    // STEP 1: Continue from the checkpoint of an interrupted run
+    MigrateProgress progress;
+    memset(&progress, 0, sizeof(progress));
+    bool resumed = load_checkpoint(&progress);
+    if (resumed) {
+        printf("Resuming migration after %ld index entries.\n", progress.lines);
+        fseek(index, progress.offset, SEEK_SET);
+    }
+    // Accounts noted after the last checkpoint are written again, so they are cut off
+    FILE *written = fopen(MIGRATE_WRITTEN, resumed ? "ab" : "wb");
+    if (written != NULL && resumed &&
+        ftruncate(fileno(written), (off_t)progress.migrated * (off_t)sizeof(WrittenAccount)) != 0) {
+        fclose(written);
+        written = NULL;
+    }
+    if (written == NULL) {
+        printf("Error: Cannot write %s.\n", MIGRATE_WRITTEN);
+        fclose(index);
+        return 1;
+    }
+
+    MigrateChunk chunk;
+    chunk.numbers = malloc(MIGRATE_CHUNK * sizeof(*chunk.numbers));
+    chunk.accounts = malloc(MIGRATE_CHUNK * sizeof(Account));
+    chunk.loaded = malloc(MIGRATE_CHUNK * sizeof(bool));
+    chunk.threads = threads;
+    if (chunk.numbers == NULL || chunk.accounts == NULL || chunk.loaded == NULL) {
+        printf("Error: Out of memory.\n");
+        fclose(index);
+        fclose(written);
+        return 1;
+    }
+
+    time_t start = time(NULL);
+    char line[100];
+    bool failed = false;
+    for (;;) {
+        // STEP 2: Read the next chunk of account numbers
+        chunk.count = 0;
+        while (chunk.count < MIGRATE_CHUNK && fgets(line, sizeof(line), index) != NULL) {
+            line[strcspn(line, "\r\n")] = '\0';
+            progress.lines++;
+            if (line[0] == '\0') {
+                continue;
+            }
+            strncpy(chunk.numbers[chunk.count], line, sizeof(chunk.numbers[0]) - 1);
+            chunk.numbers[chunk.count][sizeof(chunk.numbers[0]) - 1] = '\0';
+            chunk.count++;
+        }
+        if (chunk.count == 0) {
+            break;
+        }
+
+        // STEP 3: Load the account files in parallel
+        load_chunk(&chunk);
+
+        // STEP 4: Write the chunk into the store (in index order)
+        for (int i = 0; i < chunk.count; i++) {
+            if (!chunk.loaded[i]) {
+                fprintf(stderr, "Warning: Account file for %s could not be read\n",
+                        chunk.numbers[i]);
+                progress.missing++;
+                continue;
+            }
+            if (!store_put(&chunk.accounts[i])) {
+                fprintf(stderr, "Error: Could not write account %s to the store\n",
+                        chunk.numbers[i]);
+                failed = true;
+                break;
+            }
+            long long cents = amount_to_cents(chunk.accounts[i].balance);
+            WrittenAccount w = { account_id_from_string(chunk.numbers[i]), 0, cents };
+            AccountHot hot;
+            if (store_get_hot(w.account_id, &hot)) {
+                w.version = hot.version;
+            }
+            fwrite(&w, sizeof(w), 1, written);
+            progress.migrated++;
+            progress.balance += cents;
+            progress.hash += mix_account(w.account_id, cents);
+        }
+        if (failed) {
+            break;
+        }
+
+        // STEP 5: Remember how far we got (the accounts written first)
+        if (fflush(written) != 0) {
+            fprintf(stderr, "Error: Could not write %s\n", MIGRATE_WRITTEN);
+            failed = true;
+            break;
+        }
+        progress.offset = ftell(index);
+        if (!save_checkpoint(&progress)) {
+            fprintf(stderr, "Warning: Could not save migration checkpoint\n");
+        }
+        printf("  %ld accounts migrated (%ld s)\n", progress.migrated, (long)(time(NULL) - start));
+    }
+
+    fclose(index);
+    fclose(written);
+    free(chunk.numbers);
+    free(chunk.accounts);
+    free(chunk.loaded);
+    if (failed) {
+        printf("Migration stopped. Run it again to continue from the checkpoint.\n");
+        return 1;
+    }
+
+    // STEP 6: Verify the store against the migration totals
+    printf("\n========================================\n");
+    printf("        MIGRATION VERIFICATION\n");
+    printf("========================================\n");
+    bool ok = verify_store(&progress);
+    if (progress.missing > 0) {
+        printf("Missing:   %ld index entries had no readable account file\n", progress.missing);
+    }
+    printf("Result:    %s\n", ok ? "OK" : "MISMATCH");
+    printf("========================================\n");
+
+    if (ok) {
+        remove(MIGRATE_CHECKPOINT);
+        remove(MIGRATE_WRITTEN);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,454 @@
+/* This file is the reconciliation job (see reconcile.h)
+
+   How the work is shared:
+   The pieces of work are the log segments and chunks of RECONCILE_CHUNK
+   store records. Every thread takes the next piece that nobody has taken
+   (one atomic counter) and adds it to its own totals, so the threads
+   never wait for each other. The totals of all threads are added up at
+   the end; sums do not depend on the order they were made in
+
+   Which type a log record counts for:
+   The account type is not in the log, so it is looked up in the copy of
+   the store. Accounts that are not in it count as "closed"; a closed
+   account's records add up to zero, because its DELETE record takes out
+   the balance it still held
+ */
+
+#include "reconcile.h"
+#include "account.h"
+#include "store.h"
+#include "txlog.h"
+#include "utils.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+
+#define MAX_RECONCILE_THREADS 64
+#define CLOSED_BUCKET ACCOUNT_TYPE_COUNT   // Flows of accounts that were closed
+#define FEE_ACCOUNT_ID "000000000000"      // ID number and PIN of the fee income account
+#define FEE_ACCOUNT_PIN "----"
+
+// What one thread (and then the whole scan) adds up, in cents
+typedef struct {
+    int64_t stored[ACCOUNT_TYPE_COUNT];      // Balances in the store
+    uint64_t accounts[ACCOUNT_TYPE_COUNT];
+    int64_t flows[ACCOUNT_TYPE_COUNT + 1];   // Money the log moved in/out of each type
+    int64_t deposits;
+    int64_t withdrawals;
+    int64_t fees;                            // Fees paid by senders
+    int64_t booked;                          // Fees booked into the fee income account
+    int64_t closed;                          // Balances taken out by closed accounts
+    uint64_t records;
+    uint64_t damaged;
+} Totals;
+
+// Type of one account in the snapshot (for the log records)
+typedef struct {
+    uint32_t account_id;
+    uint32_t type;
+} AccountTypeEntry;
+
+/* One scan: pieces 0 .. store_chunks-1 are store chunks, then the segments */
+typedef struct {
+    const TxSegment *segments;
+    size_t segment_count;
+    const AccountHot *store;  // Copy of the hot records taken with the snapshot
+    size_t store_count;
+    size_t store_chunks;
+    AccountTypeEntry *types;  // Type of every account in the copy, by account number
+    size_t pieces;
+    uint64_t snapshot_id;     // Records after this one are not counted
+    size_t next_piece;        // Taken with an atomic add
+    int unreadable;           // Segments that could not be read
+} Scan;
+
+typedef struct {
+    Scan *scan;
+    Totals totals;
+} ScanWorker;
+
+static int compare_types(const void *a, const void *b) {
+    const AccountTypeEntry *x = a, *y = b;
+    return x->account_id < y->account_id ? -1 : x->account_id > y->account_id;
+}
+
+/* Type an account counts for (CLOSED_BUCKET if it is not in the snapshot) */
+static int account_bucket(const Scan *s, uint32_t id) {
+    AccountTypeEntry key = { id, 0 };
+    const AccountTypeEntry *entry = bsearch(&key, s->types, s->store_count,
+                                            sizeof(AccountTypeEntry), compare_types);
+    if (entry == NULL) {
+        return CLOSED_BUCKET;
+    }
+    return entry->type < ACCOUNT_TYPE_COUNT ? (int)entry->type : CURRENT;
+}
+
+/* Add the records of one log segment to the totals */
+static void sum_segment(Scan *s, const TxSegment *segment, Totals *t) {
+    TxLogView view;
+    if (!txlog_map_segment(segment, &view)) {
+        fprintf(stderr, "Warning: Could not read log segment %s\n", segment->path);
+        __atomic_add_fetch(&s->unreadable, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    for (size_t i = 0; i < view.count; i++) {
+        const TxRecord *rec = &view.records[i];
+        if (!txlog_record_valid(rec)) {
+            t->damaged++;
+            continue;
+        }
+        if (rec->txn_id > s->snapshot_id) {
+            break;   // Written after the job started
+        }
+        t->records++;
+        if (rec->status != TXSTATUS_OK) {
+            continue;
+        }
+        switch (rec->op) {
+            case TXOP_DEPOSIT:
+                t->flows[account_bucket(s, rec->to_id)] += rec->amount_cents;
+                t->deposits += rec->amount_cents;
+                break;
+            case TXOP_WITHDRAW:
+                t->flows[account_bucket(s, rec->from_id)] -= rec->amount_cents;
+                t->withdrawals += rec->amount_cents;
+                break;
+            case TXOP_REMIT:
+                t->flows[account_bucket(s, rec->from_id)] -= rec->amount_cents + rec->fee_cents;
+                t->flows[account_bucket(s, rec->to_id)] += rec->amount_cents;
+                t->fees += rec->fee_cents;
+                break;
+            case TXOP_DELETE:
+                t->flows[account_bucket(s, rec->from_id)] -= rec->amount_cents;
+                t->closed += rec->amount_cents;
+                break;
+            case TXOP_FEE_INCOME:
+                t->flows[account_bucket(s, rec->to_id)] += rec->amount_cents;
+                t->booked += rec->amount_cents;
+                break;
+            case TXOP_REVERSAL:
+                // Undoes a deposit (to nobody), a withdrawal (from nobody) or a remittance
+                if (rec->from_id != 0) {
+                    t->flows[account_bucket(s, rec->from_id)] -= rec->amount_cents;
+                } else {
+                    t->withdrawals -= rec->amount_cents;
+                }
+                if (rec->to_id != 0) {
+                    t->flows[account_bucket(s, rec->to_id)] += rec->amount_cents + rec->fee_cents;
+                } else {
+                    t->deposits -= rec->amount_cents;
+                }
+                t->fees -= rec->fee_cents;
+                break;
+            default:
+                break;   // Opening an account or ending a session moves no money
+        }
+    }
+    txlog_unmap(&view);
+}
+
+/* Add one chunk of store records to the totals */
+static void sum_store_chunk(Scan *s, size_t chunk, Totals *t) {
+    size_t start = chunk * RECONCILE_CHUNK;
+    size_t end = start + RECONCILE_CHUNK < s->store_count ? start + RECONCILE_CHUNK : s->store_count;
+    for (size_t i = start; i < end; i++) {
+        uint32_t type = s->store[i].type < ACCOUNT_TYPE_COUNT ? s->store[i].type : CURRENT;
+        t->stored[type] += s->store[i].balance_cents;
+        t->accounts[type]++;
+    }
+}
+
+/* Scan thread: take pieces of work until there are none left */
+static void *scan_worker(void *arg) {
+    ScanWorker *w = arg;
+    Scan *s = w->scan;
+    for (;;) {
+        size_t piece = __atomic_fetch_add(&s->next_piece, 1, __ATOMIC_RELAXED);
+        if (piece >= s->pieces) {
+            return NULL;
+        }
+        if (piece >= s->store_chunks) {
+            sum_segment(s, &s->segments[piece - s->store_chunks], &w->totals);
+            continue;
+        }
+        sum_store_chunk(s, piece, &w->totals);
+    }
+}
+
+/* Run one scan with "threads" threads and add up their totals */
+static void run_scan(Scan *s, int threads, Totals *out) {
+    ScanWorker workers[MAX_RECONCILE_THREADS];
+    pthread_t tids[MAX_RECONCILE_THREADS];
+    bool started[MAX_RECONCILE_THREADS];
+    for (int i = 0; i < threads; i++) {
+        memset(&workers[i].totals, 0, sizeof(Totals));
+        workers[i].scan = s;
+        started[i] = pthread_create(&tids[i], NULL, scan_worker, &workers[i]) == 0;
+        if (!started[i]) {
+            scan_worker(&workers[i]);   // No thread: do the work ourselves
+        }
+    }
+
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < threads; i++) {
+        if (started[i]) {
+            pthread_join(tids[i], NULL);
+        }
+        const Totals *t = &workers[i].totals;
+        for (int b = 0; b < ACCOUNT_TYPE_COUNT; b++) {
+            out->stored[b] += t->stored[b];
+            out->accounts[b] += t->accounts[b];
+        }
+        for (int b = 0; b <= CLOSED_BUCKET; b++) {
+            out->flows[b] += t->flows[b];
+        }
+        out->deposits += t->deposits;
+        out->withdrawals += t->withdrawals;
+        out->fees += t->fees;
+        out->booked += t->booked;
+        out->closed += t->closed;
+        out->records += t->records;
+        out->damaged += t->damaged;
+    }
+}
+
+/* Take the snapshot: with the store held (no operation is between saving
+   its accounts and logging them), note the last transaction and copy the
+   hot records; the scan then reads the copy, so operations that run
+   meanwhile change neither side of it
+   Returns: false if there is no memory for the copy */
+static bool take_snapshot(Scan *s, TxSegment **segments) {
+    memset(s, 0, sizeof(*s));
+    *segments = NULL;
+
+    // Map the store again, in case another program made it bigger
+    store_close();
+    store_open();
+    int hold = store_update_hold();
+    const AccountHot *records = store_hot_records();
+    size_t count = store_count();
+    AccountHot *copy = malloc((count > 0 ? count : 1) * sizeof(AccountHot));
+    if (copy != NULL) {
+        memcpy(copy, records, count * sizeof(AccountHot));
+        s->segment_count = txlog_segments(segments);
+    }
+    store_update_end(hold);
+
+    AccountTypeEntry *types = malloc((count > 0 ? count : 1) * sizeof(AccountTypeEntry));
+    if (copy == NULL || types == NULL) {
+        free(copy);
+        free(types);
+        free(*segments);
+        *segments = NULL;
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        types[i].account_id = copy[i].account_id;
+        types[i].type = copy[i].type;
+    }
+    qsort(types, count, sizeof(AccountTypeEntry), compare_types);
+
+    s->segments = *segments;
+    s->snapshot_id = s->segment_count > 0 ? (*segments)[s->segment_count - 1].last_id : 0;
+    s->store = copy;
+    s->store_count = count;
+    s->store_chunks = (count + RECONCILE_CHUNK - 1) / RECONCILE_CHUNK;
+    s->types = types;
+    s->pieces = s->store_chunks + s->segment_count;
+    return true;
+}
+
+/* Drift of every type (the store minus what the log says), and in total
+   Returns: true if there is no drift anywhere */
+static bool find_drift(const Totals *t, int64_t drift[ACCOUNT_TYPE_COUNT + 1], int64_t *total) {
+    bool balanced = true;
+    *total = 0;
+    for (int b = 0; b <= CLOSED_BUCKET; b++) {
+        int64_t stored = b < ACCOUNT_TYPE_COUNT ? t->stored[b] : 0;
+        drift[b] = stored - t->flows[b];
+        *total += drift[b];
+        balanced = balanced && drift[b] == 0;
+    }
+    return balanced;
+}
+
+/* Book fees into the fee income account (opened the first time)
+
+   The log record is written before the account is saved: if the program
+   stops in between, the next run reports the missing amount as drift
+   instead of booking the same fees a second time
+ */
+static bool book_in_window(int64_t cents, uint64_t up_to_id) {
+    Account acc;
+    if (load_account(FEE_INCOME_ACCOUNT, &acc)) {
+        // A customer account with this number (from before it was kept free) is not the bank's
+        if (strcmp(acc.id_number, FEE_ACCOUNT_ID) != 0 || strcmp(acc.pin, FEE_ACCOUNT_PIN) != 0) {
+            printf("Error: Account %s belongs to a customer; fees are not booked into it.\n",
+                   FEE_INCOME_ACCOUNT);
+            return false;
+        }
+    } else if (account_exists(FEE_INCOME_ACCOUNT)) {
+        printf("Error: Account %s could not be read (see --fsck).\n", FEE_INCOME_ACCOUNT);
+        return false;
+    } else {
+        memset(&acc, 0, sizeof(acc));
+        strcpy(acc.account_number, FEE_INCOME_ACCOUNT);
+        strcpy(acc.name, "Bank Fee Income");
+        strcpy(acc.id_number, FEE_ACCOUNT_ID);
+        // pin_matches() refuses this account, whatever PIN is typed
+        strcpy(acc.pin, FEE_ACCOUNT_PIN);
+        acc.type = CURRENT;
+        acc.balance = 0.0;
+        if (!save_account(&acc)) {
+            return false;
+        }
+        FILE *fp = fopen(INDEX_FILE, "a");
+        if (fp != NULL) {
+            fprintf(fp, "%s\n", acc.account_number);
+            fclose(fp);
+        }
+        txlog_append(TXOP_CREATE, 0, account_id_from_string(FEE_INCOME_ACCOUNT), 0, 0, TXSTATUS_OK);
+    }
+
+    TxRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.op = TXOP_FEE_INCOME;
+    rec.status = TXSTATUS_OK;
+    rec.to_id = account_id_from_string(FEE_INCOME_ACCOUNT);
+    rec.amount_cents = cents;
+    rec.ref_id = up_to_id;
+    if (txlog_append_batch(&rec, 1) == 0) {
+        return false;
+    }
+    acc.balance = (amount_to_cents(acc.balance) + cents) / 100.0;
+    return save_account(&acc);
+}
+
+// The same, as one update window (see store_update_begin())
+static bool book_fees(int64_t cents, uint64_t up_to_id) {
+    int update = store_update_begin();
+    bool ok = book_in_window(cents, up_to_id);
+    store_update_end(update);
+    return ok;
+}
+
+static void print_report(const Totals *t, const int64_t drift[ACCOUNT_TYPE_COUNT + 1],
+                         int64_t total_drift) {
+    printf("%-8s %9s %17s %17s %14s\n", "Type", "Accounts", "Store (RM)", "Ledger (RM)", "Drift (RM)");
+    uint64_t accounts = 0;
+    int64_t stored = 0, flows = 0;
+    for (int b = 0; b <= CLOSED_BUCKET; b++) {
+        const char *name = b < ACCOUNT_TYPE_COUNT ? account_type_to_string((AccountType)b) : "Closed";
+        uint64_t count = b < ACCOUNT_TYPE_COUNT ? t->accounts[b] : 0;
+        int64_t in_store = b < ACCOUNT_TYPE_COUNT ? t->stored[b] : 0;
+        printf("%-8s %9llu %17.2f %17.2f %14.2f\n", name, (unsigned long long)count,
+               in_store / 100.0, t->flows[b] / 100.0, drift[b] / 100.0);
+        accounts += count;
+        stored += in_store;
+        flows += t->flows[b];
+    }
+    printf("%-8s %9llu %17.2f %17.2f %14.2f\n", "Total", (unsigned long long)accounts,
+           stored / 100.0, flows / 100.0, total_drift / 100.0);
+    printf("\nDeposits: RM%.2f   Withdrawals: RM%.2f   Closed accounts: RM%.2f\n",
+           t->deposits / 100.0, t->withdrawals / 100.0, t->closed / 100.0);
+    printf("Fees collected: RM%.2f   Fees booked: RM%.2f\n", t->fees / 100.0, t->booked / 100.0);
+}
+
+/* Reconcile ledger function
+   Purpose: Check that the balances agree with the log, per type and in total
+
+   Steps:
+   1. Make sure only one reconciliation runs at a time (it books fees)
+   2. Take a snapshot (the last transaction so far and a copy of the
+      hot records), then scan the log up to it and the copy in parallel
+   3. Print the report
+   4. Book the fees collected since the last run, if everything agrees
+ */
+int reconcile_ledger(int threads) {
+    if (threads < 1) threads = 1;
+    if (threads > MAX_RECONCILE_THREADS) threads = MAX_RECONCILE_THREADS;
+
+    // STEP 1: One job at a time
+    int lock = open(RECONCILE_LOCK, O_RDWR | O_CREAT, 0644);
+    if (lock < 0 || flock(lock, LOCK_EX | LOCK_NB) != 0) {
+        printf("Error: Another reconciliation is running.\n");
+        if (lock >= 0) {
+            close(lock);
+        }
+        return 1;
+    }
+    if (store_count() == 0) {
+        printf("Error: The account store is empty. Run --migrate first.\n");
+        close(lock);
+        return 1;
+    }
+
+    // STEP 2: Snapshot, then scan it
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Scan scan;
+    TxSegment *segments;
+    if (!take_snapshot(&scan, &segments)) {
+        printf("Error: Out of memory.\n");
+        close(lock);
+        return 1;
+    }
+    Totals totals;
+    int64_t drift[ACCOUNT_TYPE_COUNT + 1], total_drift = 0;
+    run_scan(&scan, threads, &totals);
+    bool balanced = find_drift(&totals, drift, &total_drift);
+    uint64_t snapshot_id = scan.snapshot_id;
+    int unreadable = scan.unreadable;
+    free((void *)scan.store);
+    free(scan.types);
+    free(segments);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    // STEP 3: Report
+    printf("\n========================================\n");
+    printf("          RECONCILIATION REPORT\n");
+    printf("========================================\n");
+    printf("Snapshot: up to txn %llu, %llu log records, %d thread%s, %.3f s\n",
+           (unsigned long long)snapshot_id, (unsigned long long)totals.records, threads,
+           threads == 1 ? "" : "s", seconds);
+    print_report(&totals, drift, total_drift);
+    if (totals.damaged > 0 || unreadable > 0) {
+        printf("Damaged log records: %llu   Unreadable segments: %d\n",
+               (unsigned long long)totals.damaged, unreadable);
+    }
+    if (access(TRANSACTION_LOG, F_OK) == 0) {
+        printf("Note: %s (the old text log) is not included.\n", TRANSACTION_LOG);
+    }
+    if (balanced) {
+        printf("Result: BALANCED\n");
+    } else {
+        printf("Result: DRIFT FOUND\n");
+    }
+
+    // STEP 4: Book the fees that are not in the fee income account yet
+    // (only from a scan that balanced: with drift the fee totals can not be trusted)
+    int64_t unbooked = totals.fees - totals.booked;
+    if (!balanced && unbooked != 0) {
+        printf("Fees are not booked until the drift is resolved.\n");
+    } else if (unbooked != 0) {
+        if (book_fees(unbooked, snapshot_id)) {
+            // Negative when reversals refunded fees that were already booked
+            printf(unbooked > 0 ? "Booked RM%.2f of fees into account %s.\n"
+                                : "Took RM%.2f of refunded fees out of account %s.\n",
+                   (unbooked > 0 ? unbooked : -unbooked) / 100.0, FEE_INCOME_ACCOUNT);
+        } else {
+            printf("Error: Could not book the fees into account %s.\n", FEE_INCOME_ACCOUNT);
+        }
+    }
+    printf("========================================\n");
+
+    close(lock);
+    return balanced ? 0 : 1;
+}
@@ -0,0 +1,626 @@
+/* This file is the ledger replay engine
+   It rebuilds every balance from zero by reading the transaction log,
+   then compares the rebuilt balances with the account store
+
+   Two logs are read, oldest first:
+   - TRANSACTION_LOG: the old text log (installations that existed before
+     the binary log keep their history there)
+   - The binary log in TXLOG_DIR: every closed segment (seg-*.bin, in
+     catalog order, compressed ones unpacked into memory), then
+     active.bin, each scanned straight from memory
+
+   How it works:
+   1. The main thread reads the logs and turns every entry into events
+      (a remittance becomes two: one per account)
+   2. Every account belongs to exactly one partition (chosen by a hash of
+      its number), and every partition has its own worker thread
+   3. Events are handed to the partitions in batches, in log order, so the
+      events of one account are always applied in the order they happened
+   4. When the whole log has been read, the rebuilt balances are compared
+      with the store and every difference is reported
+ */
+
+#include "replay.h"
+#include "account.h"
+#include "store.h"
+#include "utils.h"
+#include "txlog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <time.h>
+
+#define REPLAY_BATCH 4096      // Events handed to a partition at once
+#define REPLAY_QUEUE 8         // Batches waiting per partition
+#define MAX_REPLAY_THREADS 64
+#define MAX_REPORTED 100       // Differences printed in detail
+
+/* Where an event came from: text log line numbers are stored as they are,
+   binary log transaction IDs have ENTRY_TXN added so the two never mix */
+#define ENTRY_TXN (1ULL << 63)
+
+// What an event does to an account
+typedef enum {
+    EV_CREATE,   // Account opened (balance starts at zero)
+    EV_DELETE,   // Account closed
+    EV_AMOUNT    // Money in (positive delta) or out (negative delta)
+} ReplayKind;
+
+typedef struct {
+    uint64_t entry;        // Log line or transaction ID the event came from
+    int64_t delta_cents;
+    uint32_t account_id;
+    uint32_t kind;
+} ReplayEvent;
+
+typedef struct {
+    int count;
+    ReplayEvent events[REPLAY_BATCH];
+} ReplayBatch;
+
+// Rebuilt state of one account
+typedef struct {
+    uint32_t account_id;       // 0 means the slot is empty
+    uint32_t events;
+    int64_t balance_cents;
+    uint64_t first_entry;      // First log entry that touched the account
+    uint64_t last_entry;       // Last log entry that touched the account
+    uint64_t negative_entry;   // First entry that made the balance negative (0 = never)
+    bool created;
+    bool deleted;
+} ReplayAccount;
+
+// One partition: a queue of batches, a worker thread and its accounts
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    ReplayBatch *queue[REPLAY_QUEUE];
+    int head;
+    int queued;
+    bool done;
+
+    ReplayBatch *filling;      // Batch the reader is adding events to
+
+    ReplayAccount *table;      // Open addressing hash table
+    size_t capacity;
+    size_t used;
+} ReplayPartition;
+
+typedef struct {
+    ReplayPartition *parts;
+    int threads;
+    uint64_t lines;
+    uint64_t events;
+    uint64_t unparsed;
+    char first_unparsed[80];   // Where the first unreadable entry is
+} Replay;
+
+
+static size_t hash_id(uint32_t id) {
+    uint32_t h = id * 2654435761u;
+    return (size_t)(h ^ (h >> 16));
+}
+
+/* Find (or add) an account in a partition's table */
+static ReplayAccount *find_account(ReplayPartition *part, uint32_t id, bool create) {
+    if (create && (part->used + 1) * 10 > part->capacity * 7) {
+        // Grow the table to twice the size
+        ReplayAccount *old = part->table;
+        size_t old_capacity = part->capacity;
+        part->capacity = old_capacity ? old_capacity * 2 : 4096;
+        part->table = calloc(part->capacity, sizeof(ReplayAccount));
+        if (part->table == NULL) {
+            fprintf(stderr, "Error: Out of memory during replay\n");
+            exit(1);
+        }
+        part->used = 0;
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old[i].account_id != 0) {
+                *find_account(part, old[i].account_id, true) = old[i];
+            }
+        }
+        free(old);
+    }
+    if (part->capacity == 0) {
+        return NULL;
+    }
+
+    size_t mask = part->capacity - 1;
+    size_t i = hash_id(id) & mask;
+    while (part->table[i].account_id != 0) {
+        if (part->table[i].account_id == id) {
+            return &part->table[i];
+        }
+        i = (i + 1) & mask;
+    }
+    if (!create) {
+        return NULL;
+    }
+    memset(&part->table[i], 0, sizeof(ReplayAccount));
+    part->table[i].account_id = id;
+    part->used++;
+    return &part->table[i];
+}
+
+/* Apply one event to its account (only called by the partition's thread) */
+static void apply_event(ReplayPartition *part, const ReplayEvent *ev) {
+    ReplayAccount *acc = find_account(part, ev->account_id, true);
+    if (acc->events == 0) {
+        acc->first_entry = ev->entry;
+    }
+    acc->events++;
+    acc->last_entry = ev->entry;
+
+    switch (ev->kind) {
+        case EV_CREATE:
+            // A new account (the number may have been used by a deleted one)
+            acc->balance_cents = 0;
+            acc->negative_entry = 0;
+            acc->created = true;
+            acc->deleted = false;
+            break;
+        case EV_DELETE:
+            acc->deleted = true;
+            break;
+        default:
+            acc->balance_cents += ev->delta_cents;
+            if (acc->balance_cents < 0 && acc->negative_entry == 0) {
+                acc->negative_entry = ev->entry;
+            }
+            break;
+    }
+}
+
+/* Partition worker thread: apply batches until the reader is done */
+static void *partition_worker(void *arg) {
+    ReplayPartition *part = arg;
+    for (;;) {
+        pthread_mutex_lock(&part->lock);
+        while (part->queued == 0 && !part->done) {
+            pthread_cond_wait(&part->not_empty, &part->lock);
+        }
+        if (part->queued == 0) {
+            pthread_mutex_unlock(&part->lock);
+            return NULL;
+        }
+        ReplayBatch *batch = part->queue[part->head];
+        part->head = (part->head + 1) % REPLAY_QUEUE;
+        part->queued--;
+        pthread_cond_signal(&part->not_full);
+        pthread_mutex_unlock(&part->lock);
+
+        for (int i = 0; i < batch->count; i++) {
+            apply_event(part, &batch->events[i]);
+        }
+        free(batch);
+    }
+}
+
+/* Hand the batch being filled to the partition's worker (waits if it is busy) */
+static void flush_batch(ReplayPartition *part) {
+    ReplayBatch *batch = part->filling;
+    if (batch == NULL || batch->count == 0) {
+        return;
+    }
+    part->filling = NULL;
+
+    pthread_mutex_lock(&part->lock);
+    while (part->queued == REPLAY_QUEUE) {
+        pthread_cond_wait(&part->not_full, &part->lock);
+    }
+    part->queue[(part->head + part->queued) % REPLAY_QUEUE] = batch;
+    part->queued++;
+    pthread_cond_signal(&part->not_empty);
+    pthread_mutex_unlock(&part->lock);
+}
+
+/* Send an event to the partition that owns its account */
+static void route_event(Replay *r, uint32_t account_id, uint32_t kind,
+                        int64_t delta_cents, uint64_t entry) {
+    ReplayPartition *part = &r->parts[hash_id(account_id) % (size_t)r->threads];
+    if (part->filling == NULL) {
+        part->filling = malloc(sizeof(ReplayBatch));
+        if (part->filling == NULL) {
+            fprintf(stderr, "Error: Out of memory during replay\n");
+            exit(1);
+        }
+        part->filling->count = 0;
+    }
+
+    ReplayEvent *ev = &part->filling->events[part->filling->count++];
+    ev->entry = entry;
+    ev->delta_cents = delta_cents;
+    ev->account_id = account_id;
+    ev->kind = kind;
+    r->events++;
+
+    if (part->filling->count == REPLAY_BATCH) {
+        flush_batch(part);
+    }
+}
+
+/* Small parsing helpers
+   Each one moves *p past what it read and returns false if the text
+   does not match, so a line can be checked piece by piece
+ */
+static bool expect(const char **p, const char *text) {
+    size_t len = strlen(text);
+    if (strncmp(*p, text, len) != 0) {
+        return false;
+    }
+    *p += len;
+    return true;
+}
+
+static bool parse_account(const char **p, uint32_t *id) {
+    char number[16];
+    int len = 0;
+    while (isdigit((unsigned char)**p) && len < 15) {
+        number[len++] = *(*p)++;
+    }
+    number[len] = '\0';
+    *id = account_id_from_string(number);
+    return *id != 0;
+}
+
+// Parse an amount written with "%.2f" (exp. "1234.50") into cents
+static bool parse_cents(const char **p, int64_t *cents) {
+    int64_t value = 0;
+    int digits = 0;
+    while (isdigit((unsigned char)**p)) {
+        value = value * 10 + (*(*p)++ - '0');
+        digits++;
+    }
+    if (digits == 0 || **p != '.' || !isdigit((unsigned char)(*p)[1]) ||
+        !isdigit((unsigned char)(*p)[2])) {
+        return false;
+    }
+    *cents = value * 100 + ((*p)[1] - '0') * 10 + ((*p)[2] - '0');
+    *p += 3;
+    return true;
+}
+
+/* Turn one log line into events
+   Returns: false if the line looks like a money movement but can't be read
+ */
+static bool parse_line(Replay *r, const char *line, uint64_t line_no) {
+    const char *p = line;
+    uint32_t from, to;
+    int64_t amount, fee;
+
+    // Skip the "[YYYY-MM-DD HH:MM:SS] " timestamp
+    if (*p == '[') {
+        p = strchr(p, ']');
+        if (p == NULL || p[1] != ' ') {
+            return false;
+        }
+        p += 2;
+    }
+
+    if (expect(&p, "Deposit: Account ")) {
+        if (!parse_account(&p, &to) || !expect(&p, ", Amount: RM") || !parse_cents(&p, &amount)) {
+            return false;
+        }
+        route_event(r, to, EV_AMOUNT, amount, line_no);
+    } else if (expect(&p, "Withdrawal: Account ")) {
+        if (!parse_account(&p, &from) || !expect(&p, ", Amount: RM") || !parse_cents(&p, &amount)) {
+            return false;
+        }
+        route_event(r, from, EV_AMOUNT, -amount, line_no);
+    } else if (expect(&p, "Remittance: From ")) {
+        if (!parse_account(&p, &from) || !expect(&p, " to ") || !parse_account(&p, &to) ||
+            !expect(&p, ", Amount: RM") || !parse_cents(&p, &amount) ||
+            !expect(&p, ", Fee: RM") || !parse_cents(&p, &fee)) {
+            return false;
+        }
+        route_event(r, from, EV_AMOUNT, -(amount + fee), line_no);
+        route_event(r, to, EV_AMOUNT, amount, line_no);
+    } else if (expect(&p, "Created account ")) {
+        if (!parse_account(&p, &to)) {
+            return false;
+        }
+        route_event(r, to, EV_CREATE, 0, line_no);
+    } else if (expect(&p, "Deleted account ")) {
+        if (!parse_account(&p, &from)) {
+            return false;
+        }
+        route_event(r, from, EV_DELETE, 0, line_no);
+    }
+    // Any other line (exp. "User exited the system") does not move money
+    return true;
+}
+
+/* Write where an entry is, exp. "line 120" or "txn 4410" */
+static const char *format_entry(uint64_t entry, char *buf, size_t size) {
+    if (entry & ENTRY_TXN) {
+        snprintf(buf, size, "txn %llu", (unsigned long long)(entry & ~ENTRY_TXN));
+    } else {
+        snprintf(buf, size, "line %llu", (unsigned long long)entry);
+    }
+    return buf;
+}
+
+/* Read the text log from start to end, routing every event */
+static void read_text_log(Replay *r, FILE *fp) {
+    static char buffer[1 << 20];
+    setvbuf(fp, buffer, _IOFBF, sizeof(buffer));
+
+    char line[512];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        r->lines++;
+        if (!parse_line(r, line, r->lines)) {
+            if (r->unparsed == 0) {
+                format_entry(r->lines, r->first_unparsed, sizeof(r->first_unparsed));
+            }
+            r->unparsed++;
+        }
+    }
+}
+
+/* Read one segment of the binary log straight from memory, routing every event
+   Damaged records (bad checksum) are counted and skipped */
+static void read_binary_log(Replay *r, const TxSegment *segment, const TxLogView *view) {
+    const char *name = strrchr(segment->path, '/');
+    name = name != NULL ? name + 1 : segment->path;
+
+    for (size_t i = 0; i < view->count; i++) {
+        const TxRecord *rec = &view->records[i];
+        r->lines++;
+        if (!txlog_record_valid(rec)) {
+            if (r->unparsed == 0) {
+                snprintf(r->first_unparsed, sizeof(r->first_unparsed),
+                         "%.40s record %zu", name, i);
+            }
+            r->unparsed++;
+            continue;
+        }
+        if (rec->status != TXSTATUS_OK) {
+            continue;  // Nothing was changed by a failed operation
+        }
+
+        uint64_t entry = rec->txn_id | ENTRY_TXN;
+        switch (rec->op) {
+            case TXOP_CREATE:
+                route_event(r, rec->to_id, EV_CREATE, 0, entry);
+                break;
+            case TXOP_DELETE:
+                route_event(r, rec->from_id, EV_DELETE, 0, entry);
+                break;
+            case TXOP_DEPOSIT:
+            case TXOP_FEE_INCOME:
+                route_event(r, rec->to_id, EV_AMOUNT, rec->amount_cents, entry);
+                break;
+            case TXOP_WITHDRAW:
+                route_event(r, rec->from_id, EV_AMOUNT, -rec->amount_cents, entry);
+                break;
+            case TXOP_REMIT:
+                route_event(r, rec->from_id, EV_AMOUNT, -(rec->amount_cents + rec->fee_cents), entry);
+                route_event(r, rec->to_id, EV_AMOUNT, rec->amount_cents, entry);
+                break;
+            case TXOP_REVERSAL:
+                if (rec->from_id != 0) {
+                    route_event(r, rec->from_id, EV_AMOUNT, -rec->amount_cents, entry);
+                }
+                if (rec->to_id != 0) {
+                    route_event(r, rec->to_id, EV_AMOUNT, rec->amount_cents + rec->fee_cents, entry);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/* Look up the stored balance of an account
+   The compact store is used when it has been filled (see --migrate),
+   otherwise the account's text file is read
+ */
+static bool stored_balance(uint32_t id, bool use_store, int64_t *cents) {
+    if (use_store) {
+        AccountHot hot;
+        if (!store_get_hot(id, &hot)) {
+            return false;
+        }
+        *cents = hot.balance_cents;
+        return true;
+    }
+
+    char number[16];
+    Account acc;
+    sprintf(number, "%u", id);
+    if (!load_account(number, &acc)) {
+        return false;
+    }
+    *cents = amount_to_cents(acc.balance);
+    return true;
+}
+
+/* Print one difference (only the first MAX_REPORTED are printed in full) */
+static void report(long *reported, const char *fmt, uint32_t id,
+                   const ReplayAccount *acc, int64_t ledger, int64_t stored) {
+    if (++*reported > MAX_REPORTED) {
+        return;
+    }
+    printf("  %-9u ", id);
+    printf(fmt, ledger / 100.0, stored / 100.0, (stored - ledger) / 100.0);
+    if (acc != NULL) {
+        char first[40], last[40], negative[40];
+        printf("  (first %s, last %s", format_entry(acc->first_entry, first, sizeof(first)),
+               format_entry(acc->last_entry, last, sizeof(last)));
+        if (acc->negative_entry != 0) {
+            printf(", negative after %s",
+                   format_entry(acc->negative_entry, negative, sizeof(negative)));
+        }
+        printf(")");
+    }
+    printf("\n");
+}
+
+/* Compare the rebuilt balances with the store
+   Returns: The number of accounts that do not agree
+ */
+static long diff_with_store(Replay *r) {
+    bool use_store = store_count() > 0;
+    long reported = 0, matched = 0;
+
+    printf("Differences (ledger vs %s):\n", use_store ? "account store" : "account files");
+    for (int t = 0; t < r->threads; t++) {
+        ReplayPartition *part = &r->parts[t];
+        for (size_t i = 0; i < part->capacity; i++) {
+            const ReplayAccount *acc = &part->table[i];
+            if (acc->account_id == 0) {
+                continue;
+            }
+            int64_t stored;
+            bool exists = stored_balance(acc->account_id, use_store, &stored);
+
+            if (acc->deleted) {
+                if (exists) {
+                    report(&reported, "deleted in ledger but still stored (RM%.2f / RM%.2f, diff RM%.2f)",
+                           acc->account_id, acc, 0, stored);
+                } else {
+                    matched++;
+                }
+            } else if (!exists) {
+                report(&reported, "missing from store (ledger RM%.2f, store RM%.2f, diff RM%.2f)",
+                       acc->account_id, acc, acc->balance_cents, 0);
+            } else if (stored != acc->balance_cents || acc->negative_entry != 0) {
+                report(&reported, "ledger RM%.2f  store RM%.2f  diff RM%.2f",
+                       acc->account_id, acc, acc->balance_cents, stored);
+            } else {
+                matched++;
+            }
+        }
+    }
+
+    // Accounts that hold money but never appear in the log
+    if (use_store) {
+        const AccountHot *records = store_hot_records();
+        size_t count = store_count();
+        for (size_t i = 0; i < count; i++) {
+            ReplayPartition *part = &r->parts[hash_id(records[i].account_id) % (size_t)r->threads];
+            if (find_account(part, records[i].account_id, false) != NULL) {
+                continue;
+            }
+            if (records[i].balance_cents != 0) {
+                report(&reported, "not in ledger (ledger RM%.2f, store RM%.2f, diff RM%.2f)",
+                       records[i].account_id, NULL, 0, records[i].balance_cents);
+            } else {
+                matched++;
+            }
+        }
+    }
+
+    if (reported == 0) {
+        printf("  none\n");
+    } else if (reported > MAX_REPORTED) {
+        printf("  ... and %ld more\n", reported - MAX_REPORTED);
+    }
+    printf("Accounts matching: %ld\n", matched);
+    return reported;
+}
+
+/* Replay ledger function
+   Purpose: Rebuild all balances from the log and compare them with the store
+
+   Parameters:
+     threads - Number of partitions (one worker thread each)
+
+   Returns: 0 if every balance agrees, 1 if there are differences
+ */
+int replay_ledger(int threads) {
+    if (threads < 1) threads = 1;
+    if (threads > MAX_REPLAY_THREADS) threads = MAX_REPLAY_THREADS;
+
+    FILE *fp = fopen(TRANSACTION_LOG, "r");
+    TxSegment *segments;
+    size_t segment_count = txlog_segments(&segments);
+    if (fp == NULL && segment_count == 0) {
+        printf("No transaction log found.\n");
+        return 1;
+    }
+
+    Replay r;
+    memset(&r, 0, sizeof(r));
+    r.threads = threads;
+    r.parts = calloc((size_t)threads, sizeof(ReplayPartition));
+    if (r.parts == NULL) {
+        free(segments);
+        return 1;
+    }
+
+    // STEP 1: Start one worker per partition
+    for (int t = 0; t < threads; t++) {
+        ReplayPartition *part = &r.parts[t];
+        pthread_mutex_init(&part->lock, NULL);
+        pthread_cond_init(&part->not_empty, NULL);
+        pthread_cond_init(&part->not_full, NULL);
+        if (pthread_create(&part->thread, NULL, partition_worker, part) != 0) {
+            fprintf(stderr, "Error: Could not start replay thread\n");
+            exit(1);
+        }
+    }
+
+    // STEP 2: Read the logs (old text history first) and route the events
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (fp != NULL) {
+        read_text_log(&r, fp);
+        fclose(fp);
+    }
+    for (size_t s = 0; s < segment_count; s++) {
+        TxLogView view;
+        if (!txlog_map_segment(&segments[s], &view)) {
+            fprintf(stderr, "Warning: Could not read log segment %s\n", segments[s].path);
+            continue;
+        }
+        read_binary_log(&r, &segments[s], &view);
+        txlog_unmap(&view);
+    }
+    free(segments);
+
+    // STEP 3: Hand over the last batches and wait for the workers
+    for (int t = 0; t < threads; t++) {
+        ReplayPartition *part = &r.parts[t];
+        flush_batch(part);
+        pthread_mutex_lock(&part->lock);
+        part->done = true;
+        pthread_cond_signal(&part->not_empty);
+        pthread_mutex_unlock(&part->lock);
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(r.parts[t].thread, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    // STEP 4: Compare with the store and report
+    printf("\n========================================\n");
+    printf("          LEDGER REPLAY REPORT\n");
+    printf("========================================\n");
+    printf("Log entries: %llu   Events: %llu   Threads: %d\n",
+           (unsigned long long)r.lines, (unsigned long long)r.events, threads);
+    printf("Replay time: %.3f s (%.0f events/s)\n", seconds,
+           seconds > 0 ? r.events / seconds : 0.0);
+    if (r.unparsed > 0) {
+        printf("Unreadable ledger entries: %llu (first at %s)\n",
+               (unsigned long long)r.unparsed, r.first_unparsed);
+    }
+    long differences = diff_with_store(&r);
+    printf("Result: %s\n", differences == 0 && r.unparsed == 0 ? "LEDGER AND BALANCES AGREE"
+                                                              : "DIFFERENCES FOUND");
+    printf("========================================\n");
+
+    for (int t = 0; t < threads; t++) {
+        pthread_mutex_destroy(&r.parts[t].lock);
+        pthread_cond_destroy(&r.parts[t].not_empty);
+        pthread_cond_destroy(&r.parts[t].not_full);
+        free(r.parts[t].table);
+    }
+    free(r.parts);
+    return differences == 0 && r.unparsed == 0 ? 0 : 1;
+}
@@ -0,0 +1,433 @@
+/* This file runs the dialogues (see session.h): on the screen for the
+   menu, and for every connection of --serve
+
+   The server has one thread. poll() says which connections sent
+   something or can take more output; a complete line is handed to that
+   connection's Session, which answers into the connection's output
+   buffer, and the buffer is sent without ever waiting for the other
+   side. A connection gets its next line only after all of its output
+   was sent, so a slow reader holds up nobody but itself
+
+   A step still reads and writes account files while it runs, like the
+   menu always did; what no longer blocks the program is waiting for a
+   person to type
+ */
+
+#include "session.h"
+#include "menu.h"
+#include "utils.h"
+#include "txlog.h"
+#include "velocity.h"
+#include "store.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+typedef void (*StepFunction)(Session *s, const char *line);
+
+// The step function of each flow, in the order of SessionFlow
+static const StepFunction step_functions[] = {
+    create_account_step,
+    delete_account_step,
+    deposit_step,
+    withdraw_step,
+    remittance_step
+};
+
+// Names of the flows on the trace (see trace.h)
+static const char *const flow_names[] = {
+    "create_account", "delete_account", "deposit", "withdraw", "remittance", "menu"
+};
+
+// One connection of --serve
+typedef struct {
+    int fd;
+    Session session;
+    char out[SESSION_OUTPUT_MAX];  // Output of the last step
+    size_t out_len;
+    size_t out_sent;               // Bytes of it already sent
+    char in[SESSION_LINE_MAX];     // Input that is not a whole line yet
+    size_t in_len;
+    bool skip_line;                // The line was too long: ignore the rest of it
+} Connection;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_stop_signal(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+/* ---------- For the dialogues ---------- */
+
+void session_prompt(Session *s, int step, const char *prompt) {
+    s->step = step;
+    print_message("%s", prompt);
+}
+
+void session_end(Session *s) {
+    s->done = true;
+}
+
+bool session_text(const char *line, char *field, size_t size) {
+    if (line == NULL) {
+        return false;
+    }
+    snprintf(field, size, "%s", line);
+
+    // Check if the input is empty
+    if (field[0] == '\0') {
+        print_message("Error: Input cannot be empty.\n");
+        return false;
+    }
+    return true;
+}
+
+bool session_number(const char *line, double *value) {
+    if (line == NULL) {
+        return false;
+    }
+
+    // Try to convert the text to a number (double)
+    char *endptr;
+    errno = 0;
+    *value = strtod(line, &endptr);
+    if (endptr == line || *endptr != '\0') {
+        print_message("Error: Invalid input. Please enter a number.\n");
+        return false;
+    }
+
+    // Check if the number was too large
+    if (errno == ERANGE) {
+        print_message("Error: Number out of range.\n");
+        return false;
+    }
+    return true;
+}
+
+/* ---------- Running a dialogue ---------- */
+
+/* Start a flow on a session; a session of --serve stays in the menu
+   (when the flow is FLOW_MENU, the menu is shown and waits for a choice) */
+static void start_flow(Session *s, SessionFlow flow) {
+    bool in_menu = s->in_menu;
+    memset(s, 0, sizeof(*s));
+    s->flow = flow;
+    s->in_menu = in_menu || flow == FLOW_MENU;
+    if (flow == FLOW_MENU) {
+        display_menu();
+        return;
+    }
+    step_functions[flow](s, NULL);
+    if (s->done && s->in_menu) {
+        start_flow(s, FLOW_MENU);
+    }
+}
+
+/* The menu of --serve: the same options and messages as the menu of main() */
+static void menu_input(Session *s, const char *line) {
+    if (line == NULL) {
+        s->closed = true;   // Nobody is left to serve
+        s->done = true;
+        return;
+    }
+    int choice = menu_choice_from_text(line);
+    if (choice >= 1 && choice <= 5) {
+        start_flow(s, (SessionFlow)(FLOW_CREATE + (choice - 1)));
+    } else if (choice == 6) {
+        print_message("\nThank you for using our Banking System!\n");
+        txlog_append(TXOP_SESSION_END, 0, 0, 0, 0, TXSTATUS_OK);
+        s->closed = true;
+        s->done = true;
+    } else {
+        print_message("\nInvalid option. Please select a valid menu option.\n");
+        display_menu();
+    }
+}
+
+void session_begin(Session *s, SessionFlow flow) {
+    memset(s, 0, sizeof(*s));
+    start_flow(s, flow);
+}
+
+void session_input(Session *s, const char *line) {
+    if (s->flow == FLOW_MENU) {
+        menu_input(s, line);
+        return;
+    }
+    if (s->done) {
+        return;
+    }
+    step_functions[s->flow](s, line);
+    if (s->done && s->in_menu) {
+        start_flow(s, FLOW_MENU);
+    }
+}
+
+void session_continue(Session *s) {
+    s->more_output = false;
+    session_input(s, NULL);
+}
+
+/* Session console function
+   Purpose: Run one dialogue with the keyboard, exactly like the menu
+   functions used to (create_account(), deposit() ... call this)
+ */
+void session_run_console(SessionFlow flow) {
+    Session s;
+    char line[SESSION_LINE_MAX];
+
+    session_begin(&s, flow);
+    while (!s.done) {
+        if (fgets(line, sizeof(line), stdin) == NULL) {
+            session_input(&s, NULL);
+            continue;
+        }
+
+        // Remove the newline; a line too long for the buffer is cut here
+        size_t len = strlen(line);
+        if (len > 0 && line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+        } else {
+            clear_input_buffer();
+        }
+        session_input(&s, line);
+    }
+}
+
+/* ---------- The server ---------- */
+
+/* Run one step of a connection's session, its output going into c->out
+   (line NULL with more_output set: print the rest of the last step) */
+static void run_step(Connection *c, const char *line) {
+    MessageBuffer buffer = { c->out, sizeof(c->out), 0 };
+    const char *name = flow_names[c->session.flow];
+
+    TRACE_REQUEST_BEGIN(name);
+    set_message_buffer(&buffer);
+    if (line == NULL && c->session.more_output) {
+        session_continue(&c->session);
+    } else {
+        session_input(&c->session, line);
+    }
+    set_message_buffer(NULL);
+    TRACE_REQUEST_END(name);
+
+    c->out_len = buffer.length;
+    c->out_sent = 0;
+}
+
+/* Send what is waiting, then feed the session its next lines while the
+   output of each one can be sent straight away
+   Returns: false when the connection is finished (Exit, or it is gone) */
+static bool pump_connection(Connection *c) {
+    for (;;) {
+        while (c->out_sent < c->out_len) {
+            ssize_t n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent,
+                             MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return true;   // Wait for POLLOUT
+            }
+            if (n <= 0) {
+                return false;
+            }
+            c->out_sent += (size_t)n;
+        }
+        c->out_len = c->out_sent = 0;
+        if (c->session.closed) {
+            return false;
+        }
+        if (c->session.more_output) {
+            run_step(c, NULL);
+            continue;
+        }
+
+        // The next line, if a whole one has arrived
+        char *newline = memchr(c->in, '\n', c->in_len);
+        if (newline == NULL) {
+            if (c->in_len == sizeof(c->in) - 1) {
+                // Too long: use what fits (like the menu) and ignore the rest
+                c->in[c->in_len] = '\0';
+                c->in_len = 0;
+                if (!c->skip_line) {
+                    c->skip_line = true;
+                    run_step(c, c->in);
+                }
+                continue;
+            }
+            return true;
+        }
+        *newline = '\0';
+        if (newline > c->in && newline[-1] == '\r') {
+            newline[-1] = '\0';   // Sent by telnet and Windows clients
+        }
+        if (c->skip_line) {
+            c->skip_line = false;
+        } else {
+            run_step(c, c->in);
+        }
+        size_t used = (size_t)(newline - c->in) + 1;
+        memmove(c->in, newline + 1, c->in_len - used);
+        c->in_len -= used;
+    }
+}
+
+/* Read what a connection sent and serve it
+   Returns: false when the connection is finished */
+static bool read_connection(Connection *c) {
+    ssize_t got = read(c->fd, c->in + c->in_len, sizeof(c->in) - 1 - c->in_len);
+    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return true;
+    }
+    if (got <= 0) {
+        return false;   // Closed without choosing Exit
+    }
+    c->in_len += (size_t)got;
+    return pump_connection(c);
+}
+
+/* Create the listening socket (a stale socket file is removed first) */
+static int open_socket(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Error: Socket path is too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        printf("Error: Cannot listen on %s (%s)\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+/* Allow as many open files as the system lets us (one per connection) */
+static void raise_file_limit(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+/* Run session server function
+   Purpose: Serve the menu to many people at once, from one thread
+
+   Parameters:
+     socket_path - Where to listen (NULL for SESSION_SOCKET)
+
+   Returns: 0 when stopped normally, 1 if the socket could not be opened
+ */
+int run_session_server(const char *socket_path) {
+    const char *path = socket_path != NULL ? socket_path : SESSION_SOCKET;
+    static struct pollfd fds[SESSION_MAX_CLIENTS + 1];
+    static Connection *connections[SESSION_MAX_CLIENTS];
+    int count = 0;
+    unsigned long served = 0;
+
+    // STEP 1: Listen, and load the limits as the menu does
+    int listen_fd = open_socket(path);
+    if (listen_fd < 0) {
+        return 1;
+    }
+    raise_file_limit();
+    velocity_init();
+    signal(SIGINT, on_stop_signal);
+    signal(SIGTERM, on_stop_signal);
+    printf("Serving the menu on %s (Ctrl+C to stop)\n", path);
+    fflush(stdout);
+
+    // STEP 2: Serve whoever is ready until we are stopped
+    while (!stop_requested) {
+        fds[0].fd = listen_fd;
+        fds[0].events = count < SESSION_MAX_CLIENTS ? POLLIN : 0;
+        for (int i = 0; i < count; i++) {
+            const Connection *c = connections[i];
+            fds[i + 1].fd = c->fd;
+            fds[i + 1].events = c->out_sent < c->out_len ? POLLOUT : POLLIN;
+        }
+        int ready = poll(fds, (nfds_t)count + 1, -1);
+        if (ready < 0 && errno != EINTR) {
+            break;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+
+        // Connections first (removing one moves the last into its place)
+        for (int i = count - 1; i >= 0; i--) {
+            short revents = fds[i + 1].revents;
+            if (revents == 0) {
+                continue;
+            }
+            Connection *c = connections[i];
+            bool open = (revents & POLLOUT) ? pump_connection(c) : read_connection(c);
+            if (!open) {
+                close(c->fd);
+                free(c);
+                connections[i] = connections[--count];
+            }
+        }
+
+        // New connections get the menu
+        while ((fds[0].revents & POLLIN) && count < SESSION_MAX_CLIENTS) {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd < 0) {
+                break;
+            }
+            Connection *c = malloc(sizeof(Connection));
+            if (c == NULL) {
+                close(fd);
+                break;
+            }
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            c->fd = fd;
+            c->in_len = 0;
+            c->skip_line = false;
+            MessageBuffer buffer = { c->out, sizeof(c->out), 0 };
+            set_message_buffer(&buffer);
+            session_begin(&c->session, FLOW_MENU);
+            set_message_buffer(NULL);
+            c->out_len = buffer.length;
+            c->out_sent = 0;
+            if (!pump_connection(c)) {
+                close(fd);
+                free(c);
+                continue;
+            }
+            connections[count++] = c;
+            served++;
+        }
+    }
+
+    // STEP 3: Close everything
+    for (int i = 0; i < count; i++) {
+        close(connections[i]->fd);
+        free(connections[i]);
+    }
+    close(listen_fd);
+    unlink(path);
+    velocity_shutdown();
+    store_close();
+    printf("\nSession server stopped after %lu connections\n", served);
+    return 0;
+}
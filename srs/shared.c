@@ -0,0 +1,166 @@
+/* This file holds the locks of shared mode (see shared.h)
+
+   SHARED_LOCKS_FILE layout:
+     SharedTable header (magic, number of locks, size of one mutex)
+     pthread_mutex_t x SHARED_STRIPES
+   The first program to map it sets up the mutexes while holding flock()
+   on the file, so two programs starting together never both do it. The
+   header is checked by everyone else, so a file made by a program built
+   with a different mutex size is refused instead of being misread
+ */
+
+#include "shared.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#define SHARED_MAGIC 0x314B4C53u   /* "SLK1" */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t stripes;
+    uint32_t mutex_size;
+    uint32_t reserved;
+    pthread_mutex_t locks[SHARED_STRIPES];
+} SharedTable;
+
+static SharedTable *table = NULL;
+static bool table_failed = false;
+
+bool shared_mode(void) {
+    return access(SHARED_MARKER, F_OK) == 0;
+}
+
+static void init_mutexes(SharedTable *t) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    for (int i = 0; i < SHARED_STRIPES; i++) {
+        pthread_mutex_init(&t->locks[i], &attr);
+    }
+    pthread_mutexattr_destroy(&attr);
+    t->stripes = SHARED_STRIPES;
+    t->mutex_size = sizeof(pthread_mutex_t);
+    t->magic = SHARED_MAGIC;   // Last, so a half set up table is never used
+}
+
+/* Map the lock table (set it up if this is the first program)
+   Returns: The table, or NULL if shared mode is off or it cannot be used */
+static SharedTable *open_table(void) {
+    if (table != NULL || table_failed || !shared_mode()) {
+        return table;
+    }
+    int fd = open(SHARED_LOCKS_FILE, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || flock(fd, LOCK_EX) != 0 || ftruncate(fd, sizeof(SharedTable)) != 0) {
+        fprintf(stderr, "Warning: Cannot open %s; accounts are not locked between programs\n",
+                SHARED_LOCKS_FILE);
+        if (fd >= 0) {
+            close(fd);
+        }
+        table_failed = true;
+        return NULL;
+    }
+    // ftruncate() only adds zeros, so a table someone else set up is kept
+    void *map = mmap(NULL, sizeof(SharedTable), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map != MAP_FAILED) {
+        SharedTable *t = map;
+        if (t->magic == 0) {
+            init_mutexes(t);
+        }
+        if (t->magic == SHARED_MAGIC && t->stripes == SHARED_STRIPES &&
+            t->mutex_size == sizeof(pthread_mutex_t)) {
+            table = t;
+        } else {
+            fprintf(stderr, "Warning: %s was made by another version of the program; "
+                    "delete it while no program is running\n", SHARED_LOCKS_FILE);
+            munmap(map, sizeof(SharedTable));
+        }
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+    table_failed = table == NULL;
+    return table;
+}
+
+int shared_command(const char *setting) {
+    if (strcmp(setting, "on") == 0) {
+        FILE *marker = fopen(SHARED_MARKER, "w");
+        if (marker == NULL) {
+            fprintf(stderr, "Error: Could not create %s\n", SHARED_MARKER);
+            return 1;
+        }
+        fprintf(marker, "shared mode: accounts are locked in %s\n", SHARED_LOCKS_FILE);
+        fclose(marker);
+        if (open_table() == NULL) {
+            return 1;
+        }
+        printf("Shared mode is on (restart programs that are already running).\n");
+        return 0;
+    }
+    if (strcmp(setting, "off") == 0) {
+        unlink(SHARED_MARKER);
+        printf("Shared mode is off.\n");
+        return 0;
+    }
+    printf("Usage: --shared on|off\n");
+    return 1;
+}
+
+static size_t stripe_of(uint32_t id) {
+    uint32_t h = id * 2654435761u;
+    return (size_t)(h ^ (h >> 16)) % SHARED_STRIPES;
+}
+
+/* Shared lock accounts function
+   Purpose: Take the locks of every account an operation changes
+
+   The locks are taken in increasing order, so two programs that need
+   the same locks can never each hold one the other is waiting for
+ */
+void shared_lock_accounts(SharedHold *hold, const uint32_t *ids, size_t count) {
+    hold->count = 0;
+    SharedTable *t = open_table();
+    if (t == NULL) {
+        return;
+    }
+
+    // Which locks are needed (each one once, in order)
+    unsigned char wanted[SHARED_STRIPES];
+    memset(wanted, 0, sizeof(wanted));
+    for (size_t i = 0; i < count; i++) {
+        if (ids[i] != 0) {
+            wanted[stripe_of(ids[i])] = 1;
+        }
+    }
+
+    for (int s = 0; s < SHARED_STRIPES; s++) {
+        if (!wanted[s]) {
+            continue;
+        }
+        int rc = pthread_mutex_lock(&t->locks[s]);
+        if (rc == EOWNERDEAD) {
+            // Its owner died; the lock is ours now and can be used again
+            pthread_mutex_consistent(&t->locks[s]);
+            fprintf(stderr, "Warning: A program stopped while changing accounts under "
+                    "lock %d; run --reconcile to check them\n", s);
+        } else if (rc != 0) {
+            fprintf(stderr, "Warning: Could not take account lock %d (error %d)\n", s, rc);
+            continue;
+        }
+        hold->stripes[hold->count++] = (uint16_t)s;
+    }
+}
+
+void shared_unlock_accounts(SharedHold *hold) {
+    while (hold->count > 0) {
+        pthread_mutex_unlock(&table->locks[hold->stripes[--hold->count]]);
+    }
+}
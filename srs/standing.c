@@ -0,0 +1,628 @@
+/* This file contains the standing orders scheduler (see standing.h)
+
+   The timer wheel:
+   Time is counted in ticks of one minute. The wheel has 4 levels of 64
+   slots: level 0 holds orders due in the next 64 minutes (one slot per
+   minute), level 1 orders due in the next 64 * 64 minutes (one slot per
+   64 minutes), and so on up to about 31 years. Each time level 0 goes
+   round once, the next slot of level 1 is emptied and its orders are put
+   back in, now into level 0 ("cascading"). So every order is touched
+   only a few times however far away it is, and finding what is due in a
+   minute is just reading one slot
+ */
+
+#include "standing.h"
+#include "account.h"
+#include "fees.h"
+#include "store.h"
+#include "txlog.h"
+#include "shared.h"
+#include "trace.h"
+#include "utils.h"
+#include "velocity.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TICK_SECS 60
+#define WHEEL_LEVELS 4
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+typedef struct {
+    uint64_t now;                                    // Current tick
+    StandingOrder *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    StandingOrder *overflow;                         // Beyond the last level
+} TimerWheel;
+
+static const char *repeat_names[] = { "daily", "weekly", "monthly" };
+
+
+/* ---------- The schedule file ---------- */
+
+/* Load every order from STANDING_FILE
+   Returns: The number of orders (the array is allocated, caller frees) */
+static size_t load_orders(StandingOrder **orders) {
+    *orders = NULL;
+    FILE *fp = fopen(STANDING_FILE, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+
+    size_t count = 0, capacity = 0;
+    StandingOrder o;
+    char repeat[16];
+    long long amount, next_due;
+    int active;
+    memset(&o, 0, sizeof(o));
+    while (fscanf(fp, "%u %u %u %lld %15s %d %lld %d", &o.id, &o.from_id, &o.to_id, &amount,
+                  repeat, &o.day, &next_due, &active) == 8) {
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            StandingOrder *bigger = realloc(*orders, capacity * sizeof(StandingOrder));
+            if (bigger == NULL) {
+                break;
+            }
+            *orders = bigger;
+        }
+        o.amount_cents = amount;
+        o.next_due = next_due;
+        o.active = active != 0;
+        o.repeat = REPEAT_DAILY;
+        for (int r = 0; r < 3; r++) {
+            if (strcmp(repeat, repeat_names[r]) == 0) {
+                o.repeat = (Recurrence)r;
+            }
+        }
+        (*orders)[count++] = o;
+    }
+    fclose(fp);
+    return count;
+}
+
+/* Save every order (to a temporary file first, then renamed over the old
+   one, so the schedule is never half written) */
+static bool save_orders(const StandingOrder *orders, size_t count) {
+    char temp_name[100];
+    snprintf(temp_name, sizeof(temp_name), "%s.tmp", STANDING_FILE);
+    FILE *fp = fopen(temp_name, "w");
+    if (fp == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        const StandingOrder *o = &orders[i];
+        fprintf(fp, "%u %u %u %lld %s %d %lld %d\n", o->id, o->from_id, o->to_id,
+                (long long)o->amount_cents, repeat_names[o->repeat], o->day,
+                (long long)o->next_due, o->active ? 1 : 0);
+    }
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+        fclose(fp);
+        return false;
+    }
+    fclose(fp);
+    return rename(temp_name, STANDING_FILE) == 0;
+}
+
+/* ---------- Due dates ---------- */
+
+static int days_in_month(int year, int month) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = year;
+    tm.tm_mon = month + 1;
+    tm.tm_mday = 0;        // Day 0 of the next month = last day of this one
+    tm.tm_hour = 12;
+    tm.tm_isdst = -1;
+    mktime(&tm);
+    return tm.tm_mday;
+}
+
+/* Work out when an order is due after its current due time
+   Monthly orders keep their day of the month, or use the last day of
+   shorter months (an order on the 31st runs on 30 April) */
+static int64_t following_due(const StandingOrder *o) {
+    time_t t = (time_t)o->next_due;
+    struct tm tm;
+    localtime_r(&t, &tm);
+    switch (o->repeat) {
+        case REPEAT_DAILY:
+            tm.tm_mday += 1;
+            break;
+        case REPEAT_WEEKLY:
+            tm.tm_mday += 7;
+            break;
+        case REPEAT_MONTHLY: {
+            tm.tm_mon += 1;
+            if (tm.tm_mon == 12) {
+                tm.tm_mon = 0;
+                tm.tm_year++;
+            }
+            int last = days_in_month(tm.tm_year, tm.tm_mon);
+            tm.tm_mday = o->day < last ? o->day : last;
+            break;
+        }
+    }
+    tm.tm_isdst = -1;
+    return (int64_t)mktime(&tm);
+}
+
+/* ---------- The timer wheel ---------- */
+
+static void wheel_add(TimerWheel *w, StandingOrder *o) {
+    uint64_t due = o->due_tick > w->now ? o->due_tick : w->now;
+    uint64_t delta = due - w->now;
+    StandingOrder **slot = &w->overflow;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        if (delta < (1ull << (WHEEL_BITS * (level + 1)))) {
+            slot = &w->slots[level][(due >> (WHEEL_BITS * level)) & WHEEL_MASK];
+            break;
+        }
+    }
+    o->next = *slot;
+    *slot = o;
+}
+
+// Put every order of a list back into the wheel (used when cascading)
+static void wheel_readd(TimerWheel *w, StandingOrder *list) {
+    while (list != NULL) {
+        StandingOrder *next = list->next;
+        wheel_add(w, list);
+        list = next;
+    }
+}
+
+/* Move the wheel to the current tick and take the orders due in it
+   Returns: The list of due orders (NULL if none) */
+static StandingOrder *wheel_take_due(TimerWheel *w) {
+    // Cascade: when a level has gone round, empty the next slot of the level above
+    int level;
+    for (level = 1; level < WHEEL_LEVELS; level++) {
+        unsigned shift = WHEEL_BITS * (unsigned)level;
+        if ((w->now & ((1ull << shift) - 1)) != 0) {
+            break;
+        }
+        StandingOrder **slot = &w->slots[level][(w->now >> shift) & WHEEL_MASK];
+        StandingOrder *list = *slot;
+        *slot = NULL;
+        wheel_readd(w, list);
+    }
+    if (level == WHEEL_LEVELS) {
+        StandingOrder *list = w->overflow;
+        w->overflow = NULL;
+        wheel_readd(w, list);
+    }
+
+    StandingOrder **slot = &w->slots[0][w->now & WHEEL_MASK];
+    StandingOrder *due = *slot;
+    *slot = NULL;
+    return due;
+}
+
+/* ---------- Running a group ---------- */
+
+// Sort a group by order ID, so the payments always happen in the same order
+static int compare_orders(const void *a, const void *b) {
+    uint32_t x = (*(StandingOrder *const *)a)->id, y = (*(StandingOrder *const *)b)->id;
+    return (x > y) - (x < y);
+}
+
+/* Accounts used by a group: each one is loaded and saved only once */
+typedef struct {
+    uint32_t *ids;          // Hash table of account ids
+    int *positions;         // Where each id is in the arrays below
+    size_t capacity;
+    char (*numbers)[12];
+    const char **names;
+    Account *accounts;
+    bool *loaded;
+    bool *changed;
+    size_t count;
+} GroupAccounts;
+
+static void release_group(GroupAccounts *g, int *from_pos, int *to_pos, TxRecord *records) {
+    free(g->ids); free(g->positions); free(g->numbers); free(g->names);
+    free(g->accounts); free(g->loaded); free(g->changed);
+    free(from_pos); free(to_pos); free(records);
+}
+
+static int group_account(GroupAccounts *g, uint32_t id) {
+    size_t i = (id * 2654435761u) & (g->capacity - 1);
+    while (g->ids[i] != 0) {
+        if (g->ids[i] == id) {
+            return g->positions[i];
+        }
+        i = (i + 1) & (g->capacity - 1);
+    }
+    // Not seen yet: give it the next position
+    int pos = (int)g->count++;
+    g->ids[i] = id;
+    g->positions[i] = pos;
+    snprintf(g->numbers[pos], sizeof(g->numbers[pos]), "%u", id);
+    g->names[pos] = g->numbers[pos];
+    return pos;
+}
+
+/* Run group function
+   Purpose: Pay every order of a group as one batch
+
+   How it works:
+   1. Find every account the group uses and load them all at once
+   2. Apply the remittances in memory, in order ID order, with the same
+      fee, balance and limit rules as remittance()
+   3. Save every changed account as one commit (all of them or none, see
+      commit_held_accounts()), then write all the log records (failed
+      payments are logged too, marked [FAILED]; if the commit failed,
+      every payment of the group is)
+
+   Returns: The number of payments made
+ */
+static long run_group(StandingOrder **group, size_t n, int64_t due_time) {
+    qsort(group, n, sizeof(StandingOrder *), compare_orders);
+
+    GroupAccounts g;
+    memset(&g, 0, sizeof(g));
+    g.capacity = 16;
+    while (g.capacity < 4 * n) {
+        g.capacity *= 2;
+    }
+    g.ids = calloc(g.capacity, sizeof(uint32_t));
+    g.positions = malloc(g.capacity * sizeof(int));
+    g.numbers = malloc(2 * n * sizeof(*g.numbers));
+    g.names = malloc(2 * n * sizeof(char *));
+    g.accounts = malloc(2 * n * sizeof(Account));
+    g.loaded = malloc(2 * n * sizeof(bool));
+    g.changed = calloc(2 * n, sizeof(bool));
+    int *from_pos = malloc(n * sizeof(int));
+    int *to_pos = malloc(n * sizeof(int));
+    TxRecord *records = calloc(n, sizeof(TxRecord));
+    if (g.ids == NULL || g.positions == NULL || g.numbers == NULL || g.names == NULL ||
+        g.accounts == NULL || g.loaded == NULL || g.changed == NULL ||
+        from_pos == NULL || to_pos == NULL || records == NULL) {
+        fprintf(stderr, "Error: Out of memory running standing orders\n");
+        release_group(&g, from_pos, to_pos, records);
+        return 0;
+    }
+
+    // STEP 1: Load every account of the group (one batch of reads), under
+    // their locks in shared mode (g.ids is a hash table: 0 = empty slot)
+    for (size_t i = 0; i < n; i++) {
+        from_pos[i] = group_account(&g, group[i]->from_id);
+        to_pos[i] = group_account(&g, group[i]->to_id);
+    }
+    // Their limit counters first (see velocity_init_for())
+    velocity_init_for(g.names, (int)g.count);
+    SharedHold hold;
+    shared_lock_accounts(&hold, g.ids, g.capacity);
+    // Their records too, so no commit_accounts() saves one until STEP 3 is
+    // done (the hash table is not needed any more: its IDs are packed first)
+    size_t locked = 0;
+    for (size_t i = 0; i < g.capacity; i++) {
+        if (g.ids[i] != 0) {
+            g.ids[locked++] = g.ids[i];
+        }
+    }
+    if (!lock_account_records(g.ids, locked)) {
+        fprintf(stderr, "Error: Could not lock the accounts of the standing orders\n");
+        shared_unlock_accounts(&hold);
+        velocity_shutdown();
+        release_group(&g, from_pos, to_pos, records);
+        return 0;
+    }
+    load_accounts(g.names, g.accounts, g.loaded, g.count);
+
+    // STEP 2: Apply the remittances in memory
+    long paid = 0, failed = 0;
+    for (size_t i = 0; i < n; i++) {
+        StandingOrder *o = group[i];
+        Account *from = &g.accounts[from_pos[i]];
+        Account *to = &g.accounts[to_pos[i]];
+        TxRecord *rec = &records[i];
+        rec->op = TXOP_REMIT;
+        rec->from_id = o->from_id;
+        rec->to_id = o->to_id;
+        rec->amount_cents = o->amount_cents;
+        rec->order_id = o->id;
+        rec->status = TXSTATUS_FAILED;
+
+        if (!g.loaded[from_pos[i]] || !g.loaded[to_pos[i]]) {
+            printf("Standing order %u: account not found\n", o->id);
+            failed++;
+            continue;
+        }
+        double amount = o->amount_cents / 100.0;
+        rec->fee_cents = fee_for_remittance(from->type, to->type, o->amount_cents);
+        if (amount_to_cents(from->balance) < o->amount_cents + rec->fee_cents) {
+            printf("Standing order %u: insufficient funds in %s\n", o->id, from->account_number);
+            failed++;
+            continue;
+        }
+        // Counted at once, so the next order of the group sees it
+        if (!velocity_check(from->account_number, from->type, VEL_REMIT, o->amount_cents)) {
+            printf("Standing order %u: over the remittance limit of %s\n", o->id,
+                   from->account_number);
+            failed++;
+            continue;
+        }
+        velocity_record(from->account_number, VEL_REMIT, o->amount_cents);
+
+        from->balance -= (o->amount_cents + rec->fee_cents) / 100.0;
+        to->balance += amount;
+        g.changed[from_pos[i]] = true;
+        g.changed[to_pos[i]] = true;
+        rec->status = TXSTATUS_OK;
+        paid++;
+    }
+
+    // STEP 3: Save the changed accounts as one commit, then log the whole group
+    Account **changed = malloc((g.count > 0 ? g.count : 1) * sizeof(Account *));
+    size_t changed_count = 0;
+    for (size_t i = 0; changed != NULL && i < g.count; i++) {
+        if (g.changed[i]) {
+            changed[changed_count++] = &g.accounts[i];
+        }
+    }
+    int update = store_update_begin();
+    if (changed == NULL || commit_held_accounts(changed, changed_count) != COMMIT_OK) {
+        printf("Error: The accounts could not be saved; no order of this group was paid.\n");
+        for (size_t i = 0; i < n; i++) {
+            records[i].status = TXSTATUS_FAILED;
+        }
+        failed += paid;
+        paid = 0;
+    }
+    if (txlog_append_batch(records, n) == 0 && paid > 0) {
+        printf("Error: The payments were made but could not be logged.\n");
+    }
+    store_update_end(update);
+    unlock_account_records(g.ids, locked);
+    shared_unlock_accounts(&hold);
+    velocity_shutdown();
+    free(changed);
+
+    char when[32];
+    TxRecord due;
+    memset(&due, 0, sizeof(due));
+    due.timestamp = due_time;
+    txlog_format_time(&due, when, sizeof(when));
+    printf("Standing orders due %s: %ld paid, %ld failed\n", when, paid, failed);
+    release_group(&g, from_pos, to_pos, records);
+    return paid;
+}
+
+/* Standing run due function
+   Purpose: Run every order that is due, catching up on missed ones
+
+   The wheel starts at the earliest due time and moves forward one minute
+   at a time until "now", so an order that was missed several times (the
+   scheduler was not running) is paid once for every missed time
+ */
+long standing_run_due(int64_t now) {
+    StandingOrder *orders;
+    size_t count = load_orders(&orders);
+    uint64_t now_tick = (uint64_t)now / TICK_SECS;
+
+    TimerWheel *wheel = calloc(1, sizeof(TimerWheel));
+    StandingOrder **group = malloc((count > 0 ? count : 1) * sizeof(StandingOrder *));
+    if (wheel == NULL || group == NULL) {
+        free(orders); free(wheel); free(group);
+        return -1;
+    }
+
+    // STEP 1: Put every active order into the wheel
+    wheel->now = now_tick;
+    for (size_t i = 0; i < count; i++) {
+        orders[i].due_tick = (uint64_t)orders[i].next_due / TICK_SECS;
+        if (orders[i].active && orders[i].due_tick < wheel->now) {
+            wheel->now = orders[i].due_tick;
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (orders[i].active) {
+            wheel_add(wheel, &orders[i]);
+        }
+    }
+
+    // STEP 2: Move forward minute by minute, running each group that is due
+    long paid = 0;
+    for (; wheel->now <= now_tick; wheel->now++) {
+        size_t n = 0;
+        for (StandingOrder *o = wheel_take_due(wheel); o != NULL; o = o->next) {
+            group[n++] = o;
+        }
+        if (n == 0) {
+            continue;
+        }
+
+        // Save the next due times first: an order is never paid twice
+        int64_t due = group[0]->next_due;
+        for (size_t i = 0; i < n; i++) {
+            group[i]->next_due = following_due(group[i]);
+        }
+        if (!save_orders(orders, count)) {
+            printf("Error: Could not save the standing orders; stopping.\n");
+            break;
+        }
+        TRACE_REQUEST_BEGIN("standing_group");
+        paid += run_group(group, n, due);
+        TRACE_REQUEST_END("standing_group");
+
+        // Put the orders back for their next time
+        for (size_t i = 0; i < n; i++) {
+            group[i]->due_tick = (uint64_t)group[i]->next_due / TICK_SECS;
+            if (group[i]->due_tick <= wheel->now) {
+                group[i]->due_tick = wheel->now + 1;
+            }
+            wheel_add(wheel, group[i]);
+        }
+    }
+
+    free(orders);
+    free(wheel);
+    free(group);
+    return paid;
+}
+
+/* ---------- Command line ---------- */
+
+// --standing add <from> <pin> <to> <amount> <daily|weekly|monthly> [first time]
+static int command_add(int argc, char *argv[]) {
+    if (argc < 8) {
+        printf("Usage: --standing add <from> <pin> <to> <amount> <daily|weekly|monthly> [\"YYYY-MM-DD HH:MM\"]\n");
+        return 1;
+    }
+    const char *from_num = argv[3], *pin = argv[4], *to_num = argv[5];
+    double amount = atof(argv[6]);
+
+    StandingOrder o;
+    memset(&o, 0, sizeof(o));
+    o.repeat = (Recurrence)-1;
+    for (int r = 0; r < 3; r++) {
+        if (strcmp(argv[7], repeat_names[r]) == 0) {
+            o.repeat = (Recurrence)r;
+        }
+    }
+    if ((int)o.repeat < 0) {
+        printf("Error: Repeat must be daily, weekly or monthly.\n");
+        return 1;
+    }
+
+    // Same checks as remittance(): sender's PIN, receiver exists, valid amount
+    Account receiver;
+    if (!authenticate(from_num, pin)) {
+        printf("Error: Authentication failed.\n");
+        return 1;
+    }
+    if (strcmp(from_num, to_num) == 0) {
+        printf("Error: Cannot transfer to the same account.\n");
+        return 1;
+    }
+    if (!load_account(to_num, &receiver)) {
+        printf("Error: Receiver account not found.\n");
+        return 1;
+    }
+    if (!is_valid_amount(amount, 999999999.99)) {
+        return 1;
+    }
+
+    // First payment: the given time, or the start of the next minute
+    o.next_due = ((int64_t)time(NULL) / TICK_SECS + 1) * TICK_SECS;
+    if (argc > 8 && !parse_date_time(argv[8], &o.next_due)) {
+        printf("Error: Invalid time \"%s\" (use YYYY-MM-DD HH:MM).\n", argv[8]);
+        return 1;
+    }
+    time_t first = (time_t)o.next_due;
+    struct tm tm;
+    localtime_r(&first, &tm);
+    o.day = tm.tm_mday;
+    o.from_id = account_id_from_string(from_num);
+    o.to_id = account_id_from_string(to_num);
+    o.amount_cents = amount_to_cents(amount);
+    o.active = true;
+
+    StandingOrder *orders;
+    size_t count = load_orders(&orders);
+    StandingOrder *bigger = realloc(orders, (count + 1) * sizeof(StandingOrder));
+    if (bigger == NULL) {
+        free(orders);
+        return 1;
+    }
+    orders = bigger;
+    o.id = 1;
+    for (size_t i = 0; i < count; i++) {
+        if (orders[i].id >= o.id) {
+            o.id = orders[i].id + 1;
+        }
+    }
+    orders[count++] = o;
+    bool ok = save_orders(orders, count);
+    free(orders);
+    if (!ok) {
+        printf("Error: Could not save the standing order.\n");
+        return 1;
+    }
+    printf("Standing order %u created.\n", o.id);
+    return 0;
+}
+
+static int command_list(void) {
+    StandingOrder *orders;
+    size_t count = load_orders(&orders);
+    printf("%-6s %-10s %-10s %12s  %-8s %-21s %s\n", "ID", "From", "To", "Amount (RM)",
+           "Repeat", "Next payment", "Status");
+    for (size_t i = 0; i < count; i++) {
+        TxRecord due;
+        memset(&due, 0, sizeof(due));
+        due.timestamp = orders[i].next_due;
+        char when[32];
+        txlog_format_time(&due, when, sizeof(when));
+        printf("%-6u %-10u %-10u %12.2f  %-8s %-21s %s\n", orders[i].id, orders[i].from_id,
+               orders[i].to_id, orders[i].amount_cents / 100.0, repeat_names[orders[i].repeat],
+               when, orders[i].active ? "active" : "cancelled");
+    }
+    if (count == 0) {
+        printf("No standing orders.\n");
+    }
+    free(orders);
+    return 0;
+}
+
+static int command_cancel(const char *id_text) {
+    uint32_t id = (uint32_t)strtoul(id_text, NULL, 10);
+    StandingOrder *orders;
+    size_t count = load_orders(&orders);
+    bool found = false;
+    for (size_t i = 0; i < count; i++) {
+        if (orders[i].id == id && orders[i].active) {
+            orders[i].active = false;
+            found = true;
+        }
+    }
+    bool ok = found && save_orders(orders, count);
+    free(orders);
+    if (!found) {
+        printf("Error: No active standing order %s.\n", id_text);
+        return 1;
+    }
+    if (!ok) {
+        printf("Error: Could not save the standing orders.\n");
+        return 1;
+    }
+    printf("Standing order %u cancelled.\n", id);
+    return 0;
+}
+
+int standing_command(int argc, char *argv[]) {
+    const char *command = argc > 2 ? argv[2] : "";
+
+    if (strcmp(command, "add") == 0) {
+        return command_add(argc, argv);
+    }
+    if (strcmp(command, "list") == 0) {
+        return command_list();
+    }
+    if (strcmp(command, "cancel") == 0 && argc > 3) {
+        return command_cancel(argv[3]);
+    }
+    if (strcmp(command, "run") == 0) {
+        long paid = standing_run_due((int64_t)time(NULL));
+        printf("Payments made: %ld\n", paid < 0 ? 0 : paid);
+        return paid < 0 ? 1 : 0;
+    }
+    if (strcmp(command, "daemon") == 0) {
+        // Run whatever is due, then sleep until the next minute starts
+        for (;;) {
+            if (standing_run_due((int64_t)time(NULL)) < 0) {
+                return 1;
+            }
+            fflush(stdout);
+            sleep((unsigned)(TICK_SECS - time(NULL) % TICK_SECS));
+        }
+    }
+
+    printf("Usage: --standing add|list|cancel <id>|run|daemon\n");
+    return 1;
+}
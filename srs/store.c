@@ -0,0 +1,810 @@
+/* This file is the compact account store
+   It splits every account into a hot part (the numbers that scans need)
+   and a cold part (customer details), and keeps each part in its own
+   fixed-width file:
+
+     accounts.hot  - header + dense array of AccountHot (32 bytes each)
+     accounts.cold - AccountCold records (128 bytes each), same positions
+     accounts.hix  - hash index: account id → position in the arrays
+
+   The hot file and the index are memory mapped, so looking up or updating
+   one account never reads the rest of the store, and a scan over every
+   balance only reads 32 bytes per account instead of the whole Account
+
+   Every hot and cold record ends with a CRC32C of its fields, so --fsck
+   (see fsck.h) can tell a damaged record from a real one. Stores made
+   before the checksums existed (format 1) get them when first opened
+
+   Several programs use the store at once. Anything that changes its
+   shape (adding or removing an account, growing a file, rebuilding the
+   index) holds an flock() on the hot file, plus a mutex for the threads
+   of this program. Lookups take no lock: they check that the record
+   they found really is the account, and look again under the lock if
+   it is not. The files only ever grow, and a mapping that is replaced
+   by a bigger one stays mapped until store_close(), so a pointer that
+   another thread is still using never becomes invalid
+ */
+
+#include "store.h"
+#include "utils.h"
+#include "crc32c.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <pthread.h>
+
+#define STORE_MAGIC 0x544F4842u   /* "BHOT" */
+#define INDEX_MAGIC 0x58494842u   /* "BHIX" */
+#define STORE_FORMAT 2             /* 2: records have checksums */
+#define INITIAL_CAPACITY 1024
+#define UPGRADE_CHUNK 4096         /* Cold records given checksums at once */
+#define MAX_OLD_MAPS 64            /* Replaced mappings kept until store_close() */
+
+// Header at the start of the hot file (32 bytes, same size as a record)
+typedef struct {
+    uint32_t magic;
+    uint32_t format;
+    uint32_t count;      // Number of accounts in the store
+    uint32_t capacity;   // Number of records the file has room for
+    uint32_t changes;    // Increases with every put or remove (by any program)
+    uint32_t reserved[3];
+} StoreHeader;
+
+// Header at the start of the index file
+typedef struct {
+    uint32_t magic;
+    uint32_t capacity;   // Number of index slots (always a power of two)
+    uint32_t used;       // Slots that are not empty (live + deleted)
+    uint32_t live;       // Slots that point to an account
+} IndexHeader;
+
+/* One slot of the index
+   account_id 0 means empty, INDEX_DELETED means the account was removed
+   position is stored plus one, so that 0 never looks like a valid position
+ */
+typedef struct {
+    uint32_t account_id;
+    uint32_t position;
+} IndexEntry;
+
+#define INDEX_DELETED 0xFFFFFFFFu
+
+static int hot_fd = -1;
+static int cold_fd = -1;
+static int index_fd = -1;
+
+static StoreHeader *hot_header = NULL;
+static AccountHot *hot_records = NULL;
+static size_t hot_map_size = 0;
+
+static IndexHeader *index_header = NULL;
+static IndexEntry *index_entries = NULL;
+static size_t index_map_size = 0;
+
+// Records and index slots that this program's mappings cover
+static size_t hot_capacity = 0;
+static size_t index_capacity = 0;
+
+// Mappings replaced by bigger ones (another thread may still be reading them)
+static struct { void *addr; size_t size; } old_maps[MAX_OLD_MAPS];
+static int old_map_count = 0;
+
+static pthread_mutex_t store_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool store_ready = false;   // Set once store_open() has finished
+
+static void close_store(int sync_flags);
+
+
+void store_seal_hot(AccountHot *hot) {
+    hot->checksum = crc32c(0, hot, offsetof(AccountHot, checksum));
+}
+
+bool store_hot_valid(const AccountHot *hot) {
+    return hot->checksum == crc32c(0, hot, offsetof(AccountHot, checksum));
+}
+
+static void seal_cold(AccountCold *cold) {
+    cold->checksum = crc32c(0, cold, offsetof(AccountCold, checksum));
+}
+
+bool store_cold_valid(const AccountCold *cold) {
+    return cold->checksum == crc32c(0, cold, offsetof(AccountCold, checksum));
+}
+
+/* Map file function
+   Purpose: Make a file exactly "size" bytes long and map it into memory
+   Returns: The mapped memory, or NULL if it failed
+ */
+static void *map_file(int fd, size_t size) {
+    if (ftruncate(fd, (off_t)size) != 0) {
+        return NULL;
+    }
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/* Keep a mapping that was replaced until the store is closed
+   (unmapping it at once could pull it away from a reader) */
+static void retire_map(void *addr, size_t size) {
+    if (old_map_count < MAX_OLD_MAPS) {
+        old_maps[old_map_count].addr = addr;
+        old_maps[old_map_count].size = size;
+        old_map_count++;
+    } else {
+        munmap(addr, size);
+    }
+}
+
+/* Map the hot file again at its current size (after it grew) */
+static bool remap_hot(size_t size) {
+    StoreHeader *header = map_file(hot_fd, size);
+    if (header == NULL) {
+        return false;
+    }
+    if (hot_header != NULL) {
+        retire_map(hot_header, hot_map_size);
+    }
+    hot_header = header;
+    hot_map_size = size;
+    __atomic_store_n(&hot_records, (AccountHot *)(header + 1), __ATOMIC_RELEASE);
+    __atomic_store_n(&hot_capacity, (size - sizeof(StoreHeader)) / sizeof(AccountHot),
+                     __ATOMIC_RELEASE);
+    return true;
+}
+
+/* Map the index file again at its current size (after it grew) */
+static bool remap_index(size_t size) {
+    IndexHeader *header = map_file(index_fd, size);
+    if (header == NULL) {
+        return false;
+    }
+    if (index_header != NULL) {
+        retire_map(index_header, index_map_size);
+    }
+    index_header = header;
+    index_map_size = size;
+    __atomic_store_n(&index_entries, (IndexEntry *)(header + 1), __ATOMIC_RELEASE);
+    __atomic_store_n(&index_capacity, (size - sizeof(IndexHeader)) / sizeof(IndexEntry),
+                     __ATOMIC_RELEASE);
+    return true;
+}
+
+static size_t hash_id(uint32_t id) {
+    uint32_t h = id * 2654435761u;
+    return (size_t)(h ^ (h >> 16));
+}
+
+/* Find the index slot of an account
+   Returns: The slot holding the account, or NULL if it is not in the index
+ */
+static IndexEntry *index_find(uint32_t id) {
+    // The slots this program has mapped, not the header (which may be newer)
+    size_t capacity = __atomic_load_n(&index_capacity, __ATOMIC_ACQUIRE);
+    IndexEntry *entries = __atomic_load_n(&index_entries, __ATOMIC_ACQUIRE);
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        return NULL;
+    }
+    size_t mask = capacity - 1;
+    size_t i = hash_id(id) & mask;
+    for (size_t probes = 0; entries[i].account_id != 0 && probes < capacity; probes++) {
+        if (entries[i].account_id == id) {
+            return &entries[i];
+        }
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
+
+/* Add an account to the index (the index must have a free slot) */
+static void index_insert(uint32_t id, uint32_t position) {
+    size_t mask = index_capacity - 1;
+    size_t i = hash_id(id) & mask;
+    while (index_entries[i].account_id != 0 && index_entries[i].account_id != INDEX_DELETED) {
+        i = (i + 1) & mask;
+    }
+    if (index_entries[i].account_id == 0) {
+        index_header->used++;
+    }
+    index_entries[i].account_id = id;
+    index_entries[i].position = position + 1;
+    index_header->live++;
+}
+
+/* Rebuild index function
+   Purpose: Create the index again from the hot records
+
+   The index only holds (id, position) pairs, which are all in the hot
+   file already, so it can be rebuilt at any time: when it grows, when it
+   has too many deleted slots, or when it is missing or damaged.
+   Called with the store lock held. The file never gets smaller, so a
+   program reading it without the lock never reads past its end
+ */
+static bool index_rebuild(uint32_t capacity) {
+    while (capacity < 2 * hot_header->count + 2 || capacity < index_capacity) {
+        capacity *= 2;
+    }
+
+    size_t size = sizeof(IndexHeader) + (size_t)capacity * sizeof(IndexEntry);
+    if (index_header == NULL || size != index_map_size) {
+        if (!remap_index(size)) {
+            return false;
+        }
+    }
+    memset(index_entries, 0, (size_t)capacity * sizeof(IndexEntry));
+
+    index_header->magic = INDEX_MAGIC;
+    index_header->capacity = capacity;
+    index_header->used = 0;
+    index_header->live = 0;
+    for (uint32_t pos = 0; pos < hot_header->count; pos++) {
+        index_insert(hot_records[pos].account_id, pos);
+    }
+    return true;
+}
+
+/* Make room in the hot and cold files for twice as many records
+   (called with the store lock held) */
+static bool grow_store(void) {
+    uint32_t capacity = hot_header->capacity * 2;
+    if (!remap_hot(sizeof(StoreHeader) + (size_t)capacity * sizeof(AccountHot))) {
+        return false;
+    }
+    hot_header->capacity = capacity;
+    return true;
+}
+
+/* Index valid function
+   Purpose: Check that the index file matches the hot file */
+static bool index_valid(void) {
+    return index_header != NULL && index_header->magic == INDEX_MAGIC &&
+           index_header->live == hot_header->count &&
+           index_header->capacity == index_capacity;
+}
+
+/* Lock store function
+   Purpose: Take the store lock, then map whatever other programs added
+   to the files since this program last looked, so the counts in the
+   headers and the mappings agree again
+
+   Returns: true if the lock is held (give it back with unlock_store())
+ */
+static bool lock_store(void) {
+    pthread_mutex_lock(&store_mutex);
+    if (flock(hot_fd, LOCK_EX) != 0) {
+        pthread_mutex_unlock(&store_mutex);
+        return false;
+    }
+
+    struct stat st;
+    bool ok = fstat(hot_fd, &st) == 0;
+    if (ok && (size_t)st.st_size != hot_map_size) {
+        ok = remap_hot((size_t)st.st_size);
+    }
+    ok = ok && fstat(index_fd, &st) == 0;
+    if (ok && (size_t)st.st_size != index_map_size && st.st_size >= (off_t)sizeof(IndexHeader)) {
+        ok = remap_index((size_t)st.st_size);
+    }
+    if (ok && hot_header->capacity > hot_capacity) {
+        ok = false;   // The header says there is more than the file holds
+    }
+    if (ok && !index_valid()) {
+        ok = index_rebuild(2 * INITIAL_CAPACITY);
+    }
+    if (!ok) {
+        flock(hot_fd, LOCK_UN);
+        pthread_mutex_unlock(&store_mutex);
+    }
+    return ok;
+}
+
+static void unlock_store(void) {
+    flock(hot_fd, LOCK_UN);
+    pthread_mutex_unlock(&store_mutex);
+}
+
+/* Upgrade function
+   Purpose: Give every record of a format 1 store its checksum
+
+   Runs once, while holding the store lock, so two programs that open
+   an old store at the same time do not both do it
+   Returns: false if the cold file could not be read or written
+ */
+static bool add_checksums(void) {
+    bool ok = true;
+    if (hot_header->format < STORE_FORMAT) {
+        static AccountCold cold[UPGRADE_CHUNK];
+        for (uint32_t first = 0; first < hot_header->count && ok; first += UPGRADE_CHUNK) {
+            uint32_t n = hot_header->count - first < UPGRADE_CHUNK ? hot_header->count - first
+                                                                  : UPGRADE_CHUNK;
+            size_t bytes = (size_t)n * sizeof(AccountCold);
+            off_t offset = (off_t)first * sizeof(AccountCold);
+            ok = pread(cold_fd, cold, bytes, offset) == (ssize_t)bytes;
+            for (uint32_t i = 0; i < n && ok; i++) {
+                store_seal_hot(&hot_records[first + i]);
+                seal_cold(&cold[i]);
+            }
+            ok = ok && pwrite(cold_fd, cold, bytes, offset) == (ssize_t)bytes;
+        }
+        if (ok) {
+            hot_header->format = STORE_FORMAT;
+        }
+    }
+    return ok;
+}
+
+/* Store open function
+   Purpose: Open the three store files, creating them if they don't exist
+
+   Returns: true if the store is ready to use
+ */
+bool store_open(void) {
+    if (__atomic_load_n(&store_ready, __ATOMIC_ACQUIRE)) {
+        return true;  // Already open
+    }
+    pthread_mutex_lock(&store_mutex);
+    if (store_ready) {
+        pthread_mutex_unlock(&store_mutex);
+        return true;  // Another thread opened it meanwhile
+    }
+
+    hot_fd = open(HOT_STORE_FILE, O_RDWR | O_CREAT, 0644);
+    cold_fd = open(COLD_STORE_FILE, O_RDWR | O_CREAT, 0644);
+    index_fd = open(STORE_INDEX_FILE, O_RDWR | O_CREAT, 0644);
+    if (hot_fd < 0 || cold_fd < 0 || index_fd < 0 || flock(hot_fd, LOCK_EX) != 0) {
+        fprintf(stderr, "Warning: Could not open the account store\n");
+        close_store(0);
+        pthread_mutex_unlock(&store_mutex);
+        return false;
+    }
+
+    // STEP 1: Map the hot file (a new file gets a header and empty records)
+    struct stat st;
+    fstat(hot_fd, &st);
+    bool ok;
+    if (st.st_size == 0) {
+        ok = remap_hot(sizeof(StoreHeader) + (size_t)INITIAL_CAPACITY * sizeof(AccountHot));
+        if (ok) {
+            hot_header->magic = STORE_MAGIC;
+            hot_header->format = STORE_FORMAT;
+            hot_header->capacity = INITIAL_CAPACITY;
+        }
+    } else {
+        ok = st.st_size >= (off_t)sizeof(StoreHeader) && remap_hot((size_t)st.st_size);
+    }
+
+    if (!ok || hot_header->magic != STORE_MAGIC || hot_header->capacity > hot_capacity) {
+        fprintf(stderr, "Warning: %s is damaged and was not opened\n", HOT_STORE_FILE);
+    } else if (hot_header->format < STORE_FORMAT && !add_checksums()) {
+        fprintf(stderr, "Warning: Could not add checksums to the account store\n");
+        ok = false;
+    } else {
+        // STEP 2: Map the index, rebuilding it if it is new or does not match
+        fstat(index_fd, &st);
+        if (st.st_size >= (off_t)sizeof(IndexHeader)) {
+            remap_index((size_t)st.st_size);
+        }
+        if (!index_valid() && !index_rebuild(2 * INITIAL_CAPACITY)) {
+            fprintf(stderr, "Warning: Could not build the account store index\n");
+            ok = false;
+        }
+    }
+    ok = ok && hot_header->magic == STORE_MAGIC && hot_header->capacity <= hot_capacity;
+
+    if (hot_fd >= 0) {
+        flock(hot_fd, LOCK_UN);
+    }
+    if (ok) {
+        __atomic_store_n(&store_ready, true, __ATOMIC_RELEASE);
+    } else {
+        close_store(0);
+    }
+    pthread_mutex_unlock(&store_mutex);
+    return ok;
+}
+
+/* Unmap and close the store files, after msync() with these flags
+   (0 skips the msync(), for a store that could not be opened) */
+static void close_store(int sync_flags) {
+    store_ready = false;
+    if (hot_header != NULL) {
+        if (sync_flags != 0) msync(hot_header, hot_map_size, sync_flags);
+        munmap(hot_header, hot_map_size);
+    }
+    if (index_header != NULL) {
+        if (sync_flags != 0) msync(index_header, index_map_size, sync_flags);
+        munmap(index_header, index_map_size);
+    }
+    for (int i = 0; i < old_map_count; i++) {
+        munmap(old_maps[i].addr, old_maps[i].size);
+    }
+    old_map_count = 0;
+    if (hot_fd >= 0) close(hot_fd);
+    if (cold_fd >= 0) close(cold_fd);
+    if (index_fd >= 0) close(index_fd);
+
+    hot_header = NULL;
+    hot_records = NULL;
+    index_header = NULL;
+    index_entries = NULL;
+    hot_map_size = index_map_size = 0;
+    hot_capacity = index_capacity = 0;
+    hot_fd = cold_fd = index_fd = -1;
+}
+
+/* Store close function
+   Purpose: Write the mapped files back to disk and close them
+ */
+void store_close(void) {
+    close_store(MS_SYNC);
+}
+
+/* Store detach function
+   Purpose: Close the store without waiting for the disk
+
+   For a program that ran one short operation (a subcommand, see cli.h).
+   The mappings are shared, so the kernel still writes the changed
+   records back; only the wait is skipped, which took longer than the
+   operation itself. The account files are the records the store is
+   rebuilt from (--migrate) if the machine stops before that
+ */
+void store_detach(void) {
+    close_store(MS_ASYNC);
+}
+
+uint32_t store_pin_hash(uint32_t account_id, const char *pin) {
+    // FNV-1a over the account id and the PIN digits
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 4; i++) {
+        h = (h ^ ((account_id >> (i * 8)) & 0xFF)) * 16777619u;
+    }
+    for (; *pin; pin++) {
+        h = (h ^ (unsigned char)*pin) * 16777619u;
+    }
+    return h;
+}
+
+/* Store put function
+   Purpose: Save both halves of an account in the store
+
+   Parameters:
+     acc - The account to save (new accounts are added at the end)
+
+   Returns: true if the account was saved
+ */
+bool store_put(const Account *acc) {
+    uint32_t id = account_id_from_string(acc->account_number);
+    if (id == 0 || !store_open() || !lock_store()) {
+        return false;
+    }
+
+    bool ok = true;
+    IndexEntry *entry = index_find(id);
+    uint32_t pos = 0;
+    if (entry != NULL) {
+        pos = entry->position - 1;
+    } else {
+        // A new account: make room for it in the files and in the index
+        if (hot_header->count == hot_header->capacity) {
+            ok = grow_store();
+        }
+        if (ok && (index_header->used + 1) * 2 > index_header->capacity) {
+            ok = index_rebuild(index_header->capacity * 2);
+        }
+        if (ok) {
+            pos = hot_header->count;
+            memset(&hot_records[pos], 0, sizeof(AccountHot));
+        }
+    }
+
+    // STEP 1: Write the cold part (name and ID)
+    AccountCold cold;
+    memset(&cold, 0, sizeof(cold));
+    cold.account_id = id;
+    strncpy(cold.name, acc->name, MAX_NAME_LEN - 1);
+    strncpy(cold.id_number, acc->id_number, MAX_ID_LEN - 1);
+    seal_cold(&cold);
+    ok = ok && pwrite(cold_fd, &cold, sizeof(cold), (off_t)pos * sizeof(AccountCold)) == sizeof(cold);
+
+    // STEP 2: Update the hot part in place
+    if (ok) {
+        AccountHot *hot = &hot_records[pos];
+        hot->account_id = id;
+        hot->type = (uint32_t)acc->type;
+        hot->balance_cents = amount_to_cents(acc->balance);
+        hot->pin_hash = store_pin_hash(id, acc->pin);
+        hot->version++;
+        store_seal_hot(hot);
+
+        if (entry == NULL) {
+            hot_header->count++;
+            index_insert(id, pos);
+        }
+        __atomic_add_fetch(&hot_header->changes, 1, __ATOMIC_RELEASE);
+    }
+    unlock_store();
+    return ok;
+}
+
+/* Store remove function
+   Purpose: Take an account out of the store
+
+   The last record is moved into the hole, so the hot array stays dense
+   and scans never have to skip deleted accounts
+ */
+bool store_remove(const char *account_num) {
+    uint32_t id = account_id_from_string(account_num);
+    if (id == 0 || !store_open() || !lock_store()) {
+        return false;
+    }
+
+    IndexEntry *entry = index_find(id);
+    if (entry == NULL) {
+        unlock_store();
+        return false;
+    }
+    uint32_t pos = entry->position - 1;
+    uint32_t last = hot_header->count - 1;
+
+    if (pos != last) {
+        // Move the last account (both halves) into the free position
+        AccountCold cold;
+        if (pread(cold_fd, &cold, sizeof(cold), (off_t)last * sizeof(AccountCold)) != sizeof(cold) ||
+            pwrite(cold_fd, &cold, sizeof(cold), (off_t)pos * sizeof(AccountCold)) != sizeof(cold)) {
+            unlock_store();
+            return false;
+        }
+        hot_records[pos] = hot_records[last];
+        index_find(hot_records[pos].account_id)->position = pos + 1;
+    }
+    memset(&hot_records[last], 0, sizeof(AccountHot));
+
+    entry->account_id = INDEX_DELETED;
+    entry->position = 0;
+    index_header->live--;
+    hot_header->count--;
+    __atomic_add_fetch(&hot_header->changes, 1, __ATOMIC_RELEASE);
+    unlock_store();
+    return true;
+}
+
+/* Store drop records function
+   Purpose: Take damaged records out of the store (--fsck --quarantine)
+
+   A damaged record cannot be found through the index (its account id
+   may be wrong too), so the records are removed by position, the way
+   store_remove() does it, and the index is built again from what is left
+
+   Parameters:
+     positions - Positions of the records, from the highest to the lowest
+     count - Number of positions
+
+   Returns: true if the records were removed
+ */
+bool store_drop_records(const size_t *positions, size_t count) {
+    if (!store_open() || !lock_store()) {
+        return false;
+    }
+    static AccountCold cold;
+    bool ok = true;
+    for (size_t i = 0; i < count && ok; i++) {
+        uint32_t pos = (uint32_t)positions[i];
+        uint32_t last = hot_header->count - 1;
+        if (pos > last) {
+            continue;
+        }
+        if (pos != last) {
+            ok = pread(cold_fd, &cold, sizeof(cold), (off_t)last * sizeof(AccountCold)) == sizeof(cold) &&
+                 pwrite(cold_fd, &cold, sizeof(cold), (off_t)pos * sizeof(AccountCold)) == sizeof(cold);
+            if (ok) {
+                hot_records[pos] = hot_records[last];
+            }
+        }
+        if (ok) {
+            memset(&hot_records[last], 0, sizeof(AccountHot));
+            hot_header->count--;
+        }
+    }
+    __atomic_add_fetch(&hot_header->changes, 1, __ATOMIC_RELEASE);
+    ok = index_rebuild(index_header->capacity) && ok;
+    unlock_store();
+    return ok;
+}
+
+/* Find position function
+   Purpose: Look an account up in the index without the lock
+
+   Another program may be moving records or rebuilding the index at the
+   same moment, so the answer is only used if the hot record at that
+   position really is the account; otherwise the index is asked again
+   while holding the lock, when nothing can be halfway changed
+   Returns: The position, or -1 if the account is not in the store
+ */
+static long find_position(uint32_t id) {
+    IndexEntry *entry = index_find(id);
+    if (entry != NULL) {
+        uint32_t pos = __atomic_load_n(&entry->position, __ATOMIC_RELAXED) - 1;
+        size_t capacity = __atomic_load_n(&hot_capacity, __ATOMIC_ACQUIRE);
+        AccountHot *records = __atomic_load_n(&hot_records, __ATOMIC_ACQUIRE);
+        if (pos < capacity && records[pos].account_id == id) {
+            return (long)pos;
+        }
+    }
+    if (!lock_store()) {
+        return -1;
+    }
+    entry = index_find(id);
+    long pos = entry != NULL ? (long)entry->position - 1 : -1;
+    unlock_store();
+    return pos;
+}
+
+long store_position(uint32_t account_id) {
+    if (!store_open()) {
+        return -1;
+    }
+    return find_position(account_id);
+}
+
+bool store_get_hot(uint32_t account_id, AccountHot *hot) {
+    if (!store_open()) {
+        return false;
+    }
+    long pos = find_position(account_id);
+    if (pos < 0) {
+        return false;
+    }
+    *hot = hot_records[pos];
+    return true;
+}
+
+bool store_get_cold(uint32_t account_id, AccountCold *cold) {
+    if (!store_open()) {
+        return false;
+    }
+    long pos = find_position(account_id);
+    if (pos < 0 || pread(cold_fd, cold, sizeof(*cold), (off_t)pos * sizeof(AccountCold)) != sizeof(*cold)) {
+        return false;
+    }
+    if (cold->account_id == account_id) {
+        return true;
+    }
+
+    // The record moved while it was read (another program removed an account)
+    if (!lock_store()) {
+        return false;
+    }
+    IndexEntry *entry = index_find(account_id);
+    bool ok = entry != NULL &&
+              pread(cold_fd, cold, sizeof(*cold),
+                    (off_t)(entry->position - 1) * sizeof(AccountCold)) == sizeof(*cold);
+    unlock_store();
+    return ok;
+}
+
+/* Read the cold records at positions first .. first+count-1 (the same
+   positions as in store_hot_records()) with one read; safe to call from
+   several threads at once */
+bool store_read_cold(size_t first, size_t count, AccountCold *out) {
+    if (!store_open()) {
+        return false;
+    }
+    size_t bytes = count * sizeof(AccountCold);
+    return pread(cold_fd, out, bytes, (off_t)first * sizeof(AccountCold)) == (ssize_t)bytes;
+}
+
+AccountHot *store_hot_ref(uint32_t account_id) {
+    if (!store_open()) {
+        return NULL;
+    }
+    long pos = find_position(account_id);
+    return pos >= 0 ? &hot_records[pos] : NULL;
+}
+
+/* Update window functions
+   Purpose: Let a reader find a moment when the store and the log agree
+
+   An operation saves its accounts first and writes its log record after,
+   so in between the store is ahead of the log. Operations hold a shared
+   lock on STORE_UPDATE_LOCK for that time (many at once); a reader that
+   takes the lock exclusively knows no operation is in between. flock()
+   locks disappear when a program stops, so a crash never leaves it taken
+ */
+static int take_update_lock(int mode) {
+    int fd = open(STORE_UPDATE_LOCK, O_RDWR | O_CREAT, 0644);
+    if (fd >= 0 && flock(fd, mode) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+int store_update_begin(void) {
+    return take_update_lock(LOCK_SH);
+}
+
+int store_update_hold(void) {
+    return take_update_lock(LOCK_EX);
+}
+
+void store_update_end(int handle) {
+    if (handle >= 0) {
+        flock(handle, LOCK_UN);
+        close(handle);
+    }
+}
+
+bool store_sync(bool wait) {
+    if (!store_open()) {
+        return false;
+    }
+    return msync(hot_header, hot_map_size, wait ? MS_SYNC : MS_ASYNC) == 0;
+}
+
+uint32_t store_changes(void) {
+    return store_open() ? __atomic_load_n(&hot_header->changes, __ATOMIC_ACQUIRE) : 0;
+}
+
+void store_note_change(void) {
+    if (store_open()) {
+        __atomic_add_fetch(&hot_header->changes, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/* Number of accounts, but never more than the records this program has
+   mapped: call store_hot_records() first, which maps what other programs
+   added, and then this */
+size_t store_count(void) {
+    if (!store_open()) {
+        return 0;
+    }
+    size_t count = hot_header->count;
+    size_t capacity = __atomic_load_n(&hot_capacity, __ATOMIC_ACQUIRE);
+    return count < capacity ? count : capacity;
+}
+
+const AccountHot *store_hot_records(void) {
+    if (!store_open()) {
+        return NULL;
+    }
+    if (hot_header->count > __atomic_load_n(&hot_capacity, __ATOMIC_ACQUIRE) && lock_store()) {
+        unlock_store();   // Taking the lock maps the records other programs added
+    }
+    return __atomic_load_n(&hot_records, __ATOMIC_ACQUIRE);
+}
+
+/* Store report function
+   Purpose: Show how many accounts there are and how much money they hold,
+   for each account type
+
+   Only the hot records are read (32 bytes per account), names and IDs
+   are never loaded
+ */
+void store_print_report(void) {
+    size_t count = store_count();
+    const AccountHot *records = store_hot_records();
+
+    size_t type_count[ACCOUNT_TYPE_COUNT] = { 0 };
+    long long type_cents[ACCOUNT_TYPE_COUNT] = { 0 };
+    for (size_t i = 0; i < count; i++) {
+        uint32_t type = records[i].type < ACCOUNT_TYPE_COUNT ? records[i].type : CURRENT;
+        type_count[type]++;
+        type_cents[type] += records[i].balance_cents;
+    }
+
+    printf("\n========================================\n");
+    printf("         ACCOUNT BALANCE REPORT\n");
+    printf("========================================\n");
+    long long total = 0;
+    for (int t = 0; t < ACCOUNT_TYPE_COUNT; t++) {
+        printf("%-8s accounts: %8zu   Balance: RM%.2f\n",
+               account_type_to_string((AccountType)t), type_count[t], type_cents[t] / 100.0);
+        total += type_cents[t];
+    }
+    printf("Total    accounts: %8zu   Balance: RM%.2f\n", count, total / 100.0);
+    printf("========================================\n");
+}
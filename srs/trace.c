@@ -0,0 +1,201 @@
+/* This file records and writes the trace (see trace.h)
+
+   Every thread has its own chain of TraceBuffer blocks and is the only
+   one writing to them. A new block is put at the front of one list of
+   all blocks with a compare-and-swap, so adding events never takes a
+   lock. trace_flush() runs when the threads are finished (at exit) and
+   writes every block of the list, oldest events of each thread first.
+
+   Output: {"traceEvents":[ ... ]} with one object per event:
+     {"name":"load_account","cat":"bank","ph":"B","ts":12.345,"pid":..,"tid":..,
+      "args":{"request":7}}
+   ts is in microseconds since trace_start()
+ */
+
+#include "trace.h"
+#include "types.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+typedef struct {
+    uint64_t ns;               // Since trace_start()
+    const char *name;
+    uint64_t request;
+    char phase;
+} TraceEvent;
+
+typedef struct TraceBuffer {
+    struct TraceBuffer *next;  // In the list of all blocks
+    struct TraceBuffer *older; // The previous block of the same thread
+    long tid;
+    const char *thread_name;
+    size_t count;              // Events written (published with a release store)
+    TraceEvent events[TRACE_BUFFER_EVENTS];
+} TraceBuffer;
+
+bool trace_enabled = false;
+
+static char trace_path[300];
+static struct timespec trace_epoch;
+static TraceBuffer *all_buffers = NULL;    // Changed only with compare-and-swap
+static uint64_t last_request = 0;          // Taken with an atomic add
+static bool flushed = false;
+
+static __thread TraceBuffer *my_buffer = NULL;
+static __thread uint64_t my_request = 0;
+static __thread const char *my_name = NULL;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)(ts.tv_sec - trace_epoch.tv_sec) * 1000000000u +
+           (uint64_t)ts.tv_nsec - (uint64_t)trace_epoch.tv_nsec;
+}
+
+/* A new block for this thread (the first one, or the last one is full)
+   Returns: NULL if there is no memory left (the events are dropped) */
+static TraceBuffer *new_buffer(void) {
+    TraceBuffer *b = malloc(sizeof(TraceBuffer));
+    if (b == NULL) {
+        return NULL;
+    }
+    b->older = my_buffer;
+    b->tid = (long)syscall(SYS_gettid);
+    b->thread_name = my_name;
+    b->count = 0;
+    b->next = __atomic_load_n(&all_buffers, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&all_buffers, &b->next, b, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        // Another thread added a block first; b->next now holds the new front
+    }
+    my_buffer = b;
+    return b;
+}
+
+void trace_start(void) {
+    const char *path = getenv(TRACE_ENV);
+    if (path == NULL || path[0] == '\0') {
+        return;
+    }
+
+    // "%p" becomes the process ID
+    const char *pid_at = strstr(path, "%p");
+    if (pid_at != NULL) {
+        snprintf(trace_path, sizeof(trace_path), "%.*s%ld%s", (int)(pid_at - path), path,
+                 (long)getpid(), pid_at + 2);
+    } else {
+        snprintf(trace_path, sizeof(trace_path), "%s", path);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &trace_epoch);
+    trace_enabled = true;
+    atexit(trace_flush);
+}
+
+void trace_event_for(const char *name, char phase, uint64_t request) {
+    TraceBuffer *b = my_buffer;
+    if (b == NULL || b->count == TRACE_BUFFER_EVENTS) {
+        b = new_buffer();
+        if (b == NULL) {
+            return;
+        }
+    }
+    TraceEvent *e = &b->events[b->count];
+    e->ns = now_ns();
+    e->name = name;
+    e->request = request;
+    e->phase = phase;
+    __atomic_store_n(&b->count, b->count + 1, __ATOMIC_RELEASE);
+}
+
+void trace_event(const char *name, char phase) {
+    trace_event_for(name, phase, my_request);
+}
+
+void trace_request_begin(const char *name) {
+    my_request = __atomic_add_fetch(&last_request, 1, __ATOMIC_RELAXED);
+    trace_event_for(name, 'B', my_request);
+}
+
+void trace_request_end(const char *name) {
+    trace_event_for(name, 'E', my_request);
+    my_request = 0;
+}
+
+uint64_t trace_request(void) {
+    return my_request;
+}
+
+void trace_thread_name(const char *name) {
+    my_name = name;
+    if (my_buffer != NULL) {
+        my_buffer->thread_name = name;
+    }
+}
+
+// Write a list of blocks of one thread, the oldest first
+static void write_thread(FILE *fp, const TraceBuffer *b, long pid, bool *first) {
+    if (b == NULL) {
+        return;
+    }
+    write_thread(fp, b->older, pid, first);
+    size_t count = __atomic_load_n(&b->count, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < count; i++) {
+        const TraceEvent *e = &b->events[i];
+        fprintf(fp, "%s\n{\"name\":\"%s\",\"cat\":\"bank\",\"ph\":\"%c\",\"ts\":%llu.%03u,"
+                "\"pid\":%ld,\"tid\":%ld", *first ? "" : ",", e->name, e->phase,
+                (unsigned long long)(e->ns / 1000), (unsigned)(e->ns % 1000), pid, b->tid);
+        if (e->request != 0) {
+            fprintf(fp, ",\"args\":{\"request\":%llu}", (unsigned long long)e->request);
+        }
+        fputc('}', fp);
+        *first = false;
+    }
+}
+
+/* Trace flush function
+   Purpose: Write every recorded event to the trace file
+
+   Only the newest block of each thread is in the list with nothing
+   newer after it; write_thread() follows its "older" links back to the
+   first block, so each thread's events come out in the order they
+   happened (the viewers need a thread's begin before its end)
+ */
+void trace_flush(void) {
+    if (!trace_enabled || flushed) {
+        return;
+    }
+    flushed = true;
+    FILE *fp = fopen(trace_path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Warning: Could not write the trace to %s\n", trace_path);
+        return;
+    }
+    long pid = (long)getpid();
+    bool first = true;
+    fputs("{\"traceEvents\":[", fp);
+    TraceBuffer *head = __atomic_load_n(&all_buffers, __ATOMIC_ACQUIRE);
+    for (TraceBuffer *b = head; b != NULL; b = b->next) {
+        // Skip blocks that a newer block of the same thread points back to
+        bool newest = true;
+        for (TraceBuffer *n = head; n != NULL && newest; n = n->next) {
+            newest = n->older != b;
+        }
+        if (!newest) {
+            continue;
+        }
+        write_thread(fp, b, pid, &first);
+        if (b->thread_name != NULL) {
+            fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%ld,"
+                    "\"args\":{\"name\":\"%s\"}}", first ? "" : ",", pid, b->tid, b->thread_name);
+            first = false;
+        }
+    }
+    fputs("\n],\"displayTimeUnit\":\"ms\"}\n", fp);
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Warning: Could not write the trace to %s\n", trace_path);
+    }
+}
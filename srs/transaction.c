@@ -6,10 +6,164 @@
 #include "transaction.h"
 #include "account.h"
 #include "utils.h"
+#include "velocity.h"
+#include "store.h"
+#include "txlog.h"
+#include "fees.h"
+#include "shared.h"
+#include "session.h"
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
 
 
+/* ---------- Saving an operation ----------
+   The last part of deposit(), withdraw() and remittance(), also used by
+   the functions without the menu at the end of this file. The accounts
+   have been loaded and checked; these change them, save them with
+   commit_accounts() and log the operation in one update window
+
+   Another teller may have saved an account after it was loaded. Then the
+   commit writes nothing, and the account is loaded again, checked again
+   and changed again (in shared mode its lock is held, so only programs
+   outside shared mode can do that)
+
+   If the accounts were saved but the log record could not be written,
+   the money has moved without a transaction ID: that is TXN_NOT_LOGGED,
+   never TXN_OK with ID 0 */
+
+// What the dialogues say for TXN_NOT_LOGGED
+static void report_not_logged(const char *what, double balance) {
+    print_message("Error: The %s was saved (new balance RM%.2f), but it could not be\n"
+                  "written to the transaction log. Please report it; --reconcile shows it as drift.\n",
+                  what, balance);
+}
+
+static TxnStatus apply_deposit(Account *acc, double amount, TxnResult *out) {
+    SharedHold hold;
+    uint32_t ids[1] = { account_id_from_string(acc->account_number) };
+    shared_lock_accounts(&hold, ids, 1);
+    Account *changed[1] = { acc };
+    CommitResult result = COMMIT_CONFLICT;
+    for (int attempt = 0; attempt < COMMIT_ATTEMPTS && result == COMMIT_CONFLICT; attempt++) {
+        if (attempt > 0 && !load_account(acc->account_number, acc)) {
+            result = COMMIT_FAILED;
+            break;
+        }
+        acc->balance += amount;
+        
+        // Save, then log (see store_update_begin())
+        int update = store_update_begin();
+        result = commit_accounts(changed, 1);
+        if (result == COMMIT_OK) {
+            out->txn_id = txlog_append(TXOP_DEPOSIT, 0, ids[0], amount_to_cents(amount), 0, TXSTATUS_OK);
+        }
+        store_update_end(update);
+    }
+    shared_unlock_accounts(&hold);
+    if (result != COMMIT_OK) {
+        return TXN_FAILED;
+    }
+    velocity_record(acc->account_number, VEL_DEPOSIT, amount_to_cents(amount));
+    out->fee = 0;
+    out->balance = acc->balance;
+    out->receiver_balance = 0;
+    return out->txn_id != 0 ? TXN_OK : TXN_NOT_LOGGED;
+}
+
+static TxnStatus apply_withdrawal(Account *acc, double amount, TxnResult *out) {
+    SharedHold hold;
+    uint32_t ids[1] = { account_id_from_string(acc->account_number) };
+    shared_lock_accounts(&hold, ids, 1);
+    Account *changed[1] = { acc };
+    CommitResult result = COMMIT_CONFLICT;
+    TxnStatus status = TXN_OK;
+    for (int attempt = 0; attempt < COMMIT_ATTEMPTS && result == COMMIT_CONFLICT; attempt++) {
+        if (attempt > 0 && !load_account(acc->account_number, acc)) {
+            result = COMMIT_FAILED;
+            break;
+        }
+        if (amount > acc->balance) {
+            status = TXN_NO_FUNDS;
+            break;
+        }
+        acc->balance -= amount;
+        
+        int update = store_update_begin();
+        result = commit_accounts(changed, 1);
+        if (result == COMMIT_OK) {
+            out->txn_id = txlog_append(TXOP_WITHDRAW, ids[0], 0, amount_to_cents(amount), 0, TXSTATUS_OK);
+        }
+        store_update_end(update);
+    }
+    shared_unlock_accounts(&hold);
+    if (status != TXN_OK) {
+        return status;
+    }
+    if (result != COMMIT_OK) {
+        return TXN_FAILED;
+    }
+    velocity_record(acc->account_number, VEL_WITHDRAW, amount_to_cents(amount));
+    out->fee = 0;
+    out->balance = acc->balance;
+    out->receiver_balance = 0;
+    return out->txn_id != 0 ? TXN_OK : TXN_NOT_LOGGED;
+}
+
+// The sender loses amount + fee, the receiver only gains the amount
+static TxnStatus apply_remittance(Account *sender, Account *receiver, double amount, double fee,
+                                  TxnResult *out) {
+    SharedHold hold;
+    uint32_t ids[2] = { account_id_from_string(sender->account_number),
+                        account_id_from_string(receiver->account_number) };
+    shared_lock_accounts(&hold, ids, 2);
+    Account *changed[2] = { sender, receiver };
+    CommitResult result = COMMIT_CONFLICT;
+    TxnStatus status = TXN_OK;
+    for (int attempt = 0; attempt < COMMIT_ATTEMPTS && result == COMMIT_CONFLICT; attempt++) {
+        if (attempt > 0 && (!load_account(sender->account_number, sender) ||
+                            !load_account(receiver->account_number, receiver))) {
+            result = COMMIT_FAILED;
+            break;
+        }
+        if (amount + fee > sender->balance) {
+            status = TXN_NO_FUNDS;
+            break;
+        }
+        sender->balance -= amount + fee;
+        receiver->balance += amount;
+        
+        // commit_accounts() writes both accounts or neither (a half-done one is undone)
+        int update = store_update_begin();
+        result = commit_accounts(changed, 2);
+        if (result == COMMIT_OK) {
+            out->txn_id = txlog_append(TXOP_REMIT, ids[0], ids[1], amount_to_cents(amount),
+                                       amount_to_cents(fee), TXSTATUS_OK);
+        }
+        store_update_end(update);
+    }
+    shared_unlock_accounts(&hold);
+    if (status != TXN_OK) {
+        return status;
+    }
+    if (result != COMMIT_OK) {
+        return TXN_FAILED;
+    }
+    velocity_record(sender->account_number, VEL_REMIT, amount_to_cents(amount));
+    out->fee = fee;
+    out->balance = sender->balance;
+    out->receiver_balance = receiver->balance;
+    return out->txn_id != 0 ? TXN_OK : TXN_NOT_LOGGED;
+}
+
+
+/* ---------- The dialogues ----------
+   Each one is a step function (see session.h): it is called once to
+   start, then once for every line typed. A "break" out of the switch
+   ends the dialogue; a step that asks another question returns */
+
 /* Users can deposit money to their accounts using this function 
  *  
  * Process:
@@ -19,83 +173,94 @@
  *   4. Add money to balance
  *   5. Save updated account
  */
-void deposit(void) {
-    char account_num[20];     
-    char pin[PIN_LEN + 1];    
-    double amount;              
-    
-    printf("\n========================================\n");
-    printf("              DEPOSIT\n");
-    printf("========================================\n");
-    
+enum { DEPOSIT_ACCOUNT = 1, DEPOSIT_PIN, DEPOSIT_AMOUNT };
 
-    // STEP 1: Get Account Information
-
-    if (!get_string_input(account_num, 20, "Enter account number: ")) {
-        return;
-    }
-    
-    if (!get_string_input(pin, PIN_LEN + 1, "Enter 4-digit PIN: ")) {
+void deposit_step(Session *s, const char *line) {
+    double amount;
+    TxnResult done;
+    TxnStatus status;
+    
+    switch (s->step) {
+    case 0:
+        print_message("\n========================================\n");
+        print_message("              DEPOSIT\n");
+        print_message("========================================\n");
+        
+        // STEP 1: Get Account Information
+        session_prompt(s, DEPOSIT_ACCOUNT, "Enter account number: ");
         return;
-    }
-    
-    /* STEP 2: Verify User Identity
-       Verify the account's existence and PIN.
-     */
-    if (!authenticate(account_num, pin)) {
-        printf("Error: Authentication failed.\n");
+        
+    case DEPOSIT_ACCOUNT:
+        if (!session_text(line, s->account_num, sizeof(s->account_num))) {
+            break;
+        }
+        session_prompt(s, DEPOSIT_PIN, "Enter 4-digit PIN: ");
         return;
-    }
-    
-     // STEP 3: Load the Account Data
-
-    Account acc;
-    if (!load_account(account_num, &acc)) {
-        printf("Error: Failed to load account.\n");
+        
+    case DEPOSIT_PIN:
+        if (!session_text(line, s->pin, sizeof(s->pin))) {
+            break;
+        }
+        
+        /* STEP 2: Verify User Identity
+           Verify the account's existence and PIN.
+         */
+        if (!authenticate(s->account_num, s->pin)) {
+            print_message("Error: Authentication failed.\n");
+            break;
+        }
+        
+        // STEP 3: Load the Account Data
+        if (!load_account(s->account_num, &s->acc)) {
+            print_message("Error: Failed to load account.\n");
+            break;
+        }
+        
+        // Show the current balance
+        print_message("Current Balance: RM%.2f\n", s->acc.balance);
+        
+        /* STEP 4: Obtain and Validate Deposit Amount
+           Find out the user's desired deposit amount
+           Validation checks: correct decimal format, positive amount, and not too large
+         */
+        session_prompt(s, DEPOSIT_AMOUNT, "Enter deposit amount (RM): ");
         return;
+        
+    case DEPOSIT_AMOUNT:
+        if (!session_number(line, &amount) || !is_valid_amount(amount, MAX_DEPOSIT)) {
+            break;
+        }
+        
+        // Check the per-minute, per-hour and daily deposit limits
+        if (!velocity_check(s->account_num, s->acc.type, VEL_DEPOSIT, amount_to_cents(amount))) {
+            break;
+        }
+        
+        // STEP 5-7: Add the amount, save the account and log the deposit
+        status = apply_deposit(&s->acc, amount, &done);
+        if (status == TXN_NOT_LOGGED) {
+            report_not_logged("deposit", s->acc.balance);
+            break;
+        }
+        if (status != TXN_OK) {
+            print_message("Error: Failed to save account.\n");
+            break;
+        }
+        
+        // STEP 8: Show the Success Message
+        print_message("\n========================================\n");
+        print_message("Deposit successful!\n");
+        print_message("Transaction ID: %llu\n", (unsigned long long)done.txn_id);
+        print_message("Amount Deposited: RM%.2f\n", amount);
+        print_message("New Balance: RM%.2f\n", s->acc.balance);
+        print_message("========================================\n");
+        break;
     }
-    
-    // Show the current balance
-    printf("Current Balance: RM%.2f\n", acc.balance);
-    
+    session_end(s);
+}
 
-     /* STEP 4: Obtain and Validate Deposit Amount
-       Find out the user's desired deposit amount
-       Validation checks: correct decimal format, positive amount, and not too large
-     */
-    if (!get_double_input(&amount, "Enter deposit amount (RM): ")) {
-        return;
-    }
-    
-    if (!is_valid_amount(amount, MAX_DEPOSIT)) {
-        return; 
-    }
-    
-    /* STEP 5: Update the Account Balance
-       Increase the account balance by the deposit amount
-     */
-    acc.balance += amount;
-    
-    // STEP 6: Save the Updated Account
-    if (!save_account(&acc)) {
-        printf("Error: Failed to save account.\n");
-        return;
-    }
-    
-    /* 
-       STEP 7: Record the Transaction in Log
-       Keep a record of this deposit for audit purposes
-     */
-    char log_msg[200];
-    sprintf(log_msg, "Deposit: Account %s, Amount: RM%.2f", account_num, amount);
-    log_transaction(log_msg);
-    
-     // STEP 8: Show the Success Message
-    printf("\n========================================\n");
-    printf("Deposit successful!\n");
-    printf("Amount Deposited: RM%.2f\n", amount);
-    printf("New Balance: RM%.2f\n", acc.balance);
-    printf("========================================\n");
+void deposit(void) {
+    session_run_console(FLOW_DEPOSIT);
 }
 
 /* 
@@ -113,87 +278,109 @@ void deposit(void) {
    
    Important: You can't take out more money than the account balance
  */
-void withdraw(void) {
-    char account_num[20];     
-    char pin[PIN_LEN + 1];   
-    double amount;          
-    
-    printf("\n========================================\n");
-    printf("            WITHDRAWAL\n");
-    printf("========================================\n");
-    
-     //STEP 1: Get the Account Information
-    if (!get_string_input(account_num, 20, "Enter account number: ")) {
-        return;
-    }
-    
-    if (!get_string_input(pin, PIN_LEN + 1, "Enter 4-digit PIN: ")) {
-        return;
-    }
+enum { WITHDRAW_ACCOUNT = 1, WITHDRAW_PIN, WITHDRAW_AMOUNT };
 
-     // STEP 2: Verify User's Identity
-    if (!authenticate(account_num, pin)) {
-        printf("Error: Authentication failed.\n");
+void withdraw_step(Session *s, const char *line) {
+    double amount;
+    TxnResult done;
+    TxnStatus status;
+    
+    switch (s->step) {
+    case 0:
+        print_message("\n========================================\n");
+        print_message("            WITHDRAWAL\n");
+        print_message("========================================\n");
+        
+        // STEP 1: Get the Account Information
+        session_prompt(s, WITHDRAW_ACCOUNT, "Enter account number: ");
         return;
-    }
-    
-     // STEP 3: Load the Account Data
-    Account acc;
-    if (!load_account(account_num, &acc)) {
-        printf("Error: Failed to load account.\n");
-        return;
-    }
-    
-    // Show the balance available
-    printf("Available Balance: RM%.2f\n", acc.balance);
-    
-
-     // STEP 4: Get the Desired Withdrawal Amount
-    if (!get_double_input(&amount, "Enter withdrawal amount (RM): ")) {
-        return;
-    }
-    
-    /* STEP 5: Validate the Withdrawal Amount
-       Check 1: Amount must be positive
-       Check 2: It must not exceed the account balance 
-       Check 3: It must be within the maximum withdrawal amount allowed
-     */
-    if (amount <= 0) {
-        printf("Error: Amount must be greater than RM0.\n");
+        
+    case WITHDRAW_ACCOUNT:
+        if (!session_text(line, s->account_num, sizeof(s->account_num))) {
+            break;
+        }
+        session_prompt(s, WITHDRAW_PIN, "Enter 4-digit PIN: ");
         return;
-    }
-    
-    // Verify that the account has sufficient money 
-    if (amount > acc.balance) {
-        printf("Error: Insufficient funds. Please try again.\n");
+        
+    case WITHDRAW_PIN:
+        if (!session_text(line, s->pin, sizeof(s->pin))) {
+            break;
+        }
+        
+        // STEP 2: Verify User's Identity
+        if (!authenticate(s->account_num, s->pin)) {
+            print_message("Error: Authentication failed.\n");
+            break;
+        }
+        
+        // STEP 3: Load the Account Data
+        if (!load_account(s->account_num, &s->acc)) {
+            print_message("Error: Failed to load account.\n");
+            break;
+        }
+        
+        // Show the balance available
+        print_message("Available Balance: RM%.2f\n", s->acc.balance);
+        
+        // STEP 4: Get the Desired Withdrawal Amount
+        session_prompt(s, WITHDRAW_AMOUNT, "Enter withdrawal amount (RM): ");
         return;
+        
+    case WITHDRAW_AMOUNT:
+        if (!session_number(line, &amount)) {
+            break;
+        }
+        
+        /* STEP 5: Validate the Withdrawal Amount
+           Check 1: Amount must be positive
+           Check 2: It must not exceed the account balance 
+           Check 3: It must be within the maximum withdrawal amount allowed
+         */
+        if (amount <= 0) {
+            print_message("Error: Amount must be greater than RM0.\n");
+            break;
+        }
+        
+        // Verify that the account has sufficient money 
+        if (amount > s->acc.balance) {
+            print_message("Error: Insufficient funds. Please try again.\n");
+            break;
+        }
+        
+        // Check the per-minute, per-hour and daily withdrawal limits
+        if (!velocity_check(s->account_num, s->acc.type, VEL_WITHDRAW, amount_to_cents(amount))) {
+            break;
+        }
+        
+        // STEP 6-8: Take the amount off, save the account and log the withdrawal
+        status = apply_withdrawal(&s->acc, amount, &done);
+        if (status == TXN_NO_FUNDS) {
+            print_message("Error: Insufficient funds. Please try again.\n");
+            break;
+        }
+        if (status == TXN_NOT_LOGGED) {
+            report_not_logged("withdrawal", s->acc.balance);
+            break;
+        }
+        if (status != TXN_OK) {
+            print_message("Error: Failed to save account.\n");
+            break;
+        }
+        
+        // STEP 9: Show a Success Message
+        print_message("\n========================================\n");
+        print_message("Withdrawal successful!\n");
+        print_message("Transaction ID: %llu\n", (unsigned long long)done.txn_id);
+        print_message("Amount Withdrawn: RM%.2f\n", amount);
+        print_message("New Balance: RM%.2f\n", s->acc.balance);
+        print_message("========================================\n");
+        break;
     }
-    
+    session_end(s);
+}
 
-    /* STEP 6: Update Balance
-       Take the withdrawal amount and deduct it from the account balance
-     */
-    acc.balance -= amount;
-    
-    /* 
-       STEP 7: Save the Updated Account
-     */
-    if (!save_account(&acc)) {
-        printf("Error: Failed to save account.\n");
-        return;
-    }
-    
-     // STEP 8: Record the Transaction in Log
-    char log_msg[200];
-    sprintf(log_msg, "Withdrawal: Account %s, Amount: RM%.2f", account_num, amount);
-    log_transaction(log_msg);
-    
-     // STEP 9: Show a Success Message
-    printf("\n========================================\n");
-    printf("Withdrawal successful!\n");
-    printf("Amount Withdrawn: RM%.2f\n", amount);
-    printf("New Balance: RM%.2f\n", acc.balance);
-    printf("========================================\n");
+void withdraw(void) {
+    session_run_console(FLOW_WITHDRAW);
 }
 
 /* REMITTANCE FUNCTION
@@ -218,135 +405,448 @@ void withdraw(void) {
     Current to Savings: 3% fee
     Same type (S->S or C->C): 1% fee
  */
-void remittance(void) {
-    char sender_num[20];        
-    char sender_pin[PIN_LEN + 1]; 
-    char receiver_num[20];   
-    double amount;       
-    
-    printf("\n========================================\n");
-    printf("            REMITTANCE\n");
-    printf("========================================\n");
+enum { REMIT_SENDER = 1, REMIT_PIN, REMIT_RECEIVER, REMIT_AMOUNT };
 
-     // STEP 1: Obtain Sender's Information
-    if (!get_string_input(sender_num, 20, "Enter sender account number: ")) {
+void remittance_step(Session *s, const char *line) {
+    double amount, fee, total_deduction;
+    TxnResult done;
+    TxnStatus status;
+    
+    switch (s->step) {
+    case 0:
+        print_message("\n========================================\n");
+        print_message("            REMITTANCE\n");
+        print_message("========================================\n");
+        
+        // STEP 1: Obtain Sender's Information
+        session_prompt(s, REMIT_SENDER, "Enter sender account number: ");
         return;
-    }
-    
-    if (!get_string_input(sender_pin, PIN_LEN + 1, "Enter sender 4-digit PIN: ")) {
+        
+    case REMIT_SENDER:
+        if (!session_text(line, s->account_num, sizeof(s->account_num))) {
+            break;
+        }
+        session_prompt(s, REMIT_PIN, "Enter sender 4-digit PIN: ");
         return;
+        
+    case REMIT_PIN:
+        if (!session_text(line, s->pin, sizeof(s->pin))) {
+            break;
+        }
+        
+        // STEP 2: Verify Sender's Identity
+        if (!authenticate(s->account_num, s->pin)) {
+            print_message("Error: Authentication failed.\n");
+            break;
+        }
+        
+        // STEP 3: Load Sender's Account Data
+        if (!load_account(s->account_num, &s->acc)) {
+            print_message("Error: Failed to load sender account.\n");
+            break;
+        }
+        
+        // Show sender's balance that is available
+        print_message("Sender Balance: RM%.2f\n", s->acc.balance);
+        
+        // STEP 4: Obtain Receiver's Account Number
+        session_prompt(s, REMIT_RECEIVER, "Enter receiver account number: ");
+        return;
+        
+    case REMIT_RECEIVER:
+        if (!session_text(line, s->other_num, sizeof(s->other_num))) {
+            break;
+        }
+        
+        /* STEP 5: Validate Receiver Account
+         * Check 1: You can't transfer to yourself
+         * Check 2: There must be a receiver account.
+         */
+        if (strcmp(s->account_num, s->other_num) == 0) {
+            print_message("Error: Cannot transfer to the same account.\n");
+            break;
+        }
+        
+        // STEP 6: Load Receiver's Account Data
+        if (!load_account(s->other_num, &s->other)) {
+            print_message("Error: Receiver account not found.\n");
+            break;
+        }
+        
+        // Show the information of the receiver
+        print_message("Receiver: %s (%s)\n", s->other.name, account_type_to_string(s->other.type));
+        
+        // STEP 7: Get the Transfer Amount
+        session_prompt(s, REMIT_AMOUNT, "Enter transfer amount (RM): ");
+        return;
+        
+    case REMIT_AMOUNT:
+        if (!session_number(line, &amount)) {
+            break;
+        }
+        
+        /* STEP 8: Calculate Transfer Fee
+           The fee comes from the fee schedule (see fees.h) and depends on
+           both account types and the amount. By default:
+           - Savings → Current: 2% fee (cheaper rate)
+           - Current → Savings: 3% fee (higher rate)
+           - Same type: 1% fee (default rate)
+           
+           NOTE: The recipient does not pay the fee; only the sender does
+         */
+        fee = fee_for_remittance(s->acc.type, s->other.type, amount_to_cents(amount)) / 100.0;
+        if (fee > 0) {
+            print_message("Remittance Fee: RM%.2f\n", fee);
+        }
+        
+        // Calculate the total amount that sender will pay
+        total_deduction = amount + fee;
+        print_message("Total Deduction: RM%.2f\n", total_deduction);
+        
+        /* STEP 9: Validate Transfer Amount
+           Check 1: The amount must be positive
+           Check 2: The sender must have enough money to send (amount + fee)
+         */
+        if (amount <= 0) {
+            print_message("Error: Amount must be greater than RM0.\n");
+            break;
+        }
+        
+        if (total_deduction > s->acc.balance) {
+            print_message("Error: Insufficient funds. Please try again.\n");
+            break;
+        }
+        
+        // Check the sender's remittance limits (the fee is not counted)
+        if (!velocity_check(s->account_num, s->acc.type, VEL_REMIT, amount_to_cents(amount))) {
+            break;
+        }
+        
+        // STEP 10-12: Move the money, save both accounts and log the remittance
+        status = apply_remittance(&s->acc, &s->other, amount, fee, &done);
+        if (status == TXN_NO_FUNDS) {
+            print_message("Error: Insufficient funds. Please try again.\n");
+            break;
+        }
+        if (status == TXN_NOT_LOGGED) {
+            report_not_logged("remittance", s->acc.balance);
+            break;
+        }
+        if (status != TXN_OK) {
+            print_message("Error: Failed to save accounts.\n");
+            break;
+        }
+        
+        // STEP 13: Show a Success Message
+        print_message("\n========================================\n");
+        print_message("Remittance successful!\n");
+        print_message("Transaction ID: %llu\n", (unsigned long long)done.txn_id);
+        print_message("Amount Transferred: RM%.2f\n", amount);
+        print_message("Remittance Fee: RM%.2f\n", fee);
+        print_message("Sender New Balance: RM%.2f\n", s->acc.balance);
+        print_message("Receiver New Balance: RM%.2f\n", s->other.balance);
+        print_message("========================================\n");
+        break;
     }
-    
+    session_end(s);
+}
 
-     // STEP 2: Verify Sender's Identity
-    if (!authenticate(sender_num, sender_pin)) {
-        printf("Error: Authentication failed.\n");
-        return;
+void remittance(void) {
+    session_run_console(FLOW_REMIT);
+}
+
+/* ---------- Without the menu ---------- */
+
+TxnStatus load_authenticated(const char *account_num, const char *pin, Account *acc) {
+    if (!load_account(account_num, acc) || !pin_matches(acc, pin)) {
+        return TXN_AUTH_FAILED;
     }
-    
+    return TXN_OK;
+}
 
-     // STEP 3: Load Sender's Account Data
-    Account sender;
-    if (!load_account(sender_num, &sender)) {
-        printf("Error: Failed to load sender account.\n");
-        return;
+TxnStatus deposit_amount(const char *account_num, const char *pin, double amount, TxnResult *out) {
+    Account acc;
+    if (load_authenticated(account_num, pin, &acc) != TXN_OK) {
+        return TXN_AUTH_FAILED;
     }
-    
-    // Show sender's balance that is available
-    printf("Sender Balance: RM%.2f\n", sender.balance);
-    
-  
-     // STEP 4: Obtain Receiver's Account Number
-    if (!get_string_input(receiver_num, 20, "Enter receiver account number: ")) {
-        return;
+    if (!is_valid_amount(amount, MAX_DEPOSIT)) {
+        return TXN_INVALID;
+    }
+    if (!velocity_check(account_num, acc.type, VEL_DEPOSIT, amount_to_cents(amount))) {
+        return TXN_LIMIT;
     }
+    return apply_deposit(&acc, amount, out);
+}
 
-    /* STEP 5: Validate Receiver Account
-     * Check 1: You can't transfer to yourself
-     * Check 2: There must be a receiver account.
-     */
-    if (strcmp(sender_num, receiver_num) == 0) {
-        printf("Error: Cannot transfer to the same account.\n");
-        return;
+TxnStatus withdraw_amount(const char *account_num, const char *pin, double amount, TxnResult *out) {
+    Account acc;
+    if (load_authenticated(account_num, pin, &acc) != TXN_OK) {
+        return TXN_AUTH_FAILED;
+    }
+    if (amount <= 0) {
+        printf("Error: Amount must be greater than RM0.\n");
+        return TXN_INVALID;
+    }
+    if (amount > acc.balance) {
+        return TXN_NO_FUNDS;
     }
+    if (!velocity_check(account_num, acc.type, VEL_WITHDRAW, amount_to_cents(amount))) {
+        return TXN_LIMIT;
+    }
+    return apply_withdrawal(&acc, amount, out);
+}
 
-    // STEP 6: Load Receiver's Account Data
-    Account receiver;
-    if (!load_account(receiver_num, &receiver)) {
-        printf("Error: Receiver account not found.\n");
-        return;
+TxnStatus remit_amount(const char *sender_num, const char *pin, const char *receiver_num,
+                       double amount, TxnResult *out) {
+    Account sender, receiver;
+    if (load_authenticated(sender_num, pin, &sender) != TXN_OK) {
+        return TXN_AUTH_FAILED;
     }
-    
-    // Show the information of the receiver
-    printf("Receiver: %s (%s)\n", receiver.name, account_type_to_string(receiver.type));
-    
-    // STEP 7: Get the Transfer Amount
-    if (!get_double_input(&amount, "Enter transfer amount (RM): ")) {
-        return;
+    if (strcmp(sender_num, receiver_num) == 0) {
+        printf("Error: Cannot transfer to the same account.\n");
+        return TXN_INVALID;
     }
-    
-    /* STEP 8: Calculate Transfer Fee
-       Fee rates depend on account types:
-       - Savings → Current: 2% fee (cheaper rate)
-       - Current → Savings: 3% fee (higher rate)
-       - Same type: 1% fee (default rate)
-       
-       NOTE: The recipient does not pay the fee; only the sender does
-     */
-    double fee = 0.0;
-    if (sender.type == SAVINGS && receiver.type == CURRENT) {
-        fee = amount * 0.02; 
-        printf("Remittance Fee (2%%): RM%.2f\n", fee);
-    } else if (sender.type == CURRENT && receiver.type == SAVINGS) {
-        fee = amount * 0.03; 
-        printf("Remittance Fee (3%%): RM%.2f\n", fee);
+    if (!load_account(receiver_num, &receiver)) {
+        return TXN_NOT_FOUND;
     }
-    
-    // Calculate the total amount that sender will pay
-    double total_deduction = amount + fee;
-    printf("Total Deduction: RM%.2f\n", total_deduction);
-    
-    /* STEP 9: Validate Transfer Amount
-       Check 1: The amount must be positive
-       Check 2: The sender must have enough money to send (amount + fee)
-     */
     if (amount <= 0) {
         printf("Error: Amount must be greater than RM0.\n");
-        return;
+        return TXN_INVALID;
     }
-    
-    if (total_deduction > sender.balance) {
-        printf("Error: Insufficient funds. Please try again.\n");
-        return;
+    double fee = fee_for_remittance(sender.type, receiver.type, amount_to_cents(amount)) / 100.0;
+    if (amount + fee > sender.balance) {
+        return TXN_NO_FUNDS;
     }
-    
-    /* STEP 10: Update the Balances of Both Accounts
-       Sender: loses amount + fee
-       Receiver: only gains the amount 
-     */
-    sender.balance -= total_deduction;
-    receiver.balance += amount;
-    
-    /* STEP 11: Save Both Accounts
-       The transaction is unsuccessful unless both accounts are saved correctly
-     */
-    if (!save_account(&sender) || !save_account(&receiver)) {
+    if (!velocity_check(sender_num, sender.type, VEL_REMIT, amount_to_cents(amount))) {
+        return TXN_LIMIT;
+    }
+    return apply_remittance(&sender, &receiver, amount, fee, out);
+}
+
+/* ---------- Looking up and reversing transactions ---------- */
+
+/* The reversal index (REVERSAL_INDEX) has one bit per transaction ID, set
+   when that transaction has been reversed, after an 8-byte header holding
+   the last log record it has been checked against. The bit is set after
+   the reversal is logged; if the program stops in between, catch_up()
+   finds the REVERSAL record in the log and sets it the next time */
+
+// Where the bit of a transaction is: byte offset in the file, and mask
+static off_t bit_offset(uint64_t txn_id, unsigned char *mask) {
+    *mask = (unsigned char)(1u << (txn_id % 8));
+    return (off_t)(sizeof(uint64_t) + txn_id / 8);
+}
+
+static bool is_reversed(int fd, uint64_t txn_id) {
+    unsigned char mask, byte = 0;
+    off_t offset = bit_offset(txn_id, &mask);
+    return pread(fd, &byte, 1, offset) == 1 && (byte & mask) != 0;
+}
+
+static bool mark_reversed(int fd, uint64_t txn_id) {
+    unsigned char mask, byte = 0;
+    off_t offset = bit_offset(txn_id, &mask);
+    if (pread(fd, &byte, 1, offset) < 0) {
+        return false;
+    }
+    byte |= mask;
+    return pwrite(fd, &byte, 1, offset) == 1;
+}
+
+typedef struct {
+    int fd;
+    uint64_t last_id;
+} CatchUp;
+
+static bool catch_up_record(const TxRecord *rec, void *ctx) {
+    CatchUp *c = ctx;
+    if (rec->op == TXOP_REVERSAL && rec->status == TXSTATUS_OK) {
+        mark_reversed(c->fd, rec->ref_id);
+    }
+    c->last_id = rec->txn_id;
+    return true;
+}
+
+/* Set the bits of reversals the index has not seen yet (normally none)
+   Returns: false if the log could not be read */
+static bool catch_up(int fd) {
+    CatchUp c = { fd, 0 };
+    if (pread(fd, &c.last_id, sizeof(c.last_id), 0) != sizeof(c.last_id)) {
+        c.last_id = 0;   // New index: check the whole log once
+    }
+    uint64_t before = c.last_id;
+    if (txlog_query_after(before, INT64_MAX, catch_up_record, &c) < 0) {
+        return false;
+    }
+    return c.last_id == before ||
+           pwrite(fd, &c.last_id, sizeof(c.last_id), 0) == sizeof(c.last_id);
+}
+
+/* Open the reversal index and lock it (one reversal at a time)
+   Returns: The file descriptor, or -1 */
+static int open_reversal_index(void) {
+    int fd = open(REVERSAL_INDEX, O_RDWR | O_CREAT, 0644);
+    if (fd >= 0 && flock(fd, LOCK_EX) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+static void close_reversal_index(int fd) {
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+/* Show transaction function
+   Purpose: Print one transaction found by its ID
+ */
+int show_transaction(uint64_t txn_id) {
+    TxRecord rec;
+    if (!txlog_find(txn_id, &rec)) {
+        printf("Error: Transaction %llu not found.\n", (unsigned long long)txn_id);
+        return 1;
+    }
+    char when[32], text[200];
+    txlog_format_time(&rec, when, sizeof(when));
+    txlog_describe(&rec, text, sizeof(text));
+    printf("Transaction %llu %s %s\n", (unsigned long long)txn_id, when, text);
+
+    int fd = open(REVERSAL_INDEX, O_RDONLY);
+    if (fd >= 0) {
+        if (is_reversed(fd, txn_id)) {
+            printf("This transaction has been reversed.\n");
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+/* Load one side of a reversal and change its balance
+   Returns: false (with a message) if the account is gone or too poor */
+static bool reversal_side(uint32_t id, int64_t change_cents, Account *acc) {
+    char account_num[20];
+    snprintf(account_num, sizeof(account_num), "%u", id);
+    if (!load_account(account_num, acc)) {
+        printf("Error: Account %s no longer exists.\n", account_num);
+        return false;
+    }
+    long long cents = amount_to_cents(acc->balance) + change_cents;
+    if (cents < 0) {
+        printf("Error: Account %s does not have RM%.2f to give back.\n",
+               account_num, -change_cents / 100.0);
+        return false;
+    }
+    acc->balance = cents / 100.0;
+    return true;
+}
+
+/* Reverse transaction function
+   Purpose: Undo a deposit, withdrawal or remittance
+
+   How it works:
+   1. Find the transaction by its ID (it must have succeeded)
+   2. Lock the reversal index and make sure it was not reversed before
+   3. Swap the two sides: money goes back from where it went to where it
+      came from, and a remittance fee is refunded to the sender
+   4. Save the accounts and log one TXOP_REVERSAL record (ref_id = the
+      reversed transaction), inside one update window
+   5. Mark the transaction as reversed
+ */
+int reverse_transaction(uint64_t txn_id) {
+    // STEP 1: Find it
+    TxRecord orig;
+    if (!txlog_find(txn_id, &orig)) {
+        printf("Error: Transaction %llu not found.\n", (unsigned long long)txn_id);
+        return 1;
+    }
+    if (orig.status != TXSTATUS_OK) {
+        printf("Error: Transaction %llu failed, so there is nothing to reverse.\n",
+               (unsigned long long)txn_id);
+        return 1;
+    }
+    if (orig.op != TXOP_DEPOSIT && orig.op != TXOP_WITHDRAW && orig.op != TXOP_REMIT) {
+        printf("Error: Only deposits, withdrawals and remittances can be reversed.\n");
+        return 1;
+    }
+
+    // STEP 2: Not reversed yet
+    int index = open_reversal_index();
+    if (index < 0 || !catch_up(index)) {
+        printf("Error: Could not read the reversal index.\n");
+        if (index >= 0) {
+            close_reversal_index(index);
+        }
+        return 1;
+    }
+    if (is_reversed(index, txn_id)) {
+        printf("Error: Transaction %llu has already been reversed.\n", (unsigned long long)txn_id);
+        close_reversal_index(index);
+        return 1;
+    }
+
+    // STEP 3: The reversal record (0 means outside the bank)
+    TxRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.op = TXOP_REVERSAL;
+    rec.status = TXSTATUS_OK;
+    rec.from_id = orig.to_id;
+    rec.to_id = orig.from_id;
+    rec.amount_cents = orig.amount_cents;
+    rec.fee_cents = orig.fee_cents;
+    rec.ref_id = txn_id;
+
+    SharedHold hold;
+    uint32_t ids[2] = { rec.from_id, rec.to_id };
+    shared_lock_accounts(&hold, ids, 2);
+    Account payer, payee;
+    CommitResult result = COMMIT_CONFLICT;
+    uint64_t reversal_id = 0;
+    for (int attempt = 0; attempt < COMMIT_ATTEMPTS && result == COMMIT_CONFLICT; attempt++) {
+        bool ok = (rec.from_id == 0 || reversal_side(rec.from_id, -rec.amount_cents, &payer)) &&
+                  (rec.to_id == 0 || reversal_side(rec.to_id, rec.amount_cents + rec.fee_cents, &payee));
+        if (!ok) {
+            shared_unlock_accounts(&hold);
+            close_reversal_index(index);
+            return 1;
+        }
+
+        // STEP 4: Save (both or neither, see commit_accounts()), then log
+        Account *changed[2];
+        size_t count = 0;
+        if (rec.from_id != 0) {
+            changed[count++] = &payer;
+        }
+        if (rec.to_id != 0) {
+            changed[count++] = &payee;
+        }
+        int update = store_update_begin();
+        result = commit_accounts(changed, count);
+        if (result == COMMIT_OK) {
+            reversal_id = txlog_append_batch(&rec, 1);
+        }
+        store_update_end(update);
+    }
+    shared_unlock_accounts(&hold);
+    if (result != COMMIT_OK) {
         printf("Error: Failed to save accounts.\n");
-        return;
+        close_reversal_index(index);
+        return 1;
     }
-    
-  // STEP 12: Record the Transaction in Log
-    char log_msg[300];
-    sprintf(log_msg, "Remittance: From %s to %s, Amount: RM%.2f, Fee: RM%.2f",
-            sender_num, receiver_num, amount, fee);
-    log_transaction(log_msg);
-    
-     // STEP 13: Show a Success Message
-    printf("\n========================================\n");
-    printf("Remittance successful!\n");
-    printf("Amount Transferred: RM%.2f\n", amount);
-    printf("Remittance Fee: RM%.2f\n", fee);
-    printf("Sender New Balance: RM%.2f\n", sender.balance);
-    printf("Receiver New Balance: RM%.2f\n", receiver.balance);
-    printf("========================================\n");
+
+    // STEP 5: Mark it (the money has moved back even if it was not logged)
+    mark_reversed(index, txn_id);
+    close_reversal_index(index);
+    if (reversal_id == 0) {
+        printf("Error: The reversal was saved, but it could not be written to the transaction log.\n"
+               "Please report it; --reconcile shows it as drift.\n");
+        return 1;
+    }
+
+    char text[200];
+    txlog_describe(&rec, text, sizeof(text));
+    printf("Reversal successful!\n");
+    printf("%s\n", text);
+    printf("Transaction ID: %llu\n", (unsigned long long)reversal_id);
+    return 0;
 }
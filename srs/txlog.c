@@ -0,0 +1,776 @@
+/* This file writes and reads the binary transaction log
+
+   Every record is 64 bytes long and protected by a CRC32C checksum.
+   Appends are done under an exclusive lock on TXLOG_LOCK, so several
+   running programs can share one log and the transaction IDs still
+   increase by exactly one per record
+
+   The log is split into segments (see txlog.h). Closing a segment is done
+   in an order that can be finished after a crash at any point:
+   1. Write the footer at the end of active.bin
+   2. Add the segment to the catalog
+   3. Rename active.bin to seg-<first ID>.bin
+   If active.bin is found with a footer, steps 2 and 3 are simply repeated
+   A closed segment is compressed (TXLOG_COMPRESS_MARKER) only after the
+   log lock has been let go
+ */
+
+#include "txlog.h"
+#include "types.h"
+#include "crc32c.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#define CHECKSUMMED_BYTES offsetof(TxRecord, checksum)
+#define RECORD_SIZE ((off_t)sizeof(TxRecord))
+
+
+void txlog_seal(TxRecord *rec) {
+    rec->checksum = crc32c(0, rec, CHECKSUMMED_BYTES);
+}
+
+bool txlog_record_valid(const TxRecord *rec) {
+    return rec->magic == TXLOG_MAGIC && rec->checksum == crc32c(0, rec, CHECKSUMMED_BYTES);
+}
+
+/* Lock the whole log (LOCK_EX to append, LOCK_SH to list segments)
+   Returns: The lock file descriptor, or -1 if it failed */
+static int lock_log(int mode) {
+    if (mkdir(TXLOG_DIR, 0755) != 0 && errno != EEXIST) {
+        return -1;
+    }
+    int fd = open(TXLOG_LOCK, O_RDWR | O_CREAT, 0644);
+    if (fd >= 0) {
+        flock(fd, mode);
+    }
+    return fd;
+}
+
+static void unlock_log(int fd) {
+    if (fd >= 0) {
+        flock(fd, LOCK_UN);
+        close(fd);
+    }
+}
+
+/* Read the catalog
+   Returns: The number of segments read into *segments (caller frees) */
+static size_t read_catalog(TxSegment **segments) {
+    *segments = NULL;
+    FILE *fp = fopen(TXLOG_CATALOG, "r");
+    if (fp == NULL) {
+        return 0;
+    }
+
+    size_t count = 0, capacity = 0;
+    char name[64];
+    long long first_ts, last_ts;
+    unsigned long long first_id, last_id, records;
+    while (fscanf(fp, "%63s %lld %lld %llu %llu %llu", name, &first_ts, &last_ts,
+                  &first_id, &last_id, &records) == 6) {
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            TxSegment *bigger = realloc(*segments, capacity * sizeof(TxSegment));
+            if (bigger == NULL) {
+                break;
+            }
+            *segments = bigger;
+        }
+        TxSegment *seg = &(*segments)[count++];
+        snprintf(seg->path, sizeof(seg->path), "%s/%s", TXLOG_DIR, name);
+        seg->first_ts = first_ts;
+        seg->last_ts = last_ts;
+        seg->first_id = first_id;
+        seg->last_id = last_id;
+        seg->count = records;
+        seg->active = false;
+    }
+    fclose(fp);
+    return count;
+}
+
+/* Look at the records of an open segment file
+   Fills in the time range, ID range and count of the records, and tells
+   whether the file already ends with a footer. Damaged records at the end
+   still used their IDs (IDs go up by one per record), so they count in
+   last_id: the next record never gets the ID of one that was written */
+static void describe_file(int fd, TxSegment *seg, bool *has_footer) {
+    struct stat st;
+    seg->count = 0;
+    seg->first_ts = seg->last_ts = 0;
+    seg->first_id = seg->last_id = 0;
+    *has_footer = false;
+    if (fstat(fd, &st) != 0) {
+        return;
+    }
+
+    off_t end = st.st_size - st.st_size % RECORD_SIZE;
+    TxRecord rec;
+    if (end >= RECORD_SIZE && pread(fd, &rec, sizeof(rec), end - RECORD_SIZE) == sizeof(rec) &&
+        rec.magic == TXLOG_FOOTER_MAGIC) {
+        *has_footer = true;
+        end -= RECORD_SIZE;
+    }
+
+    // First valid record from the front, last valid record from the back
+    off_t pos;
+    for (pos = 0; pos < end; pos += RECORD_SIZE) {
+        if (pread(fd, &rec, sizeof(rec), pos) == sizeof(rec) && txlog_record_valid(&rec)) {
+            seg->first_ts = rec.timestamp;
+            seg->first_id = rec.txn_id;
+            break;
+        }
+    }
+    if (pos >= end) {
+        return;  // No valid records
+    }
+    for (off_t back = end - RECORD_SIZE; back >= pos; back -= RECORD_SIZE) {
+        if (pread(fd, &rec, sizeof(rec), back) == sizeof(rec) && txlog_record_valid(&rec)) {
+            seg->last_ts = rec.timestamp;
+            seg->last_id = rec.txn_id + (uint64_t)((end - RECORD_SIZE - back) / RECORD_SIZE);
+            break;
+        }
+    }
+    seg->count = (uint64_t)(end / RECORD_SIZE);
+}
+
+/* Finish closing the active segment (steps 2 and 3, see the top of the file)
+   "closed" gets the path of the closed segment (128 bytes) */
+static bool finish_rotation(const TxSegment *seg, char *closed) {
+    char name[64], path[128];
+    snprintf(name, sizeof(name), "seg-%020llu.bin", (unsigned long long)seg->first_id);
+    snprintf(path, sizeof(path), "%s/%s", TXLOG_DIR, name);
+
+    // Add the catalog line unless a previous attempt already did
+    TxSegment *listed;
+    size_t count = read_catalog(&listed);
+    bool in_catalog = count > 0 && listed[count - 1].first_id == seg->first_id;
+    free(listed);
+
+    if (!in_catalog) {
+        FILE *fp = fopen(TXLOG_CATALOG, "a");
+        if (fp == NULL) {
+            return false;
+        }
+        fprintf(fp, "%s %lld %lld %llu %llu %llu\n", name,
+                (long long)seg->first_ts, (long long)seg->last_ts,
+                (unsigned long long)seg->first_id, (unsigned long long)seg->last_id,
+                (unsigned long long)seg->count);
+        if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+            fclose(fp);
+            return false;
+        }
+        fclose(fp);
+    }
+
+    if (rename(TXLOG_ACTIVE, path) != 0) {
+        return false;
+    }
+    memcpy(closed, path, sizeof(path));
+    return true;
+}
+
+/* Compress a closed segment in the background
+   gzip is started without a shell, from a child that exits at once (so
+   nobody has to wait for gzip), with every other file of this program
+   closed: it never holds one of our locks while it runs */
+static void compress_segment(const char *path) {
+    pid_t child = fork();
+    if (child == 0) {
+        if (fork() == 0) {
+            int null_fd = open("/dev/null", O_RDWR);
+            if (null_fd >= 0) {
+                dup2(null_fd, STDOUT_FILENO);
+                dup2(null_fd, STDERR_FILENO);
+            }
+#ifdef SYS_close_range
+            if (syscall(SYS_close_range, 3, ~0U, 0) != 0)
+#endif
+            {
+                for (int fd = 3; fd < 65536; fd++) {
+                    close(fd);
+                }
+            }
+            execlp("gzip", "gzip", "-q", path, (char *)NULL);
+            _exit(127);
+        }
+        _exit(0);
+    }
+    if (child < 0 || waitpid(child, NULL, 0) != child) {
+        fprintf(stderr, "Warning: Could not start compressing %s\n", path);
+    }
+}
+
+/* Close the active segment: write its footer, then finish the rotation */
+static bool rotate(int fd, const TxSegment *seg, char *closed) {
+    TxFooter footer;
+    memset(&footer, 0, sizeof(footer));
+    footer.magic = TXLOG_FOOTER_MAGIC;
+    footer.first_ts = seg->first_ts;
+    footer.last_ts = seg->last_ts;
+    footer.first_id = seg->first_id;
+    footer.last_id = seg->last_id;
+    footer.count = seg->count;
+    footer.checksum = crc32c(0, &footer, offsetof(TxFooter, checksum));
+
+    if (write(fd, &footer, sizeof(footer)) != sizeof(footer) || fsync(fd) != 0) {
+        return false;
+    }
+    return finish_rotation(seg, closed);
+}
+
+/* Open the active segment for appending, closing it first if it is full,
+   too old, or was left half closed by a crash ("closed" then gets the path
+   of the closed segment, else "")
+
+   Also moves a log from before segments existed (TXLOG_FILE) into place
+ */
+static int open_active(TxSegment *seg, char *closed) {
+    closed[0] = '\0';
+    if (access(TXLOG_ACTIVE, F_OK) != 0 && access(TXLOG_FILE, F_OK) == 0) {
+        rename(TXLOG_FILE, TXLOG_ACTIVE);
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int fd = open(TXLOG_ACTIVE, O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) {
+            return -1;
+        }
+
+        // A crash can leave a partial record at the end; cut it off
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size % RECORD_SIZE != 0 &&
+            ftruncate(fd, st.st_size - st.st_size % RECORD_SIZE) != 0) {
+            close(fd);
+            return -1;
+        }
+
+        bool has_footer;
+        describe_file(fd, seg, &has_footer);
+        bool full = (off_t)(seg->count * sizeof(TxRecord)) >= TXLOG_SEGMENT_BYTES;
+        bool old = seg->count > 0 && (int64_t)time(NULL) - seg->first_ts >= TXLOG_SEGMENT_SECS;
+
+        if (seg->count > 0 && (has_footer || full || old)) {
+            bool done = has_footer ? finish_rotation(seg, closed) : rotate(fd, seg, closed);
+            close(fd);
+            if (!done) {
+                return -1;
+            }
+            continue;  // Open the new (empty) active segment
+        }
+        return fd;
+    }
+    return -1;
+}
+
+/* Work out the next transaction ID
+   From the last record of the active segment, or from the catalog when the
+   active segment has no valid record (plus one ID for every damaged
+   record it holds) */
+static uint64_t next_txn_id(const TxSegment *active) {
+    if (active->last_id > 0) {
+        return active->last_id + 1;
+    }
+    TxSegment *listed;
+    size_t count = read_catalog(&listed);
+    uint64_t next = count > 0 ? listed[count - 1].last_id + 1 : 1;
+    free(listed);
+    return next + active->count;
+}
+
+/* Txlog append function
+   Purpose: Record one operation in the log
+
+   Parameters:
+   - op: What happened (deposit, withdrawal, ...)
+   - from_id, to_id: Account numbers involved (0 if not used)
+   - amount_cents, fee_cents: Money moved and fee charged
+   - status: TXSTATUS_OK or TXSTATUS_FAILED
+
+   Returns: The transaction ID of the new record, or 0 if it failed
+ */
+uint64_t txlog_append(TxOp op, uint32_t from_id, uint32_t to_id,
+                      int64_t amount_cents, int64_t fee_cents, TxStatus status) {
+    TxRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.op = (uint8_t)op;
+    rec.status = (uint8_t)status;
+    rec.from_id = from_id;
+    rec.to_id = to_id;
+    rec.amount_cents = amount_cents;
+    rec.fee_cents = fee_cents;
+    return txlog_append_batch(&rec, 1);
+}
+
+// The work of txlog_append_batch() (below), outside its trace span
+static uint64_t append_records(TxRecord *recs, size_t count) {
+    int lock = lock_log(LOCK_EX);
+    TxSegment active;
+    char closed[128];
+    int fd = lock >= 0 ? open_active(&active, closed) : -1;
+    if (fd < 0) {
+        unlock_log(lock);
+        fprintf(stderr, "Warning: Could not open transaction log\n");
+        return 0;
+    }
+
+    uint64_t first_id = next_txn_id(&active);
+    int64_t now = (int64_t)time(NULL);
+    for (size_t i = 0; i < count; i++) {
+        recs[i].magic = TXLOG_MAGIC;
+        recs[i].txn_id = first_id + i;
+        recs[i].timestamp = now;
+        txlog_seal(&recs[i]);
+    }
+
+    // write() may write less than asked for large batches; keep going
+    const char *data = (const char *)recs;
+    size_t left = count * sizeof(TxRecord);
+    while (left > 0) {
+        ssize_t n = write(fd, data, left);
+        if (n <= 0) {
+            break;
+        }
+        data += n;
+        left -= (size_t)n;
+    }
+    close(fd);
+    unlock_log(lock);
+
+    // Optionally compress the segment that was closed, now that the log is free again
+    if (closed[0] != '\0' && access(TXLOG_COMPRESS_MARKER, F_OK) == 0) {
+        compress_segment(closed);
+    }
+    if (left > 0) {
+        fprintf(stderr, "Warning: Could not write to transaction log\n");
+        return 0;
+    }
+    return first_id;
+}
+
+/* Txlog append batch function
+   Purpose: Record many operations with one lock and one write
+
+   The caller fills in op, status, the accounts and the amounts of every
+   record; the magic number, transaction ID, time and checksum are filled
+   in here. The records get consecutive transaction IDs
+
+   Returns: The transaction ID of the first record, or 0 if it failed
+ */
+uint64_t txlog_append_batch(TxRecord *recs, size_t count) {
+    if (count == 0) {
+        return 0;
+    }
+    TRACE_BEGIN("txlog_append");
+    uint64_t first_id = append_records(recs, count);
+    TRACE_END("txlog_append");
+    return first_id;
+}
+
+/* Txlog segments function
+   Purpose: List every segment of the log, oldest first
+
+   The shared lock makes sure a rotation is not half done while we look
+ */
+size_t txlog_segments(TxSegment **segments) {
+    int lock = lock_log(LOCK_SH);
+    size_t count = read_catalog(segments);
+
+    int fd = open(TXLOG_ACTIVE, O_RDONLY);
+    if (fd < 0) {
+        fd = open(TXLOG_FILE, O_RDONLY);  // Log from before segments existed
+    }
+    if (fd >= 0) {
+        TxSegment active;
+        bool has_footer;
+        describe_file(fd, &active, &has_footer);
+        close(fd);
+
+        TxSegment *bigger = active.count > 0 ? realloc(*segments, (count + 1) * sizeof(TxSegment)) : NULL;
+        if (bigger != NULL) {
+            *segments = bigger;
+            active.active = true;
+            snprintf(active.path, sizeof(active.path), "%s",
+                     access(TXLOG_ACTIVE, F_OK) == 0 ? TXLOG_ACTIVE : TXLOG_FILE);
+            (*segments)[count++] = active;
+        }
+    }
+
+    unlock_log(lock);
+    return count;
+}
+
+/* Unpack a gzip-compressed segment into memory */
+static bool read_compressed(const char *path, TxLogView *view) {
+    char command[300];
+    snprintf(command, sizeof(command), "gzip -dc '%s'", path);
+    FILE *pipe = popen(command, "r");
+    if (pipe == NULL) {
+        return false;
+    }
+
+    size_t size = 0, capacity = 1 << 20;
+    char *data = malloc(capacity);
+    size_t got;
+    while (data != NULL && (got = fread(data + size, 1, capacity - size, pipe)) > 0) {
+        size += got;
+        if (size == capacity) {
+            char *bigger = realloc(data, capacity * 2);
+            if (bigger == NULL) {
+                free(data);
+                data = NULL;
+                break;
+            }
+            data = bigger;
+            capacity *= 2;
+        }
+    }
+    if (pclose(pipe) != 0 || data == NULL) {
+        free(data);
+        return false;
+    }
+
+    view->records = (const TxRecord *)data;
+    view->count = size / sizeof(TxRecord);
+    view->map_size = size;
+    view->owned = true;
+    return true;
+}
+
+/* Txlog map segment function
+   Purpose: Make the records of a segment readable like an array
+   (view->records[0] ... view->records[view->count - 1])
+
+   A closed segment may have been compressed in the meantime, so the .gz
+   file is tried when the plain one is gone. The footer is not included
+ */
+bool txlog_map_segment(const TxSegment *segment, TxLogView *view) {
+    view->records = NULL;
+    view->count = 0;
+    view->map_size = 0;
+    view->owned = false;
+
+    int fd = open(segment->path, O_RDONLY);
+    if (fd < 0) {
+        char gz_path[150];
+        snprintf(gz_path, sizeof(gz_path), "%s.gz", segment->path);
+        if (!read_compressed(gz_path, view)) {
+            return false;
+        }
+    } else {
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            return false;
+        }
+        size_t count = (size_t)st.st_size / sizeof(TxRecord);
+        if (count > 0) {
+            void *p = mmap(NULL, count * sizeof(TxRecord), PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                close(fd);
+                return false;
+            }
+            // Segments are read from start to end, so tell the kernel to read ahead
+            madvise(p, count * sizeof(TxRecord), MADV_SEQUENTIAL);
+            view->records = p;
+            view->count = count;
+            view->map_size = count * sizeof(TxRecord);
+        }
+        close(fd);
+    }
+
+    if (view->count > 0 && view->records[view->count - 1].magic == TXLOG_FOOTER_MAGIC) {
+        view->count--;
+    }
+    return true;
+}
+
+void txlog_unmap(TxLogView *view) {
+    if (view->records != NULL) {
+        if (view->owned) {
+            free((void *)view->records);
+        } else {
+            munmap((void *)view->records, view->map_size);
+        }
+    }
+    view->records = NULL;
+    view->count = 0;
+}
+
+/* Find a record by its ID in a mapped segment: the IDs of the valid
+   records increase through a segment, so a binary search finds it,
+   stepping over damaged records
+   Returns: its position, or -1 if it is not there */
+static long find_in_view(const TxLogView *view, uint64_t txn_id) {
+    size_t low = 0, high = view->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        size_t probe = mid;
+        while (probe < high && !txlog_record_valid(&view->records[probe])) {
+            probe++;
+        }
+        if (probe == high) {
+            high = mid;   // Only damaged records from mid on
+            continue;
+        }
+        uint64_t id = view->records[probe].txn_id;
+        if (id == txn_id) {
+            return (long)probe;
+        }
+        if (id < txn_id) {
+            low = probe + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return -1;
+}
+
+/* Txlog find function
+   Purpose: Fetch one transaction by its ID without scanning the log
+
+   1. Binary search the segment list (sorted by first transaction ID)
+   2. Read the record at the offset its ID gives (IDs go up by one per
+      record); that is the right one unless damaged records came before
+      the segment's first valid record
+   3. Otherwise binary search the segment by transaction ID (a compressed
+      segment always takes this way, after it has been unpacked)
+ */
+bool txlog_find(uint64_t txn_id, TxRecord *out) {
+    TxSegment *segments;
+    size_t count = txlog_segments(&segments);
+
+    // STEP 1: Last segment that starts at or before txn_id
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (segments[mid].first_id <= txn_id) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low == 0 || txn_id > segments[low - 1].last_id) {
+        free(segments);
+        return false;
+    }
+    TxSegment *segment = &segments[low - 1];
+    uint64_t index = txn_id - segment->first_id;
+
+    // STEP 2: The record at its offset
+    bool found = false;
+    int fd = open(segment->path, O_RDONLY);
+    if (fd >= 0) {
+        found = pread(fd, out, sizeof(*out), (off_t)(index * sizeof(TxRecord))) == sizeof(*out) &&
+                txlog_record_valid(out) && out->txn_id == txn_id;
+        close(fd);
+    }
+
+    // STEP 3: Search the segment by ID
+    TxLogView view;
+    if (!found && txlog_map_segment(segment, &view)) {
+        long position = find_in_view(&view, txn_id);
+        if (position >= 0) {
+            *out = view.records[position];
+            found = true;
+        }
+        txlog_unmap(&view);
+    }
+    free(segments);
+    return found;
+}
+
+/* Txlog query function
+   Purpose: Visit the records of a time range
+
+   How it works:
+   1. Skip every segment whose time range does not overlap (no file is opened)
+   2. Records are in time order, so a binary search finds the first record
+      of the range inside a segment
+   3. Visit records until the end of the range
+ */
+long txlog_query(int64_t from_ts, int64_t to_ts, TxVisitFn fn, void *ctx) {
+    TxSegment *segments;
+    size_t count = txlog_segments(&segments);
+    long visited = 0;
+
+    for (size_t s = 0; s < count; s++) {
+        if (segments[s].last_ts < from_ts || segments[s].first_ts > to_ts) {
+            continue;
+        }
+        TxLogView view;
+        if (!txlog_map_segment(&segments[s], &view)) {
+            continue;
+        }
+
+        size_t low = 0, high = view.count;
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            if (view.records[mid].timestamp < from_ts) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+
+        bool keep_going = true;
+        for (size_t i = low; i < view.count && keep_going; i++) {
+            const TxRecord *rec = &view.records[i];
+            if (!txlog_record_valid(rec)) {
+                continue;
+            }
+            if (rec->timestamp > to_ts) {
+                break;
+            }
+            visited++;
+            keep_going = fn(rec, ctx);
+        }
+        txlog_unmap(&view);
+        if (!keep_going) {
+            break;
+        }
+    }
+
+    free(segments);
+    return visited;
+}
+
+/* Txlog query after function
+   Purpose: Visit the records that follow a known transaction, up to a time
+
+   Used to bring a balance snapshot forward: the snapshot says which
+   transaction it includes last, so only newer records are needed
+   1. Skip every segment that ends at or before after_id, and stop at the
+      first segment that starts after to_ts
+   2. Transaction IDs increase inside a segment, so a binary search finds
+      the first record after after_id
+   3. Visit records until one is newer than to_ts
+ */
+long txlog_query_after(uint64_t after_id, int64_t to_ts, TxVisitFn fn, void *ctx) {
+    TxSegment *segments;
+    size_t count = txlog_segments(&segments);
+    long visited = 0;
+
+    for (size_t s = 0; s < count; s++) {
+        if (segments[s].count == 0 || segments[s].last_id <= after_id) {
+            continue;
+        }
+        if (segments[s].first_ts > to_ts) {
+            break;
+        }
+        TxLogView view;
+        if (!txlog_map_segment(&segments[s], &view)) {
+            continue;
+        }
+
+        size_t low = 0, high = view.count;
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            if (view.records[mid].txn_id <= after_id) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+
+        bool keep_going = true;
+        bool past_end = false;
+        for (size_t i = low; i < view.count && keep_going; i++) {
+            const TxRecord *rec = &view.records[i];
+            if (!txlog_record_valid(rec)) {
+                continue;
+            }
+            if (rec->timestamp > to_ts) {
+                past_end = true;
+                break;
+            }
+            visited++;
+            keep_going = fn(rec, ctx);
+        }
+        txlog_unmap(&view);
+        if (!keep_going || past_end) {
+            break;
+        }
+    }
+
+    free(segments);
+    return visited;
+}
+
+void txlog_format_time(const TxRecord *rec, char *buf, size_t size) {
+    time_t when = (time_t)rec->timestamp;
+    struct tm *t = localtime(&when);
+    snprintf(buf, size, "[%04d-%02d-%02d %02d:%02d:%02d]",
+             t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
+             t->tm_hour, t->tm_min, t->tm_sec);
+}
+
+/* Txlog describe function
+   Purpose: Write a record in the same words the text log used
+ */
+void txlog_describe(const TxRecord *rec, char *buf, size_t size) {
+    switch (rec->op) {
+        case TXOP_CREATE:
+            snprintf(buf, size, "Created account %u", rec->to_id);
+            break;
+        case TXOP_DELETE:
+            snprintf(buf, size, "Deleted account %u", rec->from_id);
+            if (rec->amount_cents != 0) {
+                size_t len = strlen(buf);
+                snprintf(buf + len, size - len, ", Closing balance: RM%.2f",
+                         rec->amount_cents / 100.0);
+            }
+            break;
+        case TXOP_DEPOSIT:
+            snprintf(buf, size, "Deposit: Account %u, Amount: RM%.2f",
+                     rec->to_id, rec->amount_cents / 100.0);
+            break;
+        case TXOP_WITHDRAW:
+            snprintf(buf, size, "Withdrawal: Account %u, Amount: RM%.2f",
+                     rec->from_id, rec->amount_cents / 100.0);
+            break;
+        case TXOP_REMIT:
+            snprintf(buf, size, "Remittance: From %u to %u, Amount: RM%.2f, Fee: RM%.2f",
+                     rec->from_id, rec->to_id, rec->amount_cents / 100.0, rec->fee_cents / 100.0);
+            break;
+        case TXOP_SESSION_END:
+            snprintf(buf, size, "User exited the system");
+            break;
+        case TXOP_FEE_INCOME:
+            snprintf(buf, size, "Fee income: Account %u, Amount: RM%.2f",
+                     rec->to_id, rec->amount_cents / 100.0);
+            break;
+        case TXOP_REVERSAL:
+            snprintf(buf, size, "Reversal of transaction %llu: From %u to %u, Amount: RM%.2f",
+                     (unsigned long long)rec->ref_id, rec->from_id, rec->to_id,
+                     rec->amount_cents / 100.0);
+            if (rec->fee_cents != 0) {
+                size_t len = strlen(buf);
+                snprintf(buf + len, size - len, ", Fee refunded: RM%.2f", rec->fee_cents / 100.0);
+            }
+            break;
+        default:
+            snprintf(buf, size, "Unknown operation %u", rec->op);
+            break;
+    }
+
+    size_t len = strlen(buf);
+    if (rec->order_id != 0) {
+        snprintf(buf + len, size - len, " (standing order %u)", rec->order_id);
+        len = strlen(buf);
+    }
+    if (rec->status != TXSTATUS_OK) {
+        snprintf(buf + len, size - len, " [FAILED]");
+    }
+}
@@ -1,10 +1,10 @@
 /* This file contains helper functions that are used throughout the banking system.
    
    Main categories:
-   1. Input Functions - Get data from users safely
-   2. Validation Functions - Check if data is valid
-   3. File System Functions - Create directories
-   4. Logging Functions - Record system activities
+   1. Output Functions - Show prompts and messages
+   2. Input Functions - Get data from users safely
+   3. Validation Functions - Check if data is valid
+   4. File System Functions - Create directories
    5. Conversion Functions - Convert between data formats
  */
 
@@ -12,11 +12,55 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <ctype.h>
 #include <time.h>
 #include <errno.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
 
 
+// The buffer this thread's messages go to (NULL for stdout)
+static __thread MessageBuffer *message_buffer = NULL;
+
+void set_message_buffer(MessageBuffer *buffer) {
+    message_buffer = buffer;
+}
+
+/* Print message function
+   Purpose: Show a prompt or a message to the person being served
+
+   With no message buffer it is printf(). A session (see session.h)
+   sets its buffer first, and the text is added to it instead; text
+   that does not fit is cut off (the dialogues check message_room()
+   before printing something long, like the list of accounts)
+ */
+void print_message(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (message_buffer == NULL) {
+        vprintf(format, args);
+    } else if (message_buffer->length < message_buffer->size) {
+        size_t room = message_buffer->size - message_buffer->length;
+        int n = vsnprintf(message_buffer->text + message_buffer->length, room, format, args);
+        if (n > 0) {
+            message_buffer->length += (size_t)n < room ? (size_t)n : room - 1;
+        }
+    }
+    va_end(args);
+}
+
+size_t message_room(void) {
+    if (message_buffer == NULL) {
+        return SIZE_MAX;
+    }
+    return message_buffer->size - message_buffer->length;
+}
+
 /* Clear input buffer function
    Purpose: Remove any remaining characters from the input stream
    
@@ -184,24 +228,24 @@ bool is_valid_pin(const char *pin) {
  */
 bool is_valid_amount(double amount, double max) {
     if (amount <= 0) {
-        printf("Error: Amount must be greater than RM0.\n");
+        print_message("Error: Amount must be greater than RM0.\n");
         return false;
     }
     
     if (amount > max) {
-        printf("Error: Amount cannot exceed RM%.2f per operation.\n", max);
+        print_message("Error: Amount cannot exceed RM%.2f per operation.\n", max);
         return false;
     }
     
     if (amount > 999999999.99) {
-        printf("Error: Amount is too large.\n");
+        print_message("Error: Amount is too large.\n");
         return false;
     }
     
     // Check decimal places (money can only have 2 decimal places)
     double cents = amount * 100;
     if (cents != (long long)cents) {
-        printf("Error: Amount cannot have more than 2 decimal places.\n");
+        print_message("Error: Amount cannot have more than 2 decimal places.\n");
         return false;
     }
     
@@ -224,14 +268,14 @@ bool is_valid_amount(double amount, double max) {
  */
 bool is_valid_name(const char *name) {
     if (strlen(name) < 2) {
-        printf("Error: Name must be at least 2 characters long.\n");
+        print_message("Error: Name must be at least 2 characters long.\n");
         return false;
     }
     
     // Check each character
     for (size_t i = 0; i < strlen(name); i++) {
         if (!isalpha(name[i]) && name[i] != ' ' && name[i] != '.' && name[i] != '-') {
-            printf("Error: Name can only contain letters, spaces, hyphens, and periods.\n");
+            print_message("Error: Name can only contain letters, spaces, hyphens, and periods.\n");
             return false;
         }
     }
@@ -254,14 +298,14 @@ bool is_valid_name(const char *name) {
  */
 bool is_valid_id(const char *id) {
     if (strlen(id) < 3) {
-        printf("Error: ID must be at least 3 characters long.\n");
+        print_message("Error: ID must be at least 3 characters long.\n");
         return false;
     }
     
     // Verify each character
     for (size_t i = 0; i < strlen(id); i++) {
         if (!isalnum(id[i]) && id[i] != '-' && id[i] != '_') {
-            printf("Error: ID can only contain letters, numbers, hyphens, and underscores.\n");
+            print_message("Error: ID can only contain letters, numbers, hyphens, and underscores.\n");
             return false;
         }
     }
@@ -274,54 +318,21 @@ bool is_valid_id(const char *id) {
    Purpose: Create the database folder if it doesn't exist already
    
    How it works:
-     The "mkdir" command is used on Windows
-     The "mkdir -p" command is used on Unix/Mac (p flag creates parent directories)
+     The folder is made with the mkdir() system call (an existing folder
+     is not an error). Running the "mkdir" command through a shell took
+     longer than a whole command-line deposit (see cli.h)
    
    All account files are kept in this folder
  */
 void create_database_dir(void) {
     #ifdef _WIN32
-        system("if not exist database mkdir database");  
+        _mkdir(DATABASE_DIR);
     #else
-        system("mkdir -p database"); 
+        mkdir(DATABASE_DIR, 0755);
     #endif
 }
 
 
-/* 
-   Log transaction function
-   Purpose: Record a transaction event in the log file
-   
-   Parameters:
-   - action: Description of what happened (exp. "Deposit: Account 12345")
-   
-   How it works:
-   1. Use append mode to open the log file (adds to end)
-   2. Obtain the current time and date
-   3. Write timestamp and add the action to the log file
-   4. Close the file
-
-   An audit trail of all system operations is produced as a result
- */
-void log_transaction(const char *action) {
-    FILE *fp = fopen(TRANSACTION_LOG, "a");  
-    if (fp == NULL) {
-        fprintf(stderr, "Warning: Could not open transaction log\n");
-        return;
-    }
-    
-    // Get the current date and time 
-    time_t now = time(NULL);
-    struct tm *t = localtime(&now);
-    
-    // Write timestamp and action it to the log file 
-    fprintf(fp, "[%04d-%02d-%02d %02d:%02d:%02d] %s\n",
-            t->tm_year + 1900, t->tm_mon + 1, t->tm_mday,
-            t->tm_hour, t->tm_min, t->tm_sec, action);
-    
-    fclose(fp);
-}
-
 /* Account type to string function
    Purpose: Convert AccountType enum to a text
    
@@ -375,3 +386,72 @@ AccountType string_to_account_type(const char *str) {
     }
     return CURRENT;  
 }
+
+/* Account ID from string function
+   Purpose: Convert an account number (text) into a number
+   
+   Parameters:
+     account_num: The account number as text (exp. "12345678")
+   
+   Returns: The account number as an unsigned number, or 0 if the text
+            is not a valid 7-9 digit account number
+   
+   Why we need this:
+   Numbers are much smaller and faster to compare than strings, so the
+   in-memory tables (such as the limits engine) are keyed by this number
+ */
+unsigned int account_id_from_string(const char *account_num) {
+    size_t len = strlen(account_num);
+    if (len < 7 || len > 9) {
+        return 0;
+    }
+    
+    unsigned long id = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (!isdigit((unsigned char)account_num[i])) {
+            return 0;
+        }
+        id = id * 10 + (unsigned long)(account_num[i] - '0');
+    }
+    
+    if (id < MIN_ACCOUNT_NUM || id > MAX_ACCOUNT_NUM) {
+        return 0;
+    }
+    return (unsigned int)id;
+}
+
+/* Amount to cents function
+   Purpose: Convert a money amount (double) into whole cents
+   
+   Example:
+     12.34 → 1234
+     0.1 + 0.2 → 30 (rounding hides the floating point error)
+ */
+long long amount_to_cents(double amount) {
+    return (long long)(amount * 100.0 + (amount >= 0 ? 0.5 : -0.5));
+}
+
+/* Parse date time function
+   Purpose: Read a local date and time typed by a person
+
+   Accepted: "2024-01-31", "2024-01-31 14:03" and "2024-01-31 14:03:59"
+   (a missing time is midnight, missing seconds are 0)
+ */
+bool parse_date_time(const char *text, int64_t *out) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    int n = sscanf(text, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                   &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    if (n != 3 && n != 5 && n != 6) {
+        return false;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    time_t t = mktime(&tm);
+    if (t == (time_t)-1) {
+        return false;
+    }
+    *out = (int64_t)t;
+    return true;
+}
@@ -0,0 +1,753 @@
+/* This file is the velocity and daily limit engine
+   It keeps track of how much money (and how many operations) moved through
+   each account recently, so that deposit(), withdraw() and remittance()
+   can refuse an operation that would go over the limit for the account type
+
+   Main parts:
+   1. Limits table - one limit per (account type, operation, window)
+   2. Counter table - a small hash table with one entry per active account
+   3. Sliding windows - every counter covers the last minute/hour/day
+   4. Checkpoints - the counter table is saved to VELOCITY_FILE periodically
+
+   The checkpoint file is the counter table itself: a header, then every
+   slot of the hash table at its own position (empty slots are zeros and
+   whole chunks of them are left as holes). A program that moves money
+   for one account finds that account's counters with one or two reads
+   at the slot its id hashes to, instead of reading the whole file.
+
+   Several programs save into the same file, so a checkpoint never writes
+   its counters over the file's: every program also keeps what it counted
+   since its last checkpoint (the pending table), and under the file's
+   lock adds that to what the file holds for the account
+ */
+
+#include "velocity.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+
+/* Sliding window counter
+   Purpose: Count operations and money inside the last "window length" seconds
+
+   How it works:
+   Time is cut into fixed windows (exp. hours 10:00-11:00, 11:00-12:00).
+   We keep the totals for the current window and the one before it.
+   The sliding total is the current window plus the part of the previous
+   window that is still inside the last hour:
+
+     estimate = current + previous * (time left of the previous window)
+
+   This needs only 32 bytes per counter, and is always O(1)
+ */
+typedef struct {
+    unsigned int window_index;   // Which fixed window "current" belongs to
+    unsigned int cur_count;
+    unsigned int prev_count;
+    unsigned int reserved;
+    long long cur_cents;
+    long long prev_cents;
+} VelocityCounter;
+
+// One entry per account: every (operation, window) pair has its own counter
+typedef struct {
+    unsigned int account_id;     // 0 means the slot is empty
+    unsigned int reserved;
+    VelocityCounter counters[VEL_OP_COUNT][VEL_WINDOW_COUNT];
+} VelocityEntry;
+
+// Length of each window in seconds
+static const long window_seconds[VEL_WINDOW_COUNT] = { 60, 3600, 86400 };
+
+static const char *op_names[VEL_OP_COUNT] = { "deposit", "withdraw", "remit" };
+static const char *window_names[VEL_WINDOW_COUNT] = { "minute", "hour", "day" };
+static const char *type_names[ACCOUNT_TYPE_COUNT] = { "savings", "current" };
+
+/* Limits of every account type (0 means no limit)
+   [account type][operation][window] = { max operations, max cents }
+   There are none until LIMITS_CONFIG sets them
+ */
+static VelocityLimit limits[ACCOUNT_TYPE_COUNT][VEL_OP_COUNT][VEL_WINDOW_COUNT];
+
+// An open addressing hash table of entries keyed by account id
+typedef struct {
+    VelocityEntry *entries;
+    size_t capacity;   // Always a power of two
+    size_t used;
+} CounterTable;
+
+/* The counters (everything this program knows), and the operations it
+   counted since its last checkpoint (added to the file at the next one) */
+static CounterTable table;
+static CounterTable pending;
+
+// Checkpoint bookkeeping
+static int ops_since_checkpoint = 0;
+static time_t last_checkpoint = 0;
+
+// VELOCITY_LOCK, while velocity_init_for() holds accounts (-1 otherwise)
+static int counted_lock_fd = -1;
+
+// Checkpoint entries read or written at once
+#define CHECKPOINT_CHUNK 256
+
+#define VELOCITY_MAGIC 0x324C4556u   /* "VEL2": the file is the hash table */
+
+// Header of a checkpoint
+typedef struct {
+    unsigned int magic;
+    unsigned int capacity;   // Slots in the file (a power of two)
+    unsigned int used;       // Slots that hold an account
+    unsigned int reserved;
+} CheckpointHeader;
+
+// Position of slot i in a checkpoint
+#define SLOT_OFFSET(i) ((off_t)sizeof(CheckpointHeader) + (off_t)(i) * (off_t)sizeof(VelocityEntry))
+
+
+/* Hash function for account ids
+   Mixes the bits so that account numbers that are close together
+   end up in different slots of the table
+ */
+static size_t hash_id(unsigned int id) {
+    unsigned int h = id * 2654435761u;
+    return (size_t)(h ^ (h >> 16));
+}
+
+/* Find the entry of an account
+   Parameters:
+     t - the table to look in
+     id - account id to look for
+     create - if true, add a new empty entry when the account is missing
+
+   Returns: A pointer to the entry, or NULL if it is missing (and create is false)
+ */
+static VelocityEntry *find_entry(CounterTable *t, unsigned int id, bool create);
+
+/* Make a table bigger (twice the size) and put every entry in its new slot */
+static bool grow_table(CounterTable *t) {
+    size_t new_capacity = t->capacity ? t->capacity * 2 : 1024;
+    VelocityEntry *old_entries = t->entries;
+    size_t old_capacity = t->capacity;
+
+    t->entries = calloc(new_capacity, sizeof(VelocityEntry));
+    if (t->entries == NULL) {
+        t->entries = old_entries;
+        return false;
+    }
+    t->capacity = new_capacity;
+    t->used = 0;
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_entries[i].account_id != 0) {
+            VelocityEntry *e = find_entry(t, old_entries[i].account_id, true);
+            *e = old_entries[i];
+        }
+    }
+    free(old_entries);
+    return true;
+}
+
+static VelocityEntry *find_entry(CounterTable *t, unsigned int id, bool create) {
+    // Keep the table at most 70% full so probing stays short
+    if (create && (t->used + 1) * 10 > t->capacity * 7) {
+        if (!grow_table(t)) {
+            return NULL;
+        }
+    }
+    if (t->capacity == 0) {
+        return NULL;
+    }
+
+    size_t mask = t->capacity - 1;
+    size_t i = hash_id(id) & mask;
+    while (t->entries[i].account_id != 0) {
+        if (t->entries[i].account_id == id) {
+            return &t->entries[i];
+        }
+        i = (i + 1) & mask;
+    }
+
+    if (!create) {
+        return NULL;
+    }
+    memset(&t->entries[i], 0, sizeof(VelocityEntry));
+    t->entries[i].account_id = id;
+    t->used++;
+    return &t->entries[i];
+}
+
+// Empty a table (the memory is kept)
+static void clear_table(CounterTable *t) {
+    if (t->entries != NULL) {
+        memset(t->entries, 0, t->capacity * sizeof(VelocityEntry));
+    }
+    t->used = 0;
+}
+
+static void free_table(CounterTable *t) {
+    free(t->entries);
+    t->entries = NULL;
+    t->capacity = 0;
+    t->used = 0;
+}
+
+/* Move a counter forward to the window that "now" falls into
+   If one window passed, current becomes previous
+   If more than one window passed, both are reset to zero
+ */
+static void roll_counter(VelocityCounter *c, long length, time_t now) {
+    unsigned int index = (unsigned int)(now / length);
+    if (c->window_index == index) {
+        return;
+    }
+    if (c->window_index + 1 == index) {
+        c->prev_count = c->cur_count;
+        c->prev_cents = c->cur_cents;
+    } else {
+        c->prev_count = 0;
+        c->prev_cents = 0;
+    }
+    c->cur_count = 0;
+    c->cur_cents = 0;
+    c->window_index = index;
+}
+
+/* Work out the sliding totals of a counter (see VelocityCounter above)
+   The counter is read only, so checking never changes the table
+ */
+static void estimate_counter(const VelocityCounter *c, long length, time_t now,
+                             double *count, double *cents) {
+    unsigned int index = (unsigned int)(now / length);
+    double weight = 1.0 - (double)(now % length) / (double)length;
+
+    if (c->window_index == index) {
+        *count = c->cur_count + c->prev_count * weight;
+        *cents = c->cur_cents + c->prev_cents * weight;
+    } else if (c->window_index + 1 == index) {
+        *count = c->cur_count * weight;
+        *cents = c->cur_cents * weight;
+    } else {
+        *count = 0;
+        *cents = 0;
+    }
+}
+
+/* Add the operations counted since the last checkpoint to the counters
+   of the file: both are moved to the current windows first, so the
+   totals of the same windows are added together */
+static void add_pending(VelocityEntry *saved, const VelocityEntry *counted, time_t now) {
+    for (int op = 0; op < VEL_OP_COUNT; op++) {
+        for (int w = 0; w < VEL_WINDOW_COUNT; w++) {
+            VelocityCounter *c = &saved->counters[op][w];
+            VelocityCounter extra = counted->counters[op][w];
+            roll_counter(c, window_seconds[w], now);
+            roll_counter(&extra, window_seconds[w], now);
+            c->cur_count += extra.cur_count;
+            c->prev_count += extra.prev_count;
+            c->cur_cents += extra.cur_cents;
+            c->prev_cents += extra.prev_cents;
+        }
+    }
+}
+
+/* Open VELOCITY_FILE and lock it (flock)
+   A checkpoint that grows the file replaces it with rename(), so once
+   the lock is held the file is checked to still be the one called
+   VELOCITY_FILE
+   Returns: The locked descriptor, or -1 */
+static int lock_checkpoint_file(bool create) {
+    for (int tries = 0; tries < 8; tries++) {
+        int fd = open(VELOCITY_FILE, O_RDWR | (create ? O_CREAT : 0), 0644);
+        if (fd < 0) {
+            return -1;
+        }
+        struct stat held, named;
+        if (flock(fd, LOCK_EX) == 0 && fstat(fd, &held) == 0 && stat(VELOCITY_FILE, &named) == 0 &&
+            held.st_ino == named.st_ino && held.st_dev == named.st_dev) {
+            return fd;
+        }
+        close(fd);
+    }
+    return -1;
+}
+
+/* Read a checkpoint header
+   Returns: false if the file is empty or not a checkpoint */
+static bool read_header(int fd, CheckpointHeader *h) {
+    memset(h, 0, sizeof(*h));
+    return pread(fd, h, sizeof(*h), 0) == (ssize_t)sizeof(*h) && h->magic == VELOCITY_MAGIC &&
+           h->capacity > 0 && (h->capacity & (h->capacity - 1)) == 0;
+}
+
+/* Call visit() for every entry of a checkpoint, in chunks
+   Returns: false if the file could not be read to the end */
+static bool read_all_entries(int fd, const CheckpointHeader *h, void (*visit)(const VelocityEntry *)) {
+    VelocityEntry chunk[CHECKPOINT_CHUNK];
+    for (unsigned int first = 0; first < h->capacity; first += CHECKPOINT_CHUNK) {
+        unsigned int n = h->capacity - first < CHECKPOINT_CHUNK ? h->capacity - first : CHECKPOINT_CHUNK;
+        if (pread(fd, chunk, n * sizeof(VelocityEntry), SLOT_OFFSET(first)) !=
+            (ssize_t)(n * sizeof(VelocityEntry))) {
+            return false;
+        }
+        for (unsigned int i = 0; i < n; i++) {
+            if (chunk[i].account_id != 0) {
+                visit(&chunk[i]);
+            }
+        }
+    }
+    return true;
+}
+
+/* Find the slot of an account in a checkpoint
+   Returns: The slot holding it, or the empty slot it would go into
+   (*found tells which), or -1 if the file could not be read */
+static long find_slot(int fd, const CheckpointHeader *h, unsigned int id, VelocityEntry *entry,
+                      bool *found) {
+    size_t mask = h->capacity - 1;
+    size_t i = hash_id(id) & mask;
+    for (unsigned int probes = 0; probes < h->capacity; probes++) {
+        if (pread(fd, entry, sizeof(*entry), SLOT_OFFSET(i)) != (ssize_t)sizeof(*entry)) {
+            return -1;
+        }
+        if (entry->account_id == id || entry->account_id == 0) {
+            *found = entry->account_id == id;
+            return (long)i;
+        }
+        i = (i + 1) & mask;
+    }
+    return -1;
+}
+
+/* Write the whole counter table into a new file (for a rename over
+   VELOCITY_FILE). Chunks with no account are skipped and stay holes
+   Returns: true if it was written */
+static bool write_table_file(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    CheckpointHeader header = { VELOCITY_MAGIC, (unsigned int)table.capacity,
+                                (unsigned int)table.used, 0 };
+    bool ok = pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+              ftruncate(fd, SLOT_OFFSET(table.capacity)) == 0;
+    for (size_t first = 0; ok && first < table.capacity; first += CHECKPOINT_CHUNK) {
+        size_t n = table.capacity - first < CHECKPOINT_CHUNK ? table.capacity - first : CHECKPOINT_CHUNK;
+        bool any = false;
+        for (size_t i = first; i < first + n && !any; i++) {
+            any = table.entries[i].account_id != 0;
+        }
+        if (any) {
+            size_t bytes = n * sizeof(VelocityEntry);
+            ok = pwrite(fd, &table.entries[first], bytes, SLOT_OFFSET(first)) == (ssize_t)bytes;
+        }
+    }
+    ok = close(fd) == 0 && ok;
+    if (!ok) {
+        remove(path);
+    }
+    return ok;
+}
+
+// Time of the checkpoint that is being merged (for merge_entry())
+static time_t merge_time;
+
+/* Take an entry of the file into the table, plus what this program
+   counted for the account since its last checkpoint */
+static void merge_entry(const VelocityEntry *entry) {
+    VelocityEntry merged = *entry;
+    const VelocityEntry *counted = find_entry(&pending, entry->account_id, false);
+    if (counted != NULL) {
+        add_pending(&merged, counted, merge_time);
+    }
+    VelocityEntry *e = find_entry(&table, entry->account_id, true);
+    if (e != NULL) {
+        *e = merged;
+    }
+}
+
+/* Checkpoint function
+   Purpose: Save what this program counted into VELOCITY_FILE
+
+   Everything happens under the file's lock, so the counters that other
+   programs saved are kept and added to:
+   - Usually each account of the pending table is read from its slot of
+     the file, gets the pending operations added, and is written back
+     into the same slot (or the empty slot it hashes to)
+   - When the file is too full for the new accounts (or is empty), all
+     its entries are merged into the table and the table is written to a
+     temporary file of this program, which is renamed over VELOCITY_FILE
+     (so a crash never leaves a half written checkpoint)
+   Either way the table then holds the merged counters of those accounts
+ */
+static void velocity_checkpoint(void) {
+    int fd = lock_checkpoint_file(true);
+    if (fd < 0) {
+        fprintf(stderr, "Warning: Could not write velocity checkpoint\n");
+        return;
+    }
+    time_t now = time(NULL);
+    CheckpointHeader header;
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    bool empty = ok && st.st_size == 0;
+    bool valid = ok && !empty && read_header(fd, &header);
+    if (ok && !empty && !valid) {
+        ok = false;   // Not a checkpoint: leave it alone
+    }
+
+    // STEP 1: Count the accounts that are not in the file yet
+    size_t added = 0;
+    for (size_t i = 0; ok && valid && i < pending.capacity; i++) {
+        if (pending.entries[i].account_id != 0) {
+            VelocityEntry entry;
+            bool found;
+            ok = find_slot(fd, &header, pending.entries[i].account_id, &entry, &found) >= 0;
+            added += found ? 0 : 1;
+        }
+    }
+    bool in_place = valid && (header.used + added) * 10 <= (size_t)header.capacity * 7;
+
+    // STEP 2: Add them to their slots, or write the whole merged table
+    if (ok && in_place) {
+        for (size_t i = 0; ok && i < pending.capacity; i++) {
+            const VelocityEntry *counted = &pending.entries[i];
+            if (counted->account_id == 0) {
+                continue;
+            }
+            VelocityEntry entry;
+            bool found;
+            long slot = find_slot(fd, &header, counted->account_id, &entry, &found);
+            if (!found) {
+                memset(&entry, 0, sizeof(entry));
+                entry.account_id = counted->account_id;
+            }
+            add_pending(&entry, counted, now);
+            ok = slot >= 0 && pwrite(fd, &entry, sizeof(entry), SLOT_OFFSET(slot)) == sizeof(entry);
+            header.used += ok && !found ? 1 : 0;
+            VelocityEntry *e = find_entry(&table, counted->account_id, true);
+            if (ok && e != NULL) {
+                *e = entry;
+            }
+        }
+        ok = ok && pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+    } else if (ok) {
+        merge_time = now;
+        // Accounts the file does not have yet keep only what was counted here
+        for (size_t i = 0; i < pending.capacity; i++) {
+            if (pending.entries[i].account_id != 0) {
+                VelocityEntry *e = find_entry(&table, pending.entries[i].account_id, true);
+                if (e != NULL) {
+                    memset(e->counters, 0, sizeof(e->counters));
+                    add_pending(e, &pending.entries[i], now);
+                }
+            }
+        }
+        char temp_name[100];
+        snprintf(temp_name, sizeof(temp_name), "%s.%ld.tmp", VELOCITY_FILE, (long)getpid());
+        ok = (empty || read_all_entries(fd, &header, merge_entry)) && write_table_file(temp_name) &&
+             rename(temp_name, VELOCITY_FILE) == 0;
+    }
+    if (ok) {
+        clear_table(&pending);
+    } else {
+        fprintf(stderr, "Warning: Could not write velocity checkpoint\n");
+    }
+    close(fd);   // Also lets go of the lock
+
+    ops_since_checkpoint = 0;
+    last_checkpoint = now;
+}
+
+// Put an entry of the checkpoint into the table
+static void load_entry(const VelocityEntry *entry) {
+    VelocityEntry *e = find_entry(&table, entry->account_id, true);
+    if (e != NULL) {
+        *e = *entry;
+    }
+}
+
+/* Load the counters from the last checkpoint (if there is one) */
+static void load_checkpoint(void) {
+    int fd = open(VELOCITY_FILE, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    CheckpointHeader header;
+    if (!read_header(fd, &header)) {
+        fprintf(stderr, "Warning: Ignoring invalid velocity checkpoint\n");
+    } else {
+        read_all_entries(fd, &header, load_entry);
+    }
+    close(fd);
+}
+
+/* Find the index of a name inside a list of names (-1 if it is not found) */
+static int lookup_name(const char *name, const char **names, int count) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Load limits configuration function
+   Purpose: Set the limits to the values in LIMITS_CONFIG
+
+   File format (one limit per line, # starts a comment):
+     <savings|current> <deposit|withdraw|remit> <minute|hour|day> <max ops> <max RM>
+
+   Example:
+     savings withdraw day 20 10000.00
+     current remit hour 0 25000      (0 operations means no count limit)
+ */
+static void load_limits_config(void) {
+    FILE *fp = fopen(LIMITS_CONFIG, "r");
+    if (fp == NULL) {
+        return;  // No file: no limits
+    }
+
+    char line[200];
+    int line_no = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line_no++;
+        line[strcspn(line, "#\n")] = '\0';
+
+        char type_str[20], op_str[20], window_str[20];
+        unsigned int max_count;
+        double max_amount;
+        int fields = sscanf(line, "%19s %19s %19s %u %lf",
+                            type_str, op_str, window_str, &max_count, &max_amount);
+        if (fields <= 0) {
+            continue;  // Empty line or comment
+        }
+
+        // An unknown type is not guessed (a typo must not limit the wrong accounts)
+        int type = lookup_name(type_str, type_names, ACCOUNT_TYPE_COUNT);
+        if (type < 0) {
+            fprintf(stderr, "Error: %s line %d: unknown account type \"%s\" "
+                    "(savings or current); the line was ignored\n",
+                    LIMITS_CONFIG, line_no, type_str);
+            continue;
+        }
+        int op = lookup_name(op_str, op_names, VEL_OP_COUNT);
+        int window = lookup_name(window_str, window_names, VEL_WINDOW_COUNT);
+        if (fields != 5 || op < 0 || window < 0 || max_amount < 0) {
+            fprintf(stderr, "Warning: %s line %d is invalid and was ignored\n",
+                    LIMITS_CONFIG, line_no);
+            continue;
+        }
+
+        limits[type][op][window].max_count = max_count;
+        limits[type][op][window].max_cents = amount_to_cents(max_amount);
+    }
+    fclose(fp);
+}
+
+static int compare_ids(const void *a, const void *b) {
+    unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+    return (x > y) - (x < y);
+}
+
+/* Lock the counters of some accounts until velocity_shutdown()
+
+   Two programs that start at once for the same account would both load
+   its counters before either counted its operation, and both would pass
+   velocity_check(). Each account is one byte of VELOCITY_LOCK (an fcntl()
+   lock, taken in id order so two programs never wait for each other).
+   It is a file of its own because closing any descriptor of a file drops
+   the program's fcntl() locks on it, and every checkpoint opens and
+   closes VELOCITY_FILE
+ */
+static void lock_counted_accounts(const char *const account_nums[], int count) {
+    unsigned int *ids = malloc((count > 0 ? count : 1) * sizeof(unsigned int));
+    counted_lock_fd = ids != NULL ? open(VELOCITY_LOCK, O_RDWR | O_CREAT, 0644) : -1;
+    if (counted_lock_fd < 0) {
+        fprintf(stderr, "Warning: Could not lock the velocity counters\n");
+        free(ids);
+        return;
+    }
+    for (int a = 0; a < count; a++) {
+        ids[a] = account_id_from_string(account_nums[a]);
+    }
+    qsort(ids, count, sizeof(unsigned int), compare_ids);
+    for (int a = 0; a < count; a++) {
+        if (ids[a] == 0 || (a > 0 && ids[a] == ids[a - 1])) {
+            continue;
+        }
+        struct flock fl;
+        memset(&fl, 0, sizeof(fl));
+        fl.l_type = F_WRLCK;
+        fl.l_whence = SEEK_SET;
+        fl.l_start = (off_t)ids[a];
+        fl.l_len = 1;
+        while (fcntl(counted_lock_fd, F_SETLKW, &fl) != 0) {
+            if (errno != EINTR) {
+                fprintf(stderr, "Warning: Could not lock the velocity counters\n");
+                break;
+            }
+        }
+    }
+    free(ids);
+}
+
+/* Velocity init function
+   Purpose: Get the engine ready before the first transaction
+   1. Read the limits configuration (if any)
+   2. Load the counters from the last checkpoint
+ */
+void velocity_init(void) {
+    load_limits_config();
+    grow_table(&table);
+    grow_table(&pending);
+    load_checkpoint();
+    last_checkpoint = time(NULL);
+}
+
+/* Velocity init for function
+   Purpose: Get the engine ready for a program that only moves money for
+   a few accounts (a command-line subcommand, see cli.h)
+
+   Only those accounts' counters are read from the checkpoint (from the
+   slots their ids hash to). Checkpoints only write what was counted
+   (see velocity_checkpoint()), so start-up and shutdown never read or
+   rewrite the whole table
+
+   The accounts stay locked until velocity_shutdown() has saved what was
+   counted, so the next program for one of them waits and then sees it.
+   Call it before taking the accounts' own locks (shared_lock_accounts(),
+   lock_account_records()). Programs started with velocity_init() (the
+   menu, --serve, --batch) only see what others saved at checkpoints
+ */
+void velocity_init_for(const char *const account_nums[], int count) {
+    lock_counted_accounts(account_nums, count);
+    load_limits_config();
+    grow_table(&table);
+    grow_table(&pending);
+    last_checkpoint = time(NULL);
+
+    int fd = open(VELOCITY_FILE, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    CheckpointHeader header;
+    if (read_header(fd, &header)) {
+        for (int a = 0; a < count; a++) {
+            unsigned int id = account_id_from_string(account_nums[a]);
+            VelocityEntry entry;
+            bool found = false;
+            if (id != 0 && find_slot(fd, &header, id, &entry, &found) >= 0 && found) {
+                load_entry(&entry);
+            }
+        }
+    }
+    close(fd);
+}
+
+/* Velocity shutdown function
+   Purpose: Save the counters one last time before the program ends
+   (then let go of the accounts velocity_init_for() locked)
+ */
+void velocity_shutdown(void) {
+    if (pending.used > 0) {
+        velocity_checkpoint();
+    }
+    if (counted_lock_fd >= 0) {
+        close(counted_lock_fd);
+        counted_lock_fd = -1;
+    }
+    free_table(&table);
+    free_table(&pending);
+}
+
+VelocityLimit velocity_get_limit(AccountType type, VelocityOp op, VelocityWindow window) {
+    return limits[type][op][window];
+}
+
+/* Velocity check function
+   Purpose: Decide whether an operation is allowed by the limits
+
+   Parameters:
+   - account_num: The account that the money moves out of (or into, for deposits)
+   - type: Account type, used to pick the limits
+   - op: The kind of operation
+   - amount_cents: The amount that is about to move
+
+   Returns: true if the operation is allowed, false (with an error message) if not
+
+   Only the in-memory table is read, so this never touches the disk
+ */
+bool velocity_check(const char *account_num, AccountType type,
+                    VelocityOp op, long long amount_cents) {
+    unsigned int id = account_id_from_string(account_num);
+    if (id == 0) {
+        return true;  // Not a numbered account, nothing to count
+    }
+
+    VelocityEntry *e = find_entry(&table, id, false);
+    time_t now = time(NULL);
+
+    for (int w = 0; w < VEL_WINDOW_COUNT; w++) {
+        VelocityLimit limit = limits[type][op][w];
+        double count = 0, cents = 0;
+        if (e != NULL) {
+            estimate_counter(&e->counters[op][w], window_seconds[w], now, &count, &cents);
+        }
+
+        if (limit.max_count > 0 && count + 1 > limit.max_count) {
+            print_message("Error: Limit of %u %s operations per %s reached. "
+                          "Please try again later.\n", limit.max_count, op_names[op], window_names[w]);
+            return false;
+        }
+        if (limit.max_cents > 0 && cents + amount_cents > limit.max_cents) {
+            print_message("Error: Amount exceeds the %s limit of RM%.2f per %s.\n",
+                          op_names[op], limit.max_cents / 100.0, window_names[w]);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Velocity record function
+   Purpose: Add a finished operation to the account's counters
+
+   Every VELOCITY_CHECKPOINT_OPS operations (or VELOCITY_CHECKPOINT_SECS seconds)
+   the table is checkpointed to disk
+ */
+void velocity_record(const char *account_num, VelocityOp op, long long amount_cents) {
+    unsigned int id = account_id_from_string(account_num);
+    if (id == 0) {
+        return;
+    }
+
+    // Counted in the table (for the checks) and in the pending table (for the file)
+    VelocityEntry *e = find_entry(&table, id, true);
+    VelocityEntry *p = find_entry(&pending, id, true);
+    if (e == NULL || p == NULL) {
+        return;
+    }
+
+    time_t now = time(NULL);
+    for (int w = 0; w < VEL_WINDOW_COUNT; w++) {
+        VelocityCounter *counters[2] = { &e->counters[op][w], &p->counters[op][w] };
+        for (int k = 0; k < 2; k++) {
+            roll_counter(counters[k], window_seconds[w], now);
+            counters[k]->cur_count++;
+            counters[k]->cur_cents += amount_cents;
+        }
+    }
+
+    ops_since_checkpoint++;
+    if (ops_since_checkpoint >= VELOCITY_CHECKPOINT_OPS ||
+        now - last_checkpoint >= VELOCITY_CHECKPOINT_SECS) {
+        velocity_checkpoint();
+    }
+}
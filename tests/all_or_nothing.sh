@@ -0,0 +1,114 @@
+#!/bin/sh
+# Regression check: money moves for every account of an operation or for none
+#
+# Usage (from the top folder, after make):
+#   tests/all_or_nothing.sh
+#
+# How it works:
+# 1. Make an empty database in a temporary folder with a sender and two
+#    receivers
+# 2. Bulk remittance (--bulk): a list with an account that does not exist
+#    and a list the sender cannot pay are cancelled, and no balance
+#    changes; a good list pays every line
+# 3. Commit intents: leave a commit that stopped halfway (its intent in
+#    database/intents names two accounts, one of them already saved), then
+#    check that the next program to lock the accounts undoes it
+# 4. --reconcile finds no drift and --fsck finds no problems
+#
+# Exit code: 0 if every check passed, 1 if one failed
+
+BANK=$(cd "$(dirname "$0")/.." && pwd)/banking_system
+if [ ! -x "$BANK" ]; then
+    echo "Build the program first (make)" >&2
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+mkdir database
+
+fail() {
+    echo "FAILED: $1"
+    exit 1
+}
+
+# Balance of an account in cents
+cents() {
+    "$BANK" balance "$1" 1234 | sed -n 's/.*"balance":\([0-9.]*\).*/\1/p' | awk '{ printf "%.0f", $1 * 100 }'
+}
+
+# Version of an account file
+version() {
+    sed -n 's/^Version: *\([0-9]*\).*/\1/p' "database/$1.txt"
+}
+
+# STEP 1: The accounts
+"$BANK" create "Sam Sender" 900101010001 savings 1234 >created.json || fail "could not open the sender"
+"$BANK" create "Rae Receiver" 900101010002 savings 1234 >>created.json || fail "could not open a receiver"
+"$BANK" create "Ray Receiver" 900101010003 current 1234 >>created.json || fail "could not open a receiver"
+SENDER=$(sed -n '1s/.*"account":"\([0-9]*\)".*/\1/p' created.json)
+FIRST=$(sed -n '2s/.*"account":"\([0-9]*\)".*/\1/p' created.json)
+SECOND=$(sed -n '3s/.*"account":"\([0-9]*\)".*/\1/p' created.json)
+"$BANK" deposit "$SENDER" 1234 1000 >/dev/null || fail "could not fund the sender"
+"$BANK" deposit "$FIRST" 1234 100 >/dev/null || fail "could not fund a receiver"
+
+# STEP 2: Bulk remittances
+before="$(cents "$SENDER") $(cents "$FIRST") $(cents "$SECOND")"
+# Account 999999999 is not one of the three (a database of three accounts)
+printf '%s 10.00\n999999999 10.00\n%s 10.00\n' "$FIRST" "$SECOND" >unknown.txt
+"$BANK" --bulk "$SENDER" 1234 unknown.txt >bulk.txt 2>&1
+grep -q "nothing was transferred" bulk.txt || { cat bulk.txt; fail "a list with an unknown account was not cancelled"; }
+[ "$(cents "$SENDER") $(cents "$FIRST") $(cents "$SECOND")" = "$before" ] ||
+    fail "a cancelled list (unknown account) moved money"
+
+printf '%s 600.00\n%s 600.00\n' "$FIRST" "$SECOND" >too_much.txt
+"$BANK" --bulk "$SENDER" 1234 too_much.txt >bulk.txt 2>&1
+grep -q "nothing was transferred" bulk.txt || { cat bulk.txt; fail "a list over the balance was not cancelled"; }
+[ "$(cents "$SENDER") $(cents "$FIRST") $(cents "$SECOND")" = "$before" ] ||
+    fail "a cancelled list (insufficient funds) moved money"
+
+printf '%s 100.00\n%s 50.00\n%s 25.00\n' "$FIRST" "$SECOND" "$FIRST" >good.txt
+"$BANK" --bulk "$SENDER" 1234 good.txt >bulk.txt 2>&1 || { cat bulk.txt; fail "a good list was refused"; }
+grep -q "Bulk remittance successful" bulk.txt || { cat bulk.txt; fail "a good list was not paid"; }
+fees=$(sed -n 's/^Total Fees: RM\([0-9.]*\).*/\1/p' bulk.txt | awk '{ printf "%.0f", $1 * 100 }')
+[ "$(cents "$SENDER")" -eq $((100000 - 17500 - fees)) ] || fail "the sender paid $(cents "$SENDER"), fees $fees"
+[ "$(cents "$FIRST")" -eq 22500 ] || fail "the first receiver has $(cents "$FIRST"), expected 22500"
+[ "$(cents "$SECOND")" -eq 5000 ] || fail "the second receiver has $(cents "$SECOND"), expected 5000"
+echo "Bulk: 2 lists cancelled, 1 list of 3 payments paid (fees $fees cents)"
+
+# STEP 3: A commit that stopped halfway
+# The first receiver gets RM100.00 that the log never hears of (the log
+# cannot be opened), as a crashed remittance would have left it
+first=$(cents "$FIRST")
+first_version=$(version "$FIRST")
+second=$(cents "$SECOND")
+second_version=$(version "$SECOND")
+mv database/txlog/active.bin active.bin.saved
+mkdir database/txlog/active.bin
+"$BANK" deposit "$FIRST" 1234 100 >/dev/null 2>&1
+[ $? -eq 1 ] || fail "a deposit that could not be logged was not reported"
+rmdir database/txlog/active.bin
+mv active.bin.saved database/txlog/active.bin
+[ "$(cents "$FIRST")" -eq $((first + 10000)) ] || fail "the deposit that was not logged was not saved"
+
+# The intent of that remittance: the second receiver was never saved
+mkdir -p database/intents
+printf 'INTENT 999999\nACCOUNT %s %s %s %s\nACCOUNT %s %s %s %s\n' \
+    "$FIRST" "$first_version" "$first" $((first + 10000)) \
+    "$SECOND" "$second_version" "$second" $((second - 10000)) >"database/intents/$FIRST"
+ln "database/intents/$FIRST" "database/intents/$SECOND"
+
+"$BANK" deposit "$FIRST" 1234 10 >/dev/null 2>intent.txt || { cat intent.txt; fail "the deposit after the crash failed"; }
+grep -q "unfinished commit" intent.txt || { cat intent.txt; fail "the unfinished commit was not reported"; }
+[ "$(cents "$FIRST")" -eq $((first + 1000)) ] || fail "the first receiver has $(cents "$FIRST"), expected $((first + 1000))"
+[ "$(cents "$SECOND")" -eq "$second" ] || fail "an account the commit never saved was changed"
+[ -z "$(ls database/intents)" ] || fail "the intent was not removed"
+echo "Intent: the half-done commit was undone"
+
+# STEP 4: The totals
+"$BANK" --reconcile >reconcile.txt 2>&1 || { cat reconcile.txt; fail "--reconcile found drift"; }
+"$BANK" --fsck >fsck.txt 2>&1
+grep -q "Result: CLEAN" fsck.txt || { cat fsck.txt; fail "--fsck found problems"; }
+
+echo "PASSED"
@@ -0,0 +1,95 @@
+#!/bin/sh
+# Regression check: velocity limits (database/limits.cfg)
+#
+# Usage (from the top folder, after make):
+#   tests/limits.sh [processes]
+#
+# How it works:
+# 1. Make an empty database in a temporary folder with one savings and
+#    one current account, and a limits.cfg for savings accounts only
+# 2. Count limit: the deposits over the hourly number are refused with
+#    exit code 7, also when <processes> programs deposit at once (they
+#    share database/velocity.dat, so together they get exactly the limit)
+# 3. Amount limit: a withdrawal that would go over the daily amount is
+#    refused, and so is a remittance (the sender's limit counts); the
+#    current account has no limits
+# 4. A line with an unknown account type is refused, naming the line
+# 5. The balances are what the accepted operations left, --reconcile
+#    finds no drift and --fsck finds no problems
+#
+# Exit code: 0 if every check passed, 1 if one failed
+
+PROCESSES=${1:-6}
+
+BANK=$(cd "$(dirname "$0")/.." && pwd)/banking_system
+if [ ! -x "$BANK" ]; then
+    echo "Build the program first (make)" >&2
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+mkdir database
+
+fail() {
+    echo "FAILED: $1"
+    exit 1
+}
+
+# Balance of an account in cents
+cents() {
+    "$BANK" balance "$1" 1234 | sed -n 's/.*"balance":\([0-9.]*\).*/\1/p' | awk '{ printf "%.0f", $1 * 100 }'
+}
+
+# STEP 1: The accounts and the limits
+"$BANK" create "Lena Savings" 900101010001 savings 1234 >created.json || fail "could not open the savings account"
+"$BANK" create "Lena Current" 900101010002 current 1234 >>created.json || fail "could not open the current account"
+SAVINGS=$(sed -n '1s/.*"account":"\([0-9]*\)".*/\1/p' created.json)
+CURRENT=$(sed -n '2s/.*"account":"\([0-9]*\)".*/\1/p' created.json)
+cat >database/limits.cfg <<EOF
+savings deposit hour $PROCESSES 0
+savings withdraw day 0 50.00
+savings remit day 0 50.00
+EOF
+
+# STEP 2: At most PROCESSES deposits an hour, counted by every program together
+p=0
+while [ "$p" -lt $((PROCESSES * 2)) ]; do
+    "$BANK" deposit "$SAVINGS" 1234 100 >"deposit.$p.json" 2>"deposit.$p.txt" &
+    p=$((p + 1))
+done
+wait
+accepted=$(cat deposit.*.json | grep -c '"status":"ok"')
+refused=$(cat deposit.*.json | grep -c '"exit_code":7')
+echo "Deposits: $((PROCESSES * 2)) sent at once, $accepted accepted, $refused refused (limit $PROCESSES)"
+[ "$accepted" -eq "$PROCESSES" ] || fail "expected $PROCESSES deposits to be accepted"
+[ "$refused" -eq "$PROCESSES" ] || fail "expected $PROCESSES deposits to be refused with exit code 7"
+"$BANK" deposit "$SAVINGS" 1234 100 >/dev/null 2>&1
+[ $? -eq 7 ] || fail "a later program forgot the deposits counted so far"
+
+# STEP 3: RM50.00 a day out of the savings account, per kind of operation
+"$BANK" withdraw "$SAVINGS" 1234 30 >/dev/null || fail "a withdrawal under the limit was refused"
+"$BANK" withdraw "$SAVINGS" 1234 30 >/dev/null 2>&1
+[ $? -eq 7 ] || fail "a withdrawal over the daily amount was not refused"
+"$BANK" withdraw "$SAVINGS" 1234 20 >/dev/null || fail "a withdrawal up to the limit was refused"
+"$BANK" remit "$SAVINGS" 1234 "$CURRENT" 60 >/dev/null 2>&1
+[ $? -eq 7 ] || fail "a remittance over the daily amount was not refused"
+"$BANK" deposit "$CURRENT" 1234 500 >/dev/null || fail "could not fund the current account"
+"$BANK" withdraw "$CURRENT" 1234 300 >/dev/null || fail "the current account has no limits, but was refused"
+
+expected=$((PROCESSES * 10000 - 5000))
+[ "$(cents "$SAVINGS")" -eq "$expected" ] || fail "savings balance is $(cents "$SAVINGS"), expected $expected"
+[ "$(cents "$CURRENT")" -eq 20000 ] || fail "current balance is $(cents "$CURRENT"), expected 20000"
+
+# STEP 4: An unknown account type
+echo "checking deposit hour 1 0" >>database/limits.cfg
+"$BANK" deposit "$CURRENT" 1234 1 >/dev/null 2>limits.txt
+grep -q "line 4" limits.txt || { cat limits.txt; fail "the unknown account type was not reported"; }
+
+# STEP 5: The totals
+"$BANK" --reconcile >reconcile.txt 2>&1 || { cat reconcile.txt; fail "--reconcile found drift"; }
+"$BANK" --fsck >fsck.txt 2>&1
+grep -q "Result: CLEAN" fsck.txt || { cat fsck.txt; fail "--fsck found problems"; }
+
+echo "PASSED"
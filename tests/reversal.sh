@@ -0,0 +1,96 @@
+#!/bin/sh
+# Regression check: reversals (--reverse)
+#
+# Usage (from the top folder, after make):
+#   tests/reversal.sh
+#
+# How it works:
+# 1. Make an empty database in a temporary folder with two accounts and
+#    one deposit, withdrawal and remittance
+# 2. Reverse all three: the balances are back to what they were before
+#    them (the sender of the remittance also gets the fee back)
+# 3. A transaction that was reversed already is refused, and so is a
+#    deposit whose money the account no longer has
+# 4. --reconcile finds no drift and --fsck finds no problems
+#
+# Exit code: 0 if every check passed, 1 if one failed
+
+BANK=$(cd "$(dirname "$0")/.." && pwd)/banking_system
+if [ ! -x "$BANK" ]; then
+    echo "Build the program first (make)" >&2
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+mkdir database
+
+fail() {
+    echo "FAILED: $1"
+    exit 1
+}
+
+# Balance of an account in cents
+cents() {
+    "$BANK" balance "$1" 1234 | sed -n 's/.*"balance":\([0-9.]*\).*/\1/p' | awk '{ printf "%.0f", $1 * 100 }'
+}
+
+# Transaction ID of a subcommand's output
+txn_id() {
+    sed -n 's/.*"txn_id":\([0-9]*\).*/\1/p' "$1"
+}
+
+# Reverse a transaction; the output is kept in reverse.txt
+reverse() {
+    "$BANK" --reverse "$1" >reverse.txt 2>&1
+}
+
+# STEP 1: The accounts and the transactions
+"$BANK" create "Rob Sender" 900101010001 savings 1234 >created.json || fail "could not open the sender"
+"$BANK" create "Ria Receiver" 900101010002 current 1234 >>created.json || fail "could not open the receiver"
+SENDER=$(sed -n '1s/.*"account":"\([0-9]*\)".*/\1/p' created.json)
+RECEIVER=$(sed -n '2s/.*"account":"\([0-9]*\)".*/\1/p' created.json)
+"$BANK" deposit "$SENDER" 1234 500 >/dev/null || fail "could not fund the sender"
+"$BANK" deposit "$RECEIVER" 1234 100 >/dev/null || fail "could not fund the receiver"
+sender=$(cents "$SENDER")
+receiver=$(cents "$RECEIVER")
+
+"$BANK" deposit "$SENDER" 1234 40 >deposit.json || fail "the deposit failed"
+"$BANK" withdraw "$SENDER" 1234 25 >withdraw.json || fail "the withdrawal failed"
+"$BANK" remit "$SENDER" 1234 "$RECEIVER" 60 >remit.json || fail "the remittance failed"
+fee=$(sed -n 's/.*"fee":\([0-9.]*\).*/\1/p' remit.json | awk '{ printf "%.0f", $1 * 100 }')
+[ "$(cents "$SENDER")" -eq $((sender + 4000 - 2500 - 6000 - fee)) ] || fail "the transactions did not add up"
+
+# STEP 2: Undo them, newest first
+for name in remit withdraw deposit; do
+    reverse "$(txn_id "$name.json")" || { cat reverse.txt; fail "the $name could not be reversed"; }
+    grep -q "Reversal successful" reverse.txt || { cat reverse.txt; fail "the $name was not reversed"; }
+done
+[ "$(cents "$SENDER")" -eq "$sender" ] || fail "the sender has $(cents "$SENDER"), expected $sender"
+[ "$(cents "$RECEIVER")" -eq "$receiver" ] || fail "the receiver has $(cents "$RECEIVER"), expected $receiver"
+echo "Reversed: a deposit, a withdrawal and a remittance (fee $fee cents refunded)"
+
+# STEP 3: What must be refused
+if reverse "$(txn_id remit.json)"; then
+    fail "a remittance was reversed twice"
+fi
+grep -q "already been reversed" reverse.txt || { cat reverse.txt; fail "the refusal did not say why"; }
+[ "$(cents "$RECEIVER")" -eq "$receiver" ] || fail "a refused reversal moved money"
+
+"$BANK" deposit "$RECEIVER" 1234 30 >deposit.json || fail "the second deposit failed"
+"$BANK" withdraw "$RECEIVER" 1234 "$(awk -v c=$((receiver + 3000)) 'BEGIN { printf "%.2f", c / 100 }')" >/dev/null ||
+    fail "could not empty the receiver"
+if reverse "$(txn_id deposit.json)"; then
+    fail "a deposit the account no longer has was reversed"
+fi
+grep -q "does not have" reverse.txt || { cat reverse.txt; fail "the refusal did not say why"; }
+[ "$(cents "$RECEIVER")" -eq 0 ] || fail "a refused reversal moved money"
+echo "Refused: a second reversal, and a deposit that was spent"
+
+# STEP 4: The totals
+"$BANK" --reconcile >reconcile.txt 2>&1 || { cat reconcile.txt; fail "--reconcile found drift"; }
+"$BANK" --fsck >fsck.txt 2>&1
+grep -q "Result: CLEAN" fsck.txt || { cat fsck.txt; fail "--fsck found problems"; }
+
+echo "PASSED"
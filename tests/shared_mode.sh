@@ -0,0 +1,112 @@
+#!/bin/sh
+# Regression check: several programs moving money in the same database
+#
+# Usage (from the top folder, after make):
+#   tests/shared_mode.sh [processes] [operations per process] [accounts]
+#
+# How it works:
+# 1. Make an empty database in a temporary folder, turn on shared mode
+#    and open <accounts> accounts with RM1000.00 each
+# 2. Start <processes> programs at once; each makes <operations> random
+#    deposits, withdrawals and remittances between those accounts with
+#    the banking_system subcommands
+# 3. Check that the balances add up to what the successful operations
+#    moved (deposits - withdrawals - fees), that --reconcile finds no
+#    drift and that --fsck finds no problems
+#
+# Exit code: 0 if every check passed, 1 if one failed
+
+PROCESSES=${1:-8}
+OPERATIONS=${2:-40}
+ACCOUNTS=${3:-4}
+
+BANK=$(cd "$(dirname "$0")/.." && pwd)/banking_system
+if [ ! -x "$BANK" ]; then
+    echo "Build the program first (make)" >&2
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+mkdir database
+
+fail() {
+    echo "FAILED: $1"
+    exit 1
+}
+
+# STEP 1: Shared mode and the accounts
+"$BANK" --shared on >/dev/null || fail "could not turn on shared mode"
+i=0
+while [ "$i" -lt "$ACCOUNTS" ]; do
+    # Names may only hold letters: "Teller A", "Teller B", ...
+    letter=$(printf "\\$(printf '%03o' $((65 + i)))")
+    "$BANK" create "Teller $letter" "90010101$(printf '%04d' "$i")" savings 1234 >>created.json ||
+        fail "could not open account $i"
+    i=$((i + 1))
+done
+ACCOUNT_LIST=$(sed -n 's/.*"account":"\([0-9]*\)".*/\1/p' created.json)
+for account in $ACCOUNT_LIST; do
+    "$BANK" deposit "$account" 1234 1000 >>seed.json || fail "could not fund $account"
+done
+
+# STEP 2: The programs, all at once
+worker() {
+    count=$(echo $ACCOUNT_LIST | wc -w)
+    # Each worker gets its own random numbers (awk seeds from its number)
+    awk -v seed="$1$$" -v ops="$OPERATIONS" -v count="$count" \
+        'BEGIN { srand(seed); for (i = 0; i < ops; i++) print int(rand() * 3), int(rand() * count) + 1, int(rand() * count) + 1 }' |
+    while read -r op from to; do
+        from_account=$(echo $ACCOUNT_LIST | cut -d' ' -f"$from")
+        to_account=$(echo $ACCOUNT_LIST | cut -d' ' -f"$to")
+        case $op in
+            0) "$BANK" deposit "$from_account" 1234 10 ;;
+            1) "$BANK" withdraw "$from_account" 1234 3 ;;
+            2) [ "$from" = "$to" ] || "$BANK" remit "$from_account" 1234 "$to_account" 7 ;;
+        esac
+    done
+}
+
+p=0
+while [ "$p" -lt "$PROCESSES" ]; do
+    worker "$p" >"out.$p.json" 2>"err.$p.txt" &
+    p=$((p + 1))
+done
+wait
+
+# STEP 3: Check the totals
+expected=$(cat seed.json out.*.json | awk -F'[{}:,]' '
+    /"status":"ok"/ {
+        for (i = 1; i < NF; i++) {
+            if ($i == "\"command\"") command = $(i + 1)
+            if ($i == "\"amount\"") amount = $(i + 1)
+            if ($i == "\"fee\"") fee = $(i + 1)
+        }
+        if (command == "\"deposit\"") total += amount * 100
+        if (command == "\"withdraw\"") total -= amount * 100
+        if (command == "\"remit\"") total -= fee * 100
+        fee = 0
+    }
+    END { printf "%.0f\n", total }')
+
+actual=0
+for account in $ACCOUNT_LIST; do
+    cents=$("$BANK" balance "$account" 1234 |
+            sed -n 's/.*"balance":\([0-9.]*\).*/\1/p' | awk '{ printf "%.0f", $1 * 100 }')
+    [ -n "$cents" ] || fail "could not read the balance of $account"
+    actual=$((actual + cents))
+done
+
+ok=$(cat out.*.json | grep -c '"status":"ok"')
+errors=$(cat err.*.txt | grep -v "Limit of\|Insufficient" | grep -c .)
+echo "Processes: $PROCESSES   Operations: $((PROCESSES * OPERATIONS))   Succeeded: $ok"
+echo "Expected total: $expected cents   Found: $actual cents"
+[ "$errors" -eq 0 ] || { cat err.*.txt; fail "$errors unexpected messages"; }
+[ "$expected" -eq "$actual" ] || fail "the balances do not add up"
+
+"$BANK" --reconcile >reconcile.txt 2>&1 || { cat reconcile.txt; fail "--reconcile found drift"; }
+"$BANK" --fsck >fsck.txt 2>&1
+grep -q "Result: CLEAN" fsck.txt || { cat fsck.txt; fail "--fsck found problems"; }
+
+echo "PASSED"